@@ -0,0 +1,193 @@
+/*
+ * battery_model.h - Li-ion state of charge and runtime estimate
+ *
+ * This file contains the BatteryModel class. The state of charge comes
+ * from two sources:
+ * - the open-circuit voltage, looked up in a Li-ion discharge table after
+ *   the sampler has added back the drop across the cell resistance at the
+ *   present load
+ * - a coulomb count of the charge the EnergyMonitor estimates was used
+ *
+ * The coulomb count follows every read and sleep cycle. Each OCV
+ * reading pulls it slowly towards the table value, so model errors do
+ * not pile up. Together with the measured charge per read and the average
+ * draw, this predicts the hours and meter reads that are left.
+ *
+ * The model lives in RTC memory. Like the energy totals it is fed from,
+ * it starts over after any reset other than a wake from deep sleep.
+ */
+
+#ifndef BATTERY_MODEL_H
+#define BATTERY_MODEL_H
+
+#include <Arduino.h>
+#include <esp_sleep.h>
+#include "config.h"
+#include "energy_monitor.h"
+
+// Open-circuit voltage of a Li-ion cell at 0, 5, ... 100% charge (mV)
+#define BATTERY_OCV_POINTS 21
+
+static const uint16_t BATTERY_OCV_TABLE_MV[BATTERY_OCV_POINTS] = {
+  3000, 3300, 3450, 3530, 3590, 3630, 3660, 3690, 3720, 3750, 3780,
+  3810, 3840, 3880, 3920, 3960, 4000, 4040, 4080, 4130, 4200
+};
+
+struct BatteryModelState {
+  uint32_t magic;
+  float socPercent;             // Coulomb-counted charge, < 0 until the first OCV reading
+  float lastTotalMah;           // Energy total at the last update
+  float startTotalMah;          // Energy total when the read count started
+  uint32_t reads;
+  float readChargeMah;          // Moving average of the charge of one read
+};
+
+#define BATTERY_MODEL_MAGIC 0x42544D31  // "BTM1"
+
+// Restarted by init() with the energy totals unless this is a deep-sleep wake
+RTC_DATA_ATTR static BatteryModelState rtcBatteryModel;
+
+class BatteryModel {
+private:
+  EnergyMonitor* energy;
+  float readStartMah;           // < 0 when no read is running
+
+public:
+  BatteryModel();
+
+  void setEnergyMonitor(EnergyMonitor* monitor) { energy = monitor; }
+
+  // Initialization (after the energy monitor)
+  void init();
+
+  // Charge from the open-circuit voltage table, 0-100
+  static float socFromOcv(float volts);
+
+  // Coulomb count and OCV correction (main loop, every battery check)
+  void update(float ocvPercent);
+
+  // Meter reads, for the charge per read
+  void beginRead();
+  void endRead();
+
+  // Predictions
+  float getSocPercent() const { return rtcBatteryModel.socPercent; }
+  float getRemainingMah() const;
+  float getAverageMilliAmps();
+  float getMahPerRead();
+  String getReport(float voltageV, float loadMilliAmps);
+};
+
+// Implementation
+BatteryModel::BatteryModel() : energy(nullptr), readStartMah(-1) {
+}
+
+void BatteryModel::init() {
+  // Any other reset also restarts the energy totals the model is fed from
+  bool fromDeepSleep = esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED;
+  if (rtcBatteryModel.magic == BATTERY_MODEL_MAGIC && fromDeepSleep) {
+    return;
+  }
+  memset(&rtcBatteryModel, 0, sizeof(rtcBatteryModel));
+  rtcBatteryModel.magic = BATTERY_MODEL_MAGIC;
+  rtcBatteryModel.socPercent = -1;
+  if (energy) {
+    rtcBatteryModel.lastTotalMah = energy->getTotalMilliAmpHours();
+    rtcBatteryModel.startTotalMah = rtcBatteryModel.lastTotalMah;
+  }
+}
+
+float BatteryModel::socFromOcv(float volts) {
+  float milliVolts = volts * 1000.0f;
+  if (milliVolts <= BATTERY_OCV_TABLE_MV[0]) return 0;
+  if (milliVolts >= BATTERY_OCV_TABLE_MV[BATTERY_OCV_POINTS - 1]) return 100;
+
+  // Linear between the two surrounding points
+  int i = 1;
+  while (milliVolts > BATTERY_OCV_TABLE_MV[i]) {
+    i++;
+  }
+  float low = BATTERY_OCV_TABLE_MV[i - 1];
+  float high = BATTERY_OCV_TABLE_MV[i];
+  return 5.0f * (i - 1) + 5.0f * (milliVolts - low) / (high - low);
+}
+
+void BatteryModel::update(float ocvPercent) {
+  if (!energy) {
+    return;
+  }
+
+  float totalMah = energy->getTotalMilliAmpHours();
+  float usedMah = totalMah - rtcBatteryModel.lastTotalMah;
+  rtcBatteryModel.lastTotalMah = totalMah;
+
+  if (rtcBatteryModel.socPercent < 0) {
+    rtcBatteryModel.socPercent = ocvPercent;
+    return;
+  }
+
+  float soc = rtcBatteryModel.socPercent - usedMah * 100.0f / BATTERY_CAPACITY_MAH;
+  soc += BATTERY_SOC_OCV_WEIGHT * (ocvPercent - soc);
+  rtcBatteryModel.socPercent = constrain(soc, 0.0f, 100.0f);
+}
+
+void BatteryModel::beginRead() {
+  readStartMah = energy ? energy->getTotalMilliAmpHours() : -1;
+}
+
+void BatteryModel::endRead() {
+  if (!energy || readStartMah < 0) {
+    return;
+  }
+
+  float chargeMah = energy->getTotalMilliAmpHours() - readStartMah;
+  readStartMah = -1;
+  rtcBatteryModel.readChargeMah = rtcBatteryModel.reads == 0 ? chargeMah :
+    rtcBatteryModel.readChargeMah + BATTERY_READ_CHARGE_ALPHA * (chargeMah - rtcBatteryModel.readChargeMah);
+  rtcBatteryModel.reads++;
+}
+
+float BatteryModel::getRemainingMah() const {
+  return rtcBatteryModel.socPercent < 0 ? 0 : BATTERY_CAPACITY_MAH * rtcBatteryModel.socPercent / 100.0f;
+}
+
+float BatteryModel::getAverageMilliAmps() {
+  float hours = energy ? energy->getTotalHours() : 0;
+  return hours > 0 ? energy->getTotalMilliAmpHours() / hours : 0;
+}
+
+float BatteryModel::getMahPerRead() {
+  // With enough reads, each one carries its share of the idle and sleep time too
+  if (!energy || rtcBatteryModel.reads == 0) {
+    return 0;
+  }
+  if (rtcBatteryModel.reads < BATTERY_MODEL_MIN_READS) {
+    return rtcBatteryModel.readChargeMah;
+  }
+  return (energy->getTotalMilliAmpHours() - rtcBatteryModel.startTotalMah) / rtcBatteryModel.reads;
+}
+
+String BatteryModel::getReport(float voltageV, float loadMilliAmps) {
+  String report = "=== Battery Model ===\n";
+  report += "Open-circuit: " + String(voltageV, 2) + " V (" + String(loadMilliAmps, 0) + " mA load compensated), " +
+            String(socFromOcv(voltageV), 0) + "% by OCV table\n";
+  if (rtcBatteryModel.socPercent < 0) {
+    report += "Charge: not estimated yet";
+    return report;
+  }
+
+  float remainingMah = getRemainingMah();
+  float averageMa = getAverageMilliAmps();
+  float perReadMah = getMahPerRead();
+  report += "Charge: " + String(rtcBatteryModel.socPercent, 1) + "%, " + String(remainingMah, 0) + " of " +
+            String(BATTERY_CAPACITY_MAH) + " mAh left\n";
+  report += "Average draw: " + String(averageMa, 2) + " mA over " + String(energy ? energy->getTotalHours() : 0, 1) + " h\n";
+  report += "Per read: " + String(perReadMah, 3) + " mAh " +
+            (rtcBatteryModel.reads >= BATTERY_MODEL_MIN_READS ? "incl. idle and sleep" : "read alone") + " (" +
+            String(rtcBatteryModel.reads) + " reads)\n";
+  report += "Remaining: " + (averageMa > 0 ? "~" + String(remainingMah / averageMa, 0) + " h" : String("? h")) + ", " +
+            (perReadMah > 0 ? "~" + String((uint32_t)(remainingMah / perReadMah)) + " reads" : String("? reads"));
+  return report;
+}
+
+#endif // BATTERY_MODEL_H
@@ -0,0 +1,194 @@
+/*
+ * buzzer.h - Background beep patterns on an LEDC channel
+ *
+ * This file contains the Buzzer class that plays beep patterns without
+ * blocking the caller. The tone comes from an LEDC channel on PIN_BUZZER
+ * and a one-shot esp_timer steps through the on/off times of each
+ * pattern. Patterns are queued, so the beeps at the start and end of a
+ * command play one after the other while the command itself runs.
+ *
+ * Light sleep stops the LEDC clock, so a power lock is held while a
+ * pattern plays.
+ */
+
+#ifndef BUZZER_H
+#define BUZZER_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <esp_pm.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include "config.h"
+#include "energy_monitor.h"
+
+struct BuzzerStep {
+  uint16_t onMs;
+  uint16_t offMs;       // Silence after the tone
+};
+
+struct BuzzerPattern {
+  uint8_t stepCount;
+  BuzzerStep steps[BUZZER_MAX_STEPS];
+};
+
+class Buzzer {
+private:
+  QueueHandle_t queue;
+  esp_timer_handle_t timer;
+  esp_pm_lock_handle_t sleepLock;         // ESP_PM_NO_LIGHT_SLEEP while playing
+  portMUX_TYPE lock;
+  volatile bool playing;
+  BuzzerPattern current;                  // Timer callback only while playing
+  uint8_t step;
+  bool toneOn;
+  uint32_t patternsPlayed;
+  uint32_t patternsDropped;
+  EnergyMonitor* energy;
+
+  static void onTimer(void* arg);
+  void advance();
+  void setTone(bool on);
+
+public:
+  Buzzer();
+
+  // Initialization (after the 38 kHz carrier has its LEDC channel)
+  bool init();
+  void setEnergyMonitor(EnergyMonitor* monitor) { energy = monitor; }
+
+  // Queues a pattern; false if the buzzer is unavailable or the queue is full
+  bool play(const BuzzerPattern& pattern);
+  bool playBeeps(int count, uint16_t onMs, uint16_t offMs);
+
+  // Status
+  bool isPlaying() const { return playing; }
+  bool waitIdle(unsigned long timeoutMs);
+  uint32_t getPatternsPlayed() const { return patternsPlayed; }
+  uint32_t getPatternsDropped() const { return patternsDropped; }
+};
+
+// Implementation
+Buzzer::Buzzer()
+  : queue(nullptr), timer(nullptr), sleepLock(nullptr), lock(portMUX_INITIALIZER_UNLOCKED), playing(false),
+    step(0), toneOn(false), patternsPlayed(0), patternsDropped(0), energy(nullptr) {
+  memset(&current, 0, sizeof(current));
+}
+
+bool Buzzer::init() {
+  // A channel on its own LEDC timer; the carrier keeps its 38 kHz
+  if (!ledcAttachChannel(PIN_BUZZER, BUZZER_FREQ, BUZZER_RESOLUTION, BUZZER_LEDC_CHANNEL)) {
+    Serial.println("ERROR: Failed to attach LEDC to buzzer pin");
+    return false;
+  }
+  ledcWrite(PIN_BUZZER, 0);
+
+  queue = xQueueCreate(BUZZER_QUEUE_DEPTH, sizeof(BuzzerPattern));
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = onTimer;
+  timerArgs.arg = this;
+  timerArgs.dispatch_method = ESP_TIMER_TASK;
+  timerArgs.name = "buzzer";
+  if (!queue || esp_timer_create(&timerArgs, &timer) != ESP_OK) {
+    Serial.println("ERROR: Could not create buzzer queue or timer");
+    return false;
+  }
+
+  // Without power management there is no light sleep to hold off
+  if (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "buzzer", &sleepLock) != ESP_OK) {
+    sleepLock = nullptr;
+  }
+  return true;
+}
+
+bool Buzzer::play(const BuzzerPattern& pattern) {
+  if (!timer || pattern.stepCount == 0) {
+    return false;
+  }
+  if (xQueueSend(queue, &pattern, 0) != pdTRUE) {
+    patternsDropped++;
+    return false;
+  }
+
+  portENTER_CRITICAL(&lock);
+  bool start = !playing;
+  playing = true;
+  portEXIT_CRITICAL(&lock);
+
+  // Idle: the timer is not armed, so the first step is started from here
+  if (start) {
+    if (sleepLock) esp_pm_lock_acquire(sleepLock);
+    step = current.stepCount;
+    advance();
+  }
+  return true;
+}
+
+bool Buzzer::playBeeps(int count, uint16_t onMs, uint16_t offMs) {
+  BuzzerPattern pattern;
+  pattern.stepCount = constrain(count, 0, BUZZER_MAX_STEPS);
+  for (int i = 0; i < pattern.stepCount; i++) {
+    pattern.steps[i].onMs = onMs;
+    pattern.steps[i].offMs = i < pattern.stepCount - 1 ? offMs : 0;
+  }
+  return play(pattern);
+}
+
+void Buzzer::onTimer(void* arg) {
+  static_cast<Buzzer*>(arg)->advance();
+}
+
+void Buzzer::advance() {
+  if (toneOn) {
+    setTone(false);
+    uint16_t offMs = current.steps[step].offMs;
+    step++;
+    if (offMs > 0) {
+      esp_timer_start_once(timer, offMs * 1000ULL);
+      return;
+    }
+  }
+
+  // Next step, or the first step of the next queued pattern
+  while (step >= current.stepCount) {
+    if (xQueueReceive(queue, &current, 0) == pdTRUE) {
+      step = 0;
+      patternsPlayed++;
+      continue;
+    }
+
+    // Checked again under the lock so a pattern queued right now is not stranded
+    portENTER_CRITICAL(&lock);
+    bool more = uxQueueMessagesWaiting(queue) > 0;
+    if (!more) {
+      playing = false;
+    }
+    portEXIT_CRITICAL(&lock);
+    if (!more) {
+      if (sleepLock) esp_pm_lock_release(sleepLock);
+      return;
+    }
+  }
+
+  setTone(true);
+  esp_timer_start_once(timer, current.steps[step].onMs * 1000ULL);
+}
+
+void Buzzer::setTone(bool on) {
+  ledcWrite(PIN_BUZZER, on ? BUZZER_DUTY : 0);
+  toneOn = on;
+  if (energy) energy->setState(ENERGY_BUZZER, on);
+}
+
+bool Buzzer::waitIdle(unsigned long timeoutMs) {
+  unsigned long startTime = millis();
+  while (playing) {
+    if (millis() - startTime >= timeoutMs) {
+      return false;
+    }
+    delay(10);
+  }
+  return true;
+}
+
+#endif // BUZZER_H
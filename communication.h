@@ -9,27 +9,45 @@
 #define COMMUNICATION_H
 
 #include <Arduino.h>
+#include <new>
 #include <BluetoothSerial.h>
 #include <HardwareSerial.h>
-#include <WiFiMulti.h>
+#include <esp_rom_crc.h>
 #include "config.h"
+#include "lz_codec.h"
+#include "network_manager.h"
 
 class CommunicationManager {
 private:
   BluetoothSerial* bluetoothSerial;
   HardwareSerial* irdaSerial;
   HardwareSerial* irSerial;
-  WiFiMulti* wifiMulti;
+  NetworkManager* network;
+  int irdaBaudRate;
   
   String commandBuffer;
   unsigned long lastCommandTime;
   
+  // Compressed output (Bluetooth side only, Serial stays plain text)
+  LZCompressor* compressor;
+  
+  void writeBluetooth(const uint8_t* data, size_t length);
+  static void sealFrame(uint8_t type, const uint8_t* prefix, size_t prefixLength, const uint8_t* body,
+                        size_t bodyLength, uint8_t* header, uint8_t* trailer);
+  static void onCompressedOutput(const uint8_t* data, size_t length, void* context);
+  
+  // Wakes the idle main loop on Bluetooth traffic
+  static void (*activityCallback)();
+  static void onBluetoothEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t* param);
+  
 public:
   CommunicationManager();
   ~CommunicationManager();
   
   // Initialization
-  void init(const String& bluetoothName);
+  void init(const String& bluetoothName, bool startBluetooth = true);
+  void setNetworkManager(NetworkManager* netMgr) { network = netMgr; }
+  void setActivityCallback(void (*callback)()) { activityCallback = callback; }
   
   // Bluetooth operations
   String readBluetoothCommand();
@@ -38,9 +56,15 @@ public:
   void printChar(char c);
   bool isBluetoothConnected();
   
+  // Compressed output blocks
+  bool beginCompressedOutput();
+  void endCompressedOutput();
+  bool isCompressing() const { return compressor != nullptr; }
+  
   // Serial communication setup
   void setupIRDASerial(int baudRate);
   void setupIRSerial(int baudRate);
+  int getIRDABaudRate() const { return irdaBaudRate; }
   
   // WiFi operations
   bool connectWiFi(const String& ssid, const String& password);
@@ -53,6 +77,12 @@ public:
   void printBatteryStatus(int batteryLevel);
   void printDataReceived(const String& meterType);
   void printRawData(const String& data);
+  bool sendRawFrame(MeterData& data);
+  size_t sendFrame(uint8_t type, const uint8_t* prefix, size_t prefixLength, const uint8_t* body, size_t bodyLength);
+  static size_t writeFrame(Print& out, uint8_t type, const uint8_t* prefix, size_t prefixLength,
+                           const uint8_t* body, size_t bodyLength);
+  static size_t frameSize(size_t payloadLength) { return RAW_FRAME_HEADER_SIZE + payloadLength + RAW_FRAME_CRC_SIZE; }
+  String readPendingInput();
   void printSystemStatus();
   
   // Hardware serial access
@@ -68,18 +98,18 @@ public:
 // Implementation
 CommunicationManager::CommunicationManager() 
   : bluetoothSerial(nullptr), irdaSerial(nullptr), irSerial(nullptr), 
-    wifiMulti(nullptr), lastCommandTime(0) {
+    network(nullptr), irdaBaudRate(0), lastCommandTime(0), compressor(nullptr) {
 }
 
 CommunicationManager::~CommunicationManager() {
+  delete compressor;
   delete bluetoothSerial;
-  delete wifiMulti;
 }
 
-void CommunicationManager::init(const String& bluetoothName) {
+void CommunicationManager::init(const String& bluetoothName, bool startBluetooth) {
   Serial.println("Initializing communication manager...");
   
-  // Initialize Bluetooth
+  // Initialize Bluetooth (the object always exists; unstarted it reads and writes nothing)
   bluetoothSerial = new BluetoothSerial();
   
   #if !defined(CONFIG_BT_ENABLED) || !defined(CONFIG_BLUEDROID_ENABLED)
@@ -87,14 +117,17 @@ void CommunicationManager::init(const String& bluetoothName) {
     return;
   #endif
   
-  if (!bluetoothSerial->begin(bluetoothName)) {
+  if (!startBluetooth) {
+    Serial.println("Bluetooth left off");
+  } else if (!bluetoothSerial->begin(bluetoothName)) {
     Serial.println("ERROR: Bluetooth initialization failed!");
     return;
+  } else {
+    bluetoothSerial->setTimeout(BT_TIMEOUT);
+    bluetoothSerial->register_callback(onBluetoothEvent);
+    Serial.println("Bluetooth initialized: " + bluetoothName);
   }
   
-  bluetoothSerial->setTimeout(BT_TIMEOUT);
-  Serial.println("Bluetooth initialized: " + bluetoothName);
-  
   // Initialize hardware serials
   irdaSerial = &Serial2;
   irSerial = &Serial1;
@@ -103,12 +136,17 @@ void CommunicationManager::init(const String& bluetoothName) {
   setupIRDASerial(BAUD_RATE_9600);
   setupIRSerial(BAUD_RATE_2400);
   
-  // Initialize WiFi
-  wifiMulti = new WiFiMulti();
-  
   Serial.println("Communication manager initialized successfully");
 }
 
+void (*CommunicationManager::activityCallback)() = nullptr;
+
+void CommunicationManager::onBluetoothEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t* param) {
+  if (activityCallback && (event == ESP_SPP_DATA_IND_EVT || event == ESP_SPP_SRV_OPEN_EVT)) {
+    activityCallback();
+  }
+}
+
 String CommunicationManager::readBluetoothCommand() {
   String command = "";
   unsigned long startTime = millis();
@@ -136,20 +174,77 @@ String CommunicationManager::readBluetoothCommand() {
 }
 
 void CommunicationManager::println(const String& message) {
-  bluetoothSerial->println(message);
+  if (compressor) {
+    writeBluetooth(reinterpret_cast<const uint8_t*>(message.c_str()), message.length());
+    writeBluetooth(reinterpret_cast<const uint8_t*>("\r\n"), 2);
+  } else {
+    bluetoothSerial->println(message);
+  }
   Serial.println(message);
 }
 
 void CommunicationManager::print(const String& message) {
-  bluetoothSerial->print(message);
+  if (compressor) {
+    writeBluetooth(reinterpret_cast<const uint8_t*>(message.c_str()), message.length());
+  } else {
+    bluetoothSerial->print(message);
+  }
   Serial.print(message);
 }
 
 void CommunicationManager::printChar(char c) {
-  bluetoothSerial->print(c);
+  if (compressor) {
+    writeBluetooth(reinterpret_cast<const uint8_t*>(&c), 1);
+  } else {
+    bluetoothSerial->print(c);
+  }
   Serial.print(c);
 }
 
+void CommunicationManager::writeBluetooth(const uint8_t* data, size_t length) {
+  if (compressor) {
+    compressor->write(data, length);
+  } else {
+    bluetoothSerial->write(data, length);
+  }
+}
+
+void CommunicationManager::onCompressedOutput(const uint8_t* data, size_t length, void* context) {
+  CommunicationManager* self = static_cast<CommunicationManager*>(context);
+  self->bluetoothSerial->write(data, length);
+}
+
+bool CommunicationManager::beginCompressedOutput() {
+  if (compressor) {
+    return true;
+  }
+  
+  // Allocated per block so the ~3KB working set is only held while in use
+  compressor = new (std::nothrow) LZCompressor();
+  if (!compressor) {
+    Serial.println("ERROR: Not enough memory for compressed output");
+    return false;
+  }
+  
+  compressor->begin(onCompressedOutput, this);
+  return true;
+}
+
+void CommunicationManager::endCompressedOutput() {
+  if (!compressor) {
+    return;
+  }
+  
+  compressor->finish();
+  
+  uint32_t bytesIn = compressor->getBytesIn();
+  uint32_t bytesOut = compressor->getBytesOut();
+  delete compressor;
+  compressor = nullptr;
+  
+  Serial.println("Compressed output: " + String(bytesIn) + " -> " + String(bytesOut) + " bytes");
+}
+
 bool CommunicationManager::isBluetoothConnected() {
   return bluetoothSerial->hasClient();
 }
@@ -157,6 +252,7 @@ bool CommunicationManager::isBluetoothConnected() {
 void CommunicationManager::setupIRDASerial(int baudRate) {
   irdaSerial->begin(baudRate, SERIAL_8N1, PIN_RXD2, PIN_TXD2);
   irdaSerial->setTimeout(IRDA_TIMEOUT);
+  irdaBaudRate = baudRate;
   
   // Configure GPIO registers for IRDA
   WRITE_PERI_REG(0x3FF6E020, READ_PERI_REG(0x3FF6E020) | (1 << 16) | (1 << 10));
@@ -179,44 +275,24 @@ void CommunicationManager::setupIRSerial(int baudRate) {
 }
 
 bool CommunicationManager::connectWiFi(const String& ssid, const String& password) {
-  Serial.println("Connecting to WiFi: " + ssid);
-  
-  // FIXED: Clear any existing AP configurations - ESP32 Core 3.x compatible
-  WiFi.disconnect();
-  WiFi.mode(WIFI_STA);
-  
-  // Add the configured network
-  wifiMulti->addAP(ssid.c_str(), password.c_str());
-  
-  // Attempt to connect with timeout
-  int attempts = 0;
-  const int maxAttempts = 20; // 10 seconds timeout
-  
-  while (wifiMulti->run() != WL_CONNECTED && attempts < maxAttempts) {
-    delay(500);
-    Serial.print(".");
-    attempts++;
-  }
-  
-  if (wifiMulti->run() == WL_CONNECTED) {
-    Serial.println("\nWiFi connected successfully");
-    Serial.println("SSID: " + ssid);
-    Serial.println("IP address: " + WiFi.localIP().toString());
-    return true;
-  } else {
-    Serial.println("\nWiFi connection failed after " + String(attempts) + " attempts");
+  if (!network) {
+    Serial.println("ERROR: Network manager not set");
     return false;
   }
+  
+  Serial.println("Connecting to WiFi: " + ssid);
+  network->setPrimaryNetwork(ssid, password);
+  return network->connect();
 }
 
 void CommunicationManager::disconnectWiFi() {
-  WiFi.disconnect();
-  WiFi.mode(WIFI_OFF);
-  Serial.println("WiFi disconnected");
+  if (network) {
+    network->disconnect();
+  }
 }
 
 bool CommunicationManager::isWiFiConnected() {
-  return WiFi.status() == WL_CONNECTED;
+  return network ? network->isConnected() : (WiFi.status() == WL_CONNECTED);
 }
 
 String CommunicationManager::getWiFiIP() {
@@ -253,6 +329,100 @@ void CommunicationManager::printRawData(const String& data) {
   println("===============");
 }
 
+// Send the captured frame as a binary-safe envelope. The header and CRC
+// are filled in around the capture buffer so the frame goes out in one write.
+bool CommunicationManager::sendRawFrame(MeterData& data) {
+  if (!data.binaryData || data.dataLength == 0) {
+    println("ERROR: No raw frame captured");
+    return false;
+  }
+  
+  uint8_t* frame = data.binaryData;
+  uint16_t length = (uint16_t)data.dataLength;
+  
+  frame[0] = RAW_FRAME_MAGIC_0;
+  frame[1] = RAW_FRAME_MAGIC_1;
+  frame[2] = (uint8_t)data.type;
+  frame[3] = length & 0xFF;
+  frame[4] = length >> 8;
+  
+  uint32_t crc = esp_rom_crc32_le(0, frame + 2, RAW_FRAME_HEADER_SIZE - 2 + length);
+  uint8_t* trailer = frame + RAW_FRAME_HEADER_SIZE + length;
+  trailer[0] = crc & 0xFF;
+  trailer[1] = (crc >> 8) & 0xFF;
+  trailer[2] = (crc >> 16) & 0xFF;
+  trailer[3] = (crc >> 24) & 0xFF;
+  
+  writeBluetooth(frame, RAW_FRAME_HEADER_SIZE + length + RAW_FRAME_CRC_SIZE);
+  
+  Serial.println("Raw frame sent: " + String(length) + " bytes, CRC " + String(crc, HEX));
+  return true;
+}
+
+// Same envelope as sendRawFrame for data that lives elsewhere (e.g. mapped
+// flash): the body is written from where it is, only the CRC is computed here.
+size_t CommunicationManager::sendFrame(uint8_t type, const uint8_t* prefix, size_t prefixLength,
+                                       const uint8_t* body, size_t bodyLength) {
+  uint8_t header[RAW_FRAME_HEADER_SIZE];
+  uint8_t trailer[RAW_FRAME_CRC_SIZE];
+  sealFrame(type, prefix, prefixLength, body, bodyLength, header, trailer);
+  
+  writeBluetooth(header, sizeof(header));
+  if (prefixLength > 0) writeBluetooth(prefix, prefixLength);
+  if (bodyLength > 0) writeBluetooth(body, bodyLength);
+  writeBluetooth(trailer, sizeof(trailer));
+  
+  return frameSize(prefixLength + bodyLength);
+}
+
+// Same envelope on any other stream (e.g. an HTTP upload body)
+size_t CommunicationManager::writeFrame(Print& out, uint8_t type, const uint8_t* prefix, size_t prefixLength,
+                                        const uint8_t* body, size_t bodyLength) {
+  uint8_t header[RAW_FRAME_HEADER_SIZE];
+  uint8_t trailer[RAW_FRAME_CRC_SIZE];
+  sealFrame(type, prefix, prefixLength, body, bodyLength, header, trailer);
+  
+  size_t written = out.write(header, sizeof(header));
+  if (prefixLength > 0) written += out.write(prefix, prefixLength);
+  if (bodyLength > 0) written += out.write(body, bodyLength);
+  written += out.write(trailer, sizeof(trailer));
+  return written;
+}
+
+void CommunicationManager::sealFrame(uint8_t type, const uint8_t* prefix, size_t prefixLength, const uint8_t* body,
+                                     size_t bodyLength, uint8_t* header, uint8_t* trailer) {
+  uint16_t length = (uint16_t)(prefixLength + bodyLength);
+  header[0] = RAW_FRAME_MAGIC_0;
+  header[1] = RAW_FRAME_MAGIC_1;
+  header[2] = type;
+  header[3] = (uint8_t)(length & 0xFF);
+  header[4] = (uint8_t)(length >> 8);
+  
+  uint32_t crc = esp_rom_crc32_le(0, header + 2, RAW_FRAME_HEADER_SIZE - 2);
+  crc = esp_rom_crc32_le(crc, prefix, prefixLength);
+  crc = esp_rom_crc32_le(crc, body, bodyLength);
+  trailer[0] = (uint8_t)(crc & 0xFF);
+  trailer[1] = (uint8_t)((crc >> 8) & 0xFF);
+  trailer[2] = (uint8_t)((crc >> 16) & 0xFF);
+  trailer[3] = (uint8_t)((crc >> 24) & 0xFF);
+}
+
+// Drain whatever the client has sent without echoing it back; used while a
+// binary transfer owns the link
+String CommunicationManager::readPendingInput() {
+  String input = "";
+  while (bluetoothSerial->available()) {
+    char c = bluetoothSerial->read();
+    if (isPrintable(c)) {
+      input += c;
+    }
+  }
+  if (input.length() > 0) {
+    lastCommandTime = millis();
+  }
+  return input;
+}
+
 void CommunicationManager::printSystemStatus() {
   println("=== System Status ===");
   println("Bluetooth: " + String(isBluetoothConnected() ? "Connected" : "Disconnected"));
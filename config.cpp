@@ -6,14 +6,16 @@
  */
 
 #include "config.h"
+#include <esp_rom_crc.h>
 
 ConfigManager::ConfigManager() {
   // Initialize with default values
-  config.bluetoothName = DEFAULT_BLE_NAME;
-  config.ssid = DEFAULT_SSID;
-  config.password = DEFAULT_PASSWORD;
-  config.ipAddress = DEFAULT_IP;
-  config.port = DEFAULT_PORT;
+  memset(&config, 0, sizeof(config));
+  copyField(config.bluetoothName, sizeof(config.bluetoothName), DEFAULT_BLE_NAME);
+  copyField(config.ssid, sizeof(config.ssid), DEFAULT_SSID);
+  copyField(config.password, sizeof(config.password), DEFAULT_PASSWORD);
+  copyField(config.ipAddress, sizeof(config.ipAddress), DEFAULT_IP);
+  config.port = String(DEFAULT_PORT).toInt();
 }
 
 ConfigManager::~ConfigManager() {
@@ -26,109 +28,333 @@ void ConfigManager::init() {
 }
 
 void ConfigManager::loadAll() {
-  // Load configuration from preferences with fallback to defaults
-  config.bluetoothName = preferences.getString("blename", DEFAULT_BLE_NAME);
-  config.ssid = preferences.getString("ssid", DEFAULT_SSID);
-  config.password = preferences.getString("password", DEFAULT_PASSWORD);
-  config.ipAddress = preferences.getString("ipaddress", DEFAULT_IP);
-  config.port = preferences.getString("port", DEFAULT_PORT);
+  // One blob read; older firmware kept one string key per field
+  if (loadBlob()) {
+    Serial.println("Configuration loaded successfully");
+    return;
+  }
   
-  // Validate loaded data and use defaults if invalid
-  if (!isValidBluetoothName(config.bluetoothName)) {
-    config.bluetoothName = DEFAULT_BLE_NAME;
+  if (migrateBlobV1()) {
+    Serial.println("Configuration migrated to version " + String(CONFIG_BLOB_VERSION));
+    return;
   }
-  if (!isValidSSID(config.ssid)) {
-    config.ssid = DEFAULT_SSID;
+  
+  if (migrateLegacyKeys()) {
+    Serial.println("Configuration migrated to blob format");
+  } else {
+    Serial.println("No stored configuration, using defaults");
   }
-  if (config.password.length() == 0) {
-    config.password = DEFAULT_PASSWORD;
+}
+
+void ConfigManager::restore(const SystemConfig& settings) {
+  // Same state loadAll() produced before the device went to sleep
+  config = settings;
+  Serial.println("Configuration restored from RTC memory");
+}
+
+void ConfigManager::saveAll() {
+  if (commit()) {
+    Serial.println("Configuration saved to flash memory");
   }
-  if (!isValidIP(config.ipAddress)) {
-    config.ipAddress = DEFAULT_IP;
+}
+
+// ========================= BLOB STORAGE =========================
+
+bool ConfigManager::loadBlob() {
+  ConfigBlob blob;
+  if (preferences.getBytesLength(CONFIG_BLOB_KEY) != sizeof(blob) ||
+      preferences.getBytes(CONFIG_BLOB_KEY, &blob, sizeof(blob)) != sizeof(blob)) {
+    return false;
   }
-  if (!isValidPort(config.port)) {
-    config.port = DEFAULT_PORT;
+  
+  if (blob.magic != CONFIG_BLOB_MAGIC || blob.crc != blobCRC(blob)) {
+    Serial.println("Stored configuration is corrupt, ignoring it");
+    return false;
   }
   
-  Serial.println("Configuration loaded successfully");
+  if (blob.version != CONFIG_BLOB_VERSION) {
+    Serial.println("Unknown configuration version " + String(blob.version));
+    return false;
+  }
+  
+  // Fields are terminated on write; enforce it anyway before use
+  blob.settings.bluetoothName[sizeof(blob.settings.bluetoothName) - 1] = '\0';
+  blob.settings.ssid[sizeof(blob.settings.ssid) - 1] = '\0';
+  blob.settings.password[sizeof(blob.settings.password) - 1] = '\0';
+  blob.settings.ipAddress[sizeof(blob.settings.ipAddress) - 1] = '\0';
+  config = blob.settings;
+  return true;
 }
 
-void ConfigManager::saveAll() {
-  preferences.putString("blename", config.bluetoothName);
-  preferences.putString("ssid", config.ssid);
-  preferences.putString("password", config.password);
-  preferences.putString("ipaddress", config.ipAddress);
-  preferences.putString("port", config.port);
+bool ConfigManager::migrateBlobV1() {
+  ConfigBlobV1 blob;
+  if (preferences.getBytesLength(CONFIG_BLOB_KEY) != sizeof(blob) ||
+      preferences.getBytes(CONFIG_BLOB_KEY, &blob, sizeof(blob)) != sizeof(blob)) {
+    return false;
+  }
+  
+  uint32_t crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&blob), offsetof(ConfigBlobV1, crc));
+  if (blob.magic != CONFIG_BLOB_MAGIC || blob.version != 1 || blob.crc != crc) {
+    return false;
+  }
+  
+  // Same fields and sizes as before; the schedule starts out off
+  SystemConfig migrated = config;
+  memcpy(migrated.bluetoothName, blob.settings.bluetoothName, sizeof(migrated.bluetoothName));
+  memcpy(migrated.ssid, blob.settings.ssid, sizeof(migrated.ssid));
+  memcpy(migrated.password, blob.settings.password, sizeof(migrated.password));
+  memcpy(migrated.ipAddress, blob.settings.ipAddress, sizeof(migrated.ipAddress));
+  migrated.bluetoothName[sizeof(migrated.bluetoothName) - 1] = '\0';
+  migrated.ssid[sizeof(migrated.ssid) - 1] = '\0';
+  migrated.password[sizeof(migrated.password) - 1] = '\0';
+  migrated.ipAddress[sizeof(migrated.ipAddress) - 1] = '\0';
+  migrated.port = blob.settings.port;
+  config = migrated;
   
-  Serial.println("Configuration saved to flash memory");
+  return commit();
+}
+
+bool ConfigManager::migrateLegacyKeys() {
+  if (!preferences.isKey("blename") && !preferences.isKey("ssid") && !preferences.isKey("password") &&
+      !preferences.isKey("ipaddress") && !preferences.isKey("port")) {
+    return false;
+  }
+  
+  // Take each legacy value that still validates, keep the default otherwise
+  SystemConfig migrated = config;
+  String error;
+  applyField(migrated, "bname", preferences.getString("blename", DEFAULT_BLE_NAME), error);
+  applyField(migrated, "ssid", preferences.getString("ssid", DEFAULT_SSID), error);
+  applyField(migrated, "password", preferences.getString("password", DEFAULT_PASSWORD), error);
+  applyField(migrated, "ipaddress", preferences.getString("ipaddress", DEFAULT_IP), error);
+  applyField(migrated, "port", preferences.getString("port", DEFAULT_PORT), error);
+  config = migrated;
+  
+  if (!commit()) {
+    return false;
+  }
+  
+  // The blob is authoritative from now on
+  preferences.remove("blename");
+  preferences.remove("ssid");
+  preferences.remove("password");
+  preferences.remove("ipaddress");
+  preferences.remove("port");
+  return true;
+}
+
+bool ConfigManager::commit() {
+  ConfigBlob blob;
+  memset(&blob, 0, sizeof(blob));
+  blob.magic = CONFIG_BLOB_MAGIC;
+  blob.version = CONFIG_BLOB_VERSION;
+  blob.settings = config;
+  blob.crc = blobCRC(blob);
+  
+  // NVS replaces the whole entry or nothing, so the blob is never half-written
+  if (preferences.putBytes(CONFIG_BLOB_KEY, &blob, sizeof(blob)) != sizeof(blob)) {
+    Serial.println("ERROR: Could not save configuration");
+    return false;
+  }
+  return true;
+}
+
+uint32_t ConfigManager::blobCRC(const ConfigBlob& blob) {
+  return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&blob), offsetof(ConfigBlob, crc));
+}
+
+void ConfigManager::copyField(char* field, size_t size, const String& value) {
+  memset(field, 0, size);
+  strncpy(field, value.c_str(), size - 1);
+}
+
+// ========================= UPDATES =========================
+
+bool ConfigManager::applyField(SystemConfig& target, const String& key, const String& value, String& error) const {
+  if (key == "bname") {
+    if (!isValidBluetoothName(value)) {
+      error = "Invalid Bluetooth name: " + value;
+      return false;
+    }
+    copyField(target.bluetoothName, sizeof(target.bluetoothName), value);
+  }
+  else if (key == "ssid") {
+    if (!isValidSSID(value)) {
+      error = "Invalid SSID: " + value;
+      return false;
+    }
+    copyField(target.ssid, sizeof(target.ssid), value);
+  }
+  else if (key == "password") {
+    if (value.length() == 0 || value.length() > MAX_PASSWORD_LENGTH) {
+      error = "Invalid password (empty or longer than " + String(MAX_PASSWORD_LENGTH) + ")";
+      return false;
+    }
+    copyField(target.password, sizeof(target.password), value);
+  }
+  else if (key == "ipaddress") {
+    if (!isValidIP(value)) {
+      error = "Invalid IP address: " + value;
+      return false;
+    }
+    copyField(target.ipAddress, sizeof(target.ipAddress), value);
+  }
+  else if (key == "port") {
+    if (!isValidPort(value)) {
+      error = "Invalid port: " + value;
+      return false;
+    }
+    target.port = value.toInt();
+  }
+  else {
+    error = "Unknown setting: " + key;
+    return false;
+  }
+  return true;
+}
+
+bool ConfigManager::updateBatch(const String& assignments, String& error) {
+  SystemConfig updated = config;
+  int start = 0;
+  int fields = 0;
+  
+  while (start < (int)assignments.length()) {
+    int end = assignments.indexOf(';', start);
+    if (end == -1) end = assignments.length();
+    
+    String assignment = assignments.substring(start, end);
+    start = end + 1;
+    assignment.trim();
+    if (assignment.length() == 0) continue;
+    
+    int equals = assignment.indexOf('=');
+    if (equals <= 0) {
+      error = "Expected key=value: " + assignment;
+      return false;
+    }
+    
+    String key = assignment.substring(0, equals);
+    key.trim();
+    if (!applyField(updated, key, assignment.substring(equals + 1), error)) {
+      return false;
+    }
+    fields++;
+  }
+  
+  if (fields == 0) {
+    error = "No settings given";
+    return false;
+  }
+  
+  // Nothing is applied unless every field validated
+  SystemConfig previous = config;
+  config = updated;
+  if (!commit()) {
+    config = previous;
+    error = "Flash write failed";
+    return false;
+  }
+  
+  Serial.println("Configuration updated: " + String(fields) + " settings in one commit");
+  return true;
 }
 
 void ConfigManager::updateBluetoothName(const String& name) {
-  if (isValidBluetoothName(name)) {
-    config.bluetoothName = name;
-    preferences.putString("blename", name);
+  String error;
+  if (applyField(config, "bname", name, error) && commit()) {
     Serial.println("Bluetooth name updated: " + name);
   } else {
-    Serial.println("Invalid Bluetooth name: " + name);
+    Serial.println(error);
   }
 }
 
 void ConfigManager::updateSSID(const String& ssid) {
-  if (isValidSSID(ssid)) {
-    config.ssid = ssid;
-    preferences.putString("ssid", ssid);
+  String error;
+  if (applyField(config, "ssid", ssid, error) && commit()) {
     Serial.println("SSID updated: " + ssid);
   } else {
-    Serial.println("Invalid SSID: " + ssid);
+    Serial.println(error);
   }
 }
 
 void ConfigManager::updatePassword(const String& password) {
-  if (password.length() > 0) {
-    config.password = password;
-    preferences.putString("password", password);
+  String error;
+  if (applyField(config, "password", password, error) && commit()) {
     Serial.println("Password updated successfully");
   } else {
-    Serial.println("Invalid password (empty)");
+    Serial.println(error);
   }
 }
 
 void ConfigManager::updateIPAddress(const String& ip) {
-  if (isValidIP(ip)) {
-    config.ipAddress = ip;
-    preferences.putString("ipaddress", ip);
+  String error;
+  if (applyField(config, "ipaddress", ip, error) && commit()) {
     Serial.println("IP Address updated: " + ip);
   } else {
-    Serial.println("Invalid IP address: " + ip);
+    Serial.println(error);
   }
 }
 
 void ConfigManager::updatePort(const String& port) {
-  if (isValidPort(port)) {
-    config.port = port;
-    preferences.putString("port", port);
+  String error;
+  if (applyField(config, "port", port, error) && commit()) {
     Serial.println("Port updated: " + port);
   } else {
-    Serial.println("Invalid port: " + port);
+    Serial.println(error);
   }
 }
 
+bool ConfigManager::updateSchedule(uint32_t intervalS, MeterType meterType, long uploadEveryCycles, String& error) {
+  if (intervalS != 0 && (intervalS < SCHEDULE_MIN_INTERVAL_S || intervalS > SCHEDULE_MAX_INTERVAL_S)) {
+    error = "Interval must be " + String(SCHEDULE_MIN_INTERVAL_S) + "-" + String(SCHEDULE_MAX_INTERVAL_S) + " s";
+    return false;
+  }
+  if (intervalS != 0 && meterType == METER_TYPE_UNKNOWN) {
+    error = "Unknown meter command";
+    return false;
+  }
+  if (intervalS != 0 && (uploadEveryCycles < 0 || uploadEveryCycles > SCHEDULE_MAX_UPLOAD_CYCLES)) {
+    error = "Upload period must be 0-" + String(SCHEDULE_MAX_UPLOAD_CYCLES) + " cycles";
+    return false;
+  }
+  
+  SystemConfig previous = config;
+  config.scheduleIntervalS = intervalS;
+  config.scheduleMeterType = intervalS != 0 ? (uint8_t)meterType : 0;
+  config.uploadEveryCycles = intervalS != 0 ? (uint16_t)uploadEveryCycles : 0;
+  if (!commit()) {
+    config = previous;
+    error = "Flash write failed";
+    return false;
+  }
+  
+  Serial.println(intervalS != 0 ? "Reading schedule set: every " + String(intervalS) + " s" : String("Reading schedule off"));
+  return true;
+}
+
 void ConfigManager::printConfig() const {
   Serial.println("=== Current Configuration ===");
-  Serial.println("Bluetooth Name: " + config.bluetoothName);
-  Serial.println("SSID: " + config.ssid);
-  Serial.println("IP Address: " + config.ipAddress);
-  Serial.println("Port: " + config.port);
+  Serial.println("Bluetooth Name: " + getBluetoothName());
+  Serial.println("SSID: " + getSSID());
+  Serial.println("IP Address: " + getIPAddress());
+  Serial.println("Port: " + getPort());
   Serial.println("Password: [HIDDEN]");
+  if (isScheduleEnabled()) {
+    Serial.println("Schedule: every " + String(config.scheduleIntervalS) + " s, type " + String(config.scheduleMeterType) +
+                   ", upload every " + String(config.uploadEveryCycles) + " cycles");
+  }
   Serial.println("=============================");
 }
 
 void ConfigManager::resetToDefaults() {
-  config.bluetoothName = DEFAULT_BLE_NAME;
-  config.ssid = DEFAULT_SSID;
-  config.password = DEFAULT_PASSWORD;
-  config.ipAddress = DEFAULT_IP;
-  config.port = DEFAULT_PORT;
+  copyField(config.bluetoothName, sizeof(config.bluetoothName), DEFAULT_BLE_NAME);
+  copyField(config.ssid, sizeof(config.ssid), DEFAULT_SSID);
+  copyField(config.password, sizeof(config.password), DEFAULT_PASSWORD);
+  copyField(config.ipAddress, sizeof(config.ipAddress), DEFAULT_IP);
+  config.port = String(DEFAULT_PORT).toInt();
+  config.scheduleIntervalS = 0;
+  config.scheduleMeterType = 0;
+  config.uploadEveryCycles = 0;
   
   saveAll();
   Serial.println("Configuration reset to factory defaults");
@@ -145,7 +371,7 @@ bool ConfigManager::isValidSSID(const String& ssid) const {
 
 bool ConfigManager::isValidIP(const String& ip) const {
   // Basic IP validation - check for proper format
-  if (ip.length() == 0) return false;
+  if (ip.length() == 0 || ip.length() >= MAX_IP_LENGTH) return false;
   
   int dotCount = 0;
   for (int i = 0; i < ip.length(); i++) {
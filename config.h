@@ -24,6 +24,8 @@
 
 // IRDA and External Controls
 #define PIN_IRDA_EN 12
+#define PIN_IRDA_EN_ON LOW               // Transceiver shutdown input: low while a meter session runs
+#define PIN_IRDA_EN_OFF HIGH
 #define PIN_EXT_SW 33
 #define PIN_EXT_PW 32
 
@@ -51,10 +53,110 @@
 #define BAUD_RATE_9600 9600
 #define BAUD_RATE_115200 115200
 
+// ========================= WIFI SETTINGS =========================
+
+#define WIFI_MAX_NETWORKS 4
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 4000   // Cached BSSID/channel/lease attempt
+#define WIFI_CONNECT_TIMEOUT_MS 30000       // Overall budget including scan
+#define WIFI_LEASE_REUSE_S 3600             // Cached IP used without DHCP this long; keep below the lease time
+
+// ========================= OTA SETTINGS =========================
+
+#define OTA_FIRMWARE_PATH "/firmware/ota.bin"
+#define OTA_MANIFEST_PATH "/firmware/manifest.json" // Checked before any download
+#define OTA_PATCH_PATH "/firmware/ota.patch" // Delta against the running image, ?from=<app hash>
+#define OTA_ACCEPT_COMPRESSED true       // Ask for fw_compress.h images (Accept-Encoding)
+#define OTA_CONTENT_ENCODING "fwz"       // Content-Encoding of a compressed image
+#define OTA_SECTOR_SIZE 4096             // Flash erase unit; one sector is buffered in RAM
+#define OTA_SAVE_INTERVAL_BYTES 65536    // Resume offset saved to NVS this often
+#define OTA_RECEIVE_CHUNK 512            // TCP read size (on the stack)
+#define OTA_MAX_ATTEMPTS 8               // Connections per update; progress carries over
+#define OTA_RETRY_DELAY_MS 2000          // Times the attempt number
+#define OTA_READ_TIMEOUT_MS 15000        // No data for this long counts as a drop
+#define OTA_ETAG_MAX_LENGTH 64           // Longer ETags are not kept for resuming
+#define OTA_MANIFEST_MAX_LENGTH 2048     // Larger manifests are refused
+#define OTA_VERSION_MAX_LENGTH 32        // Manifest "version" field, with terminator
+#define OTA_SIGNATURE_MAX_SIZE 72        // DER ECDSA P-256 signature in the manifest
+
+// PEM public key (P-256) whose private half signs ota.bin. An image without a
+// valid manifest "signature" is never made bootable; empty = updates refused
+#define OTA_SIGNING_PUBLIC_KEY ""
+
+// PEM CA certificate of the update server; empty = HTTPS updates refused
+#define OTA_SERVER_CA_CERT ""
+
+// ========================= READING LOG SETTINGS =========================
+
+#define READING_LOG_PARTITION "readlog"
+#define READING_LOG_PARTITION_SUBTYPE 0x40  // Must match partitions.csv
+#define READING_LOG_QUEUE_DEPTH 8
+#define READING_LOG_TASK_STACK 3072
+#define READING_LOG_TASK_PRIORITY 1
+#define LOG_QUERY_MAX_RESULTS 50           // Records per #LOG? page; ",from=<seq>" continues
+#define LOG_EXPORT_WINDOW 4                 // Chunks (sectors) in flight per export
+#define LOG_EXPORT_MAX_WINDOW 16
+#define LOG_EXPORT_ACK_TIMEOUT_MS 2000
+#define LOG_EXPORT_MAX_RETRIES 5
+
+// ========================= SCHEDULED READING SETTINGS =========================
+
+#define SCHEDULE_MIN_INTERVAL_S 60          // Shortest timer-wake reading cycle
+#define SCHEDULE_MAX_INTERVAL_S 604800      // One week
+#define SCHEDULE_MAX_UPLOAD_CYCLES 1000     // Longest upload period in cycles
+#define SCHEDULE_MIN_SLEEP_MS 1000          // Floor when a cycle overruns its interval
+#define READING_UPLOAD_PATH "/readings"     // HTTP POST target on the configured server
+#define READING_UPLOAD_TIMEOUT_MS 10000
+
 // ========================= POWER MANAGEMENT SETTINGS =========================
 
-#define SLEEP_TIMEOUT_MS 210000  // 3.5 minutes
-#define BUTTON_DEBOUNCE_MS 2000
+#define SLEEP_TIMEOUT_MS 210000  // 3.5 minutes (until the gap model has learned enough)
+#define SLEEP_TIMEOUT_MIN_MS 60000       // Bounds of the learned timeout
+#define SLEEP_TIMEOUT_MAX_MS 600000
+#define SLEEP_MODEL_MIN_SAMPLES 8        // Gaps seen before the learned timeout is used
+#define SLEEP_MODEL_DECAY 0.97f          // Weight older gaps keep per new gap (~30-gap memory)
+#define SLEEP_MODEL_AWAKE_MA 45.0f       // Draw while awake and idle with Bluetooth on
+#define SLEEP_MODEL_WAKE_MAS 150.0f      // Charge of a wake from deep sleep (boot, Bluetooth start), mA*s
+#define SLEEP_MODEL_LONG_GAP_S 1800      // Assumed length of gaps past the last histogram bin
+#define BUTTON_DEBOUNCE_MS 30            // Contact settling time after an edge
+#define BUTTON_LONG_PRESS_MS 2000        // Hold time that puts the device to sleep
+#define BUTTON_DOUBLE_PRESS_MS 400       // Second press must start within this time of the first release
+#define BUTTON_FORCED_SLEEP_MS 1000      // Long press not taken by a busy loop: the button task sleeps itself
+#define SLEEP_GATE_WAIT_MS 10000         // Forced sleep waits this long for a meter session or flash write
+#define BUTTON_QUEUE_DEPTH 8             // Raw edges between interrupt and button task
+#define BUTTON_TASK_STACK 3072
+#define BUTTON_TASK_PRIORITY 3
+#define BATTERY_SAMPLE_INTERVAL_MS 250   // One calibrated ADC read per interval
+#define BATTERY_EMA_ALPHA 0.05f          // Filter weight of each new sample (~5 s time constant)
+#define BATTERY_DIVIDER_RATIO 2.0f       // Battery to ADC pin voltage divider
+#define BATTERY_TASK_STACK 2048
+#define BATTERY_TASK_PRIORITY 1
+#define BATTERY_CAPACITY_MAH 2000        // Rated cell capacity
+#define BATTERY_INTERNAL_MOHM 150        // Cell, protection and wiring resistance (load compensation)
+#define BATTERY_SOC_OCV_WEIGHT 0.02f     // Pull of each OCV reading on the coulomb count (~25 min at 30 s checks)
+#define BATTERY_READ_CHARGE_ALPHA 0.2f   // Weight of the newest read in the charge per read
+#define BATTERY_MODEL_MIN_READS 3        // Reads before the charge per read includes idle and sleep
+#define POWER_IDLE_CPU_MHZ 80            // CPU clock between commands (APB stays at 80 MHz for the UARTs)
+#define POWER_IDLE_POLL_MS 500           // Longest idle wait before the loop runs its periodic work
+#define POWER_BUSY_POLL_MS 10            // Idle wait while WiFi connects
+#define POWER_UART_WAKE_THRESHOLD 3      // RX edges that wake UART0 from light sleep
+#define POWER_LOW_CLOCK_MA 30            // Estimated draw at POWER_IDLE_CPU_MHZ with Bluetooth on
+#define POWER_MAX_CLOCK_MA 50            // Estimated draw at the maximum CPU clock
+#define POWER_NOMINAL_VOLTAGE 3.7f       // Used for energy estimates until the battery is sampled
+
+// ========================= ENERGY MODEL =========================
+
+// Estimated current of each subsystem while on (mA), added together;
+// measure the board on a bench and adjust
+#define ENERGY_MA_BT_CONNECTED 35.0f
+#define ENERGY_MA_BT_ADVERTISING 12.0f
+#define ENERGY_MA_WIFI 80.0f
+#define ENERGY_MA_IRDA 5.0f
+#define ENERGY_MA_PWM 20.0f
+#define ENERGY_MA_EXT_POWER 15.0f
+#define ENERGY_MA_CPU_ACTIVE 30.0f
+#define ENERGY_MA_CPU_IDLE 8.0f
+#define ENERGY_MA_BUZZER 30.0f
+#define ENERGY_MA_DEEP_SLEEP 0.15f
 
 // ========================= PWM SETTINGS =========================
 
@@ -63,12 +165,49 @@
 #define PWM_RESOLUTION 8
 #define PWM_DUTY_CYCLE 85
 
+// ========================= BUZZER SETTINGS =========================
+
+#define BUZZER_FREQ 2857                 // Same pitch as the old bit-banged tone (175 us half period)
+#define BUZZER_RESOLUTION 8
+#define BUZZER_DUTY 128                  // 50% square wave
+#define BUZZER_LEDC_CHANNEL 2            // Own LEDC timer, apart from the 38 kHz carrier
+#define BUZZER_QUEUE_DEPTH 4             // Patterns waiting to play
+#define BUZZER_MAX_STEPS 8               // Beeps per pattern
+#define BUZZER_BEEP_MS 175
+#define BUZZER_SLEEP_WAIT_MS 3000        // Longest wait for the sleep beeps before deep sleep
+
+// ========================= STATUS LED SETTINGS =========================
+
+#define LED_OTA_PERIOD_MS 1000           // Blink period during an update
+#define LED_OTA_MIN_MS 50                // Shortest on and off time of that blink
+
+// ========================= PERIPHERAL POWER SETTINGS =========================
+
+// Time from switching a peripheral on until it can be used
+#define PERIPH_EXT_POWER_WARMUP_MS 20    // External rail settling after PIN_EXT_PW
+#define PERIPH_IRDA_WARMUP_MS 1          // Transceiver out of shutdown (well under 1 ms)
+#define PERIPH_PWM_WARMUP_MS 1           // 38 kHz carrier stable after a few periods
+#define PERIPH_LINGER_MS 10000           // Kept on after a session for back-to-back reads
+
 // ========================= BUFFER SIZES =========================
 
 #define MAX_BT_NAME_LENGTH 20
+#define MAX_SSID_LENGTH 32
+#define MAX_PASSWORD_LENGTH 64
+#define MAX_IP_LENGTH 16
 #define PACKET_BUFFER_SIZE 100
 #define COMMAND_BUFFER_SIZE 50
 
+// ========================= RAW FRAME ENVELOPE =========================
+
+// Raw reads are sent as: A5 5A <type> <len lo> <len hi> <payload> <crc32 LE>
+// The CRC covers type, length and payload (standard CRC-32, as zlib.crc32)
+#define RAW_FRAME_MAGIC_0 0xA5
+#define RAW_FRAME_MAGIC_1 0x5A
+#define RAW_FRAME_HEADER_SIZE 5
+#define RAW_FRAME_CRC_SIZE 4
+#define RAW_FRAME_MAX_PAYLOAD 256
+
 // ========================= ENUMERATIONS =========================
 
 // Meter types enumeration
@@ -90,20 +229,52 @@ enum MeterType {
 
 // ========================= DATA STRUCTURES =========================
 
-// Configuration data structure
+// Configuration data structure (fixed-size so it loads with one read)
 struct SystemConfig {
-  String bluetoothName;
-  String ssid;
-  String password;
-  String ipAddress;
-  String port;
+  char bluetoothName[MAX_BT_NAME_LENGTH];
+  char ssid[MAX_SSID_LENGTH + 1];
+  char password[MAX_PASSWORD_LENGTH + 1];
+  char ipAddress[MAX_IP_LENGTH];
+  uint16_t port;
+  uint32_t scheduleIntervalS;     // Timer-wake reading cycle, 0 = off
+  uint8_t scheduleMeterType;      // MeterType read on each cycle
+  uint8_t reserved;
+  uint16_t uploadEveryCycles;     // Upload the log every N cycles, 0 = never
+};
+
+// Stored as a single NVS blob: header, settings, CRC-32 of everything before it
+#define CONFIG_BLOB_KEY "config"
+#define CONFIG_BLOB_MAGIC 0x4346  // "CF"
+#define CONFIG_BLOB_VERSION 2
+
+struct ConfigBlob {
+  uint16_t magic;
+  uint16_t version;
+  SystemConfig settings;
+  uint32_t crc;
+};
+
+// Version 1 layout (before the reading schedule), migrated on load
+struct SystemConfigV1 {
+  char bluetoothName[MAX_BT_NAME_LENGTH];
+  char ssid[MAX_SSID_LENGTH + 1];
+  char password[MAX_PASSWORD_LENGTH + 1];
+  char ipAddress[MAX_IP_LENGTH];
+  uint16_t port;
+};
+
+struct ConfigBlobV1 {
+  uint16_t magic;
+  uint16_t version;
+  SystemConfigV1 settings;
+  uint32_t crc;
 };
 
 // Meter data structure
 struct MeterData {
-  String rawData;
-  uint8_t* binaryData;
-  size_t dataLength;
+  String rawData;         // Text view of the capture, used by the parser
+  uint8_t* binaryData;    // Envelope buffer: [header][payload][crc]
+  size_t dataLength;      // Payload bytes captured
   bool isValid;
   MeterType type;
   
@@ -117,6 +288,22 @@ struct MeterData {
       binaryData = nullptr;
     }
   }
+  
+  // Owns binaryData; always passed by reference
+  MeterData(const MeterData&) = delete;
+  MeterData& operator=(const MeterData&) = delete;
+  
+  // Allocate the envelope buffer on first use
+  bool reserveBinary() {
+    if (!binaryData) {
+      binaryData = (uint8_t*)malloc(RAW_FRAME_HEADER_SIZE + RAW_FRAME_MAX_PAYLOAD + RAW_FRAME_CRC_SIZE);
+    }
+    return binaryData != nullptr;
+  }
+  
+  // Capture area, leaving room for the envelope header in front
+  uint8_t* payload() { return binaryData + RAW_FRAME_HEADER_SIZE; }
+  size_t payloadSpace() const { return RAW_FRAME_MAX_PAYLOAD - dataLength; }
 };
 
 // ========================= CONFIGURATION MANAGER CLASS =========================
@@ -126,6 +313,17 @@ private:
   Preferences preferences;
   SystemConfig config;
   
+  // Blob storage
+  bool loadBlob();
+  bool migrateBlobV1();
+  bool migrateLegacyKeys();
+  bool commit();
+  static uint32_t blobCRC(const ConfigBlob& blob);
+  static void copyField(char* field, size_t size, const String& value);
+  
+  // Field assignment on a working copy, shared by single and batch updates
+  bool applyField(SystemConfig& target, const String& key, const String& value, String& error) const;
+  
 public:
   ConfigManager();
   ~ConfigManager();
@@ -137,20 +335,32 @@ public:
   void loadAll();
   void saveAll();
   
+  // Warm boot: settings retained in RTC memory across deep sleep
+  const SystemConfig& getSettings() const { return config; }
+  void restore(const SystemConfig& settings);
+  
   // Individual parameter updates
   void updateBluetoothName(const String& name);
   void updateSSID(const String& ssid);
   void updatePassword(const String& password);
   void updateIPAddress(const String& ip);
   void updatePort(const String& port);
+  bool updateSchedule(uint32_t intervalS, MeterType meterType, long uploadEveryCycles, String& error);
+  
+  // Several fields in one commit: "key=value;key=value" (all or nothing)
+  bool updateBatch(const String& assignments, String& error);
   
   // Getters
-  String getBluetoothName() const { return config.bluetoothName; }
-  String getSSID() const { return config.ssid; }
-  String getPassword() const { return config.password; }
-  String getIPAddress() const { return config.ipAddress; }
-  String getPort() const { return config.port; }
-  int getPortInt() const { return config.port.toInt(); }
+  String getBluetoothName() const { return String(config.bluetoothName); }
+  String getSSID() const { return String(config.ssid); }
+  String getPassword() const { return String(config.password); }
+  String getIPAddress() const { return String(config.ipAddress); }
+  String getPort() const { return String(config.port); }
+  int getPortInt() const { return config.port; }
+  bool isScheduleEnabled() const { return config.scheduleIntervalS > 0; }
+  uint32_t getScheduleIntervalS() const { return config.scheduleIntervalS; }
+  MeterType getScheduleMeterType() const { return (MeterType)config.scheduleMeterType; }
+  uint16_t getUploadEveryCycles() const { return config.uploadEveryCycles; }
   
   // Utility
   void printConfig() const;
@@ -73,6 +73,7 @@ struct ParsedMeterData {
 class DataParser {
 private:
   CommunicationManager* comm;
+  bool reportErrors;
   
   // ========================= UTILITY FUNCTIONS =========================
   uint32_t hexToDecimal(const uint8_t* data, int length);
@@ -105,6 +106,8 @@ public:
   
   // ========================= MAIN PARSING INTERFACE =========================
   bool parseAndPrint(const MeterData& data, MeterType type);
+  bool parseAndPrint(const MeterData& data, MeterType type, ParsedMeterData& parsed);
+  bool parse(const MeterData& data, MeterType type, ParsedMeterData& parsed, bool quiet = false);
   
   // ========================= INDIVIDUAL PARSERS =========================
   bool parse1PhaseIRDA(const String& rawData, ParsedMeterData& parsed);
@@ -120,25 +123,68 @@ public:
 
 // ========================= IMPLEMENTATION =========================
 
-DataParser::DataParser() : comm(nullptr) {
+DataParser::DataParser() : comm(nullptr), reportErrors(true) {
 }
 
 bool DataParser::parseAndPrint(const MeterData& data, MeterType type) {
+  ParsedMeterData parsed;
+  return parseAndPrint(data, type, parsed);
+}
+
+bool DataParser::parseAndPrint(const MeterData& data, MeterType type, ParsedMeterData& parsed) {
   if (!comm || !data.isValid || data.rawData.length() == 0) {
     if (comm) comm->println("ERROR: Invalid data or parser not initialized");
     return false;
   }
   
-  ParsedMeterData parsed;
-  bool success = false;
+  switch (type) {
+    case IRDA_1PH_PARSED:
+    case IRDA_3PH_PARSED:
+    case IRDA_3PH_14HP:
+    case IRDA_3PH_13HP:
+    case IR_1PH_PARSED:
+    case IR_3PH_PARSED:
+      break;
+    default:
+      comm->println("ERROR: Unsupported parsing type");
+      return false;
+  }
   
   printSeparator("PARSING DATA");
   
+  bool success = parse(data, type, parsed);
+  
+  if (success && parsed.isValid) {
+    printMeterInfo(parsed.info);
+    printEnergyData(parsed.energy);
+    printElectricalData(parsed.electrical);
+    printDataStatistics(parsed);
+    return true;
+  } else {
+    comm->println("ERROR: Failed to parse meter data");
+    return false;
+  }
+}
+
+// Fills the structure without printing; raw and solar reads use this for the reading log
+bool DataParser::parse(const MeterData& data, MeterType type, ParsedMeterData& parsed, bool quiet) {
+  if (!data.isValid || data.rawData.length() == 0) {
+    return false;
+  }
+  
+  reportErrors = !quiet;
+  bool success = false;
+  
   switch (type) {
+    case IRDA_1PH_RAW:
     case IRDA_1PH_PARSED:
       success = parse1PhaseIRDA(data.rawData, parsed);
       break;
+    case IRDA_3PH_RAW:
     case IRDA_3PH_PARSED:
+    case IRDA_3PH_SOLAR_RAW:
+    case IRDA_3PH_SOLAR_PARSED:
+      // Solar captures start with the import packet in the 3-phase layout
       success = parse3PhaseIRDA(data.rawData, parsed);
       break;
     case IRDA_3PH_14HP:
@@ -147,27 +193,20 @@ bool DataParser::parseAndPrint(const MeterData& data, MeterType type) {
     case IRDA_3PH_13HP:
       success = parse3PhaseHPIRDA(data.rawData, parsed, 7);
       break;
+    case IR_1PH_RAW:
     case IR_1PH_PARSED:
       success = parse1PhaseIR(data.rawData, parsed);
       break;
+    case IR_3PH_RAW:
     case IR_3PH_PARSED:
       success = parse3PhaseIR(data.rawData, parsed);
       break;
     default:
-      comm->println("ERROR: Unsupported parsing type");
-      return false;
+      break;
   }
   
-  if (success && parsed.isValid) {
-    printMeterInfo(parsed.info);
-    printEnergyData(parsed.energy);
-    printElectricalData(parsed.electrical);
-    printDataStatistics(parsed);
-    return true;
-  } else {
-    comm->println("ERROR: Failed to parse meter data");
-    return false;
-  }
+  reportErrors = true;
+  return success;
 }
 
 bool DataParser::parse1PhaseIRDA(const String& rawData, ParsedMeterData& parsed) {
@@ -459,7 +498,7 @@ float DataParser::convertToFloat(uint32_t value, int decimals) {
 
 bool DataParser::validatePacketLength(const String& data, int minLength) {
   if (data.length() < minLength) {
-    if (comm) {
+    if (comm && reportErrors) {
       comm->println("ERROR: Packet too short (" + String(data.length()) + " < " + String(minLength) + ")");
     }
     return false;
@@ -0,0 +1,266 @@
+/*
+ * energy_monitor.h - Estimated energy use per subsystem
+ *
+ * This file contains the EnergyMonitor class that times how long each
+ * power consumer is on (Bluetooth, WiFi, IRDA transceiver, 38 kHz PWM,
+ * external power, CPU, buzzer) and weights the time with the current
+ * model in config.h. Totals since boot live in RAM; totals across
+ * deep-sleep cycles, including the time spent asleep, are kept in RTC
+ * memory and start over after any reset that is not a deep-sleep wake
+ * (power-on, brown-out, watchdog, panic, restart after an OTA update).
+ *
+ * Modules report switchable loads with setState(); the main loop
+ * reports the polled ones (Bluetooth, WiFi, CPU idle time). The state is
+ * written from several tasks (loop, buzzer) and read by the battery
+ * task, so its 64-bit times are only touched under stateLock.
+ */
+
+#ifndef ENERGY_MONITOR_H
+#define ENERGY_MONITOR_H
+
+#include <Arduino.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <esp_rtc_time.h>
+#include <freertos/FreeRTOS.h>
+#include "config.h"
+
+enum EnergySubsystem {
+  ENERGY_BT_CONNECTED,
+  ENERGY_BT_ADVERTISING,    // Discoverable, waiting for a client
+  ENERGY_WIFI,
+  ENERGY_IRDA,              // PIN_IRDA_EN
+  ENERGY_PWM,               // 38 kHz carrier on PIN_LED_PWM
+  ENERGY_EXT_POWER,         // PIN_EXT_PW
+  ENERGY_CPU_ACTIVE,
+  ENERGY_CPU_IDLE,
+  ENERGY_BUZZER,
+  ENERGY_SUBSYSTEM_COUNT
+};
+
+// Totals across deep-sleep cycles
+struct EnergyHistory {
+  uint32_t magic;
+  uint32_t boots;
+  uint32_t deepSleeps;
+  uint64_t deepSleepUs;
+  uint64_t sleepStartUs;    // RTC time at the last deep-sleep entry, 0 if none
+  uint64_t onUs[ENERGY_SUBSYSTEM_COUNT];
+};
+
+#define ENERGY_HISTORY_MAGIC 0x454E4731  // "ENG1"
+
+// Kept only across deep-sleep wakes; init() clears it after any other reset
+RTC_DATA_ATTR static EnergyHistory rtcEnergyHistory;
+
+class EnergyMonitor {
+private:
+  uint64_t onUs[ENERGY_SUBSYSTEM_COUNT];      // Closed intervals since boot
+  int64_t onSinceUs[ENERGY_SUBSYSTEM_COUNT];  // Start of the open interval, -1 when off
+  uint64_t cpuIdleUs;
+  bool committed;
+  mutable portMUX_TYPE stateLock;
+
+  uint64_t totalOnUs(EnergySubsystem subsystem, int64_t now) const;
+  static float currentMilliAmps(EnergySubsystem subsystem);
+  static const char* subsystemName(EnergySubsystem subsystem);
+  static float toMilliAmpHours(uint64_t us, float milliAmps) { return milliAmps * (us / 3600000000.0f); }
+
+public:
+  EnergyMonitor();
+
+  // Initialization (picks up the time spent in deep sleep)
+  void init();
+
+  // State reporting
+  void setState(EnergySubsystem subsystem, bool on);
+  void setCpuIdleTime(uint64_t idleUs);
+
+  // Called right before esp_deep_sleep_start()
+  void prepareSleep();
+
+  // Totals across all cycles, deep sleep included (battery model)
+  float getTotalMilliAmpHours();
+  float getTotalHours();
+  float getLoadMilliAmps();               // Draw of everything on right now
+
+  // Status
+  String getReport();
+};
+
+// Implementation
+EnergyMonitor::EnergyMonitor() : cpuIdleUs(0), committed(false), stateLock(portMUX_INITIALIZER_UNLOCKED) {
+  for (int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++) {
+    onUs[i] = 0;
+    onSinceUs[i] = -1;
+  }
+}
+
+void EnergyMonitor::init() {
+  bool fromDeepSleep = esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED;
+  if (rtcEnergyHistory.magic != ENERGY_HISTORY_MAGIC || !fromDeepSleep) {
+    memset(&rtcEnergyHistory, 0, sizeof(rtcEnergyHistory));
+    rtcEnergyHistory.magic = ENERGY_HISTORY_MAGIC;
+  }
+
+  // The RTC timer keeps running in deep sleep
+  uint64_t now = esp_rtc_get_time_us();
+  if (fromDeepSleep && rtcEnergyHistory.sleepStartUs != 0 && now > rtcEnergyHistory.sleepStartUs) {
+    rtcEnergyHistory.deepSleepUs += now - rtcEnergyHistory.sleepStartUs;
+  }
+  rtcEnergyHistory.sleepStartUs = 0;
+  rtcEnergyHistory.boots++;
+}
+
+void EnergyMonitor::setState(EnergySubsystem subsystem, bool on) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&stateLock);
+  if (on && onSinceUs[subsystem] < 0) {
+    onSinceUs[subsystem] = now;
+  } else if (!on && onSinceUs[subsystem] >= 0) {
+    onUs[subsystem] += now - onSinceUs[subsystem];
+    onSinceUs[subsystem] = -1;
+  }
+  portEXIT_CRITICAL(&stateLock);
+}
+
+void EnergyMonitor::setCpuIdleTime(uint64_t idleUs) {
+  portENTER_CRITICAL(&stateLock);
+  cpuIdleUs = idleUs;
+  portEXIT_CRITICAL(&stateLock);
+}
+
+uint64_t EnergyMonitor::totalOnUs(EnergySubsystem subsystem, int64_t now) const {
+  portENTER_CRITICAL(&stateLock);
+  uint64_t idleUs = cpuIdleUs;
+  uint64_t total = onUs[subsystem];
+  int64_t since = onSinceUs[subsystem];
+  portEXIT_CRITICAL(&stateLock);
+
+  // CPU time is split by the idle time the power manager measured
+  if (subsystem == ENERGY_CPU_IDLE) {
+    return idleUs;
+  }
+  if (subsystem == ENERGY_CPU_ACTIVE) {
+    return (uint64_t)now > idleUs ? now - idleUs : 0;
+  }
+
+  if (since >= 0) {
+    total += now - since;
+  }
+  return total;
+}
+
+void EnergyMonitor::prepareSleep() {
+  if (committed) {
+    return;
+  }
+
+  int64_t now = esp_timer_get_time();
+  for (int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++) {
+    rtcEnergyHistory.onUs[i] += totalOnUs((EnergySubsystem)i, now);
+  }
+  rtcEnergyHistory.deepSleeps++;
+  rtcEnergyHistory.sleepStartUs = esp_rtc_get_time_us();
+  committed = true;
+}
+
+float EnergyMonitor::currentMilliAmps(EnergySubsystem subsystem) {
+  switch (subsystem) {
+    case ENERGY_BT_CONNECTED: return ENERGY_MA_BT_CONNECTED;
+    case ENERGY_BT_ADVERTISING: return ENERGY_MA_BT_ADVERTISING;
+    case ENERGY_WIFI: return ENERGY_MA_WIFI;
+    case ENERGY_IRDA: return ENERGY_MA_IRDA;
+    case ENERGY_PWM: return ENERGY_MA_PWM;
+    case ENERGY_EXT_POWER: return ENERGY_MA_EXT_POWER;
+    case ENERGY_CPU_ACTIVE: return ENERGY_MA_CPU_ACTIVE;
+    case ENERGY_CPU_IDLE: return ENERGY_MA_CPU_IDLE;
+    case ENERGY_BUZZER: return ENERGY_MA_BUZZER;
+    default: return 0;
+  }
+}
+
+const char* EnergyMonitor::subsystemName(EnergySubsystem subsystem) {
+  switch (subsystem) {
+    case ENERGY_BT_CONNECTED: return "Bluetooth connected";
+    case ENERGY_BT_ADVERTISING: return "Bluetooth discoverable";
+    case ENERGY_WIFI: return "WiFi";
+    case ENERGY_IRDA: return "IRDA transceiver";
+    case ENERGY_PWM: return "38 kHz PWM";
+    case ENERGY_EXT_POWER: return "External power";
+    case ENERGY_CPU_ACTIVE: return "CPU active";
+    case ENERGY_CPU_IDLE: return "CPU idle";
+    case ENERGY_BUZZER: return "Buzzer";
+    default: return "?";
+  }
+}
+
+float EnergyMonitor::getTotalMilliAmpHours() {
+  int64_t now = esp_timer_get_time();
+  float total = toMilliAmpHours(rtcEnergyHistory.deepSleepUs, ENERGY_MA_DEEP_SLEEP);
+  for (int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++) {
+    uint64_t us = (committed ? 0 : totalOnUs((EnergySubsystem)i, now)) + rtcEnergyHistory.onUs[i];
+    total += toMilliAmpHours(us, currentMilliAmps((EnergySubsystem)i));
+  }
+  return total;
+}
+
+float EnergyMonitor::getTotalHours() {
+  // Awake time is CPU active plus idle
+  uint64_t us = rtcEnergyHistory.deepSleepUs + rtcEnergyHistory.onUs[ENERGY_CPU_ACTIVE] +
+                rtcEnergyHistory.onUs[ENERGY_CPU_IDLE] + (committed ? 0 : esp_timer_get_time());
+  return us / 3600000000.0f;
+}
+
+float EnergyMonitor::getLoadMilliAmps() {
+  // CPU time is not switched; count it as active while anything samples the battery
+  bool on[ENERGY_SUBSYSTEM_COUNT];
+  portENTER_CRITICAL(&stateLock);
+  for (int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++) {
+    on[i] = onSinceUs[i] >= 0;
+  }
+  portEXIT_CRITICAL(&stateLock);
+
+  float milliAmps = ENERGY_MA_CPU_ACTIVE;
+  for (int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++) {
+    if (on[i]) {
+      milliAmps += currentMilliAmps((EnergySubsystem)i);
+    }
+  }
+  return milliAmps;
+}
+
+String EnergyMonitor::getReport() {
+  int64_t now = esp_timer_get_time();
+  float bootTotal = 0;
+  float allTotal = 0;
+  String lines = "";
+
+  for (int i = 0; i < ENERGY_SUBSYSTEM_COUNT; i++) {
+    EnergySubsystem subsystem = (EnergySubsystem)i;
+    float milliAmps = currentMilliAmps(subsystem);
+    uint64_t bootUs = totalOnUs(subsystem, now);
+    uint64_t allUs = bootUs + (committed ? 0 : rtcEnergyHistory.onUs[i]);
+    float bootMah = toMilliAmpHours(bootUs, milliAmps);
+    float allMah = toMilliAmpHours(allUs, milliAmps);
+    bootTotal += bootMah;
+    allTotal += allMah;
+    lines += String(subsystemName(subsystem)) + " (" + String(milliAmps, 1) + " mA): " +
+             String((uint32_t)(bootUs / 1000000)) + " s, " + String(bootMah, 3) + " mAh | all " +
+             String((uint32_t)(allUs / 1000000)) + " s, " + String(allMah, 3) + " mAh\n";
+  }
+
+  float sleepMah = toMilliAmpHours(rtcEnergyHistory.deepSleepUs, ENERGY_MA_DEEP_SLEEP);
+  allTotal += sleepMah;
+
+  String report = "=== Energy (estimated) ===\n";
+  report += "Since boot: " + String((uint32_t)(now / 1000000)) + " s, " + String(bootTotal, 3) + " mAh\n";
+  report += "All cycles: " + String(rtcEnergyHistory.boots) + " boots, " + String(rtcEnergyHistory.deepSleeps) +
+            " deep sleeps, " + String(allTotal, 3) + " mAh\n";
+  report += lines;
+  report += "Deep sleep (" + String(ENERGY_MA_DEEP_SLEEP, 2) + " mA): " +
+            String((uint32_t)(rtcEnergyHistory.deepSleepUs / 1000000)) + " s, " + String(sleepMah, 3) + " mAh";
+  return report;
+}
+
+#endif // ENERGY_MONITOR_H
@@ -0,0 +1,305 @@
+/*
+ * fw_compress.h - Compressed firmware images and their streaming decoder
+ *
+ * A compressed image is the ota.bin file cut into FW_COMPRESS_BLOCK_SIZE
+ * blocks (one flash sector each), every block LZSS-compressed on its own
+ * or stored as is when that is smaller. Matches only reach back inside
+ * their own block, so the decoder's window is the one block it is
+ * building and it holds no state between blocks: a download can stop
+ * and resume at any block boundary, just like a plain image or a
+ * fw_patch.h delta.
+ *
+ * The codec has no Arduino dependencies so tools/fw_compress.cpp can
+ * share it with the firmware. Only the decoder is built into the
+ * firmware; the encoder lives in the host tool.
+ *
+ * Why not lz_codec.h: that is one continuous stream. Its matches reach
+ * back across everything sent so far, and its decoder keeps a 1 KB
+ * window of its own between calls, so it cannot restart at a block
+ * boundary after a dropped download. Its 16-bit match token (10-bit
+ * distance, 6-bit length) also cannot address a whole flash sector.
+ * Firmware gains from the 4 KB window and from the long matches over
+ * 0xFF padding and repeated tables. Here the window is the sector
+ * buffer itself, so decoding needs no RAM beyond it. Only the
+ * flag-byte token grouping is shared with lz_codec.h.
+ *
+ * Image format (integers little-endian):
+ *   'F' 'Z' <version> <reserved>
+ *   uint32 image size
+ *   32 bytes: SHA-256 of the whole image file
+ *   one block per FW_COMPRESS_BLOCK_SIZE of image (the last may be short):
+ *     uint16 payload length, | FW_COMPRESS_STORED if the payload is raw
+ *     payload: raw bytes, or groups of one flag byte followed by up to
+ *       8 tokens (bit set = match)
+ *       literal token: 1 byte
+ *       match token:   2 bytes big-endian, (distance - 1) << 4 | length code
+ *                      length = code + 3; code 15 adds one byte:
+ *                      length = 18 + that byte
+ */
+
+#ifndef FW_COMPRESS_H
+#define FW_COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// ========================= FORMAT PARAMETERS =========================
+
+#define FW_COMPRESS_FORMAT_VERSION 1
+#define FW_COMPRESS_HEADER_SIZE 40
+#define FW_COMPRESS_HASH_SIZE 32
+#define FW_COMPRESS_BLOCK_SIZE 4096    // Also the match window; 12-bit distances
+#define FW_COMPRESS_STORED 0x8000      // Block length flag: payload is the raw block
+#define FW_COMPRESS_MIN_MATCH 3
+#define FW_COMPRESS_LENGTH_EXTENDED 15 // Length code followed by an extra length byte
+#define FW_COMPRESS_MAX_MATCH (FW_COMPRESS_MIN_MATCH + FW_COMPRESS_LENGTH_EXTENDED + 255)
+
+struct FwCompressHeader {
+  uint32_t imageSize;
+  uint8_t imageHash[FW_COMPRESS_HASH_SIZE];
+};
+
+// Callbacks return false to stop decoding
+struct FwCompressCallbacks {
+  bool (*acceptHeader)(const FwCompressHeader& header, void* context);  // Optional
+  bool (*writeBlock)(const uint8_t* data, size_t length, void* context);
+  void* context;
+};
+
+static inline void fwCompressEncodeHeader(const FwCompressHeader& header, uint8_t* out) {
+  out[0] = 'F';
+  out[1] = 'Z';
+  out[2] = FW_COMPRESS_FORMAT_VERSION;
+  out[3] = 0;
+  out[4] = header.imageSize;
+  out[5] = header.imageSize >> 8;
+  out[6] = header.imageSize >> 16;
+  out[7] = header.imageSize >> 24;
+  memcpy(out + 8, header.imageHash, FW_COMPRESS_HASH_SIZE);
+}
+
+static inline bool fwCompressDecodeHeader(const uint8_t* in, FwCompressHeader& header) {
+  if (in[0] != 'F' || in[1] != 'Z' || in[2] != FW_COMPRESS_FORMAT_VERSION) {
+    return false;
+  }
+  header.imageSize = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24);
+  memcpy(header.imageHash, in + 8, FW_COMPRESS_HASH_SIZE);
+  return true;
+}
+
+// ========================= DECODER =========================
+
+class FwCompressDecoder {
+private:
+  enum State {
+    STATE_HEADER, STATE_BLOCK_LENGTH, STATE_STORED, STATE_FLAGS, STATE_TOKEN, STATE_MATCH_LOW,
+    STATE_MATCH_EXTRA, STATE_DONE, STATE_ERROR
+  };
+
+  State state;
+  uint8_t headerBytes[FW_COMPRESS_HEADER_SIZE];
+  size_t headerLength;
+  FwCompressHeader header;
+
+  uint8_t block[FW_COMPRESS_BLOCK_SIZE];  // The block being built, also the match window
+  uint32_t blockFill;
+  uint32_t blockSize;             // Image bytes this block must produce
+  uint32_t payloadLeft;           // Payload bytes of this block not yet taken
+  uint8_t lengthBytes;
+  uint8_t flags;
+  uint8_t flagBit;
+  uint16_t token;
+
+  FwCompressCallbacks callbacks;
+  uint32_t consumed;              // Input bytes taken, counted before their block is written
+  uint32_t produced;
+  const char* error;
+
+  bool fail(const char* reason) {
+    error = reason;
+    state = STATE_ERROR;
+    return false;
+  }
+
+  void startBlock() {
+    uint32_t left = header.imageSize - produced;
+    blockSize = left < FW_COMPRESS_BLOCK_SIZE ? left : FW_COMPRESS_BLOCK_SIZE;
+    blockFill = 0;
+    lengthBytes = 0;
+    payloadLeft = 0;
+    state = blockSize > 0 ? STATE_BLOCK_LENGTH : STATE_DONE;
+  }
+
+  bool copyMatch(uint32_t distance, uint32_t length) {
+    if (distance > blockFill || length > blockSize - blockFill) {
+      return fail("match outside the block");
+    }
+    // Byte by byte: a match may overlap the bytes it produces
+    const uint8_t* from = block + blockFill - distance;
+    for (uint32_t i = 0; i < length; i++) {
+      block[blockFill + i] = from[i];
+    }
+    blockFill += length;
+    return true;
+  }
+
+  // After every payload byte: write the block out once its payload is used up
+  bool endOfPayload() {
+    if (payloadLeft > 0) {
+      return true;
+    }
+    if (blockFill != blockSize) {
+      return fail("block size does not match the image");
+    }
+    if (!callbacks.writeBlock(block, blockFill, callbacks.context)) {
+      return fail("output rejected");
+    }
+    produced += blockFill;
+    startBlock();
+    return true;
+  }
+
+public:
+  FwCompressDecoder() : state(STATE_HEADER), headerLength(0), blockFill(0), blockSize(0), payloadLeft(0),
+                        lengthBytes(0), flags(0), flagBit(0), token(0), consumed(0), produced(0),
+                        error(nullptr) {
+    memset(&header, 0, sizeof(header));
+    memset(&callbacks, 0, sizeof(callbacks));
+  }
+
+  // Start of a compressed image
+  void begin(const FwCompressCallbacks& compressCallbacks) {
+    callbacks = compressCallbacks;
+    state = STATE_HEADER;
+    headerLength = 0;
+    consumed = 0;
+    produced = 0;
+    error = nullptr;
+  }
+
+  // Continue at a block boundary of the image; the header was seen before
+  void resume(const FwCompressCallbacks& compressCallbacks, const FwCompressHeader& knownHeader,
+              uint32_t imageOffset) {
+    begin(compressCallbacks);
+    header = knownHeader;
+    produced = imageOffset;
+    if ((imageOffset % FW_COMPRESS_BLOCK_SIZE != 0 && imageOffset != header.imageSize) ||
+        imageOffset > header.imageSize) {
+      fail("resume off a block boundary");
+      return;
+    }
+    startBlock();
+  }
+
+  // Feed compressed bytes; returns false on a malformed image or a callback error
+  bool write(const uint8_t* data, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+      if (state == STATE_STORED) {
+        // Raw blocks go into the block buffer in one piece
+        size_t run = length - i < payloadLeft ? length - i : payloadLeft;
+        memcpy(block + blockFill, data + i, run);
+        blockFill += run;
+        payloadLeft -= run;
+        consumed += run;
+        i += run;
+        if (!endOfPayload()) return false;
+        continue;
+      }
+
+      uint8_t value = data[i++];
+      consumed++;
+
+      switch (state) {
+        case STATE_HEADER:
+          headerBytes[headerLength++] = value;
+          if (headerLength == FW_COMPRESS_HEADER_SIZE) {
+            if (!fwCompressDecodeHeader(headerBytes, header)) {
+              return fail("not a compressed image");
+            }
+            if (callbacks.acceptHeader && !callbacks.acceptHeader(header, callbacks.context)) {
+              return fail("image rejected");
+            }
+            startBlock();
+          }
+          break;
+
+        case STATE_BLOCK_LENGTH:
+          payloadLeft |= (uint32_t)value << (8 * lengthBytes);
+          if (++lengthBytes < 2) break;
+          if (payloadLeft & FW_COMPRESS_STORED) {
+            payloadLeft &= ~FW_COMPRESS_STORED;
+            if (payloadLeft != blockSize) return fail("stored block of the wrong size");
+            state = STATE_STORED;
+          } else {
+            if (payloadLeft == 0) return fail("empty block");
+            state = STATE_FLAGS;
+          }
+          break;
+
+        case STATE_FLAGS:
+          flags = value;
+          flagBit = 0;
+          payloadLeft--;
+          state = STATE_TOKEN;
+          break;
+
+        case STATE_TOKEN:
+          payloadLeft--;
+          if (flags & (1 << flagBit)) {
+            token = (uint16_t)value << 8;
+            state = STATE_MATCH_LOW;
+            break;
+          }
+          if (blockFill == blockSize) return fail("literal past the block end");
+          block[blockFill++] = value;
+          if (++flagBit == 8) state = STATE_FLAGS;
+          break;
+
+        case STATE_MATCH_LOW:
+          payloadLeft--;
+          token |= value;
+          if ((token & 0x0F) == FW_COMPRESS_LENGTH_EXTENDED) {
+            state = STATE_MATCH_EXTRA;
+            break;
+          }
+          if (!copyMatch((token >> 4) + 1, (token & 0x0F) + FW_COMPRESS_MIN_MATCH)) return false;
+          state = ++flagBit == 8 ? STATE_FLAGS : STATE_TOKEN;
+          break;
+
+        case STATE_MATCH_EXTRA:
+          payloadLeft--;
+          if (!copyMatch((token >> 4) + 1, FW_COMPRESS_MIN_MATCH + FW_COMPRESS_LENGTH_EXTENDED + value)) {
+            return false;
+          }
+          state = ++flagBit == 8 ? STATE_FLAGS : STATE_TOKEN;
+          break;
+
+        case STATE_STORED:
+          break;
+
+        case STATE_DONE:
+          return fail("data after the end of the image");
+
+        case STATE_ERROR:
+          return false;
+      }
+
+      if (state == STATE_ERROR) return false;
+      if (state != STATE_HEADER && state != STATE_BLOCK_LENGTH && state != STATE_DONE && !endOfPayload()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool hasHeader() const { return state != STATE_HEADER; }
+  bool isDone() const { return state == STATE_DONE; }
+  const FwCompressHeader& getHeader() const { return header; }
+  uint32_t getConsumed() const { return consumed; }
+  uint32_t getProduced() const { return produced; }
+  const char* getError() const { return error ? error : ""; }
+};
+
+#endif // FW_COMPRESS_H
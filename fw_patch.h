@@ -0,0 +1,298 @@
+/*
+ * fw_patch.h - Firmware delta patches and their streaming decoder
+ *
+ * A patch rebuilds the new firmware image from the running one with
+ * two operations: copy a run of bytes from the old image, or insert
+ * literal bytes carried in the patch. The decoder is fed the patch as it
+ * arrives and reads old bytes through a callback, so the device applies
+ * it straight from the running partition into the inactive one with a
+ * few hundred bytes of RAM.
+ *
+ * Operations never cross a FW_PATCH_BLOCK_SIZE boundary of the new image
+ * and copy sources are relative to the current position in the new
+ * image, not to the previous copy. At every block boundary the decoder
+ * has no state beyond the header, so a download can stop and resume
+ * there. Code that only moved by a few bytes still costs one or two
+ * bytes per copy offset.
+ *
+ * The codec has no Arduino dependencies so tools/fw_patch.cpp can share
+ * it with the firmware.
+ *
+ * Patch format (integers little-endian):
+ *   'F' 'P' <version> <reserved>
+ *   uint32 old image size, uint32 new image size
+ *   32 bytes: app hash of the old image (its appended SHA-256, the value
+ *             esp_partition_get_sha256() reports for the running slot)
+ *   32 bytes: SHA-256 of the whole new image file
+ *   operations until the new image is complete:
+ *     varint (length << 1) | 0, then length literal bytes     (insert)
+ *     varint (length << 1) | 1, then zigzag varint of
+ *       (old image offset - new image offset)                 (copy)
+ */
+
+#ifndef FW_PATCH_H
+#define FW_PATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// ========================= FORMAT PARAMETERS =========================
+
+#define FW_PATCH_FORMAT_VERSION 1
+#define FW_PATCH_HEADER_SIZE 76
+#define FW_PATCH_HASH_SIZE 32
+#define FW_PATCH_BLOCK_SIZE 4096       // Operations never cross a multiple of this (one flash sector)
+#define FW_PATCH_COPY_CHUNK 256        // Old-image read size while copying
+#define FW_PATCH_OP_INSERT 0
+#define FW_PATCH_OP_COPY 1
+
+struct FwPatchHeader {
+  uint32_t oldSize;
+  uint32_t newSize;
+  uint8_t oldHash[FW_PATCH_HASH_SIZE];
+  uint8_t newHash[FW_PATCH_HASH_SIZE];
+};
+
+// Callbacks return false to stop decoding
+struct FwPatchCallbacks {
+  bool (*acceptHeader)(const FwPatchHeader& header, void* context);      // Optional
+  bool (*readOld)(uint32_t offset, uint8_t* data, size_t length, void* context);
+  bool (*writeNew)(const uint8_t* data, size_t length, void* context);
+  void* context;
+};
+
+static inline void fwPatchPutLE32(uint8_t* p, uint32_t value) {
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+}
+
+static inline uint32_t fwPatchGetLE32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void fwPatchEncodeHeader(const FwPatchHeader& header, uint8_t* out) {
+  out[0] = 'F';
+  out[1] = 'P';
+  out[2] = FW_PATCH_FORMAT_VERSION;
+  out[3] = 0;
+  fwPatchPutLE32(out + 4, header.oldSize);
+  fwPatchPutLE32(out + 8, header.newSize);
+  memcpy(out + 12, header.oldHash, FW_PATCH_HASH_SIZE);
+  memcpy(out + 12 + FW_PATCH_HASH_SIZE, header.newHash, FW_PATCH_HASH_SIZE);
+}
+
+static inline bool fwPatchDecodeHeader(const uint8_t* in, FwPatchHeader& header) {
+  if (in[0] != 'F' || in[1] != 'P' || in[2] != FW_PATCH_FORMAT_VERSION) {
+    return false;
+  }
+  header.oldSize = fwPatchGetLE32(in + 4);
+  header.newSize = fwPatchGetLE32(in + 8);
+  memcpy(header.oldHash, in + 12, FW_PATCH_HASH_SIZE);
+  memcpy(header.newHash, in + 12 + FW_PATCH_HASH_SIZE, FW_PATCH_HASH_SIZE);
+  return true;
+}
+
+// Signed offsets as varints: 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+static inline uint32_t fwPatchZigzag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t fwPatchUnzigzag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// Appends a varint to out; returns its length (at most 5)
+static inline size_t fwPatchPutVarint(uint8_t* out, uint32_t value) {
+  size_t length = 0;
+  while (value >= 0x80) {
+    out[length++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  out[length++] = value;
+  return length;
+}
+
+// ========================= DECODER =========================
+
+class FwPatchDecoder {
+private:
+  enum State { STATE_HEADER, STATE_OP, STATE_COPY_OFFSET, STATE_INSERT, STATE_DONE, STATE_ERROR };
+
+  State state;
+  uint8_t headerBytes[FW_PATCH_HEADER_SIZE];
+  size_t headerLength;
+  FwPatchHeader header;
+
+  uint32_t varint;
+  uint8_t varintShift;
+  uint32_t opLength;              // Bytes the current operation still produces
+
+  uint8_t copyBuffer[FW_PATCH_COPY_CHUNK];
+  FwPatchCallbacks callbacks;
+  uint32_t consumed;              // Patch bytes taken, counted before their output is written
+  uint32_t produced;
+  const char* error;
+
+  bool fail(const char* reason) {
+    error = reason;
+    state = STATE_ERROR;
+    return false;
+  }
+
+  // True once a varint is complete in 'varint'
+  bool takeVarint(uint8_t value) {
+    if (varintShift > 28) {
+      return fail("varint too long");
+    }
+    varint |= (uint32_t)(value & 0x7F) << varintShift;
+    varintShift += 7;
+    return !(value & 0x80);
+  }
+
+  void resetVarint() {
+    varint = 0;
+    varintShift = 0;
+  }
+
+  bool checkLength(uint32_t length) {
+    uint32_t blockLeft = FW_PATCH_BLOCK_SIZE - produced % FW_PATCH_BLOCK_SIZE;
+    if (length == 0 || length > blockLeft || length > header.newSize - produced) {
+      return fail("operation crosses a block or the image end");
+    }
+    return true;
+  }
+
+  bool copyOld(int64_t offset, uint32_t length) {
+    if (offset < 0 || offset > header.oldSize || length > header.oldSize - offset) {
+      return fail("copy outside the old image");
+    }
+    while (length > 0) {
+      size_t n = length < sizeof(copyBuffer) ? length : sizeof(copyBuffer);
+      if (!callbacks.readOld(offset, copyBuffer, n, callbacks.context)) {
+        return fail("old image read failed");
+      }
+      if (!callbacks.writeNew(copyBuffer, n, callbacks.context)) {
+        return fail("output rejected");
+      }
+      produced += n;
+      offset += n;
+      length -= n;
+    }
+    return true;
+  }
+
+  void finishOp() {
+    state = produced == header.newSize ? STATE_DONE : STATE_OP;
+    resetVarint();
+  }
+
+public:
+  FwPatchDecoder() : state(STATE_HEADER), headerLength(0), varint(0), varintShift(0), opLength(0),
+                     consumed(0), produced(0), error(nullptr) {
+    memset(&header, 0, sizeof(header));
+    memset(&callbacks, 0, sizeof(callbacks));
+  }
+
+  // Start of a patch
+  void begin(const FwPatchCallbacks& patchCallbacks) {
+    callbacks = patchCallbacks;
+    state = STATE_HEADER;
+    headerLength = 0;
+    consumed = 0;
+    produced = 0;
+    error = nullptr;
+    resetVarint();
+  }
+
+  // Continue at a block boundary of the new image; the header was seen before
+  void resume(const FwPatchCallbacks& patchCallbacks, const FwPatchHeader& knownHeader, uint32_t newOffset) {
+    begin(patchCallbacks);
+    header = knownHeader;
+    produced = newOffset;
+    if (newOffset % FW_PATCH_BLOCK_SIZE != 0 && newOffset != header.newSize) {
+      fail("resume off a block boundary");
+      return;
+    }
+    finishOp();
+  }
+
+  // Feed patch bytes; returns false on a malformed patch or a callback error
+  bool write(const uint8_t* data, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+      if (state == STATE_INSERT) {
+        // Literal runs go to the output straight from the input
+        size_t run = length - i < opLength ? length - i : opLength;
+        consumed += run;
+        if (!callbacks.writeNew(data + i, run, callbacks.context)) {
+          return fail("output rejected");
+        }
+        produced += run;
+        opLength -= run;
+        i += run;
+        if (opLength == 0) finishOp();
+        continue;
+      }
+
+      uint8_t value = data[i++];
+      consumed++;
+
+      switch (state) {
+        case STATE_HEADER:
+          headerBytes[headerLength++] = value;
+          if (headerLength == FW_PATCH_HEADER_SIZE) {
+            if (!fwPatchDecodeHeader(headerBytes, header)) {
+              return fail("not a firmware patch");
+            }
+            if (callbacks.acceptHeader && !callbacks.acceptHeader(header, callbacks.context)) {
+              return fail("patch rejected");
+            }
+            finishOp();
+          }
+          break;
+
+        case STATE_OP:
+          if (!takeVarint(value)) break;
+          opLength = varint >> 1;
+          if (!checkLength(opLength)) return false;
+          if ((varint & 1) == FW_PATCH_OP_COPY) {
+            resetVarint();
+            state = STATE_COPY_OFFSET;
+          } else {
+            state = STATE_INSERT;
+          }
+          break;
+
+        case STATE_COPY_OFFSET:
+          if (!takeVarint(value)) break;
+          if (!copyOld((int64_t)produced + fwPatchUnzigzag(varint), opLength)) return false;
+          finishOp();
+          break;
+
+        case STATE_INSERT:
+          break;
+
+        case STATE_DONE:
+          return fail("data after the end of the image");
+
+        case STATE_ERROR:
+          return false;
+      }
+
+      if (state == STATE_ERROR) return false;
+    }
+    return true;
+  }
+
+  bool hasHeader() const { return state != STATE_HEADER; }
+  bool isDone() const { return state == STATE_DONE; }
+  const FwPatchHeader& getHeader() const { return header; }
+  uint32_t getConsumed() const { return consumed; }
+  uint32_t getProduced() const { return produced; }
+  const char* getError() const { return error ? error : ""; }
+};
+
+#endif // FW_PATCH_H
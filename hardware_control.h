@@ -10,11 +10,19 @@
 
 #include <Arduino.h>
 #include "config.h"
+#include "energy_monitor.h"
+#include "buzzer.h"
 
 class HardwareControl {
 private:
   bool ledState;
   unsigned long lastBeepTime;
+  Buzzer buzzer;
+  EnergyMonitor* energy;
+  
+  void reportEnergy(EnergySubsystem subsystem, bool on) {
+    if (energy) energy->setState(subsystem, on);
+  }
   
   void configurePWM();
   void configureGPIO();
@@ -25,29 +33,33 @@ public:
   // Initialization
   void init();
   void startupSequence();
+  void setEnergyMonitor(EnergyMonitor* monitor) { energy = monitor; buzzer.setEnergyMonitor(monitor); }
   
   // LED controls
   void ledOn();
   void ledOff();
   void ledToggle();
-  void ledBlink(int count, int delayMs = 100);
   
-  // Buzzer controls
+  // Buzzer controls (queued, played in the background)
   void beep();
   void doubleBeep();
   void multiBeep(int count);
   void longBeep(int durationMs = 500);
+  bool waitForBuzzer(unsigned long timeoutMs) { return buzzer.waitIdle(timeoutMs); }
   
   // External power and switch
   void enableExternalPower();
   void disableExternalPower();
   bool isExternalSwitchPressed();
-  bool isExternalSwitchHeld(unsigned long durationMs);
   
   // IRDA control
   void enableIRDA();
   void disableIRDA();
   
+  // 38 kHz carrier on PIN_LED_PWM
+  void enablePWM();
+  void disablePWM();
+  
   // Utility functions
   void delayWithYield(unsigned long ms);
   void resetWatchdog();
@@ -58,7 +70,7 @@ public:
 };
 
 // Implementation
-HardwareControl::HardwareControl() : ledState(false), lastBeepTime(0) {
+HardwareControl::HardwareControl() : ledState(false), lastBeepTime(0), energy(nullptr) {
 }
 
 void HardwareControl::init() {
@@ -66,10 +78,12 @@ void HardwareControl::init() {
   
   configureGPIO();
   configurePWM();
+  if (buzzer.init()) {
+    Serial.println("Buzzer configured on LEDC channel " + String(BUZZER_LEDC_CHANNEL));
+  }
   
-  // Set initial states
-  enableExternalPower();
-  enableIRDA();
+  // External power, IRDA and the carrier stay off until a meter session
+  // needs them (see PeripheralPower)
   
   Serial.println("Hardware control initialized successfully");
 }
@@ -89,8 +103,8 @@ void HardwareControl::configureGPIO() {
   digitalWrite(PIN_LED, LOW);
   digitalWrite(PIN_BUZZER, LOW);
   digitalWrite(PIN_BUZZER1, LOW);
-  digitalWrite(PIN_IRDA_EN, HIGH);
-  digitalWrite(PIN_EXT_PW, HIGH);
+  digitalWrite(PIN_IRDA_EN, PIN_IRDA_EN_OFF);
+  digitalWrite(PIN_EXT_PW, LOW);
   
   Serial.println("GPIO pins configured");
 }
@@ -105,7 +119,7 @@ void HardwareControl::configurePWM() {
   if (!ledcAttach(PIN_LED_PWM, PWM_FREQ, PWM_RESOLUTION)) {
     Serial.println("ERROR: Failed to attach LEDC to pin");
   } else {
-    ledcWrite(PIN_LED_PWM, PWM_DUTY_CYCLE);
+    ledcWrite(PIN_LED_PWM, 0);
     Serial.println("PWM configured for IRDA modulation");
   }
 }
@@ -113,10 +127,8 @@ void HardwareControl::configurePWM() {
 void HardwareControl::startupSequence() {
   Serial.println("Performing startup sequence...");
   
-  // LED and buzzer startup indication
-  ledOn();
+  // Buzzer startup indication (the LED is up to StatusLed)
   doubleBeep();
-  ledOff();
   
   delayWithYield(100);
   
@@ -142,100 +154,62 @@ void HardwareControl::ledToggle() {
   }
 }
 
-void HardwareControl::ledBlink(int count, int delayMs) {
-  for (int i = 0; i < count; i++) {
-    ledOn();
-    delayWithYield(delayMs);
-    ledOff();
-    if (i < count - 1) {
-      delayWithYield(delayMs);
-    }
-  }
-}
-
 // Buzzer controls
 void HardwareControl::beep() {
-  unsigned long currentTime = millis();
-  
-  // Prevent rapid consecutive beeping
-  if (currentTime - lastBeepTime < 50) {
-    return;
-  }
-  
-  // Generate 38kHz modulated beep
-  for (int i = 0; i < 500; i++) {
-    digitalWrite(PIN_BUZZER, HIGH);
-    delayMicroseconds(175);
-    digitalWrite(PIN_BUZZER, LOW);
-    delayMicroseconds(175);
-  }
-  
-  lastBeepTime = currentTime;
+  buzzer.playBeeps(1, BUZZER_BEEP_MS, 0);
+  lastBeepTime = millis();
 }
 
 void HardwareControl::doubleBeep() {
-  beep();
-  delayWithYield(100);
-  beep();
+  buzzer.playBeeps(2, BUZZER_BEEP_MS, 100);
+  lastBeepTime = millis();
 }
 
 void HardwareControl::multiBeep(int count) {
-  for (int i = 0; i < count; i++) {
-    beep();
-    if (i < count - 1) {
-      delayWithYield(300);
-    }
-  }
+  buzzer.playBeeps(count, BUZZER_BEEP_MS, 300);
+  lastBeepTime = millis();
 }
 
 void HardwareControl::longBeep(int durationMs) {
-  unsigned long startTime = millis();
-  
-  while (millis() - startTime < durationMs) {
-    digitalWrite(PIN_BUZZER, HIGH);
-    delayMicroseconds(175);
-    digitalWrite(PIN_BUZZER, LOW);
-    delayMicroseconds(175);
-  }
+  buzzer.playBeeps(1, durationMs, 0);
+  lastBeepTime = millis();
 }
 
 // External power and switch
 void HardwareControl::enableExternalPower() {
   digitalWrite(PIN_EXT_PW, HIGH);
+  reportEnergy(ENERGY_EXT_POWER, true);
 }
 
 void HardwareControl::disableExternalPower() {
   digitalWrite(PIN_EXT_PW, LOW);
+  reportEnergy(ENERGY_EXT_POWER, false);
 }
 
 bool HardwareControl::isExternalSwitchPressed() {
   return digitalRead(PIN_EXT_SW) == LOW;
 }
 
-bool HardwareControl::isExternalSwitchHeld(unsigned long durationMs) {
-  if (!isExternalSwitchPressed()) {
-    return false;
-  }
-  
-  unsigned long startTime = millis();
-  
-  while (millis() - startTime < durationMs) {
-    if (!isExternalSwitchPressed()) {
-      return false;
-    }
-    delayWithYield(10);
-  }
-  
-  return true;
-}
-
-// IRDA control
+// IRDA control (only PeripheralPower switches the transceiver)
 void HardwareControl::enableIRDA() {
-  digitalWrite(PIN_IRDA_EN, HIGH);
+  digitalWrite(PIN_IRDA_EN, PIN_IRDA_EN_ON);
+  reportEnergy(ENERGY_IRDA, true);
 }
 
 void HardwareControl::disableIRDA() {
-  digitalWrite(PIN_IRDA_EN, LOW);
+  digitalWrite(PIN_IRDA_EN, PIN_IRDA_EN_OFF);
+  reportEnergy(ENERGY_IRDA, false);
+}
+
+// PWM control
+void HardwareControl::enablePWM() {
+  ledcWrite(PIN_LED_PWM, PWM_DUTY_CYCLE);
+  reportEnergy(ENERGY_PWM, true);
+}
+
+void HardwareControl::disablePWM() {
+  ledcWrite(PIN_LED_PWM, 0);
+  reportEnergy(ENERGY_PWM, false);
 }
 
 // Utility functions
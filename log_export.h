@@ -0,0 +1,253 @@
+/*
+ * log_export.h - Bulk export of the reading log
+ *
+ * This file contains the LogExporter class that streams the reading
+ * log to the client in sector-sized chunks, written to Bluetooth
+ * straight from the memory-mapped partition. Up to a window of chunks
+ * is kept in flight; the client acknowledges cumulatively with
+ * "#ACK=<n>*" and the device goes back to the oldest unacknowledged
+ * chunk when acknowledgements stop arriving (go-back-N). With the 'Z'
+ * prefix each chunk is LZ-compressed on its own inside its frame, so a
+ * resent chunk decodes without the ones before it.
+ *
+ * Frame layout is described in log_format.h; tools/log_receiver.cpp
+ * is the matching host side.
+ */
+
+#ifndef LOG_EXPORT_H
+#define LOG_EXPORT_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "communication.h"
+#include "reading_log.h"
+#include "lz_codec.h"
+
+class LogExporter {
+private:
+  CommunicationManager* comm;
+  ReadingLog* log;
+  String ackBuffer;
+  bool abortRequested;
+  String lastReport;
+
+  // Chunk compression, allocated only for the duration of a 'Z' export
+  LZCompressor* compressor;
+  uint8_t* packed;
+  size_t packedLength;
+  bool packedOverflow;
+  uint32_t entryBytes;
+  uint32_t packedBytes;
+
+  static void onPackedOutput(const uint8_t* data, size_t length, void* context);
+  bool beginCompression();
+  void endCompression();
+  size_t sendChunk(const LogExportPlan& plan, uint32_t index);
+  uint32_t collectAcks(uint32_t acked, uint32_t limit);
+  void logExportEvent(const String& event);
+
+public:
+  LogExporter();
+
+  void setCommunicationManager(CommunicationManager* commMgr) { comm = commMgr; }
+  void setReadingLog(ReadingLog* readingLog) { log = readingLog; }
+
+  // Blocks until the client has acknowledged every chunk or gives up
+  bool exportFrom(uint32_t fromSequence, uint16_t window = LOG_EXPORT_WINDOW, bool compressChunks = false);
+  String getLastReport() const { return lastReport; }
+};
+
+// Implementation
+LogExporter::LogExporter()
+  : comm(nullptr), log(nullptr), abortRequested(false), compressor(nullptr), packed(nullptr),
+    packedLength(0), packedOverflow(false), entryBytes(0), packedBytes(0) {
+}
+
+bool LogExporter::exportFrom(uint32_t fromSequence, uint16_t window, bool compressChunks) {
+  if (!comm || !log) {
+    return false;
+  }
+
+  LogExportPlan plan;
+  if (!log->planExport(fromSequence, plan)) {
+    comm->println("Nothing to export from #" + String(fromSequence));
+    return false;
+  }
+
+  if (compressChunks && !beginCompression()) {
+    logExportEvent("Not enough memory to compress, sending plain chunks");
+  }
+
+  if (window < 1) window = 1;
+  if (window > LOG_EXPORT_MAX_WINDOW) window = LOG_EXPORT_MAX_WINDOW;
+
+  ackBuffer = "";
+  abortRequested = false;
+  comm->readPendingInput();  // Drop anything sent before the export started
+
+  unsigned long startTime = millis();
+  uint32_t bytesSent = 0;
+  uint32_t chunksSent = 0;
+
+  LogExportStart start;
+  start.fromSequence = plan.fromSequence;
+  start.toSequence = plan.toSequence;
+  start.chunkCount = plan.chunkCount;
+  start.window = window;
+  start.formatVersion = LOG_FORMAT_VERSION;
+  bytesSent += comm->sendFrame(LOG_FRAME_EXPORT_START, reinterpret_cast<const uint8_t*>(&start), sizeof(start), nullptr, 0);
+
+  uint32_t acked = 0;
+  uint32_t next = 0;
+  uint32_t retries = 0;
+  unsigned long lastProgress = millis();
+
+  while (acked < plan.chunkCount && !abortRequested) {
+    // Fill the window
+    while (next < plan.chunkCount && next < acked + window) {
+      bytesSent += sendChunk(plan, next);
+      next++;
+      chunksSent++;
+    }
+
+    uint32_t newAcked = collectAcks(acked, next);
+    if (newAcked > acked) {
+      acked = newAcked;
+      lastProgress = millis();
+      retries = 0;
+      continue;
+    }
+
+    if (millis() - lastProgress > LOG_EXPORT_ACK_TIMEOUT_MS) {
+      if (++retries > LOG_EXPORT_MAX_RETRIES) {
+        logExportEvent("No acknowledgement, giving up at chunk " + String(acked));
+        break;
+      }
+      logExportEvent("ACK timeout, resending from chunk " + String(acked));
+      next = acked;
+      lastProgress = millis();
+    }
+
+    delay(1);
+  }
+
+  unsigned long elapsed = millis() - startTime;
+  bool complete = acked >= plan.chunkCount;
+
+  LogExportEnd end;
+  end.chunksSent = chunksSent;
+  end.bytesSent = bytesSent;
+  end.elapsedMs = elapsed;
+  end.complete = complete ? 1 : 0;
+  memset(end.reserved, 0, sizeof(end.reserved));
+  comm->sendFrame(LOG_FRAME_EXPORT_END, reinterpret_cast<const uint8_t*>(&end), sizeof(end), nullptr, 0);
+
+  String compression = compressor ? ", entries " + String(entryBytes) + " -> " + String(packedBytes) + " bytes" : "";
+  endCompression();
+
+  uint32_t kbPerSecond = elapsed > 0 ? (uint32_t)((uint64_t)bytesSent * 1000 / elapsed / 1024) : 0;
+  lastReport = String(complete ? "Export complete: " : "Export incomplete: ") +
+               String(plan.toSequence - plan.fromSequence + 1) + " records (#" + String(plan.fromSequence) +
+               " - #" + String(plan.toSequence) + "), " + String(chunksSent) + " chunks (" +
+               String(chunksSent - (complete ? plan.chunkCount : acked)) + " resent), " + String(bytesSent) +
+               " bytes in " + String(elapsed) + " ms, " + String(kbPerSecond) + " KB/s" + compression;
+  comm->println(lastReport);
+  return complete;
+}
+
+size_t LogExporter::sendChunk(const LogExportPlan& plan, uint32_t index) {
+  const uint8_t* data = nullptr;
+  size_t length = 0;
+  if (!log->getExportChunk(plan, index, data, length)) {
+    return 0;
+  }
+
+  uint32_t chunkIndex = index;
+  if (compressor) {
+    packedLength = 0;
+    packedOverflow = false;
+    compressor->begin(onPackedOutput, this, LZ_DICTIONARY_NONE);
+    compressor->write(data, length);
+    compressor->finish();
+
+    entryBytes += length;
+    if (!packedOverflow && packedLength < length) {
+      packedBytes += packedLength;
+      return comm->sendFrame(LOG_FRAME_EXPORT_CHUNK_LZ, reinterpret_cast<const uint8_t*>(&chunkIndex),
+                             sizeof(chunkIndex), packed, packedLength);
+    }
+    packedBytes += length;  // Incompressible sector, sent as is
+  }
+
+  // Entries go out directly from the mapped flash
+  return comm->sendFrame(LOG_FRAME_EXPORT_CHUNK, reinterpret_cast<const uint8_t*>(&chunkIndex), sizeof(chunkIndex),
+                         data, length);
+}
+
+void LogExporter::onPackedOutput(const uint8_t* data, size_t length, void* context) {
+  LogExporter* self = static_cast<LogExporter*>(context);
+  if (self->packedOverflow || self->packedLength + length > LOG_DATA_SIZE) {
+    self->packedOverflow = true;
+    return;
+  }
+  memcpy(self->packed + self->packedLength, data, length);
+  self->packedLength += length;
+}
+
+bool LogExporter::beginCompression() {
+  // ~7KB together, so only held while a compressed export runs
+  compressor = new (std::nothrow) LZCompressor();
+  packed = new (std::nothrow) uint8_t[LOG_DATA_SIZE];
+  entryBytes = 0;
+  packedBytes = 0;
+  if (!compressor || !packed) {
+    endCompression();
+    return false;
+  }
+  return true;
+}
+
+void LogExporter::endCompression() {
+  delete compressor;
+  delete[] packed;
+  compressor = nullptr;
+  packed = nullptr;
+}
+
+uint32_t LogExporter::collectAcks(uint32_t acked, uint32_t limit) {
+  ackBuffer += comm->readPendingInput();
+
+  if (ackBuffer.indexOf("#ABORT*") != -1) {
+    abortRequested = true;
+    logExportEvent("Aborted by client");
+  }
+
+  // Cumulative acknowledgements; keep a trailing partial one for the next call
+  int pos = ackBuffer.indexOf("#ACK=");
+  int consumed = 0;
+  while (pos != -1) {
+    int end = ackBuffer.indexOf('*', pos);
+    if (end == -1) {
+      consumed = pos;
+      break;
+    }
+    uint32_t value = strtoul(ackBuffer.c_str() + pos + 5, nullptr, 10);
+    if (value > acked) {
+      acked = value > limit ? limit : value;
+    }
+    consumed = end + 1;
+    pos = ackBuffer.indexOf("#ACK=", consumed);
+  }
+
+  if (pos == -1 && consumed < (int)ackBuffer.length() - 4) {
+    consumed = ackBuffer.length() - 4;  // Only the start of a split "#ACK=" can matter
+  }
+  ackBuffer = ackBuffer.substring(consumed);
+  return acked;
+}
+
+void LogExporter::logExportEvent(const String& event) {
+  Serial.println("[Export] " + event);
+}
+
+#endif // LOG_EXPORT_H
@@ -0,0 +1,407 @@
+/*
+ * log_format.h - On-flash and export format of the reading log
+ *
+ * This file describes the sector layout used by reading_log.h, the
+ * entry codec and the framing of bulk exports. It has no Arduino
+ * dependencies so the host tools in tools/ can share it with the
+ * firmware. All multi-byte fields are little endian.
+ *
+ * Sector: 4032 bytes of entries packed front to back, then a 64-byte
+ * index slot. Erased flash (0xFF) marks the end of the entries.
+ *
+ * Entries:
+ *   keyframe  A1 <len> <full reading, 57 bytes> <crc16>
+ *   delta     A2 <len> <keyframe index> <varint sequence delta>
+ *             <zigzag varint timestamp delta> <frame hash u32>
+ *             <field bitmap u16> <zigzag varint per changed field> <crc16>
+ *
+ * A delta refers to a keyframe of the same meter earlier in the same
+ * sector (keyframes are numbered in order of appearance), so every
+ * sector decodes on its own. The first reading of a meter in a sector
+ * and every LOG_KEYFRAME_INTERVAL-th one after it are keyframes. The
+ * CRC is the low 16 bits of the CRC-32 of the entry up to the CRC.
+ *
+ * Export stream (every frame uses the raw-frame envelope):
+ *   A5 5A <type> <len lo> <len hi> <payload> <crc32 LE>
+ *
+ *   LOG_FRAME_EXPORT_START     LogExportStart
+ *   LOG_FRAME_EXPORT_CHUNK     uint32 chunk index, then the sector's entries
+ *   LOG_FRAME_EXPORT_CHUNK_LZ  uint32 chunk index, then the sector's entries
+ *                              as one lz_codec.h stream (no dictionary)
+ *   LOG_FRAME_EXPORT_END       LogExportEnd
+ *
+ * The client acknowledges with "#ACK=<n>*", meaning every chunk below
+ * n has arrived intact. The device keeps up to a window of chunks in
+ * flight and resends from the oldest unacknowledged one on timeout.
+ */
+
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// ========================= SECTOR LAYOUT =========================
+
+#define LOG_FORMAT_VERSION 3
+#define LOG_SECTOR_SIZE 4096
+#define LOG_INDEX_SIZE 64
+#define LOG_DATA_SIZE (LOG_SECTOR_SIZE - LOG_INDEX_SIZE)
+#define LOG_INDEX_MAGIC 0x5849           // "IX"
+#define LOG_BLOOM_BYTES 60
+#define LOG_BLOOM_BITS (LOG_BLOOM_BYTES * 8)
+#define LOG_BLOOM_HASHES 3
+#define LOG_CLOCK_VALID_AFTER 1600000000UL  // Earlier timestamps are uptime seconds
+
+// Entry markers
+#define LOG_ENTRY_ERASED 0xFF
+#define LOG_ENTRY_KEYFRAME 0xA1
+#define LOG_ENTRY_DELTA 0xA2
+
+#define LOG_KEYFRAME_SIZE 61
+#define LOG_ENTRY_MAX_SIZE 96          // Worst-case delta (every field changed)
+#define LOG_KEYFRAME_INTERVAL 16         // Deltas per keyframe before a fresh one
+#define LOG_MAX_SECTOR_KEYFRAMES 32      // Keyframes a delta can refer to per sector
+
+// Record flags
+#define LOG_FLAG_PARSED 0x01             // Reading fields below are valid
+#define LOG_FLAG_CLOCK_SET 0x02          // Timestamp is epoch time, not uptime
+
+// One decoded reading
+struct LogRecord {
+  uint32_t sequence;
+  uint32_t timestamp;
+  uint32_t frameHash;         // CRC-32 of the captured payload
+  char meterId[12];           // Serial number or manufacturer ID, not terminated when full
+  uint8_t meterType;          // MeterType, same value as the raw frame type byte
+  uint8_t flags;
+  uint32_t kwh;               // x100
+  uint32_t kvah;              // x100
+  uint32_t kvarhLag;          // x100
+  uint32_t kvarhLead;         // x100
+  uint16_t maxDemand;         // x100
+  uint16_t voltage[3];        // R/Y/B x10
+  uint16_t current[3];        // R/Y/B x100
+  uint8_t powerFactor;        // x100
+};
+
+// Per-sector index in the last 64 bytes; bloom bits are cleared for members
+struct __attribute__((packed)) LogSectorIndex {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t reserved;
+  uint8_t bloom[LOG_BLOOM_BYTES];
+};
+
+static_assert(sizeof(LogSectorIndex) == LOG_INDEX_SIZE, "LogSectorIndex must fill the index slot");
+
+// ========================= ENTRY CODEC =========================
+
+// Standard CRC-32 (as zlib.crc32), chainable
+static inline uint32_t logCrc32(uint32_t crc, const uint8_t* data, size_t length) {
+  crc = ~crc;
+  while (length--) {
+    crc ^= *data++;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static inline uint32_t logZigzag(int32_t value) { return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); }
+static inline int32_t logUnzigzag(uint32_t value) { return (int32_t)(value >> 1) ^ -(int32_t)(value & 1); }
+
+static inline uint8_t* logPutVarint(uint8_t* out, uint32_t value) {
+  while (value >= 0x80) {
+    *out++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+  return out;
+}
+
+static inline const uint8_t* logGetVarint(const uint8_t* in, const uint8_t* end, uint32_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 35 && in < end; shift += 7) {
+    uint8_t byte = *in++;
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return in;
+  }
+  return nullptr;
+}
+
+static inline uint8_t* logPut(uint8_t* out, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) *out++ = (uint8_t)(value >> (8 * i));
+  return out;
+}
+
+static inline uint32_t logGet(const uint8_t* in, int bytes) {
+  uint32_t value = 0;
+  for (int i = 0; i < bytes; i++) value |= (uint32_t)in[i] << (8 * i);
+  return value;
+}
+
+// Delta fields in bitmap order
+#define LOG_DELTA_FIELDS 14
+
+static inline uint32_t logDeltaField(const LogRecord& r, int field) {
+  switch (field) {
+    case 0: return r.meterType;
+    case 1: return r.flags;
+    case 2: return r.kwh;
+    case 3: return r.kvah;
+    case 4: return r.kvarhLag;
+    case 5: return r.kvarhLead;
+    case 6: return r.maxDemand;
+    case 7: case 8: case 9: return r.voltage[field - 7];
+    case 10: case 11: case 12: return r.current[field - 10];
+    default: return r.powerFactor;
+  }
+}
+
+static inline void logSetDeltaField(LogRecord& r, int field, uint32_t value) {
+  switch (field) {
+    case 0: r.meterType = (uint8_t)value; break;
+    case 1: r.flags = (uint8_t)value; break;
+    case 2: r.kwh = value; break;
+    case 3: r.kvah = value; break;
+    case 4: r.kvarhLag = value; break;
+    case 5: r.kvarhLead = value; break;
+    case 6: r.maxDemand = (uint16_t)value; break;
+    case 7: case 8: case 9: r.voltage[field - 7] = (uint16_t)value; break;
+    case 10: case 11: case 12: r.current[field - 10] = (uint16_t)value; break;
+    default: r.powerFactor = (uint8_t)value; break;
+  }
+}
+
+static inline size_t logSealEntry(uint8_t* entry, uint8_t* end) {
+  size_t length = (end - entry) + 2;
+  entry[1] = (uint8_t)length;
+  uint32_t crc = logCrc32(0, entry, length - 2);
+  logPut(end, crc & 0xFFFF, 2);
+  return length;
+}
+
+static inline size_t logEncodeKeyframe(const LogRecord& r, uint8_t* out) {
+  uint8_t* p = out;
+  *p++ = LOG_ENTRY_KEYFRAME;
+  *p++ = 0;
+  p = logPut(p, r.sequence, 4);
+  p = logPut(p, r.timestamp, 4);
+  p = logPut(p, r.frameHash, 4);
+  memcpy(p, r.meterId, sizeof(r.meterId));
+  p += sizeof(r.meterId);
+  *p++ = r.meterType;
+  *p++ = r.flags;
+  p = logPut(p, r.kwh, 4);
+  p = logPut(p, r.kvah, 4);
+  p = logPut(p, r.kvarhLag, 4);
+  p = logPut(p, r.kvarhLead, 4);
+  p = logPut(p, r.maxDemand, 2);
+  for (int i = 0; i < 3; i++) p = logPut(p, r.voltage[i], 2);
+  for (int i = 0; i < 3; i++) p = logPut(p, r.current[i], 2);
+  *p++ = r.powerFactor;
+  return logSealEntry(out, p);
+}
+
+static inline size_t logEncodeDelta(const LogRecord& r, const LogRecord& key, uint8_t keyIndex, uint8_t* out) {
+  uint8_t* p = out;
+  *p++ = LOG_ENTRY_DELTA;
+  *p++ = 0;
+  *p++ = keyIndex;
+  p = logPutVarint(p, r.sequence - key.sequence);
+  p = logPutVarint(p, logZigzag((int32_t)(r.timestamp - key.timestamp)));
+  p = logPut(p, r.frameHash, 4);
+
+  uint8_t* bitmap = p;
+  p += 2;
+  uint16_t changed = 0;
+  for (int field = 0; field < LOG_DELTA_FIELDS; field++) {
+    uint32_t value = logDeltaField(r, field);
+    uint32_t base = logDeltaField(key, field);
+    if (value != base) {
+      changed |= 1 << field;
+      p = logPutVarint(p, logZigzag((int32_t)(value - base)));
+    }
+  }
+  logPut(bitmap, changed, 2);
+  return logSealEntry(out, p);
+}
+
+static inline void logDecodeKeyframe(const uint8_t* entry, LogRecord& r) {
+  const uint8_t* p = entry + 2;
+  r.sequence = logGet(p, 4); p += 4;
+  r.timestamp = logGet(p, 4); p += 4;
+  r.frameHash = logGet(p, 4); p += 4;
+  memcpy(r.meterId, p, sizeof(r.meterId)); p += sizeof(r.meterId);
+  r.meterType = *p++;
+  r.flags = *p++;
+  r.kwh = logGet(p, 4); p += 4;
+  r.kvah = logGet(p, 4); p += 4;
+  r.kvarhLag = logGet(p, 4); p += 4;
+  r.kvarhLead = logGet(p, 4); p += 4;
+  r.maxDemand = logGet(p, 2); p += 2;
+  for (int i = 0; i < 3; i++) { r.voltage[i] = logGet(p, 2); p += 2; }
+  for (int i = 0; i < 3; i++) { r.current[i] = logGet(p, 2); p += 2; }
+  r.powerFactor = *p;
+}
+
+// ========================= TIME SEARCH =========================
+
+// First timestamp of the sector at a ring position; false when the sector
+// holds no records or its first record was stamped with uptime
+typedef bool (*LogSectorClockFn)(uint32_t index, uint32_t& firstTimestamp, void* context);
+
+// Ring position a "since" scan starts at: the last sector whose first record
+// is clock-stamped before the timestamp. Sectors written before the clock was
+// set carry small uptime stamps anywhere in the ring, so the search probes
+// forward past them; a long run of them makes it a linear pass over the
+// summaries, never a skipped match.
+static inline uint32_t logFindSinceStart(uint32_t sectors, uint32_t timestamp, LogSectorClockFn clockAt,
+                                         void* context) {
+  uint32_t start = 0;
+  uint32_t low = 0;
+  uint32_t high = sectors;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    uint32_t probe = mid;
+    uint32_t first = 0;
+    while (probe < high && !clockAt(probe, first, context)) {
+      probe++;
+    }
+    if (probe < high && first < timestamp) {
+      start = probe;
+      low = probe + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return start;
+}
+
+// Walks the entries of one sector, decoding deltas against their keyframes
+class LogSectorReader {
+private:
+  const uint8_t* data;
+  size_t size;
+  size_t pos;
+  uint16_t keyframeOffsets[LOG_MAX_SECTOR_KEYFRAMES];
+  int keyframeCount;
+  bool atEnd;
+  bool clean;
+
+  bool decodeDelta(const uint8_t* entry, size_t length, LogRecord& r) const {
+    const uint8_t* p = entry + 2;
+    const uint8_t* end = entry + length - 2;
+    uint8_t keyIndex = *p++;
+    if (keyIndex >= keyframeCount || !isEntryValid(data + keyframeOffsets[keyIndex])) {
+      return false;
+    }
+    logDecodeKeyframe(data + keyframeOffsets[keyIndex], r);
+
+    uint32_t value;
+    if (!(p = logGetVarint(p, end, value))) return false;
+    r.sequence += value;
+    if (!(p = logGetVarint(p, end, value))) return false;
+    r.timestamp += (uint32_t)logUnzigzag(value);
+    if (p + 6 > end) return false;
+    r.frameHash = logGet(p, 4); p += 4;
+    uint16_t changed = logGet(p, 2); p += 2;
+    for (int field = 0; field < LOG_DELTA_FIELDS; field++) {
+      if (changed & (1 << field)) {
+        if (!(p = logGetVarint(p, end, value))) return false;
+        logSetDeltaField(r, field, logDeltaField(r, field) + (uint32_t)logUnzigzag(value));
+      }
+    }
+    return p == end;
+  }
+
+public:
+  uint32_t invalidEntries;
+
+  LogSectorReader(const uint8_t* sectorData, size_t dataSize = LOG_DATA_SIZE)
+    : data(sectorData), size(dataSize), pos(0), keyframeCount(0), atEnd(false), clean(false), invalidEntries(0) {}
+
+  static bool isEntryValid(const uint8_t* entry) {
+    uint8_t length = entry[1];
+    if (length < 4 || length > LOG_ENTRY_MAX_SIZE) return false;
+    if (entry[0] == LOG_ENTRY_KEYFRAME && length != LOG_KEYFRAME_SIZE) return false;
+    uint32_t crc = logCrc32(0, entry, length - 2);
+    return logGet(entry + length - 2, 2) == (crc & 0xFFFF);
+  }
+
+  // Next valid reading; torn or damaged entries are skipped
+  bool next(LogRecord& record) {
+    while (!atEnd) {
+      if (pos + 2 > size || data[pos] == LOG_ENTRY_ERASED) {
+        atEnd = true;
+        clean = true;
+        break;
+      }
+
+      uint8_t marker = data[pos];
+      uint8_t length = data[pos + 1];
+      if ((marker != LOG_ENTRY_KEYFRAME && marker != LOG_ENTRY_DELTA) || length < 4 ||
+          length > LOG_ENTRY_MAX_SIZE || pos + length > size) {
+        atEnd = true;  // Torn header: nothing after it can be trusted
+        break;
+      }
+
+      const uint8_t* entry = data + pos;
+      size_t offset = pos;
+      pos += length;
+
+      // Keyframes are numbered whether or not they survived intact
+      if (marker == LOG_ENTRY_KEYFRAME && keyframeCount < LOG_MAX_SECTOR_KEYFRAMES) {
+        keyframeOffsets[keyframeCount++] = (uint16_t)offset;
+      }
+
+      if (!isEntryValid(entry)) {
+        invalidEntries++;
+        continue;
+      }
+      if (marker == LOG_ENTRY_KEYFRAME) {
+        logDecodeKeyframe(entry, record);
+        return true;
+      }
+      if (decodeDelta(entry, length, record)) {
+        return true;
+      }
+      invalidEntries++;
+    }
+    return false;
+  }
+
+  // After next() returned false: where new entries may be appended
+  size_t endOffset() const { return pos; }
+  bool endedClean() const { return atEnd && clean; }
+  int getKeyframeCount() const { return keyframeCount; }
+  size_t keyframeOffset(int index) const { return keyframeOffsets[index]; }
+};
+
+// ========================= EXPORT FRAMES =========================
+
+#define LOG_FRAME_EXPORT_START 0xC0
+#define LOG_FRAME_EXPORT_CHUNK 0xC1
+#define LOG_FRAME_EXPORT_END 0xC2
+#define LOG_FRAME_EXPORT_CHUNK_LZ 0xC3   // Only when smaller than the plain chunk
+
+struct __attribute__((packed)) LogExportStart {
+  uint32_t fromSequence;
+  uint32_t toSequence;        // Newest record at the time of the request
+  uint32_t chunkCount;
+  uint16_t window;            // Chunks the device sends ahead of the last ACK
+  uint16_t formatVersion;     // LOG_FORMAT_VERSION of the chunk contents
+};
+
+struct __attribute__((packed)) LogExportEnd {
+  uint32_t chunksSent;        // Including retransmissions
+  uint32_t bytesSent;
+  uint32_t elapsedMs;
+  uint8_t complete;           // 0 if the export was abandoned
+  uint8_t reserved[3];
+};
+
+#endif // LOG_FORMAT_H
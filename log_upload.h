@@ -0,0 +1,267 @@
+/*
+ * log_upload.h - HTTP upload of the reading log
+ *
+ * This file contains the LogUploader class that posts the reading log
+ * to the configured server in one HTTP request. The body is the same
+ * frame stream as a Bluetooth #LOGEXPORT (start frame, one chunk per
+ * sector of delta-encoded entries, end frame), written straight from
+ * the memory-mapped partition, so a saved body can be checked with
+ * "tools/log_receiver --verify <body.bin>".
+ *
+ * The stream is compressed once, as one lz_codec.h stream with
+ * "Content-Encoding: lz" (decompress with "tools/lz_tool d"), and sent
+ * with "Transfer-Encoding: chunked" while it is produced, so the server
+ * must accept chunked request bodies. It is plain only when the
+ * compressor cannot be allocated.
+ *
+ * Chunks are whole sectors, so the body may start with records older
+ * than the requested sequence; the server keys records by sequence.
+ */
+
+#ifndef LOG_UPLOAD_H
+#define LOG_UPLOAD_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "config.h"
+#include "communication.h"
+#include "reading_log.h"
+#include "lz_codec.h"
+
+#define LOG_UPLOAD_ENCODING "lz"
+
+#define LOG_UPLOAD_CHUNK_SIZE 512        // Body bytes per HTTP chunk
+
+class LogUploader {
+private:
+  // Feeds the frame stream into the compressor
+  class CompressingPrint : public Print {
+  private:
+    LZCompressor* compressor;
+
+  public:
+    explicit CompressingPrint(LZCompressor* lz) : compressor(lz) {}
+    size_t write(uint8_t value) override { compressor->write(&value, 1); return 1; }
+    size_t write(const uint8_t* data, size_t length) override { compressor->write(data, length); return length; }
+  };
+
+  // Sends the body as HTTP chunks of up to LOG_UPLOAD_CHUNK_SIZE bytes
+  class ChunkedPrint : public Print {
+  private:
+    WiFiClient* client;
+    uint8_t buffer[LOG_UPLOAD_CHUNK_SIZE];
+    size_t fill;
+    size_t sent;
+    bool failed;
+
+    void sendChunk();
+
+  public:
+    explicit ChunkedPrint(WiFiClient* wifiClient) : client(wifiClient), fill(0), sent(0), failed(false) {}
+    size_t write(uint8_t value) override { return write(&value, 1); }
+    size_t write(const uint8_t* data, size_t length) override;
+    void finish();  // Last chunk and the terminating zero-length chunk
+
+    size_t getSent() const { return sent; }
+    bool hasFailed() const { return failed; }
+  };
+
+  ReadingLog* log;
+  String lastReport;
+
+  size_t writeFrames(Print& out, const LogExportPlan& plan, unsigned long startTime, bool& complete);
+  static void onCompressedBody(const uint8_t* data, size_t length, void* context);
+  static String urlEncode(const String& text);
+  bool readStatus(WiFiClient& client, int& status);
+  void logUploadEvent(const String& event);
+
+public:
+  LogUploader();
+
+  void setReadingLog(ReadingLog* readingLog) { log = readingLog; }
+
+  // Posts every record from fromSequence on; WiFi must be connected.
+  // On success uploadedThrough is the newest record the server now has
+  // (unchanged when there was nothing to send).
+  bool uploadFrom(const String& host, int port, const String& deviceName, uint32_t fromSequence,
+                  uint32_t& uploadedThrough);
+  String getLastReport() const { return lastReport; }
+};
+
+// Implementation
+LogUploader::LogUploader() : log(nullptr) {
+}
+
+bool LogUploader::uploadFrom(const String& host, int port, const String& deviceName, uint32_t fromSequence,
+                             uint32_t& uploadedThrough) {
+  if (!log) {
+    return false;
+  }
+
+  LogExportPlan plan;
+  if (!log->planExport(fromSequence, plan)) {
+    lastReport = "Nothing to upload from #" + String(fromSequence);
+    logUploadEvent(lastReport);
+    return true;
+  }
+
+  WiFiClient client;
+  client.setTimeout(READING_UPLOAD_TIMEOUT_MS);
+  if (!client.connect(host.c_str(), port, READING_UPLOAD_TIMEOUT_MS)) {
+    lastReport = "Upload failed: cannot connect to " + host + ":" + String(port);
+    logUploadEvent(lastReport);
+    return false;
+  }
+
+  unsigned long startTime = millis();
+
+  // ~3KB compressor, held only for the upload
+  LZCompressor* compressor = new (std::nothrow) LZCompressor();
+
+  client.print(String("POST ") + READING_UPLOAD_PATH + "?device=" + urlEncode(deviceName) +
+               "&from=" + String(plan.fromSequence) + "&to=" + String(plan.toSequence) + " HTTP/1.1\r\n" +
+               "Host: " + host + ":" + String(port) + "\r\n" +
+               "Content-Type: application/octet-stream\r\n" +
+               (compressor ? "Content-Encoding: " LOG_UPLOAD_ENCODING "\r\n" : "") +
+               "Transfer-Encoding: chunked\r\n" +
+               "Connection: close\r\n\r\n");
+
+  // Frames go through the compressor straight into the chunks, one pass over the log
+  ChunkedPrint body(&client);
+  bool compressed = compressor != nullptr;
+  bool complete = false;
+  size_t frameBytes;
+  if (compressor) {
+    compressor->begin(onCompressedBody, &body, LZ_DICTIONARY_NONE);
+    CompressingPrint out(compressor);
+    frameBytes = writeFrames(out, plan, startTime, complete);
+    compressor->finish();
+    delete compressor;
+  } else {
+    frameBytes = writeFrames(body, plan, startTime, complete);
+  }
+  body.finish();
+
+  int status = 0;
+  bool accepted = complete && !body.hasFailed() && readStatus(client, status) && status >= 200 && status < 300;
+  client.stop();
+
+  if (accepted) {
+    uploadedThrough = plan.toSequence;
+  }
+  lastReport = String(accepted ? "Upload complete: " : "Upload failed: ") + "#" + String(plan.fromSequence) + " - #" +
+               String(plan.toSequence) + ", " + String(body.getSent()) + " bytes" +
+               (compressed ? " (" + String(frameBytes) + " before compression)" : "") +
+               ", HTTP " + String(status) + ", " + String(millis() - startTime) + " ms";
+  logUploadEvent(lastReport);
+  return accepted;
+}
+
+// complete is false when a sector could not be read; the end frame then says so
+size_t LogUploader::writeFrames(Print& out, const LogExportPlan& plan, unsigned long startTime, bool& complete) {
+  LogExportStart start;
+  start.fromSequence = plan.fromSequence;
+  start.toSequence = plan.toSequence;
+  start.chunkCount = plan.chunkCount;
+  start.window = 0;  // No acknowledgements; TCP carries the body
+  start.formatVersion = LOG_FORMAT_VERSION;
+  size_t written = CommunicationManager::writeFrame(out, LOG_FRAME_EXPORT_START,
+                                                    reinterpret_cast<const uint8_t*>(&start), sizeof(start), nullptr, 0);
+
+  uint32_t chunksSent = 0;
+  for (uint32_t i = 0; i < plan.chunkCount; i++) {
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    if (!log->getExportChunk(plan, i, data, length)) {
+      break;
+    }
+    chunksSent++;
+    uint32_t chunkIndex = i;
+    written += CommunicationManager::writeFrame(out, LOG_FRAME_EXPORT_CHUNK,
+                                                reinterpret_cast<const uint8_t*>(&chunkIndex), sizeof(chunkIndex),
+                                                data, length);
+  }
+
+  LogExportEnd end;
+  complete = chunksSent == plan.chunkCount;
+  end.chunksSent = chunksSent;
+  end.bytesSent = written;
+  end.elapsedMs = millis() - startTime;
+  end.complete = complete ? 1 : 0;
+  memset(end.reserved, 0, sizeof(end.reserved));
+  written += CommunicationManager::writeFrame(out, LOG_FRAME_EXPORT_END,
+                                              reinterpret_cast<const uint8_t*>(&end), sizeof(end), nullptr, 0);
+  return written;
+}
+
+void LogUploader::onCompressedBody(const uint8_t* data, size_t length, void* context) {
+  static_cast<ChunkedPrint*>(context)->write(data, length);
+}
+
+size_t LogUploader::ChunkedPrint::write(const uint8_t* data, size_t length) {
+  size_t taken = 0;
+  while (taken < length) {
+    size_t run = length - taken < sizeof(buffer) - fill ? length - taken : sizeof(buffer) - fill;
+    memcpy(buffer + fill, data + taken, run);
+    fill += run;
+    taken += run;
+    if (fill == sizeof(buffer)) {
+      sendChunk();
+    }
+  }
+  return length;
+}
+
+void LogUploader::ChunkedPrint::sendChunk() {
+  if (fill == 0) {
+    return;
+  }
+  // After a short write the request is lost; the rest is only counted
+  if (!failed) {
+    String size = String(fill, HEX) + "\r\n";
+    failed = client->print(size) != size.length() || client->write(buffer, fill) != fill ||
+             client->print("\r\n") != 2;
+  }
+  sent += fill;
+  fill = 0;
+}
+
+void LogUploader::ChunkedPrint::finish() {
+  sendChunk();
+  if (!failed) {
+    failed = client->print("0\r\n\r\n") != 5;
+  }
+}
+
+String LogUploader::urlEncode(const String& text) {
+  static const char hex[] = "0123456789ABCDEF";
+  String encoded;
+  for (size_t i = 0; i < text.length(); i++) {
+    char c = text[i];
+    if (isalnum((unsigned char)c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      encoded += c;
+    } else {
+      encoded += '%';
+      encoded += hex[(uint8_t)c >> 4];
+      encoded += hex[(uint8_t)c & 0x0F];
+    }
+  }
+  return encoded;
+}
+
+bool LogUploader::readStatus(WiFiClient& client, int& status) {
+  // "HTTP/1.1 200 OK"; headers and body are not needed
+  String line = client.readStringUntil('\n');
+  int space = line.indexOf(' ');
+  if (!line.startsWith("HTTP/") || space == -1) {
+    return false;
+  }
+  status = line.substring(space + 1).toInt();
+  return true;
+}
+
+void LogUploader::logUploadEvent(const String& event) {
+  Serial.println("[Upload] " + event);
+}
+
+#endif // LOG_UPLOAD_H
@@ -0,0 +1,431 @@
+/*
+ * lz_codec.h - Streaming LZ compression for outbound data
+ *
+ * This file contains a small LZSS-style codec used to shrink batched
+ * uploads and bulk exports. The window is primed with a static dictionary
+ * of typical reading records so even short batches compress well.
+ *
+ * The codec has no Arduino dependencies so the host tools in tools/
+ * can share it with the firmware.
+ *
+ * Stream format:
+ *   'L' 'Z' <version> <dictionary id>
+ *   groups of one flag byte followed by 8 tokens (bit set = match)
+ *   literal token: 1 byte
+ *   match token:   2 bytes big-endian, (distance - 1) << 6 | (length - 3)
+ *   end token:     match token with length code 63
+ */
+
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// ========================= CODEC PARAMETERS =========================
+
+#define LZ_WINDOW_SIZE 1024        // Must be a power of two (10-bit distance)
+#define LZ_HASH_SIZE 512           // Must be a power of two
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 65            // 6-bit length code, 63 reserved
+#define LZ_END_CODE 63
+#define LZ_HEADER_SIZE 4
+#define LZ_FORMAT_VERSION 1
+#define LZ_OUTPUT_CHUNK 64
+
+#define LZ_DICTIONARY_NONE 0
+#define LZ_DICTIONARY_READINGS 1
+
+// Output callback: receives compressed (or decompressed) bytes in small chunks
+typedef void (*LZOutputFn)(const uint8_t* data, size_t length, void* context);
+
+// ========================= STATIC DICTIONARY =========================
+
+// Typical reading output as produced by DataParser and CommunicationManager.
+// Changing this text breaks decoding of existing streams - bump the
+// dictionary id instead.
+static const char LZ_READINGS_DICTIONARY[] =
+  "seq,time,type,meter,kwh,kvah,kvarh_lag,kvarh_lead,md,vr,vy,vb,ir,iy,ib,pf\r\n"
+  "=== PARSING DATA ===\r\n"
+  "=== METER INFORMATION ===\r\n"
+  "Serial Number: \r\n"
+  "Manufacturer ID: \r\n"
+  "Time: 00:00:00\r\n"
+  "Date: 01:01:25\r\n"
+  "Make: \r\n"
+  "Phase: 3\r\n"
+  "Multiplication Factor: 1.00\r\n"
+  "=== ENERGY DATA ===\r\n"
+  "KWh: 0.00\r\n"
+  "KVAh: 0.00\r\n"
+  "KVArh Lag: 0.000\r\n"
+  "KVArh Lead: 0.000\r\n"
+  "Max Demand: 0.00\r\n"
+  "Power Factor: 0.99\r\n"
+  "=== ELECTRICAL DATA ===\r\n"
+  "Voltage R: 230.0V\r\n"
+  "Voltage Y: 230.0V\r\n"
+  "Voltage B: 230.0V\r\n"
+  "Current R: 0.00A\r\n"
+  "Current Y: 0.00A\r\n"
+  "Current B: 0.00A\r\n"
+  "Tamper Count: \r\n"
+  "Tamper Status: \r\n"
+  "=== DATA STATISTICS ===\r\n"
+  "Parsing Status: SUCCESS\r\n"
+  "Total Power: 0.00 units\r\n"
+  "System Type: 3-Phase\r\n"
+  "BATTERY CHARGE: 100 %\r\n"
+  "VERSION: V13.MODULAR\r\n"
+  "DATA RECEIVED: IRDA-3Ph-PARSED.\r\n"
+  "IRDA-1Ph-PARSED.IR-3Ph-PARSED.IRDA-3Ph-SOLAR-RAW.\r\n";
+
+static inline const uint8_t* lzDictionaryData(uint8_t id, size_t& length) {
+  if (id == LZ_DICTIONARY_READINGS) {
+    length = sizeof(LZ_READINGS_DICTIONARY) - 1;
+    return reinterpret_cast<const uint8_t*>(LZ_READINGS_DICTIONARY);
+  }
+  length = 0;
+  return nullptr;
+}
+
+// ========================= COMPRESSOR =========================
+
+class LZCompressor {
+private:
+  static const uint16_t NO_POSITION = 0xFFFF;
+
+  // History (first half) and pending input (second half)
+  uint8_t buffer[2 * LZ_WINDOW_SIZE];
+  uint16_t hashHead[LZ_HASH_SIZE];
+  size_t position;
+  size_t end;
+
+  // Current token group: flag byte plus up to 8 tokens
+  uint8_t group[1 + 8 * 2];
+  size_t groupLength;
+  uint8_t groupTokens;
+
+  uint8_t output[LZ_OUTPUT_CHUNK];
+  size_t outputLength;
+  LZOutputFn outputFn;
+  void* outputContext;
+
+  uint32_t bytesIn;
+  uint32_t bytesOut;
+
+  static uint16_t hash(const uint8_t* p) {
+    return ((p[0] << 5) ^ (p[1] << 2) ^ p[2] ^ (p[0] >> 3)) & (LZ_HASH_SIZE - 1);
+  }
+
+  void insertHash(size_t pos) {
+    hashHead[hash(&buffer[pos])] = (uint16_t)pos;
+  }
+
+  void emit(const uint8_t* data, size_t length) {
+    while (length > 0) {
+      size_t n = sizeof(output) - outputLength;
+      if (n > length) n = length;
+      memcpy(output + outputLength, data, n);
+      outputLength += n;
+      data += n;
+      length -= n;
+      if (outputLength == sizeof(output)) {
+        flushOutput();
+      }
+    }
+  }
+
+  void flushOutput() {
+    if (outputLength > 0 && outputFn) {
+      outputFn(output, outputLength, outputContext);
+    }
+    bytesOut += outputLength;
+    outputLength = 0;
+  }
+
+  void flushGroup() {
+    if (groupTokens > 0) {
+      emit(group, groupLength);
+    }
+    group[0] = 0;
+    groupLength = 1;
+    groupTokens = 0;
+  }
+
+  void emitLiteral(uint8_t value) {
+    group[groupLength++] = value;
+    if (++groupTokens == 8) flushGroup();
+  }
+
+  void emitMatchCode(uint16_t distanceCode, uint8_t lengthCode) {
+    uint16_t token = (uint16_t)(distanceCode << 6) | lengthCode;
+    group[0] |= (uint8_t)(1 << groupTokens);
+    group[groupLength++] = (uint8_t)(token >> 8);
+    group[groupLength++] = (uint8_t)(token & 0xFF);
+    if (++groupTokens == 8) flushGroup();
+  }
+
+  // Encode buffered input, keeping LZ_MAX_MATCH bytes of lookahead unless flushing
+  void encodePending(bool flush) {
+    size_t limit = flush ? end : (end > LZ_MAX_MATCH ? end - LZ_MAX_MATCH : 0);
+
+    while (position < limit) {
+      size_t available = end - position;
+      if (available > LZ_MAX_MATCH) available = LZ_MAX_MATCH;
+
+      size_t bestLength = 0;
+      size_t bestDistance = 0;
+
+      if (available >= LZ_MIN_MATCH) {
+        uint16_t h = hash(&buffer[position]);
+        uint16_t candidate = hashHead[h];
+        hashHead[h] = (uint16_t)position;
+
+        if (candidate != NO_POSITION && candidate < position &&
+            position - candidate <= LZ_WINDOW_SIZE) {
+          size_t length = 0;
+          while (length < available && buffer[candidate + length] == buffer[position + length]) {
+            length++;
+          }
+          if (length >= LZ_MIN_MATCH) {
+            bestLength = length;
+            bestDistance = position - candidate;
+          }
+        }
+      }
+
+      if (bestLength > 0) {
+        emitMatchCode((uint16_t)(bestDistance - 1), (uint8_t)(bestLength - LZ_MIN_MATCH));
+        for (size_t i = 1; i < bestLength; i++) {
+          if (position + i + LZ_MIN_MATCH <= end) insertHash(position + i);
+        }
+        position += bestLength;
+      } else {
+        emitLiteral(buffer[position]);
+        position++;
+      }
+    }
+  }
+
+  // Drop the oldest window worth of history once the buffer is full
+  void slideWindow() {
+    memmove(buffer, buffer + LZ_WINDOW_SIZE, LZ_WINDOW_SIZE);
+    position -= LZ_WINDOW_SIZE;
+    end -= LZ_WINDOW_SIZE;
+
+    for (size_t i = 0; i < LZ_HASH_SIZE; i++) {
+      hashHead[i] = (hashHead[i] != NO_POSITION && hashHead[i] >= LZ_WINDOW_SIZE)
+                      ? (uint16_t)(hashHead[i] - LZ_WINDOW_SIZE) : NO_POSITION;
+    }
+  }
+
+public:
+  LZCompressor() : position(0), end(0), groupLength(1), groupTokens(0), outputLength(0),
+                   outputFn(nullptr), outputContext(nullptr), bytesIn(0), bytesOut(0) {
+    group[0] = 0;
+  }
+
+  // Start a new stream; the header is emitted immediately
+  void begin(LZOutputFn fn, void* context, uint8_t dictionaryId = LZ_DICTIONARY_READINGS) {
+    outputFn = fn;
+    outputContext = context;
+    outputLength = 0;
+    bytesIn = 0;
+    bytesOut = 0;
+    group[0] = 0;
+    groupLength = 1;
+    groupTokens = 0;
+
+    memset(buffer, 0, sizeof(buffer));
+    for (size_t i = 0; i < LZ_HASH_SIZE; i++) hashHead[i] = NO_POSITION;
+
+    // Prime the history so the dictionary ends right before the first input byte
+    size_t dictionaryLength = 0;
+    const uint8_t* dictionary = lzDictionaryData(dictionaryId, dictionaryLength);
+    if (dictionaryLength > LZ_WINDOW_SIZE) dictionaryLength = 0;
+
+    position = LZ_WINDOW_SIZE;
+    end = LZ_WINDOW_SIZE;
+    if (dictionaryLength > 0) {
+      size_t start = LZ_WINDOW_SIZE - dictionaryLength;
+      memcpy(buffer + start, dictionary, dictionaryLength);
+      for (size_t i = start; i + LZ_MIN_MATCH <= LZ_WINDOW_SIZE; i++) insertHash(i);
+    }
+
+    const uint8_t header[LZ_HEADER_SIZE] = {
+      'L', 'Z', LZ_FORMAT_VERSION, (uint8_t)(dictionaryLength > 0 ? dictionaryId : LZ_DICTIONARY_NONE)
+    };
+    emit(header, sizeof(header));
+  }
+
+  void write(const uint8_t* data, size_t length) {
+    while (length > 0) {
+      if (end == sizeof(buffer)) {
+        encodePending(false);
+        slideWindow();
+      }
+
+      size_t n = sizeof(buffer) - end;
+      if (n > length) n = length;
+      memcpy(buffer + end, data, n);
+      end += n;
+      data += n;
+      length -= n;
+      bytesIn += n;
+    }
+  }
+
+  // Encode everything left, append the end token and flush the output
+  void finish() {
+    encodePending(true);
+    emitMatchCode(0, LZ_END_CODE);
+    flushGroup();
+    flushOutput();
+  }
+
+  uint32_t getBytesIn() const { return bytesIn; }
+  uint32_t getBytesOut() const { return bytesOut + outputLength; }
+};
+
+// ========================= DECOMPRESSOR =========================
+
+class LZDecompressor {
+private:
+  enum State { STATE_HEADER, STATE_FLAGS, STATE_TOKEN, STATE_DONE, STATE_ERROR };
+
+  uint8_t window[LZ_WINDOW_SIZE];
+  size_t windowPos;
+
+  State state;
+  uint8_t header[LZ_HEADER_SIZE];
+  size_t headerLength;
+  uint8_t flags;
+  uint8_t flagBit;
+  uint8_t pendingHigh;
+  bool havePendingHigh;
+
+  uint8_t output[LZ_OUTPUT_CHUNK];
+  size_t outputLength;
+  LZOutputFn outputFn;
+  void* outputContext;
+  uint32_t bytesOut;
+
+  void put(uint8_t value) {
+    window[windowPos] = value;
+    windowPos = (windowPos + 1) & (LZ_WINDOW_SIZE - 1);
+    output[outputLength++] = value;
+    if (outputLength == sizeof(output)) flushOutput();
+  }
+
+  void flushOutput() {
+    if (outputLength > 0 && outputFn) {
+      outputFn(output, outputLength, outputContext);
+    }
+    bytesOut += outputLength;
+    outputLength = 0;
+  }
+
+  bool acceptHeader() {
+    if (header[0] != 'L' || header[1] != 'Z' || header[2] != LZ_FORMAT_VERSION) {
+      return false;
+    }
+
+    size_t dictionaryLength = 0;
+    const uint8_t* dictionary = lzDictionaryData(header[3], dictionaryLength);
+    if (header[3] != LZ_DICTIONARY_NONE && dictionary == nullptr) {
+      return false;
+    }
+
+    // Same layout as the compressor: dictionary ends at the last window slot
+    if (dictionaryLength > 0 && dictionaryLength <= LZ_WINDOW_SIZE) {
+      memcpy(window + LZ_WINDOW_SIZE - dictionaryLength, dictionary, dictionaryLength);
+    }
+    return true;
+  }
+
+public:
+  LZDecompressor() : windowPos(0), state(STATE_HEADER), headerLength(0), flags(0), flagBit(0),
+                     pendingHigh(0), havePendingHigh(false), outputLength(0),
+                     outputFn(nullptr), outputContext(nullptr), bytesOut(0) {}
+
+  void begin(LZOutputFn fn, void* context) {
+    outputFn = fn;
+    outputContext = context;
+    outputLength = 0;
+    bytesOut = 0;
+    memset(window, 0, sizeof(window));
+    windowPos = 0;
+    state = STATE_HEADER;
+    headerLength = 0;
+    havePendingHigh = false;
+  }
+
+  // Feed compressed bytes; returns false on a malformed stream
+  bool write(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      uint8_t value = data[i];
+
+      switch (state) {
+        case STATE_HEADER:
+          header[headerLength++] = value;
+          if (headerLength == LZ_HEADER_SIZE) {
+            state = acceptHeader() ? STATE_FLAGS : STATE_ERROR;
+          }
+          break;
+
+        case STATE_FLAGS:
+          flags = value;
+          flagBit = 0;
+          state = STATE_TOKEN;
+          break;
+
+        case STATE_TOKEN:
+          if (flags & (1 << flagBit)) {
+            if (!havePendingHigh) {
+              pendingHigh = value;
+              havePendingHigh = true;
+              continue;
+            }
+            havePendingHigh = false;
+
+            uint16_t token = (uint16_t)(pendingHigh << 8) | value;
+            uint8_t lengthCode = token & 0x3F;
+            if (lengthCode == LZ_END_CODE) {
+              flushOutput();
+              state = STATE_DONE;
+              continue;
+            }
+
+            size_t distance = (token >> 6) + 1;
+            size_t from = (windowPos - distance) & (LZ_WINDOW_SIZE - 1);
+            for (size_t n = 0; n < (size_t)lengthCode + LZ_MIN_MATCH; n++) {
+              put(window[from]);
+              from = (from + 1) & (LZ_WINDOW_SIZE - 1);
+            }
+          } else {
+            put(value);
+          }
+
+          if (++flagBit == 8) state = STATE_FLAGS;
+          break;
+
+        case STATE_DONE:
+        case STATE_ERROR:
+          state = STATE_ERROR;
+          return false;
+      }
+
+      if (state == STATE_ERROR) return false;
+    }
+
+    return true;
+  }
+
+  bool isFinished() const { return state == STATE_DONE; }
+  bool hasError() const { return state == STATE_ERROR; }
+  uint32_t getBytesOut() const { return bytesOut + outputLength; }
+};
+
+#endif // LZ_CODEC_H
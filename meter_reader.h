@@ -40,7 +40,8 @@ private:
   
   // ========================= PROTOCOL HELPERS =========================
   bool readIRDAPacket(String& data, int expectedBytes, int timeoutMs = 2000);
-  bool readIRPacket(String& data, int expectedBytes, int timeoutMs = 2000);
+  bool capturePacket(HardwareSerial* serial, MeterData& data, int expectedBytes,
+                     const char* separator = nullptr, int timeoutMs = 2000);
   void setupIRDABaudRate(int baudRate);
   void setupIRBaudRate(int baudRate);
   
@@ -68,6 +69,7 @@ public:
   void setHardwareControl(HardwareControl* hwCtrl) { hardware = hwCtrl; }
   
   // ========================= MAIN READING INTERFACE =========================
+  // The IRDA transceiver is switched by PeripheralPower: read inside a PeripheralSession
   bool readMeter(MeterType type, MeterData& data);
   
   // ========================= PROTOCOL SPECIFIC READERS =========================
@@ -137,14 +139,14 @@ void MeterReader::initializeIRDA() {
   setupIRDABaudRate(BAUD_RATE_9600);
   delay(100);
   
-  hardware->enableIRDA();
-  
   Serial.println("IRDA interface initialized");
 }
 
 bool MeterReader::readMeter(MeterType type, MeterData& data) {
   data.type = type;
   data.isValid = false;
+  data.dataLength = 0;
+  data.rawData = "";
   
   if (!comm || !hardware) {
     Serial.println("ERROR: MeterReader not properly initialized");
@@ -203,9 +205,6 @@ bool MeterReader::readMeterIRDA1PH(bool parseData, MeterData& data) {
   logProtocolAction("Reading IRDA 1-Phase meter");
   
   setupIRDABaudRate(BAUD_RATE_2400);
-  hardware->disableIRDA();
-  
-  String responseData = "";
   
   // Send all 5 commands and collect responses
   for (int i = 0; i < 5; i++) {
@@ -214,20 +213,15 @@ bool MeterReader::readMeterIRDA1PH(bool parseData, MeterData& data) {
     if (sendIRDACommand(ProtocolMessages::IRDA_1PH_CMD_STRINGS[i])) {
       delay(200);
       
-      String packet;
-      if (readIRDAPacket(packet, 30)) {
-        responseData += packet;
-        logProtocolAction("Received packet " + String(i + 1) + " (" + String(packet.length()) + " bytes)");
+      if (capturePacket(comm->getIRDASerial(), data, 30)) {
+        logProtocolAction("Received packet " + String(i + 1) + " (" + String(data.dataLength) + " bytes total)");
       } else {
         logProtocolAction("Failed to receive packet " + String(i + 1));
       }
     }
   }
   
-  hardware->enableIRDA();
-  
-  if (responseData.length() > 0) {
-    data.rawData = responseData;
+  if (data.dataLength > 0) {
     data.isValid = true;
     return true;
   }
@@ -239,7 +233,6 @@ bool MeterReader::readMeterIRDA3PH(bool parseData, MeterData& data) {
   logProtocolAction("Reading IRDA 3-Phase meter");
   
   setupIRDABaudRate(BAUD_RATE_9600);
-  hardware->disableIRDA();
   
   // First message - handshake
   if (sendIRDACommand(ProtocolMessages::IRDA_3PH_MSG1, sizeof(ProtocolMessages::IRDA_3PH_MSG1))) {
@@ -260,17 +253,14 @@ bool MeterReader::readMeterIRDA3PH(bool parseData, MeterData& data) {
       delay(1500); // Protocol requires delay between messages
       
       if (sendIRDACommand(msg2, sizeof(msg2))) {
-        String finalPacket;
-        if (readIRDAPacket(finalPacket, 79)) {
-          data.rawData = finalPacket;
+        if (capturePacket(comm->getIRDASerial(), data, 79)) {
           data.isValid = true;
-          logProtocolAction("3PH data read successful (" + String(finalPacket.length()) + " bytes)");
+          logProtocolAction("3PH data read successful (" + String(data.dataLength) + " bytes)");
         }
       }
     }
   }
   
-  hardware->enableIRDA();
   return data.isValid;
 }
 
@@ -278,7 +268,6 @@ bool MeterReader::readMeterIRDA3PHHP(int digitCount, MeterData& data) {
   logProtocolAction("Reading IRDA 3-Phase HP meter (" + String(digitCount) + " digits)");
   
   setupIRDABaudRate(BAUD_RATE_9600);
-  hardware->disableIRDA();
   
   // HP meter protocol uses different message structure
   if (sendIRDACommand(ProtocolMessages::IRDA_3PH_MSG6, sizeof(ProtocolMessages::IRDA_3PH_MSG6))) {
@@ -299,9 +288,7 @@ bool MeterReader::readMeterIRDA3PHHP(int digitCount, MeterData& data) {
       delay(1500);
       
       if (sendIRDACommand(msg7, sizeof(msg7))) {
-        String finalPacket;
-        if (readIRDAPacket(finalPacket, 71)) {
-          data.rawData = finalPacket;
+        if (capturePacket(comm->getIRDASerial(), data, 71)) {
           data.isValid = true;
           logProtocolAction("HP data read successful");
         }
@@ -309,7 +296,6 @@ bool MeterReader::readMeterIRDA3PHHP(int digitCount, MeterData& data) {
     }
   }
   
-  hardware->enableIRDA();
   return data.isValid;
 }
 
@@ -326,11 +312,8 @@ bool MeterReader::readMeterIRDA3PHSolar(bool parseData, MeterData& data) {
   memcpy(solarMsg, ProtocolMessages::IRDA_3PH_MSG2, sizeof(ProtocolMessages::IRDA_3PH_MSG2));
   solarMsg[6] = 0x01; // Solar export flag
   
-  String exportData;
   if (sendIRDACommand(solarMsg, sizeof(solarMsg))) {
-    String packet;
-    if (readIRDAPacket(packet, 79)) {
-      data.rawData += "\n** EXPORT DATA **\n" + packet;
+    if (capturePacket(comm->getIRDASerial(), data, 79, "\n** EXPORT DATA **\n")) {
       logProtocolAction("Solar export data read successful");
     }
   }
@@ -343,22 +326,15 @@ bool MeterReader::readMeterIR1PH(bool parseData, MeterData& data) {
   
   setupIRBaudRate(BAUD_RATE_2400);
   
-  String responseData = "";
-  
   // Send all 5 commands (same as IRDA but over IR)
   for (int i = 0; i < 5; i++) {
     if (sendIRDACommand(ProtocolMessages::IRDA_1PH_CMD_STRINGS[i])) {
       delay(200);
-      
-      String packet;
-      if (readIRPacket(packet, 30)) {
-        responseData += packet;
-      }
+      capturePacket(comm->getIRSerial(), data, 30);
     }
   }
   
-  if (responseData.length() > 0) {
-    data.rawData = responseData;
+  if (data.dataLength > 0) {
     data.isValid = true;
     return true;
   }
@@ -373,9 +349,7 @@ bool MeterReader::readMeterIR3PH(bool parseData, MeterData& data) {
   
   if (sendIRCommand(ProtocolMessages::IR_3PH_MSG, sizeof(ProtocolMessages::IR_3PH_MSG))) {
     delay(500);
-    String packet;
-    if (readIRPacket(packet, 50)) {
-      data.rawData = packet;
+    if (capturePacket(comm->getIRSerial(), data, 50)) {
       data.isValid = true;
       return true;
     }
@@ -403,21 +377,43 @@ bool MeterReader::readIRDAPacket(String& data, int expectedBytes, int timeoutMs)
   return data.length() >= expectedBytes;
 }
 
-bool MeterReader::readIRPacket(String& data, int expectedBytes, int timeoutMs) {
-  data = "";
-  unsigned long startTime = millis();
+// Read a packet straight into the envelope buffer of the MeterData.
+// Only complete packets are kept; the separator is stored in front of them.
+bool MeterReader::capturePacket(HardwareSerial* serial, MeterData& data, int expectedBytes,
+                                const char* separator, int timeoutMs) {
+  if (!data.reserveBinary()) {
+    logProtocolAction("ERROR: No memory for capture buffer");
+    return false;
+  }
   
-  HardwareSerial* serial = comm->getIRSerial();
+  size_t separatorLength = separator ? strlen(separator) : 0;
+  if (separatorLength + expectedBytes > data.payloadSpace()) {
+    logProtocolAction("ERROR: Capture buffer full");
+    return false;
+  }
   
-  while ((millis() - startTime < timeoutMs) && (data.length() < expectedBytes)) {
-    if (serial->available()) {
-      char c = serial->read();
-      data += c;
+  uint8_t* start = data.payload() + data.dataLength;
+  uint8_t* packet = start + separatorLength;
+  size_t received = 0;
+  unsigned long startTime = millis();
+  
+  while ((millis() - startTime < timeoutMs) && (received < expectedBytes)) {
+    while (serial->available() && received < expectedBytes) {
+      packet[received++] = serial->read();
     }
     delay(1);
   }
   
-  return data.length() >= expectedBytes;
+  if (received < expectedBytes) {
+    return false;
+  }
+  
+  if (separatorLength > 0) {
+    memcpy(start, separator, separatorLength);
+  }
+  data.rawData.concat(reinterpret_cast<const char*>(start), separatorLength + received);
+  data.dataLength += separatorLength + received;
+  return true;
 }
 
 void MeterReader::setupIRDABaudRate(int baudRate) {
@@ -471,12 +467,9 @@ bool MeterReader::testIRDAConnection() {
   logProtocolAction("Testing IRDA connection");
   
   setupIRDABaudRate(BAUD_RATE_2400);
-  hardware->disableIRDA();
   
   bool success = sendIRDACommand(ProtocolMessages::IRDA_1PH_CMD_STRINGS[0]);
   
-  hardware->enableIRDA();
-  
   return success;
 }
 
@@ -14,48 +14,125 @@
 #include "data_parser.h"
 #include "power_management.h"
 #include "ota_manager.h"
+#include "network_manager.h"
+#include "reading_log.h"
+#include "log_export.h"
+#include "energy_monitor.h"
+#include "warm_boot.h"
+#include "reading_scheduler.h"
+#include "log_upload.h"
+#include "peripheral_power.h"
+#include "status_led.h"
+#include "battery_model.h"
 
 // Global instances
 ConfigManager config;
+NetworkManager network;
 HardwareControl hardware;
 CommunicationManager comm;
 MeterReader meterReader;
 DataParser parser;
 PowerManager powerMgr;
 OTAManager otaManager;
+ReadingLog readingLog;
+LogExporter logExporter;
+EnergyMonitor energyMonitor;
+WarmBoot warmBoot;
+ReadingScheduler scheduler;
+LogUploader logUploader;
+PeripheralPower peripherals;
+StatusLed statusLed;
+BatteryModel batteryModel;
 
 void setup() {
   Serial.begin(115200);
   Serial.println("Starting Energy Meter Reader V13.MODULAR...");
   
+  // A button wake from deep sleep resumes from the RTC snapshot
+  bool warm = warmBoot.begin();
+  
   // Initialize configuration first
   config.init();
-  config.loadAll();
+  if (warm) {
+    config.restore(warmBoot.getSettings());
+  } else {
+    config.loadAll();
+  }
   
-  // Initialize hardware
+  // Start energy accounting before anything is switched on
+  energyMonitor.init();
+  hardware.setEnergyMonitor(&energyMonitor);
+  batteryModel.setEnergyMonitor(&energyMonitor);
+  batteryModel.init();
+  
+  // Timer wake with a schedule: one reading, then straight back to sleep
+  scheduler.setConfigManager(&config);
+  scheduler.init();
+  if (scheduler.isScheduledWake()) {
+    runScheduledCycle();
+  }
+  
+  // Initialize hardware (front end powered per meter session)
   hardware.init();
+  peripherals.setHardwareControl(&hardware);
+  statusLed.setHardwareControl(&hardware);
+  statusLed.init();
   
   // Initialize communication with loaded Bluetooth name
   comm.init(config.getBluetoothName());
   
+  // Shared WiFi service (primary network comes from the configuration)
+  network.init();
+  network.setPrimaryNetwork(config.getSSID(), config.getPassword());
+  
+  // Mount the reading log (disabled if the partition is missing)
+  readingLog.init();
+  
   // Connect modules (dependency injection)
   meterReader.setCommunicationManager(&comm);
   meterReader.setHardwareControl(&hardware);
   parser.setCommunicationManager(&comm);
   powerMgr.setHardwareControl(&hardware);
+  powerMgr.setEnergyMonitor(&energyMonitor);
+  powerMgr.setSleepCallback(enterSleep);
+  powerMgr.setStatusLed(&statusLed);
+  powerMgr.setBatteryModel(&batteryModel);
   otaManager.setCommunicationManager(&comm);
+  otaManager.setNetworkManager(&network);
+  otaManager.setStatusLed(&statusLed);
+  logExporter.setCommunicationManager(&comm);
+  logExporter.setReadingLog(&readingLog);
+  comm.setNetworkManager(&network);
   
   // Initialize remaining modules
   meterReader.init();
+  if (warm) {
+    powerMgr.seedBattery(warmBoot.getBatteryMilliVolts());
+  }
   powerMgr.init();
   
-  // Print current configuration
-  comm.printConfig(config);
+  // Light sleep between commands; Bluetooth traffic wakes the loop
+  powerMgr.initLightSleep();
+  comm.setActivityCallback(PowerManager::notifyActivity);
   
-  // Perform startup sequence
-  hardware.startupSequence();
-  meterReader.initializeIRDA();
+  if (warm) {
+    // Port left as it was; the transceiver was initialized on the cold boot
+    if (warmBoot.getIRDABaudRate() != comm.getIRDABaudRate()) {
+      comm.setupIRDASerial(warmBoot.getIRDABaudRate());
+    }
+  } else {
+    // Print current configuration
+    comm.printConfig(config);
+    
+    // Perform startup sequence (the front end warms up meanwhile)
+    peripherals.powerUp(PERIPH_FRONT_END);
+    statusLed.pulse(LED_STATE_NOTICE);
+    hardware.startupSequence();
+    PeripheralSession frontEnd(peripherals, PERIPH_FRONT_END);
+    meterReader.initializeIRDA();
+  }
   
+  warmBoot.markReady();
   Serial.println("System initialized successfully");
   Serial.println("Ready to accept commands via Bluetooth");
 }
@@ -67,20 +144,79 @@ void loop() {
     handleCommand(command);
   }
   
+  // Drive any asynchronous WiFi connect
+  network.update();
+  
+  // Switch the meter front end off once no session has used it for a while
+  peripherals.update();
+  
+  // Polled energy and LED states
+  updateEnergyStates();
+  statusLed.set(LED_STATE_BT_CONNECTED, comm.isBluetoothConnected());
+  statusLed.set(LED_STATE_LOW_BATTERY, powerMgr.isBatteryLow());
+  
   // Update power management and check for sleep conditions
   powerMgr.update();
   if (powerMgr.shouldSleep()) {
-    powerMgr.enterDeepSleep();
+    enterSleep();
+  }
+  
+  // Sleep until Bluetooth, UART or the button needs us (or periodic work is due)
+  if (comm.available() == 0) {
+    powerMgr.idleWait(network.isBusy() ? POWER_BUSY_POLL_MS : POWER_IDLE_POLL_MS);
   }
+}
+
+// Also run by the button task when a long press finds the loop blocked
+void enterSleep() {
+  // Queued readings must reach flash before the power goes
+  readingLog.flush();
   
-  delay(1); // Small delay for system stability
+  // Waits out a meter session or flash write still running on the loop; nothing new starts after this
+  if (!SleepGate::close(SLEEP_GATE_WAIT_MS)) {
+    Serial.println("Sleep postponed: " + String(SleepGate::getHolders()) + " task(s) still busy");
+    return;
+  }
+  warmBoot.save(config.getSettings(), comm.getIRDABaudRate(), powerMgr.getBatteryInfo().pinMilliVolts);
+  peripherals.powerDownAll();
+  powerMgr.armTimerWakeup(scheduler.getSleepUs());
+  powerMgr.enterDeepSleep();
 }
 
-void handleCommand(const String& command) {
-  // Visual and audio feedback
-  hardware.ledOn();
+void handleCommand(const String& rawCommand) {
+  // A leading 'Z' requests the response as a compressed LZ stream
+  bool compressed = rawCommand.length() > 1 && rawCommand[0] == 'Z';
+  String command = compressed ? rawCommand.substring(1) : rawCommand;
+  
+  // Late acknowledgements from a finished export need no reply
+  if (command.startsWith("#ACK=")) {
+    return;
+  }
+  
+  // Closes the gap since the last command (feeds the learned sleep timeout)
+  powerMgr.recordCommandStart();
+  
+  // No light sleep until the reply is out; phases below pick the clock
+  ScopedPowerLock powerLock(powerMgr, POWER_LOCK_COMMAND);
+  
+  // Meter reads: start the front-end warm-up before anything else
+  if (command.startsWith("#IRDA") || command.startsWith("#IRIR")) {
+    peripherals.powerUp(PERIPH_FRONT_END);
+  }
+  
+  // Visual and audio feedback (both run in the background)
+  statusLed.set(LED_STATE_COMMAND, true);
   hardware.beep();
   
+  // Exports compress each chunk inside its frame instead of the whole reply
+  bool compressChunks = compressed && command.startsWith("#LOGEXPORT");
+  if (compressChunks) {
+    compressed = false;
+  }
+  else if (compressed) {
+    compressed = comm.beginCompressedOutput();
+  }
+  
   // Route commands to appropriate handlers
   if (command.startsWith("update_")) {
     handleConfigCommand(command);
@@ -94,6 +230,46 @@ void handleCommand(const String& command) {
   else if (command == "#VER*") {
     handleVersionCommand();
   }
+  else if (command == "#SLEEPMODEL*" || command == "#SLEEPMODEL=RESET*") {
+    if (command == "#SLEEPMODEL=RESET*") {
+      powerMgr.resetSleepModel();
+    }
+    comm.println(powerMgr.getSleepModelReport());
+  }
+  else if (command.startsWith("#PM")) {
+    handlePowerCommand(command);
+  }
+  else if (command == "#BOOT*") {
+    comm.println(warmBoot.getReport());
+  }
+  else if (command == "#ENERGY*") {
+    updateEnergyStates();
+    comm.println(energyMonitor.getReport());
+  }
+  else if (command == "#WIFI*") {
+    comm.println(network.getStatusReport());
+  }
+  else if (command == "#OTA*") {
+    otaManager.printUpdateStatus();
+  }
+  else if (command == "#LOG*") {
+    comm.println(readingLog.getStatusReport());
+  }
+  else if (command == "#LOGLAST*") {
+    handleLogLastCommand();
+  }
+  else if (command.startsWith("#LOGEXPORT")) {
+    handleLogExportCommand(command, compressChunks);
+  }
+  else if (command.startsWith("#LOG?")) {
+    handleLogQueryCommand(command);
+  }
+  else if (command.startsWith("#SCHED")) {
+    handleScheduleCommand(command);
+  }
+  else if (command.startsWith("#TIME=")) {
+    handleTimeCommand(command);
+  }
   else if (command == "get_config") {
     comm.printConfig(config);
   }
@@ -104,8 +280,12 @@ void handleCommand(const String& command) {
     comm.println("Unknown command: " + command);
   }
   
+  if (compressed) {
+    comm.endCompressedOutput();
+  }
+  
   // End feedback and reset sleep timer
-  hardware.ledOff();
+  statusLed.set(LED_STATE_COMMAND, false);
   hardware.doubleBeep();
   powerMgr.resetSleepTimer();
 }
@@ -116,9 +296,11 @@ void handleConfigCommand(const String& command) {
   }
   else if (command.startsWith("update_ssid")) {
     config.updateSSID(command.substring(13));
+    network.setPrimaryNetwork(config.getSSID(), config.getPassword());
   }
   else if (command.startsWith("update_password")) {
     config.updatePassword(command.substring(17));
+    network.setPrimaryNetwork(config.getSSID(), config.getPassword());
   }
   else if (command.startsWith("update_ipaddress")) {
     config.updateIPAddress(command.substring(18));
@@ -126,14 +308,71 @@ void handleConfigCommand(const String& command) {
   else if (command.startsWith("update_port")) {
     config.updatePort(command.substring(13));
   }
+  else if (command.startsWith("update_config")) {
+    handleBatchConfigCommand(command.substring(13));
+  }
+  else if (command.startsWith("update_addwifi")) {
+    handleAddNetworkCommand(command.substring(16));
+  }
+  else if (command.startsWith("update_clearwifi")) {
+    network.clearStoredNetworks();
+    comm.println("Stored WiFi networks cleared");
+  }
+  else if (command.startsWith("update_check")) {
+    ScopedPowerLock otaLock(powerMgr, POWER_LOCK_OTA);
+    ScopedPowerPhase radioPhase(powerMgr, PHASE_RADIO);
+    bool available = otaManager.checkForUpdates(config);
+    comm.println(available ? "Run update_firmware to install it" : "Nothing to install");
+  }
   else if (command.startsWith("update_firmware")) {
-    otaManager.performUpdate(config);
+    ScopedPowerLock otaLock(powerMgr, POWER_LOCK_OTA);
+    ScopedPowerPhase radioPhase(powerMgr, PHASE_RADIO);
+    ScopedLedState otaLed(statusLed, LED_STATE_OTA);
+    statusLed.setProgress(0);
+    UpdateResult result = otaManager.performUpdate(config);
+    if (result != UPDATE_SUCCESS && result != UPDATE_NO_UPDATES) {
+      statusLed.pulse(LED_STATE_ERROR);
+    }
   }
   else {
     comm.println("Unknown config command");
   }
 }
 
+void handleBatchConfigCommand(String args) {
+  // Format: update_config <key>=<value>;<key>=<value>...
+  // Keys: bname, ssid, password, ipaddress, port
+  args.trim();
+  if (args.startsWith(":")) {
+    args = args.substring(1);
+    args.trim();
+  }
+  
+  String error;
+  if (config.updateBatch(args, error)) {
+    network.setPrimaryNetwork(config.getSSID(), config.getPassword());
+    comm.println("Configuration updated");
+  } else {
+    comm.println("Configuration unchanged: " + error);
+  }
+}
+
+void handleAddNetworkCommand(const String& args) {
+  // Format: <ssid>,<password>
+  int separator = args.indexOf(',');
+  if (separator <= 0) {
+    comm.println("Usage: update_addwifi <ssid>,<password>");
+    return;
+  }
+  
+  String ssid = args.substring(0, separator);
+  if (network.storeNetwork(ssid, args.substring(separator + 1))) {
+    comm.println("WiFi network stored: " + ssid);
+  } else {
+    comm.println("Could not store WiFi network (list full or invalid SSID)");
+  }
+}
+
 void handleMeterCommand(const String& command) {
   MeterType meterType = parseMeterCommand(command);
   if (meterType == METER_TYPE_UNKNOWN) {
@@ -141,26 +380,280 @@ void handleMeterCommand(const String& command) {
     return;
   }
   
+  ScopedPowerLock readLock(powerMgr, POWER_LOCK_METER_READ);
+  ScopedLedState readingLed(statusLed, LED_STATE_READING);
+  batteryModel.beginRead();
+  PeripheralSession frontEnd(peripherals, PERIPH_FRONT_END);
   MeterData data;
-  bool success = meterReader.readMeter(meterType, data);
+  bool success;
+  {
+    // Mostly turnaround delays and UART waits: stay at the low clock
+    ScopedPowerPhase waitPhase(powerMgr, PHASE_METER_WAIT);
+    success = meterReader.readMeter(meterType, data);
+  }
   
   if (success) {
+    ParsedMeterData parsed;
     if (shouldParseData(command)) {
-      parser.parseAndPrint(data, meterType);
+      ScopedPowerPhase parsePhase(powerMgr, PHASE_PARSE);
+      parser.parseAndPrint(data, meterType, parsed);
     } else {
-      comm.println(data.rawData);
+      {
+        ScopedPowerPhase radioPhase(powerMgr, PHASE_RADIO);
+        comm.sendRawFrame(data);
+      }
+      ScopedPowerPhase parsePhase(powerMgr, PHASE_PARSE);
+      parser.parse(data, meterType, parsed, true);
     }
     
+    // Keep a copy on flash in case the phone misses the reply
+    readingLog.append(data, parsed);
+    
     comm.printBatteryStatus(powerMgr.getBatteryLevel());
     comm.printDataReceived(getMeterTypeString(meterType));
   } else {
+    statusLed.pulse(LED_STATE_ERROR);
     comm.println("Error: Failed to read meter data");
   }
+  batteryModel.endRead();
+}
+
+void handleLogLastCommand() {
+  LogRecord record;
+  if (readingLog.readLatest(record)) {
+    comm.println(readingLog.formatRecord(record));
+  } else {
+    comm.println("Reading log is empty");
+  }
+}
+
+// One page of #LOG? output; resumeFrom is the first match left out
+struct LogQueryPage {
+  uint32_t printed;
+  uint32_t resumeFrom;
+};
+
+bool printLogRecord(const LogRecord& record, void* context) {
+  LogQueryPage* page = static_cast<LogQueryPage*>(context);
+  if (page->printed >= LOG_QUERY_MAX_RESULTS) {
+    page->resumeFrom = record.sequence;
+    return false;
+  }
+  comm.println(readingLog.formatRecordSummary(record));
+  page->printed++;
+  return true;
+}
+
+void handleLogQueryCommand(const String& command) {
+  // Format: #LOG?ID=<meter id>[,from=<seq>]* or #LOG?SINCE=<epoch>[,from=<seq>]*
+  if (!command.endsWith("*")) {
+    comm.println("Usage: #LOG?ID=<meter id>[,from=<seq>]* or #LOG?SINCE=<epoch>[,from=<seq>]*");
+    return;
+  }
+  String query = command.substring(5, command.length() - 1);
+  
+  // A truncated result names the sequence to continue from
+  uint32_t fromSequence = 0;
+  int fromPos = query.lastIndexOf(",from=");
+  if (fromPos != -1) {
+    fromSequence = strtoul(query.c_str() + fromPos + 6, nullptr, 10);
+    query = query.substring(0, fromPos);
+  }
+  
+  LogQueryPage page = { 0, 0 };
+  unsigned long start = millis();
+  LogQueryResult result;
+  
+  if (query.startsWith("ID=") && query.length() > 3) {
+    result = readingLog.findByMeter(query.substring(3), printLogRecord, &page, fromSequence);
+  }
+  else if (query.startsWith("SINCE=") && query.length() > 6) {
+    result = readingLog.findSince(strtoul(query.c_str() + 6, nullptr, 10), printLogRecord, &page, fromSequence);
+  }
+  else {
+    comm.println("Usage: #LOG?ID=<meter id>[,from=<seq>]* or #LOG?SINCE=<epoch>[,from=<seq>]*");
+    return;
+  }
+  
+  comm.println("Matches: " + String(page.printed) + (result.stopped ? " (truncated)" : "") +
+               ", sectors read: " + String(result.sectorsRead) + ", " + String(millis() - start) + " ms");
+  if (result.stopped) {
+    comm.println("More: #LOG?" + query + ",from=" + String(page.resumeFrom) + "*");
+  }
+}
+
+void handleLogExportCommand(const String& command, bool compressChunks) {
+  // Format: #LOGEXPORT* or #LOGEXPORT=<from sequence>[,<window>]*
+  uint32_t fromSequence = 0;
+  uint16_t window = LOG_EXPORT_WINDOW;
+  
+  if (command.startsWith("#LOGEXPORT=")) {
+    String args = command.substring(11);
+    fromSequence = strtoul(args.c_str(), nullptr, 10);
+    int separator = args.indexOf(',');
+    if (separator != -1) {
+      window = (uint16_t)strtoul(args.c_str() + separator + 1, nullptr, 10);
+    }
+  }
+  else if (command != "#LOGEXPORT*") {
+    comm.println("Usage: #LOGEXPORT=<from sequence>[,<window>]*");
+    return;
+  }
+  
+  ScopedPowerPhase radioPhase(powerMgr, PHASE_RADIO);
+  logExporter.exportFrom(fromSequence, window, compressChunks);
+}
+
+void handleTimeCommand(const String& command) {
+  // Format: #TIME=<epoch seconds>*
+  uint32_t epoch = strtoul(command.c_str() + 6, nullptr, 10);
+  if (epoch < LOG_CLOCK_VALID_AFTER) {
+    comm.println("Usage: #TIME=<epoch seconds>*");
+    return;
+  }
+  
+  struct timeval now = { (time_t)epoch, 0 };
+  settimeofday(&now, nullptr);
+  comm.println("Clock set: " + String(epoch));
+}
+
+void handleScheduleCommand(const String& command) {
+  // Format: #SCHED* (report), #SCHED=OFF* or #SCHED=<seconds>,<meter command>[,<upload every N cycles>]*
+  // The meter command is given without '#' and '*', e.g. #SCHED=900,IRDA3P,96*
+  if (command.startsWith("#SCHED=")) {
+    uint32_t intervalS = 0;
+    MeterType meterType = METER_TYPE_UNKNOWN;
+    long uploadEvery = 0;
+    
+    if (command != "#SCHED=OFF*") {
+      String args = command.substring(7, command.length() - 1);
+      int firstComma = args.indexOf(',');
+      int secondComma = firstComma == -1 ? -1 : args.indexOf(',', firstComma + 1);
+      if (firstComma == -1) {
+        comm.println("Usage: #SCHED=<seconds>,<meter command>[,<upload every N cycles>]*");
+        return;
+      }
+      intervalS = args.substring(0, firstComma).toInt();
+      String meterCommand = secondComma == -1 ? args.substring(firstComma + 1) : args.substring(firstComma + 1, secondComma);
+      meterType = parseMeterCommand("#" + meterCommand + "*");
+      if (secondComma != -1) {
+        String uploadText = args.substring(secondComma + 1);
+        char* end = nullptr;
+        uploadEvery = strtol(uploadText.c_str(), &end, 10);
+        if (uploadText.length() == 0 || *end != '\0') {
+          uploadEvery = -1;  // Not a number; rejected with the range error below
+        }
+      }
+      if (intervalS == 0) {
+        comm.println("Usage: #SCHED=<seconds>,<meter command>[,<upload every N cycles>]*");
+        return;
+      }
+    }
+    
+    String error;
+    if (!config.updateSchedule(intervalS, meterType, uploadEvery, error)) {
+      comm.println("ERROR: " + error);
+      return;
+    }
+  } else if (command != "#SCHED*") {
+    comm.println("Usage: #SCHED*, #SCHED=OFF* or #SCHED=<seconds>,<meter command>[,<upload every N cycles>]*");
+    return;
+  }
+  comm.println(scheduler.getReport());
+}
+
+// One timer-wake reading: Bluetooth stays off, WiFi only when an upload is due
+void runScheduledCycle() {
+  Serial.println("Scheduled reading cycle");
+  
+  hardware.init();
+  peripherals.setHardwareControl(&hardware);
+  peripherals.powerUp(PERIPH_FRONT_END);
+  comm.init(config.getBluetoothName(), false);
+  readingLog.init();
+  meterReader.setCommunicationManager(&comm);
+  meterReader.setHardwareControl(&hardware);
+  parser.setCommunicationManager(&comm);
+  powerMgr.setHardwareControl(&hardware);
+  powerMgr.setEnergyMonitor(&energyMonitor);
+  
+  MeterType meterType = config.getScheduleMeterType();
+  MeterData data;
+  bool success;
+  batteryModel.beginRead();
+  {
+    PeripheralSession frontEnd(peripherals, PERIPH_FRONT_END);
+    success = meterReader.readMeter(meterType, data);
+  }
+  peripherals.powerDownAll();
+  batteryModel.endRead();
+  if (success) {
+    ParsedMeterData parsed;
+    parser.parse(data, meterType, parsed, true);
+    readingLog.append(data, parsed);
+  }
+  scheduler.recordRead(success);
+  
+  // The writer task must be done before an upload reads the log or the flash loses power
+  readingLog.flush();
+  if (scheduler.isUploadDue()) {
+    uploadScheduledReadings();
+  }
+  
+  powerMgr.enterTimedSleep(scheduler.getSleepUs());
+}
+
+void uploadScheduledReadings() {
+  network.init();
+  network.setPrimaryNetwork(config.getSSID(), config.getPassword());
+  logUploader.setReadingLog(&readingLog);
+  
+  energyMonitor.setState(ENERGY_WIFI, true);
+  uint32_t uploadedThrough = scheduler.getUploadFrom() - 1;
+  bool success = network.connect() &&
+                 logUploader.uploadFrom(config.getIPAddress(), config.getPortInt(), config.getBluetoothName(),
+                                        scheduler.getUploadFrom(), uploadedThrough);
+  network.disconnect();
+  energyMonitor.setState(ENERGY_WIFI, false);
+  
+  scheduler.recordUpload(success, uploadedThrough);
 }
 
 void handleBatteryCommand() {
   int batteryLevel = powerMgr.getBatteryLevel();
   comm.printBatteryStatus(batteryLevel);
+  
+  // Predictions for route planning
+  BatteryInfo info = powerMgr.getBatteryInfo();
+  updateEnergyStates();
+  comm.println(batteryModel.getReport(info.voltageV, info.loadMilliAmps));
+}
+
+void handlePowerCommand(const String& command) {
+  // Format: #PM* (report), #PM=ON* or #PM=OFF* (compare idle current on a bench)
+  if (command == "#PM=ON*" || command == "#PM=OFF*") {
+    bool enable = command == "#PM=ON*";
+    if (!powerMgr.setLightSleep(enable)) {
+      comm.println("ERROR: Light sleep not available");
+      return;
+    }
+  } else if (command != "#PM*") {
+    comm.println("Usage: #PM*, #PM=ON* or #PM=OFF*");
+    return;
+  }
+  comm.println(powerMgr.getLightSleepReport());
+  comm.println(powerMgr.getPhaseReport());
+  comm.println(peripherals.getReport());
+  comm.println(powerMgr.getButtonReport());
+  comm.println(statusLed.getReport());
+}
+
+void updateEnergyStates() {
+  bool connected = comm.isBluetoothConnected();
+  energyMonitor.setState(ENERGY_BT_CONNECTED, connected);
+  energyMonitor.setState(ENERGY_BT_ADVERTISING, !connected);
+  energyMonitor.setState(ENERGY_WIFI, WiFi.getMode() != WIFI_OFF);
+  energyMonitor.setCpuIdleTime(powerMgr.getIdleTimeUs());
 }
 
 void handleVersionCommand() {
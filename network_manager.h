@@ -0,0 +1,568 @@
+/*
+ * network_manager.h - Shared WiFi service with fast reconnect
+ *
+ * This file contains the NetworkManager class that owns the WiFi
+ * station for every module. It keeps a small list of known networks,
+ * caches the last good BSSID, channel and IP lease in RTC memory (with
+ * an NVS copy for cold boots) and connects asynchronously:
+ *
+ *   1. Fast path: direct association to the cached BSSID/channel with
+ *      the cached IP lease (no scan, no DHCP)
+ *   2. Fallback: async scan, then connect to the strongest known network
+ *
+ * The cached lease is only reused for WIFI_LEASE_REUSE_S after DHCP
+ * handed it out, measured on the RTC clock that keeps running through
+ * deep sleep. Connects that reuse it do not extend that time; after it,
+ * or when the clock was reset with the chip, the fast path still skips
+ * the scan but asks DHCP again.
+ */
+
+#ifndef NETWORK_MANAGER_H
+#define NETWORK_MANAGER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include <esp_rom_crc.h>
+#include <esp_rtc_time.h>
+#include "config.h"
+
+// Connection states
+enum NetworkState {
+  NET_IDLE,
+  NET_FAST_CONNECTING,
+  NET_SCANNING,
+  NET_CONNECTING,
+  NET_CONNECTED,
+  NET_FAILED
+};
+
+// Known network entry
+struct WiFiNetwork {
+  String ssid;
+  String password;
+};
+
+// Association data reused by the fast path
+struct WiFiFastConnectCache {
+  uint32_t magic;
+  uint32_t ssidHash;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint64_t leaseObtainedUs;     // RTC time DHCP handed out the lease; 0 = unknown
+  uint32_t crc;
+};
+
+#define WIFI_CACHE_MAGIC 0x57464332  // "WFC2"
+
+// Survives deep sleep; re-seeded from NVS after power loss
+RTC_DATA_ATTR static WiFiFastConnectCache rtcWiFiCache;
+
+class NetworkManager {
+private:
+  Preferences preferences;
+  WiFiNetwork networks[WIFI_MAX_NETWORKS];
+  int networkCount;
+  int persistentStart;          // 1 once the primary (ConfigManager) network is set
+
+  NetworkState state;
+  int activeNetwork;
+  unsigned long connectStartTime;
+  unsigned long phaseStartTime;
+  unsigned long lastConnectTimeMs;
+  bool lastConnectWasFast;
+  uint32_t fastConnects;
+  uint32_t scanConnects;
+  uint32_t failedConnects;
+
+  // Cache handling
+  bool isCacheValid(const WiFiFastConnectCache& cache);
+  void sealCache(WiFiFastConnectCache& cache);
+  void loadCache();
+  void saveCache();
+  void clearCache();
+  bool isLeaseFresh(const WiFiFastConnectCache& cache);
+  int findNetworkByHash(uint32_t ssidHash);
+  static uint32_t hashSSID(const String& ssid);
+
+  // Connection phases
+  bool startFastConnect();
+  void startScan();
+  bool connectToBestScanResult();
+  void onConnected();
+  void onFailed(const String& reason);
+  void prepareStation();
+
+  // Persistence of extra networks
+  void loadStoredNetworks();
+  void saveStoredNetworks();
+
+  void logNetworkEvent(const String& event);
+
+public:
+  NetworkManager();
+
+  // Initialization
+  void init();
+
+  // Known networks
+  void setPrimaryNetwork(const String& ssid, const String& password);
+  bool storeNetwork(const String& ssid, const String& password);
+  void clearStoredNetworks();
+  int getNetworkCount() const { return networkCount; }
+
+  // Connection control
+  bool beginConnect();
+  void update();
+  bool connect(unsigned long timeoutMs = WIFI_CONNECT_TIMEOUT_MS);
+  void disconnect();
+
+  // Status
+  bool isConnected();
+  bool isBusy() const { return state == NET_FAST_CONNECTING || state == NET_SCANNING || state == NET_CONNECTING; }
+  NetworkState getState() const { return state; }
+  String getStateString() const;
+  unsigned long getLastConnectTimeMs() const { return lastConnectTimeMs; }
+  bool wasLastConnectFast() const { return lastConnectWasFast; }
+  String getActiveSSID() const;
+
+  // Diagnostics
+  String getStatusReport();
+};
+
+// Implementation
+NetworkManager::NetworkManager()
+  : networkCount(0), persistentStart(0), state(NET_IDLE), activeNetwork(-1),
+    connectStartTime(0), phaseStartTime(0), lastConnectTimeMs(0), lastConnectWasFast(false),
+    fastConnects(0), scanConnects(0), failedConnects(0) {
+}
+
+void NetworkManager::init() {
+  preferences.begin("network", false);
+
+  // Keep the driver from rewriting credentials to flash on every begin()
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false);
+
+  loadStoredNetworks();
+  loadCache();
+
+  logNetworkEvent("Initialized with " + String(networkCount) + " stored network(s), fast-connect cache " +
+                  String(isCacheValid(rtcWiFiCache) ? "present" : "empty"));
+}
+
+// ========================= KNOWN NETWORKS =========================
+
+// The primary network lives in slot 0 and is replaced, never appended,
+// so calling this before every connect keeps the list from growing
+void NetworkManager::setPrimaryNetwork(const String& ssid, const String& password) {
+  if (persistentStart == 0) {
+    if (networkCount >= WIFI_MAX_NETWORKS) {
+      networkCount--;  // Drop the last stored network to make room
+    }
+    for (int i = networkCount; i > 0; i--) {
+      networks[i] = networks[i - 1];
+    }
+    networkCount++;
+    persistentStart = 1;
+  }
+
+  networks[0].ssid = ssid;
+  networks[0].password = password;
+}
+
+bool NetworkManager::storeNetwork(const String& ssid, const String& password) {
+  if (ssid.length() == 0 || ssid.length() > 32) {
+    return false;
+  }
+
+  for (int i = persistentStart; i < networkCount; i++) {
+    if (networks[i].ssid == ssid) {
+      networks[i].password = password;
+      saveStoredNetworks();
+      return true;
+    }
+  }
+
+  if (networkCount >= WIFI_MAX_NETWORKS) {
+    logNetworkEvent("Network list full, cannot store " + ssid);
+    return false;
+  }
+
+  networks[networkCount].ssid = ssid;
+  networks[networkCount].password = password;
+  networkCount++;
+  saveStoredNetworks();
+
+  logNetworkEvent("Stored network: " + ssid);
+  return true;
+}
+
+void NetworkManager::clearStoredNetworks() {
+  networkCount = persistentStart;
+  saveStoredNetworks();
+  clearCache();
+  logNetworkEvent("Stored networks cleared");
+}
+
+void NetworkManager::loadStoredNetworks() {
+  int count = preferences.getUChar("count", 0);
+
+  for (int i = 0; i < count && networkCount < WIFI_MAX_NETWORKS; i++) {
+    String ssid = preferences.getString(("s" + String(i)).c_str(), "");
+    if (ssid.length() > 0) {
+      networks[networkCount].ssid = ssid;
+      networks[networkCount].password = preferences.getString(("p" + String(i)).c_str(), "");
+      networkCount++;
+    }
+  }
+}
+
+void NetworkManager::saveStoredNetworks() {
+  int count = networkCount - persistentStart;
+
+  for (int i = 0; i < count; i++) {
+    preferences.putString(("s" + String(i)).c_str(), networks[persistentStart + i].ssid);
+    preferences.putString(("p" + String(i)).c_str(), networks[persistentStart + i].password);
+  }
+  preferences.putUChar("count", count);
+}
+
+// ========================= FAST-CONNECT CACHE =========================
+
+uint32_t NetworkManager::hashSSID(const String& ssid) {
+  return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(ssid.c_str()), ssid.length());
+}
+
+bool NetworkManager::isCacheValid(const WiFiFastConnectCache& cache) {
+  if (cache.magic != WIFI_CACHE_MAGIC) {
+    return false;
+  }
+  uint32_t crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&cache), offsetof(WiFiFastConnectCache, crc));
+  return crc == cache.crc;
+}
+
+void NetworkManager::sealCache(WiFiFastConnectCache& cache) {
+  cache.magic = WIFI_CACHE_MAGIC;
+  cache.crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&cache), offsetof(WiFiFastConnectCache, crc));
+}
+
+void NetworkManager::loadCache() {
+  if (isCacheValid(rtcWiFiCache)) {
+    return;
+  }
+
+  // Cold boot: RTC memory is lost, fall back to the NVS copy; the RTC
+  // clock restarted too, so the lease age is unknown
+  WiFiFastConnectCache stored;
+  if (preferences.getBytes("cache", &stored, sizeof(stored)) == sizeof(stored) && isCacheValid(stored)) {
+    stored.leaseObtainedUs = 0;
+    sealCache(stored);
+    rtcWiFiCache = stored;
+  }
+}
+
+bool NetworkManager::isLeaseFresh(const WiFiFastConnectCache& cache) {
+  uint64_t now = esp_rtc_get_time_us();
+  return cache.leaseObtainedUs != 0 && now >= cache.leaseObtainedUs &&
+         now - cache.leaseObtainedUs < (uint64_t)WIFI_LEASE_REUSE_S * 1000000ULL;
+}
+
+void NetworkManager::saveCache() {
+  WiFiFastConnectCache cache;
+  memset(&cache, 0, sizeof(cache));
+
+  cache.ssidHash = hashSSID(networks[activeNetwork].ssid);
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.channel = (uint8_t)WiFi.channel();
+  cache.ip = (uint32_t)WiFi.localIP();
+  cache.gateway = (uint32_t)WiFi.gatewayIP();
+  cache.subnet = (uint32_t)WiFi.subnetMask();
+  cache.dns = (uint32_t)WiFi.dnsIP();
+
+  // A reused lease keeps the time DHCP gave it out
+  bool reused = lastConnectWasFast && isLeaseFresh(rtcWiFiCache) && cache.ip == rtcWiFiCache.ip;
+  cache.leaseObtainedUs = reused ? rtcWiFiCache.leaseObtainedUs : esp_rtc_get_time_us();
+  sealCache(cache);
+
+  // The lease time alone does not count as a change
+  bool changed = memcmp(&cache, &rtcWiFiCache, offsetof(WiFiFastConnectCache, leaseObtainedUs)) != 0;
+  rtcWiFiCache = cache;
+
+  // Only touch flash when the association actually changed
+  if (changed) {
+    preferences.putBytes("cache", &cache, sizeof(cache));
+  }
+}
+
+void NetworkManager::clearCache() {
+  memset(&rtcWiFiCache, 0, sizeof(rtcWiFiCache));
+  preferences.remove("cache");
+}
+
+int NetworkManager::findNetworkByHash(uint32_t ssidHash) {
+  for (int i = 0; i < networkCount; i++) {
+    if (networks[i].ssid.length() > 0 && hashSSID(networks[i].ssid) == ssidHash) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// ========================= CONNECTION STATE MACHINE =========================
+
+void NetworkManager::prepareStation() {
+  WiFi.disconnect();
+  WiFi.mode(WIFI_STA);
+  WiFi.setTxPower(WIFI_POWER_19_5dBm);
+}
+
+bool NetworkManager::beginConnect() {
+  if (isBusy()) {
+    return true;
+  }
+
+  if (networkCount == 0) {
+    onFailed("No networks configured");
+    return false;
+  }
+
+  connectStartTime = millis();
+  prepareStation();
+
+  if (!startFastConnect()) {
+    startScan();
+  }
+  return true;
+}
+
+bool NetworkManager::startFastConnect() {
+  if (!isCacheValid(rtcWiFiCache)) {
+    return false;
+  }
+
+  activeNetwork = findNetworkByHash(rtcWiFiCache.ssidHash);
+  if (activeNetwork < 0) {
+    return false;
+  }
+
+  // Reuse the previous lease to skip DHCP, but only while it is surely still ours
+  bool reuseLease = isLeaseFresh(rtcWiFiCache);
+  if (reuseLease) {
+    WiFi.config(IPAddress(rtcWiFiCache.ip), IPAddress(rtcWiFiCache.gateway),
+                IPAddress(rtcWiFiCache.subnet), IPAddress(rtcWiFiCache.dns));
+  } else {
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+  }
+  WiFi.begin(networks[activeNetwork].ssid.c_str(), networks[activeNetwork].password.c_str(),
+             rtcWiFiCache.channel, rtcWiFiCache.bssid);
+
+  state = NET_FAST_CONNECTING;
+  phaseStartTime = millis();
+  logNetworkEvent("Fast connect to " + networks[activeNetwork].ssid + " on channel " + String(rtcWiFiCache.channel) +
+                  (reuseLease ? " with the cached lease" : " with DHCP"));
+  return true;
+}
+
+void NetworkManager::startScan() {
+  // Drop any static lease left from a failed fast path
+  WiFi.disconnect();
+  WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+
+  WiFi.scanNetworks(true);
+  state = NET_SCANNING;
+  phaseStartTime = millis();
+  logNetworkEvent("Scanning for known networks");
+}
+
+bool NetworkManager::connectToBestScanResult() {
+  int found = WiFi.scanComplete();
+  int bestResult = -1;
+  int bestNetwork = -1;
+  int bestRSSI = -1000;
+
+  for (int i = 0; i < found; i++) {
+    // Hidden networks report a blank SSID; never match them to an unset one
+    String ssid = WiFi.SSID(i);
+    if (ssid.length() == 0) {
+      continue;
+    }
+    for (int n = 0; n < networkCount; n++) {
+      if (networks[n].ssid == ssid && WiFi.RSSI(i) > bestRSSI) {
+        bestRSSI = WiFi.RSSI(i);
+        bestResult = i;
+        bestNetwork = n;
+      }
+    }
+  }
+
+  if (bestResult < 0) {
+    WiFi.scanDelete();
+    return false;
+  }
+
+  activeNetwork = bestNetwork;
+  uint8_t bssid[6];
+  memcpy(bssid, WiFi.BSSID(bestResult), sizeof(bssid));
+  int32_t channel = WiFi.channel(bestResult);
+  WiFi.scanDelete();
+
+  WiFi.begin(networks[activeNetwork].ssid.c_str(), networks[activeNetwork].password.c_str(), channel, bssid);
+
+  state = NET_CONNECTING;
+  phaseStartTime = millis();
+  logNetworkEvent("Connecting to " + networks[activeNetwork].ssid + " (" + String(bestRSSI) + " dBm, channel " + String(channel) + ")");
+  return true;
+}
+
+void NetworkManager::update() {
+  unsigned long phaseElapsed = millis() - phaseStartTime;
+
+  switch (state) {
+    case NET_FAST_CONNECTING:
+      if (WiFi.status() == WL_CONNECTED) {
+        lastConnectWasFast = true;
+        onConnected();
+      } else if (phaseElapsed > WIFI_FAST_CONNECT_TIMEOUT_MS) {
+        logNetworkEvent("Fast connect timed out, falling back to scan");
+        startScan();
+      }
+      break;
+
+    case NET_SCANNING: {
+      int result = WiFi.scanComplete();
+      if (result == WIFI_SCAN_RUNNING) {
+        break;
+      }
+      if (result < 0 || !connectToBestScanResult()) {
+        onFailed("No known network in range");
+      }
+      break;
+    }
+
+    case NET_CONNECTING:
+      if (WiFi.status() == WL_CONNECTED) {
+        lastConnectWasFast = false;
+        onConnected();
+      } else if (millis() - connectStartTime > WIFI_CONNECT_TIMEOUT_MS) {
+        onFailed("Association timed out");
+      }
+      break;
+
+    case NET_CONNECTED:
+      if (WiFi.status() != WL_CONNECTED) {
+        state = NET_IDLE;
+        logNetworkEvent("Connection lost");
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+void NetworkManager::onConnected() {
+  state = NET_CONNECTED;
+  lastConnectTimeMs = millis() - connectStartTime;
+  if (lastConnectWasFast) {
+    fastConnects++;
+  } else {
+    scanConnects++;
+  }
+
+  saveCache();
+
+  logNetworkEvent("Connected to " + networks[activeNetwork].ssid + " in " + String(lastConnectTimeMs) + " ms (" +
+                  String(lastConnectWasFast ? "fast path" : "after scan") + "), IP " + WiFi.localIP().toString());
+}
+
+void NetworkManager::onFailed(const String& reason) {
+  state = NET_FAILED;
+  failedConnects++;
+  WiFi.disconnect();
+  WiFi.mode(WIFI_OFF);
+  logNetworkEvent("Connection failed: " + reason);
+}
+
+bool NetworkManager::connect(unsigned long timeoutMs) {
+  if (isConnected()) {
+    return true;
+  }
+
+  if (!beginConnect()) {
+    return false;
+  }
+
+  unsigned long start = millis();
+  while (isBusy() && millis() - start < timeoutMs) {
+    update();
+    delay(10);
+  }
+
+  if (isBusy()) {
+    onFailed("Timeout after " + String(timeoutMs / 1000) + " seconds");
+  }
+
+  return state == NET_CONNECTED;
+}
+
+void NetworkManager::disconnect() {
+  WiFi.disconnect();
+  WiFi.mode(WIFI_OFF);
+  state = NET_IDLE;
+  logNetworkEvent("WiFi disconnected");
+}
+
+// ========================= STATUS =========================
+
+bool NetworkManager::isConnected() {
+  return state == NET_CONNECTED && WiFi.status() == WL_CONNECTED;
+}
+
+String NetworkManager::getStateString() const {
+  switch (state) {
+    case NET_IDLE: return "IDLE";
+    case NET_FAST_CONNECTING: return "FAST_CONNECTING";
+    case NET_SCANNING: return "SCANNING";
+    case NET_CONNECTING: return "CONNECTING";
+    case NET_CONNECTED: return "CONNECTED";
+    case NET_FAILED: return "FAILED";
+    default: return "UNKNOWN";
+  }
+}
+
+String NetworkManager::getActiveSSID() const {
+  if (activeNetwork < 0 || activeNetwork >= networkCount) {
+    return "";
+  }
+  return networks[activeNetwork].ssid;
+}
+
+String NetworkManager::getStatusReport() {
+  String report = "=== WiFi Status ===\n";
+  report += "State: " + getStateString() + "\n";
+  if (isConnected()) {
+    report += "SSID: " + getActiveSSID() + "\n";
+    report += "IP: " + WiFi.localIP().toString() + "\n";
+    report += "Signal: " + String(WiFi.RSSI()) + " dBm\n";
+  }
+  report += "Known networks: " + String(networkCount) + "\n";
+  report += "Fast-connect cache: " + String(isCacheValid(rtcWiFiCache) ? "valid" : "empty") + "\n";
+  if (lastConnectTimeMs > 0) {
+    report += "Last connect: " + String(lastConnectTimeMs) + " ms (" + String(lastConnectWasFast ? "fast" : "scan") + ")\n";
+  }
+  report += "Connects fast/scan/failed: " + String(fastConnects) + "/" + String(scanConnects) + "/" + String(failedConnects) + "\n";
+  report += "===================";
+  return report;
+}
+
+void NetworkManager::logNetworkEvent(const String& event) {
+  Serial.println("[WiFi] " + event);
+}
+
+#endif // NETWORK_MANAGER_H
@@ -0,0 +1,910 @@
+/*
+ * ota_download.h - Resumable firmware download into the inactive OTA slot
+ *
+ * This file contains the OtaDownload class that fetches the firmware
+ * image with plain HTTP GETs and writes it straight into the next OTA
+ * partition, one flash sector at a time. A sector only counts as written
+ * once it has been read back from flash. The written offset is saved in
+ * NVS every OTA_SAVE_INTERVAL_BYTES, so after a dropped connection or a
+ * reboot the download carries on with "Range: bytes=<offset>-" instead
+ * of starting over.
+ *
+ * The server's ETag is sent back as If-Range, so all pieces come from
+ * the same image; if the image changed, the server answers 200 with the
+ * whole file and the download starts again from zero.
+ *
+ * Each sector is added to a running SHA-256 (the hardware SHA engine,
+ * through mbedtls) right after it has been read back, so the hash is
+ * ready when the last byte is in; only a download resumed after a reboot
+ * reads its earlier sectors back once to catch up. The hash must match
+ * the server's X-Image-SHA256 header, and the manifest's ECDSA signature
+ * must verify against OTA_SIGNING_PUBLIC_KEY, before the boot partition
+ * is switched. Without a key built in nothing is made bootable.
+ *
+ * The body can also be a delta patch (fw_patch.h) against the running
+ * firmware. It is decoded as it arrives, copying unchanged runs from the
+ * running partition. Patch operations stop at every sector boundary, so
+ * the patch offset saved with each sector is a clean place to resume.
+ *
+ * Full image requests also send "Accept-Encoding: fwz". A server with a
+ * fw_compress.h image answers with "Content-Encoding: fwz" and the device
+ * decompresses it block by block into the sector buffer; any other
+ * server sends the plain image as before. Compressed blocks line up
+ * with flash sectors, so this resumes the same way too.
+ */
+
+#ifndef OTA_DOWNLOAD_H
+#define OTA_DOWNLOAD_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/pk.h>
+#include "config.h"
+#include "fw_patch.h"
+#include "fw_compress.h"
+#include "sleep_gate.h"
+
+#define OTA_RESUME_MAGIC 0x4F544132  // "OTA2"
+#define OTA_SHA256_SIZE 32
+
+// What the response body holds
+enum OtaEncoding {
+  OTA_ENCODING_IMAGE,           // The image itself
+  OTA_ENCODING_PATCH,           // fw_patch.h delta against the running image
+  OTA_ENCODING_COMPRESSED       // fw_compress.h image, Content-Encoding: fwz
+};
+
+// Kept in NVS while a download is unfinished
+struct OtaResumeState {
+  uint32_t magic;
+  uint32_t urlHash;             // CRC-32 of host:port/path
+  uint32_t partitionAddress;    // Slot the bytes went to
+  uint8_t encoding;             // OtaEncoding of the body being received
+  uint32_t sourceSize;          // Response body bytes (image, patch or compressed image)
+  uint32_t sourceOffset;        // Body bytes behind writtenBytes; the next Range starts here
+  uint32_t baseSize;            // Patch: size of the running image it applies to
+  uint32_t imageSize;           // 0 until a patch or compressed header has been seen
+  uint32_t writtenBytes;        // Written and read back; sector-aligned until the end
+  uint8_t hasSha256;
+  uint8_t sha256[OTA_SHA256_SIZE];
+  char etag[OTA_ETAG_MAX_LENGTH];
+};
+
+// What one response says about the image
+struct OtaResponseInfo {
+  int status;
+  uint32_t contentLength;
+  uint32_t rangeStart;          // Content-Range of a 206
+  uint32_t totalSize;
+  bool hasSha256;
+  uint8_t sha256[OTA_SHA256_SIZE];
+  String etag;
+  String contentEncoding;
+};
+
+enum OtaFetchResult {
+  OTA_FETCH_COMPLETE,           // Whole image written
+  OTA_FETCH_INTERRUPTED,        // Connection lost or stalled; worth another attempt
+  OTA_FETCH_FAILED              // Server or flash error; retrying will not help
+};
+
+// Image bytes written and, for a patch or compressed image, body bytes behind them
+typedef void (*OtaProgressFn)(int written, int imageSize, int received, int bodySize);
+
+class OtaDownload {
+private:
+  Preferences preferences;
+  const esp_partition_t* partition;
+  OtaResumeState state;
+  String host;
+  int port;
+  String path;
+  OtaEncoding encoding;          // What begin() asked for; the body may still come compressed
+  uint8_t* sector;              // OTA_SECTOR_SIZE, only between begin() and end()
+  uint32_t sectorFill;
+  FwPatchDecoder* patchDecoder; // Only while a patch download runs
+  FwCompressDecoder* compressDecoder;  // Only while a full image download runs, if memory allows
+  uint32_t requestOffset;       // Body offset the current response started at
+  OtaProgressFn progressFn;
+  uint8_t runningHash[OTA_SHA256_SIZE];
+  bool hasRunningHash;
+  uint8_t expectedSha256[OTA_SHA256_SIZE];
+  bool hasExpectedSha256;       // Set from the manifest after begin()
+  uint8_t expectedSignature[OTA_SIGNATURE_MAX_SIZE];
+  size_t expectedSignatureLength;  // 0 = none; also set from the manifest
+  mbedtls_sha256_context imageHash;  // Over the first hashedBytes of the slot
+  uint32_t hashedBytes;
+  uint32_t savedBytes;          // writtenBytes at the last NVS save
+  uint32_t resumedFrom;         // Offset the first request of this update started at
+  uint32_t resumes;             // 206 answers this update
+  uint32_t restarts;            // Image changed under a partial download
+  uint32_t bytesReceived;       // This update, including partial sectors lost to drops
+  String lastError;
+
+  void loadState(uint32_t urlHash);
+  void saveState();
+  void clearState();
+  void resetState(const OtaResponseInfo& info);
+
+  bool readResponse(WiFiClient& client, OtaResponseInfo& info);
+  void startDecoder();
+  bool writeBody(const uint8_t* data, size_t length);
+  bool writeImage(const uint8_t* data, size_t length);
+  bool commitSector();
+  void restartHash();
+  bool catchUpHash();
+  bool finishHash(uint8_t digest[OTA_SHA256_SIZE]);
+  bool verifySignature(const uint8_t digest[OTA_SHA256_SIZE]);
+  static bool parseSha256(const String& hex, uint8_t digest[OTA_SHA256_SIZE]);
+  void logDownloadEvent(const String& event);
+
+  // Patch decoder callbacks
+  static bool onPatchHeader(const FwPatchHeader& header, void* context);
+  static bool readRunningImage(uint32_t offset, uint8_t* data, size_t length, void* context);
+
+  // Compressed image callbacks
+  static bool onCompressedHeader(const FwCompressHeader& header, void* context);
+
+  // Decoded image bytes from either decoder
+  static bool writeDecodedImage(const uint8_t* data, size_t length, void* context);
+
+public:
+  OtaDownload();
+  ~OtaDownload() {
+    end();
+    mbedtls_sha256_free(&imageHash);
+  }
+
+  // Picks the inactive slot and loads any unfinished download of the same URL
+  bool begin(const String& serverHost, int serverPort, const String& imagePath,
+             OtaEncoding bodyEncoding = OTA_ENCODING_IMAGE);
+
+  // Hash of the image the manifest names: stands in for a missing X-Image-SHA256
+  // and must match what the server and any patch deliver
+  void expectSha256(const uint8_t hash[OTA_SHA256_SIZE]);
+
+  // DER ECDSA signature over the image; always required
+  void expectSignature(const uint8_t* signature, size_t length);
+  static bool hasSigningKey() { return sizeof(OTA_SIGNING_PUBLIC_KEY) > 1; }
+
+  // One HTTP request; continues from the saved offset
+  OtaFetchResult fetch(WiFiClient& client, OtaProgressFn progress);
+
+  // Hash and signature check, then the boot partition switch; the resume state is cleared either way
+  bool finish();
+
+  // Frees the sector buffer; an unfinished download stays resumable
+  void end();
+
+  // App hash of the running firmware (esp_partition_get_sha256), which patches name
+  bool getRunningHash(uint8_t hash[OTA_SHA256_SIZE]);
+  static String toHex(const uint8_t* data, size_t length);
+
+  // Status
+  bool isComplete() const { return state.imageSize > 0 && state.writtenBytes == state.imageSize; }
+  uint32_t getWrittenBytes() const { return state.writtenBytes; }
+  uint32_t getImageSize() const { return state.imageSize; }
+  uint32_t getSourceSize() const { return state.sourceSize; }
+  OtaEncoding getEncoding() const { return (OtaEncoding)state.encoding; }
+  uint32_t getResumedFrom() const { return resumedFrom; }
+  String getLastError() const { return lastError; }
+  String getReport();
+};
+
+// Implementation
+OtaDownload::OtaDownload()
+  : partition(nullptr), port(0), encoding(OTA_ENCODING_IMAGE), sector(nullptr), sectorFill(0),
+    patchDecoder(nullptr), compressDecoder(nullptr), requestOffset(0), progressFn(nullptr), hasRunningHash(false),
+    hasExpectedSha256(false), expectedSignatureLength(0), hashedBytes(0), savedBytes(0), resumedFrom(0), resumes(0),
+    restarts(0), bytesReceived(0) {
+  memset(&state, 0, sizeof(state));
+  mbedtls_sha256_init(&imageHash);
+}
+
+bool OtaDownload::begin(const String& serverHost, int serverPort, const String& imagePath,
+                        OtaEncoding bodyEncoding) {
+  host = serverHost;
+  port = serverPort;
+  path = imagePath;
+  encoding = bodyEncoding;
+  hasExpectedSha256 = false;
+  expectedSignatureLength = 0;
+  resumes = 0;
+  restarts = 0;
+  bytesReceived = 0;
+  lastError = "";
+
+  partition = esp_ota_get_next_update_partition(nullptr);
+  if (!partition) {
+    lastError = "No inactive OTA partition";
+    return false;
+  }
+
+  if (!sector) {
+    sector = (uint8_t*)malloc(OTA_SECTOR_SIZE);
+  }
+  if (!sector) {
+    lastError = "Out of memory for the sector buffer";
+    return false;
+  }
+  sectorFill = 0;
+
+  if (encoding == OTA_ENCODING_PATCH) {
+    if (!getRunningHash(runningHash)) {
+      lastError = "Cannot hash the running firmware";
+      return false;
+    }
+    if (!patchDecoder) {
+      patchDecoder = new (std::nothrow) FwPatchDecoder();
+    }
+    if (!patchDecoder) {
+      lastError = "Out of memory for the patch decoder";
+      return false;
+    }
+  } else if (OTA_ACCEPT_COMPRESSED && !compressDecoder) {
+    // Without the memory, just do not ask for a compressed image
+    compressDecoder = new (std::nothrow) FwCompressDecoder();
+  }
+
+  String url = host + ":" + String(port) + path;
+  loadState(esp_rom_crc32_le(0, (const uint8_t*)url.c_str(), url.length()));
+  resumedFrom = state.writtenBytes;
+  restartHash();
+  if (state.writtenBytes > 0) {
+    logDownloadEvent("Resuming " + url + " at " + String(state.writtenBytes) + "/" + String(state.imageSize) +
+                     " bytes");
+  }
+  return true;
+}
+
+void OtaDownload::end() {
+  if (sector) {
+    free(sector);
+    sector = nullptr;
+  }
+  delete patchDecoder;
+  patchDecoder = nullptr;
+  delete compressDecoder;
+  compressDecoder = nullptr;
+}
+
+void OtaDownload::expectSha256(const uint8_t hash[OTA_SHA256_SIZE]) {
+  memcpy(expectedSha256, hash, OTA_SHA256_SIZE);
+  hasExpectedSha256 = true;
+}
+
+void OtaDownload::expectSignature(const uint8_t* signature, size_t length) {
+  expectedSignatureLength = min(length, sizeof(expectedSignature));
+  memcpy(expectedSignature, signature, expectedSignatureLength);
+}
+
+bool OtaDownload::getRunningHash(uint8_t hash[OTA_SHA256_SIZE]) {
+  // Verifies and hashes the whole running image, so it is done once per boot
+  if (!hasRunningHash) {
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    hasRunningHash = running && esp_partition_get_sha256(running, runningHash) == ESP_OK;
+  }
+  if (hasRunningHash) {
+    memcpy(hash, runningHash, OTA_SHA256_SIZE);
+  }
+  return hasRunningHash;
+}
+
+String OtaDownload::toHex(const uint8_t* data, size_t length) {
+  static const char digits[] = "0123456789abcdef";
+  String hex;
+  hex.reserve(length * 2);
+  for (size_t i = 0; i < length; i++) {
+    hex += digits[data[i] >> 4];
+    hex += digits[data[i] & 0x0F];
+  }
+  return hex;
+}
+
+void OtaDownload::loadState(uint32_t urlHash) {
+  OtaResumeState saved;
+  preferences.begin("ota", true);
+  size_t length = preferences.getBytes("resume", &saved, sizeof(saved));
+  preferences.end();
+
+  // Same URL, encoding and slot, and something to tell a changed image by
+  bool sameEncoding = saved.encoding == encoding ||
+                      (saved.encoding == OTA_ENCODING_COMPRESSED && encoding == OTA_ENCODING_IMAGE && compressDecoder);
+  bool valid = length == sizeof(saved) && saved.magic == OTA_RESUME_MAGIC && saved.urlHash == urlHash &&
+               sameEncoding && saved.partitionAddress == partition->address &&
+               saved.imageSize <= partition->size && saved.writtenBytes <= saved.imageSize &&
+               saved.sourceOffset <= saved.sourceSize && (saved.etag[0] != '\0' || saved.hasSha256);
+  if (valid) {
+    state = saved;
+  } else {
+    memset(&state, 0, sizeof(state));
+    state.magic = OTA_RESUME_MAGIC;
+    state.partitionAddress = partition->address;
+    state.encoding = encoding;
+  }
+  state.urlHash = urlHash;
+  savedBytes = state.writtenBytes;
+}
+
+void OtaDownload::saveState() {
+  if (state.writtenBytes == savedBytes && state.writtenBytes > 0) {
+    return;
+  }
+  preferences.begin("ota", false);
+  preferences.putBytes("resume", &state, sizeof(state));
+  preferences.end();
+  savedBytes = state.writtenBytes;
+}
+
+void OtaDownload::clearState() {
+  preferences.begin("ota", false);
+  preferences.remove("resume");
+  preferences.end();
+  uint32_t urlHash = state.urlHash;
+  memset(&state, 0, sizeof(state));
+  state.magic = OTA_RESUME_MAGIC;
+  state.urlHash = urlHash;
+  state.partitionAddress = partition ? partition->address : 0;
+  state.encoding = encoding;
+  savedBytes = 0;
+}
+
+void OtaDownload::resetState(const OtaResponseInfo& info) {
+  // A patch or compressed image names the image size and hash in its header
+  bool compressed = encoding == OTA_ENCODING_IMAGE && info.contentEncoding == OTA_CONTENT_ENCODING;
+  state.encoding = compressed ? OTA_ENCODING_COMPRESSED : encoding;
+  bool image = state.encoding == OTA_ENCODING_IMAGE;
+  state.sourceSize = info.contentLength;
+  state.sourceOffset = 0;
+  state.baseSize = 0;
+  state.imageSize = image ? info.contentLength : 0;
+  state.writtenBytes = 0;
+  state.hasSha256 = (image || compressed) && info.hasSha256;
+  memcpy(state.sha256, info.sha256, sizeof(state.sha256));
+  if (!state.hasSha256 && (image || compressed) && hasExpectedSha256) {
+    state.hasSha256 = 1;
+    memcpy(state.sha256, expectedSha256, sizeof(state.sha256));
+  }
+  memset(state.etag, 0, sizeof(state.etag));
+  if (info.etag.length() < sizeof(state.etag)) {
+    strncpy(state.etag, info.etag.c_str(), sizeof(state.etag) - 1);
+  }
+  savedBytes = 0;
+  saveState();
+}
+
+OtaFetchResult OtaDownload::fetch(WiFiClient& client, OtaProgressFn progress) {
+  if (!partition || !sector) {
+    lastError = "Download not started";
+    return OTA_FETCH_FAILED;
+  }
+  if (isComplete()) {
+    return OTA_FETCH_COMPLETE;
+  }
+  lastError = "";
+  progressFn = progress;
+
+  // Two-argument connect: the one a WiFiClientSecure overrides
+  client.setTimeout(OTA_READ_TIMEOUT_MS);
+  if (!client.connect(host.c_str(), port)) {
+    lastError = "Cannot connect to " + host + ":" + String(port);
+    return OTA_FETCH_INTERRUPTED;
+  }
+
+  bool resuming = state.sourceOffset > 0;
+  String request = "GET " + path + " HTTP/1.1\r\n" +
+                   "Host: " + host + ":" + String(port) + "\r\n";
+  if (resuming) {
+    request += "Range: bytes=" + String(state.sourceOffset) + "-\r\n";
+    if (state.etag[0] != '\0') {
+      request += "If-Range: " + String(state.etag) + "\r\n";
+    }
+  }
+  // A plain image already under way continues plain: the other representation has another ETag
+  if (encoding == OTA_ENCODING_IMAGE && compressDecoder && (!resuming || state.encoding == OTA_ENCODING_COMPRESSED)) {
+    request += "Accept-Encoding: " + String(OTA_CONTENT_ENCODING) + ", identity\r\n";
+  }
+  request += "Connection: close\r\n\r\n";
+  client.print(request);
+
+  OtaResponseInfo info;
+  if (!readResponse(client, info)) {
+    client.stop();
+    lastError = "No valid HTTP response";
+    return OTA_FETCH_INTERRUPTED;
+  }
+  bool compressed = info.contentEncoding == OTA_CONTENT_ENCODING;
+  if (info.contentEncoding.length() > 0 && info.contentEncoding != "identity" &&
+      !(compressed && encoding == OTA_ENCODING_IMAGE && compressDecoder)) {
+    client.stop();
+    lastError = "Unsupported Content-Encoding: " + info.contentEncoding;
+    return OTA_FETCH_FAILED;
+  }
+
+  if (info.status == 206 && resuming) {
+    // Without an ETag the hash has to vouch that this is still the same image
+    bool sameImage = info.rangeStart == state.sourceOffset && info.totalSize == state.sourceSize &&
+                     compressed == (state.encoding == OTA_ENCODING_COMPRESSED) &&
+                     (state.etag[0] != '\0' ? info.etag.length() == 0 || info.etag == state.etag
+                                            : info.hasSha256 && memcmp(info.sha256, state.sha256, OTA_SHA256_SIZE) == 0);
+    if (!sameImage) {
+      client.stop();
+      clearState();
+      restarts++;
+      lastError = "Range answer does not match the partial download; starting over";
+      return OTA_FETCH_INTERRUPTED;
+    }
+    resumes++;
+  } else if (info.status == 200) {
+    if (info.contentLength == 0 || info.contentLength > partition->size) {
+      client.stop();
+      lastError = "Image size " + String(info.contentLength) + " does not fit the " +
+                  String(partition->size) + " byte slot";
+      return OTA_FETCH_FAILED;
+    }
+    if (encoding == OTA_ENCODING_IMAGE && info.hasSha256 && hasExpectedSha256 &&
+        memcmp(info.sha256, expectedSha256, OTA_SHA256_SIZE) != 0) {
+      client.stop();
+      lastError = "Server image is not the one the manifest names";
+      return OTA_FETCH_FAILED;
+    }
+    if (resuming) {
+      restarts++;
+      logDownloadEvent("Image changed on the server; starting over");
+    }
+    resetState(info);
+  } else if (info.status == 416) {
+    // Saved offset is past the server's image
+    client.stop();
+    clearState();
+    restarts++;
+    lastError = "HTTP 416; starting over";
+    return OTA_FETCH_INTERRUPTED;
+  } else {
+    client.stop();
+    lastError = "HTTP " + String(info.status);
+    return info.status >= 500 ? OTA_FETCH_INTERRUPTED : OTA_FETCH_FAILED;
+  }
+
+  requestOffset = state.sourceOffset;
+  startDecoder();
+
+  // Whole sectors only; a partial one lost to a drop is fetched again
+  sectorFill = 0;
+  uint8_t input[OTA_RECEIVE_CHUNK];
+  uint32_t remaining = state.sourceSize - state.sourceOffset;
+  unsigned long lastData = millis();
+  while (remaining > 0) {
+    int available = client.available();
+    if (available <= 0) {
+      if (!client.connected() || millis() - lastData >= OTA_READ_TIMEOUT_MS) {
+        break;
+      }
+      delay(1);
+      continue;
+    }
+
+    int count = client.read(input, min((size_t)available, min(sizeof(input), (size_t)remaining)));
+    if (count <= 0) {
+      continue;
+    }
+    lastData = millis();
+    remaining -= count;
+    bytesReceived += count;
+
+    if (!writeBody(input, count)) {
+      client.stop();
+      saveState();
+      return OTA_FETCH_FAILED;
+    }
+  }
+  client.stop();
+  saveState();
+
+  if (!isComplete()) {
+    lastError = "Connection lost at " + String(state.writtenBytes) + "/" + String(state.imageSize) + " bytes";
+    return OTA_FETCH_INTERRUPTED;
+  }
+  return OTA_FETCH_COMPLETE;
+}
+
+bool OtaDownload::readResponse(WiFiClient& client, OtaResponseInfo& info) {
+  info.status = 0;
+  info.contentLength = 0;
+  info.rangeStart = 0;
+  info.totalSize = 0;
+  info.hasSha256 = false;
+  memset(info.sha256, 0, sizeof(info.sha256));
+  info.etag = "";
+  info.contentEncoding = "";
+
+  // "HTTP/1.1 206 Partial Content"
+  String line = client.readStringUntil('\n');
+  int space = line.indexOf(' ');
+  if (!line.startsWith("HTTP/") || space == -1) {
+    return false;
+  }
+  info.status = line.substring(space + 1).toInt();
+
+  for (;;) {
+    line = client.readStringUntil('\n');
+    line.trim();
+    if (line.length() == 0) {
+      break;
+    }
+    int colon = line.indexOf(':');
+    if (colon == -1) {
+      continue;
+    }
+    String name = line.substring(0, colon);
+    name.toLowerCase();
+    String value = line.substring(colon + 1);
+    value.trim();
+
+    if (name == "content-length") {
+      info.contentLength = strtoul(value.c_str(), nullptr, 10);
+    } else if (name == "content-range") {
+      // "bytes <start>-<end>/<total>"
+      int dash = value.indexOf('-');
+      int slash = value.indexOf('/');
+      if (value.startsWith("bytes ") && dash != -1 && slash != -1) {
+        info.rangeStart = strtoul(value.c_str() + 6, nullptr, 10);
+        info.totalSize = strtoul(value.c_str() + slash + 1, nullptr, 10);
+      }
+    } else if (name == "etag") {
+      info.etag = value;
+    } else if (name == "content-encoding") {
+      info.contentEncoding = value;
+    } else if (name == "x-image-sha256") {
+      info.hasSha256 = parseSha256(value, info.sha256);
+    }
+  }
+
+  if (info.status == 200) {
+    info.totalSize = info.contentLength;
+  }
+  return true;
+}
+
+void OtaDownload::startDecoder() {
+  // A patch or compressed image picks up at the sector boundary its saved offset belongs to
+  if (state.encoding == OTA_ENCODING_PATCH) {
+    FwPatchCallbacks callbacks = { onPatchHeader, readRunningImage, writeDecodedImage, this };
+    if (requestOffset == 0) {
+      patchDecoder->begin(callbacks);
+    } else {
+      FwPatchHeader header;
+      header.oldSize = state.baseSize;
+      header.newSize = state.imageSize;
+      memset(header.oldHash, 0, sizeof(header.oldHash));
+      memcpy(header.newHash, state.sha256, sizeof(header.newHash));
+      patchDecoder->resume(callbacks, header, state.writtenBytes);
+    }
+  } else if (state.encoding == OTA_ENCODING_COMPRESSED) {
+    FwCompressCallbacks callbacks = { onCompressedHeader, writeDecodedImage, this };
+    if (requestOffset == 0) {
+      compressDecoder->begin(callbacks);
+    } else {
+      FwCompressHeader header;
+      header.imageSize = state.imageSize;
+      memcpy(header.imageHash, state.sha256, sizeof(header.imageHash));
+      compressDecoder->resume(callbacks, header, state.writtenBytes);
+    }
+  }
+}
+
+bool OtaDownload::writeBody(const uint8_t* data, size_t length) {
+  bool written;
+  const char* decoderError = "";
+  if (state.encoding == OTA_ENCODING_PATCH) {
+    written = patchDecoder->write(data, length);
+    decoderError = patchDecoder->getError();
+  } else if (state.encoding == OTA_ENCODING_COMPRESSED) {
+    written = compressDecoder->write(data, length);
+    decoderError = compressDecoder->getError();
+  } else {
+    written = writeImage(data, length);
+  }
+  // Flash and header errors set lastError themselves
+  if (!written && lastError.length() == 0) {
+    lastError = String(state.encoding == OTA_ENCODING_PATCH ? "Patch: " : "Compressed image: ") + decoderError;
+  }
+  return written;
+}
+
+bool OtaDownload::writeImage(const uint8_t* data, size_t length) {
+  if (state.imageSize == 0 || length > state.imageSize - state.writtenBytes - sectorFill) {
+    lastError = "Data past the end of the image";
+    return false;
+  }
+
+  while (length > 0) {
+    size_t n = min(length, (size_t)(OTA_SECTOR_SIZE - sectorFill));
+    memcpy(sector + sectorFill, data, n);
+    sectorFill += n;
+    data += n;
+    length -= n;
+    if (sectorFill < OTA_SECTOR_SIZE && state.writtenBytes + sectorFill < state.imageSize) {
+      continue;
+    }
+
+    if (!commitSector()) {
+      return false;
+    }
+    // A decoder has taken exactly the body bytes behind this sector
+    if (state.encoding == OTA_ENCODING_PATCH) {
+      state.sourceOffset = requestOffset + patchDecoder->getConsumed();
+    } else if (state.encoding == OTA_ENCODING_COMPRESSED) {
+      state.sourceOffset = requestOffset + compressDecoder->getConsumed();
+    } else {
+      state.sourceOffset = state.writtenBytes;
+    }
+    if (state.writtenBytes - savedBytes >= OTA_SAVE_INTERVAL_BYTES) {
+      saveState();
+    }
+    if (progressFn) {
+      progressFn(state.writtenBytes, state.imageSize, state.sourceOffset, state.sourceSize);
+    }
+  }
+  return true;
+}
+
+bool OtaDownload::onPatchHeader(const FwPatchHeader& header, void* context) {
+  OtaDownload* self = static_cast<OtaDownload*>(context);
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  if (memcmp(header.oldHash, self->runningHash, OTA_SHA256_SIZE) != 0 || !running ||
+      header.oldSize > running->size) {
+    self->lastError = "Patch is for other firmware (" + toHex(header.oldHash, 4) + "...)";
+    return false;
+  }
+  if (header.newSize == 0 || header.newSize > self->partition->size) {
+    self->lastError = "Patched image size " + String(header.newSize) + " does not fit the slot";
+    return false;
+  }
+  if (self->hasExpectedSha256 && memcmp(header.newHash, self->expectedSha256, OTA_SHA256_SIZE) != 0) {
+    self->lastError = "Patch builds another image than the manifest names";
+    return false;
+  }
+
+  // The patch carries the hash of the image it builds
+  self->state.baseSize = header.oldSize;
+  self->state.imageSize = header.newSize;
+  self->state.hasSha256 = 1;
+  memcpy(self->state.sha256, header.newHash, OTA_SHA256_SIZE);
+  return true;
+}
+
+bool OtaDownload::readRunningImage(uint32_t offset, uint8_t* data, size_t length, void* context) {
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  return running && esp_partition_read(running, offset, data, length) == ESP_OK;
+}
+
+bool OtaDownload::writeDecodedImage(const uint8_t* data, size_t length, void* context) {
+  return static_cast<OtaDownload*>(context)->writeImage(data, length);
+}
+
+bool OtaDownload::onCompressedHeader(const FwCompressHeader& header, void* context) {
+  OtaDownload* self = static_cast<OtaDownload*>(context);
+  if (header.imageSize == 0 || header.imageSize > self->partition->size) {
+    self->lastError = "Compressed image size " + String(header.imageSize) + " does not fit the slot";
+    return false;
+  }
+  // An X-Image-SHA256 from the server has to agree with the one inside
+  if (self->state.hasSha256 && memcmp(self->state.sha256, header.imageHash, OTA_SHA256_SIZE) != 0) {
+    self->lastError = "Compressed image hash differs from X-Image-SHA256";
+    return false;
+  }
+
+  self->state.imageSize = header.imageSize;
+  self->state.hasSha256 = 1;
+  memcpy(self->state.sha256, header.imageHash, OTA_SHA256_SIZE);
+  return true;
+}
+
+bool OtaDownload::commitSector() {
+  // Erase to resume offset as one step, so a forced sleep never lands in between
+  SleepGuard guard;
+
+  // Short last sector: pad with erased bytes so writes stay whole sectors
+  memset(sector + sectorFill, 0xFF, OTA_SECTOR_SIZE - sectorFill);
+
+  uint32_t offset = state.writtenBytes;
+  esp_err_t err = esp_partition_erase_range(partition, offset, OTA_SECTOR_SIZE);
+  if (err == ESP_OK) {
+    err = esp_partition_write(partition, offset, sector, OTA_SECTOR_SIZE);
+  }
+  if (err != ESP_OK) {
+    lastError = "Flash write failed at " + String(offset) + ": " + String(esp_err_to_name(err));
+    return false;
+  }
+
+  // Read back in small pieces; only verified bytes move the resume offset
+  uint8_t check[256];
+  for (uint32_t i = 0; i < sectorFill; i += sizeof(check)) {
+    size_t length = min((uint32_t)sizeof(check), sectorFill - i);
+    if (esp_partition_read(partition, offset + i, check, length) != ESP_OK ||
+        memcmp(check, sector + i, length) != 0) {
+      lastError = "Flash verify failed at " + String(offset + i);
+      return false;
+    }
+  }
+
+  // The hash follows writtenBytes; a restarted or resumed download first catches up
+  if (hashedBytes != state.writtenBytes && !catchUpHash()) {
+    lastError = "Cannot read back the image to hash it";
+    return false;
+  }
+  mbedtls_sha256_update(&imageHash, sector, sectorFill);
+  hashedBytes += sectorFill;
+
+  state.writtenBytes += sectorFill;
+  sectorFill = 0;
+  return true;
+}
+
+void OtaDownload::restartHash() {
+  mbedtls_sha256_free(&imageHash);
+  mbedtls_sha256_init(&imageHash);
+  mbedtls_sha256_starts(&imageHash, 0);
+  hashedBytes = 0;
+}
+
+bool OtaDownload::catchUpHash() {
+  // Bytes from before a reboot, or a hash left over from an image that was restarted
+  if (hashedBytes > state.writtenBytes) {
+    restartHash();
+  }
+  uint8_t buffer[256];
+  while (hashedBytes < state.writtenBytes) {
+    size_t length = min((uint32_t)sizeof(buffer), state.writtenBytes - hashedBytes);
+    if (esp_partition_read(partition, hashedBytes, buffer, length) != ESP_OK) {
+      restartHash();
+      return false;
+    }
+    mbedtls_sha256_update(&imageHash, buffer, length);
+    hashedBytes += length;
+  }
+  return true;
+}
+
+bool OtaDownload::finishHash(uint8_t digest[OTA_SHA256_SIZE]) {
+  if (hashedBytes != state.writtenBytes && !catchUpHash()) {
+    return false;
+  }
+  mbedtls_sha256_finish(&imageHash, digest);
+  restartHash();
+  return true;
+}
+
+bool OtaDownload::verifySignature(const uint8_t digest[OTA_SHA256_SIZE]) {
+  static const char publicKey[] = OTA_SIGNING_PUBLIC_KEY;
+  if (!hasSigningKey()) {
+    lastError = "No OTA_SIGNING_PUBLIC_KEY built in";
+    return false;
+  }
+  if (expectedSignatureLength == 0) {
+    lastError = "Image is not signed";
+    return false;
+  }
+
+  // A PEM key is parsed with its terminating NUL
+  unsigned long start = millis();
+  mbedtls_pk_context key;
+  mbedtls_pk_init(&key);
+  int err = mbedtls_pk_parse_public_key(&key, (const unsigned char*)publicKey, sizeof(publicKey));
+  if (err != 0) {
+    lastError = "OTA_SIGNING_PUBLIC_KEY is not a valid public key";
+  } else {
+    err = mbedtls_pk_verify(&key, MBEDTLS_MD_SHA256, digest, OTA_SHA256_SIZE, expectedSignature,
+                            expectedSignatureLength);
+    if (err != 0) {
+      lastError = "Signature does not match the image";
+    }
+  }
+  mbedtls_pk_free(&key);
+  if (err == 0) {
+    logDownloadEvent("Signature verified in " + String(millis() - start) + " ms");
+  }
+  return err == 0;
+}
+
+bool OtaDownload::finish() {
+  if (!partition || !sector || !isComplete()) {
+    lastError = "Image incomplete";
+    return false;
+  }
+
+  // Hashed while it was written; only bytes from before a reboot are read again
+  uint8_t digest[OTA_SHA256_SIZE];
+  if (!finishHash(digest)) {
+    lastError = "Cannot read back the image";
+    clearState();
+    return false;
+  }
+  if (state.hasSha256) {
+    if (memcmp(digest, state.sha256, OTA_SHA256_SIZE) != 0) {
+      lastError = "SHA-256 mismatch";
+      clearState();
+      return false;
+    }
+    logDownloadEvent("SHA-256 matches the server's X-Image-SHA256");
+  } else {
+    logDownloadEvent("WARNING: No X-Image-SHA256 from the server; relying on the image's own checksum");
+  }
+  if (!verifySignature(digest)) {
+    clearState();
+    return false;
+  }
+
+  // Also checks the image header, segments and appended digest
+  esp_err_t err = esp_ota_set_boot_partition(partition);
+  clearState();
+  if (err != ESP_OK) {
+    lastError = "Image rejected: " + String(esp_err_to_name(err));
+    return false;
+  }
+  logDownloadEvent("Boot partition set to " + String(partition->label));
+  return true;
+}
+
+bool OtaDownload::parseSha256(const String& hex, uint8_t digest[OTA_SHA256_SIZE]) {
+  if (hex.length() != OTA_SHA256_SIZE * 2) {
+    return false;
+  }
+  for (int i = 0; i < OTA_SHA256_SIZE; i++) {
+    char pair[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+    char* end = nullptr;
+    digest[i] = (uint8_t)strtoul(pair, &end, 16);
+    if (end != pair + 2) {
+      return false;
+    }
+  }
+  return true;
+}
+
+String OtaDownload::getReport() {
+  if (!partition) {
+    // No update yet since boot; show what an earlier one left in NVS
+    OtaResumeState saved;
+    preferences.begin("ota", true);
+    size_t length = preferences.getBytes("resume", &saved, sizeof(saved));
+    preferences.end();
+    if (length != sizeof(saved) || saved.magic != OTA_RESUME_MAGIC || saved.sourceSize == 0) {
+      return "No unfinished download";
+    }
+    return "Unfinished download: " + String(saved.writtenBytes) + "/" + String(saved.imageSize) +
+           " bytes saved, resumed by update_firmware";
+  }
+
+  String report = "Slot: " + String(partition->label) + "\n";
+  if (state.sourceSize == 0) {
+    report += "No download in progress";
+    return report;
+  }
+  report += "Written: " + String(state.writtenBytes) + "/" + String(state.imageSize) + " bytes (saved " +
+            String(savedBytes) + ")\n";
+  if (state.encoding == OTA_ENCODING_PATCH) {
+    report += "Patch: " + String(state.sourceOffset) + "/" + String(state.sourceSize) + " bytes against a " +
+              String(state.baseSize) + " byte running image\n";
+  } else if (state.encoding == OTA_ENCODING_COMPRESSED) {
+    report += "Compressed: " + String(state.sourceOffset) + "/" + String(state.sourceSize) + " bytes received" +
+              (state.imageSize > 0 ? " (" + String(state.sourceSize * 100 / state.imageSize) + "% of the image)"
+                                   : String("")) + "\n";
+  }
+  report += "This update: started at " + String(resumedFrom) + ", " + String(bytesReceived) + " bytes received, " +
+            String(resumes) + " resumes, " + String(restarts) + " restarts\n";
+  report += "Check: " + String(state.hasSha256 ? "SHA-256" : "image checksum only") +
+            (state.etag[0] != '\0' ? ", ETag " + String(state.etag) : String(", no ETag"));
+  return report;
+}
+
+void OtaDownload::logDownloadEvent(const String& event) {
+  Serial.println("[OTA] " + event);
+}
+
+#endif // OTA_DOWNLOAD_H
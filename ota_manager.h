@@ -7,6 +7,9 @@
  * - Fixed WiFiClientSecure certificate handling
  * - Fixed static callback member access
  * - Replaced cleanAPlist() with WiFi.disconnect()
+ * - Downloads go through OtaDownload (resumable, hash-checked) instead of HTTPUpdate
+ * - A release manifest (OtaManifestCheck) decides whether to download at all
+ * - Updates are refused without OTA_SIGNING_PUBLIC_KEY, HTTPS without OTA_SERVER_CA_CERT
  */
 
 #ifndef OTA_MANAGER_H
@@ -14,11 +17,13 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
-#include <WiFiMulti.h>
-#include <HTTPUpdate.h>
 #include <WiFiClientSecure.h>
 #include "config.h"
 #include "communication.h"
+#include "network_manager.h"
+#include "ota_download.h"
+#include "ota_manifest.h"
+#include "status_led.h"
 
 // Update result enumeration
 enum UpdateResult {
@@ -34,22 +39,28 @@ enum UpdateResult {
 
 // Update progress information
 struct UpdateProgress {
-  int currentBytes;
+  int currentBytes;             // Image bytes written
   int totalBytes;
+  int receivedBytes;            // Body bytes behind them; fewer for a patch or compressed image
+  int receivedTotal;
   int percentComplete;
   unsigned long startTime;
   unsigned long elapsedTime;
   float downloadSpeedKBps;
   
   // Constructor
-  UpdateProgress() : currentBytes(0), totalBytes(0), percentComplete(0),
+  UpdateProgress() : currentBytes(0), totalBytes(0), receivedBytes(0), receivedTotal(0), percentComplete(0),
                      startTime(0), elapsedTime(0), downloadSpeedKBps(0.0) {}
 };
 
 class OTAManager {
 private:
   CommunicationManager* comm;
-  WiFiMulti* wifiMulti;
+  NetworkManager* network;
+  StatusLed* statusLed;
+  OtaDownload download;
+  OtaManifestCheck manifestCheck;
+  bool hasManifest;             // manifestCheck holds the server's current release
   
   // Update state
   bool updateInProgress;
@@ -68,22 +79,24 @@ private:
   // Private methods
   bool connectToWiFi(const ConfigManager& config);
   void disconnectWiFi();
-  bool waitForWiFiConnection(int timeoutSeconds = 30);
+  bool waitForWiFiConnection(int timeoutSeconds = WIFI_CONNECT_TIMEOUT_MS / 1000);
   
   // Update process
-  UpdateResult performHTTPUpdate(const String& server, int port, const String& path);
-  UpdateResult performHTTPSUpdate(const String& server, int port, const String& path);
-  void handleUpdateResult(t_httpUpdate_return result);
+  UpdateResult downloadFirmware(const String& server, int port, const String& path, OtaEncoding encoding);
+  OtaFetchResult fetchOnce();
+  bool configureSecureClient(WiFiClientSecure& client);
+  String getPatchPath();
+  OtaManifestResult fetchManifest(const String& server, int port);
   
   // Progress and error handling
-  static void onUpdateProgress(int current, int total);
-  static void onUpdateError(int error);
+  static void onUpdateProgress(int current, int total, int received, int receivedTotal);
   static void onUpdateStart();
   static void onUpdateEnd();
   
   // Validation
   bool validateUpdateURL(const String& server, int port, const String& path);
-  bool validateFirmwareVersion();
+  UpdateResult validateFirmwareVersion(const OtaManifest& manifest);
+  uint32_t getBootloaderVersion();
   
   // Logging
   void logUpdateEvent(const String& event);
@@ -94,6 +107,8 @@ public:
   ~OTAManager();
   
   void setCommunicationManager(CommunicationManager* commMgr) { comm = commMgr; }
+  void setNetworkManager(NetworkManager* netMgr) { network = netMgr; }
+  void setStatusLed(StatusLed* led) { statusLed = led; }
   
   // Main update interface
   UpdateResult performUpdate(const ConfigManager& config);
@@ -126,15 +141,13 @@ OTAManager* OTAManager::staticInstance = nullptr;
 
 // Implementation
 OTAManager::OTAManager() 
-  : comm(nullptr), wifiMulti(nullptr), updateInProgress(false), 
+  : comm(nullptr), network(nullptr), statusLed(nullptr), hasManifest(false), updateInProgress(false), 
     updateStartTime(0), updateTimeoutMs(300000), useHTTPS(false) {
   
-  wifiMulti = new WiFiMulti();
   staticInstance = this; // Set static instance for callbacks
 }
 
 OTAManager::~OTAManager() {
-  delete wifiMulti;
   staticInstance = nullptr;
 }
 
@@ -153,6 +166,18 @@ UpdateResult OTAManager::performUpdate(const ConfigManager& config) {
   
   logUpdateEvent("OTA Update Started");
   
+  // Nothing unsigned or from an unchecked server is ever installed
+  if (!OtaDownload::hasSigningKey() || (useHTTPS && sizeof(OTA_SERVER_CA_CERT) <= 1)) {
+    updateInProgress = false;
+    String reason = OtaDownload::hasSigningKey() ? "HTTPS needs OTA_SERVER_CA_CERT" :
+                                                   "No OTA_SIGNING_PUBLIC_KEY built in";
+    logError("Update refused: " + reason);
+    if (comm) {
+      comm->println("Update refused: " + reason);
+    }
+    return UPDATE_VERIFICATION_FAILED;
+  }
+  
   if (comm) {
     comm->println("=== OTA FIRMWARE UPDATE ===");
     comm->println("Version: " + getCurrentFirmwareVersion());
@@ -169,7 +194,7 @@ UpdateResult OTAManager::performUpdate(const ConfigManager& config) {
   }
   
   // Step 2: Validate update parameters
-  String firmwarePath = "/firmware/ota.bin";
+  String firmwarePath = OTA_FIRMWARE_PATH;
   if (!validateUpdateURL(config.getIPAddress(), config.getPortInt(), firmwarePath)) {
     disconnectWiFi();
     updateInProgress = false;
@@ -179,18 +204,56 @@ UpdateResult OTAManager::performUpdate(const ConfigManager& config) {
   
   if (comm) {
     comm->println("WiFi connected: " + WiFi.localIP().toString());
-    comm->println("Starting firmware download...");
   }
   
-  // Step 3: Perform the actual update
-  UpdateResult result;
-  if (useHTTPS) {
-    result = performHTTPSUpdate(config.getIPAddress(), config.getPortInt(), firmwarePath);
+  // Step 3: One small (usually 304) request decides whether there is anything to download.
+  // The signature comes with the manifest, so without one nothing could be installed
+  OtaManifestResult manifestResult = fetchManifest(config.getIPAddress(), config.getPortInt());
+  UpdateResult verdict = UPDATE_VERIFICATION_FAILED;
+  if (hasManifest && manifestCheck.getManifest().signatureLength > 0) {
+    verdict = validateFirmwareVersion(manifestCheck.getManifest());
+  } else if (hasManifest) {
+    logError("Manifest has no signature");
+  } else if (manifestResult == OTA_MANIFEST_ERROR) {
+    logError("Manifest check failed (" + manifestCheck.getLastError() + ")");
   } else {
-    result = performHTTPUpdate(config.getIPAddress(), config.getPortInt(), firmwarePath);
+    logError("No manifest on the server; a signed manifest is required");
+  }
+  if (verdict != UPDATE_SUCCESS) {
+    disconnectWiFi();
+    updateInProgress = false;
+    if (comm) {
+      comm->println("Update completed: " + getUpdateResultString(verdict));
+    }
+    logUpdateEvent("Update completed with result: " + getUpdateResultString(verdict));
+    return verdict;
   }
   
-  // Step 4: Cleanup
+  if (comm) {
+    comm->println("Starting firmware download...");
+  }
+  
+  // Step 4: Download into the inactive slot (resumes an earlier partial download).
+  // A patch against the running firmware is tried first; the full image is the fallback
+  UpdateResult result = UPDATE_FAILED;
+  String patchPath = getPatchPath();
+  if (!manifestCheck.getManifest().patchAvailable) {
+    patchPath = "";
+  }
+  if (patchPath.length() > 0) {
+    result = downloadFirmware(config.getIPAddress(), config.getPortInt(), patchPath, OTA_ENCODING_PATCH);
+    if (result == UPDATE_FAILED || result == UPDATE_VERIFICATION_FAILED) {
+      logUpdateEvent("No usable patch (" + download.getLastError() + "), downloading the full image");
+      if (comm) {
+        comm->println("No usable patch, downloading the full image...");
+      }
+    }
+  }
+  if (patchPath.length() == 0 || result == UPDATE_FAILED || result == UPDATE_VERIFICATION_FAILED) {
+    result = downloadFirmware(config.getIPAddress(), config.getPortInt(), firmwarePath, OTA_ENCODING_IMAGE);
+  }
+  
+  // Step 5: Cleanup
   disconnectWiFi();
   updateInProgress = false;
   
@@ -216,49 +279,55 @@ UpdateResult OTAManager::performUpdateFromURL(const String& url) {
 }
 
 bool OTAManager::connectToWiFi(const ConfigManager& config) {
-  logUpdateEvent("Connecting to WiFi: " + config.getSSID());
+  if (!network) {
+    logError("Network manager not set");
+    return false;
+  }
   
-  // FIXED: Clear any existing AP configurations - ESP32 Core 3.x compatible
-  WiFi.disconnect();
-  WiFi.mode(WIFI_STA);
-  WiFi.setTxPower(WIFI_POWER_19_5dBm); // Max power for better connection
+  logUpdateEvent("Connecting to WiFi: " + config.getSSID());
   
-  // Add the configured network
-  wifiMulti->addAP(config.getSSID().c_str(), config.getPassword().c_str());
+  // The configured network is always tried alongside the stored ones
+  network->setPrimaryNetwork(config.getSSID(), config.getPassword());
   
-  // Attempt to connect with progress indication
-  return waitForWiFiConnection(30);
+  return waitForWiFiConnection();
 }
 
 bool OTAManager::waitForWiFiConnection(int timeoutSeconds) {
-  int attempts = 0;
-  const int maxAttempts = timeoutSeconds * 2; // Check every 500ms
+  unsigned long timeoutMs = (unsigned long)timeoutSeconds * 1000;
+  unsigned long lastDot = millis();
+  
+  if (!network->isConnected() && !network->beginConnect()) {
+    logError("No WiFi networks configured");
+    return false;
+  }
   
-  while (wifiMulti->run() != WL_CONNECTED && attempts < maxAttempts) {
-    delay(500);
+  // Drive the async connect, printing a progress dot every 3 seconds
+  unsigned long start = millis();
+  while (network->isBusy() && millis() - start < timeoutMs) {
+    network->update();
     
-    // Progress indication
-    if (comm && attempts % 6 == 0) { // Print dots every 3 seconds
+    if (comm && millis() - lastDot >= 3000) {
       comm->print(".");
+      lastDot = millis();
     }
     
-    attempts++;
-    
-    // Update progress for long connections
-    if (attempts % 10 == 0) {
-      logUpdateEvent("WiFi connection attempt " + String(attempts / 2) + "/" + String(timeoutSeconds));
-    }
+    delay(10);
   }
   
-  if (wifiMulti->run() == WL_CONNECTED) {
-    logUpdateEvent("WiFi connected successfully");
+  if (network->isConnected()) {
+    logUpdateEvent("WiFi connected in " + String(network->getLastConnectTimeMs()) + " ms");
     if (comm) {
       comm->println("\nWiFi connected successfully");
+      comm->println("Connect time: " + String(network->getLastConnectTimeMs()) + " ms (" +
+                    String(network->wasLastConnectFast() ? "fast reconnect" : "scan") + ")");
       comm->println("Signal strength: " + String(WiFi.RSSI()) + " dBm");
       comm->println("IP address: " + WiFi.localIP().toString());
     }
     return true;
   } else {
+    if (network->isBusy()) {
+      network->disconnect();
+    }
     logError("WiFi connection failed after " + String(timeoutSeconds) + " seconds");
     if (comm) {
       comm->println("\nWiFi connection failed");
@@ -269,143 +338,166 @@ bool OTAManager::waitForWiFiConnection(int timeoutSeconds) {
 }
 
 void OTAManager::disconnectWiFi() {
-  WiFi.disconnect();
-  WiFi.mode(WIFI_OFF);
+  if (network) {
+    network->disconnect();
+  }
   logUpdateEvent("WiFi disconnected");
 }
 
-UpdateResult OTAManager::performHTTPUpdate(const String& server, int port, const String& path) {
-  logUpdateEvent("Starting HTTP update from " + server + ":" + String(port) + path);
-  
-  // Configure HTTP update settings
-  httpUpdate.rebootOnUpdate(false); // Handle reboot manually for better control
-  httpUpdate.setLedPin(-1); // Disable built-in LED control
-  
-  // FIXED: Removed httpUpdate.setTimeout() - not available in ESP32 Core 3.x
-  
-  // Set progress callback
-  httpUpdate.onProgress([](int current, int total) {
-    OTAManager::onUpdateProgress(current, total);
-  });
+UpdateResult OTAManager::downloadFirmware(const String& server, int port, const String& path,
+                                          OtaEncoding encoding) {
+  String url = String(useHTTPS ? "https://" : "http://") + server + ":" + String(port) + path;
+  logUpdateEvent("Starting download from " + url);
   
-  // Set error callback
-  httpUpdate.onError([](int error) {
-    OTAManager::onUpdateError(error);
-  });
+  if (!download.begin(server, port, path, encoding)) {
+    logError(download.getLastError());
+    download.end();
+    return UPDATE_FAILED;
+  }
+  if (hasManifest && manifestCheck.getManifest().hasSha256) {
+    download.expectSha256(manifestCheck.getManifest().sha256);
+  }
+  if (hasManifest && manifestCheck.getManifest().signatureLength > 0) {
+    download.expectSignature(manifestCheck.getManifest().signature, manifestCheck.getManifest().signatureLength);
+  }
   
   if (comm) {
-    comm->println("Downloading firmware...");
-    comm->println("URL: http://" + server + ":" + String(port) + path);
+    comm->println(String(encoding == OTA_ENCODING_PATCH ? "Downloading firmware patch" : "Downloading firmware") +
+                  (useHTTPS ? " (HTTPS)..." : "..."));
+    comm->println("URL: " + url);
+    if (download.getResumedFrom() > 0) {
+      comm->println("Resuming at " + String(download.getResumedFrom() / 1024) + "/" +
+                    String(download.getImageSize() / 1024) + " KB");
+    }
   }
+  onUpdateStart();
+  unsigned long downloadStart = millis();
   
-  // Create WiFi client and perform update
-  WiFiClient client;
-  t_httpUpdate_return result = httpUpdate.update(client, server, port, path);
+  // A drop only costs the sector in flight; each retry continues with a Range request
+  OtaFetchResult fetchResult = OTA_FETCH_INTERRUPTED;
+  for (int attempt = 1; attempt <= OTA_MAX_ATTEMPTS; attempt++) {
+    if (network->isConnected() || waitForWiFiConnection()) {
+      fetchResult = fetchOnce();
+      if (fetchResult != OTA_FETCH_INTERRUPTED) {
+        break;
+      }
+    }
+    
+    logError("Attempt " + String(attempt) + "/" + String(OTA_MAX_ATTEMPTS) + ": " + download.getLastError());
+    if (attempt < OTA_MAX_ATTEMPTS) {
+      if (comm) {
+        comm->println("Download interrupted (" + download.getLastError() + "), retrying...");
+      }
+      delay(OTA_RETRY_DELAY_MS * attempt);
+    }
+  }
   
-  // Convert result to our enum
-  switch (result) {
-    case HTTP_UPDATE_FAILED:
-      return UPDATE_FAILED;
-    case HTTP_UPDATE_NO_UPDATES:
-      return UPDATE_NO_UPDATES;
-    case HTTP_UPDATE_OK:
-      return UPDATE_SUCCESS;
-    default:
-      return UPDATE_FAILED;
+  if (fetchResult != OTA_FETCH_COMPLETE) {
+    logError("Download stopped: " + download.getLastError());
+    if (comm) {
+      comm->println("Download stopped: " + download.getLastError());
+      if (download.getWrittenBytes() > 0) {
+        comm->println("Kept " + String(download.getWrittenBytes() / 1024) + "/" +
+                      String(download.getImageSize() / 1024) + " KB; update_firmware resumes from there");
+      }
+    }
+    download.end();
+    return fetchResult == OTA_FETCH_FAILED ? UPDATE_FAILED : UPDATE_DOWNLOAD_FAILED;
   }
-}
-
-UpdateResult OTAManager::performHTTPSUpdate(const String& server, int port, const String& path) {
-  logUpdateEvent("Starting HTTPS update from " + server + ":" + String(port) + path);
   
-  // Configure HTTPS update (more secure)
-  WiFiClientSecure client;
+  onUpdateEnd();
+  // finish() clears the download state either way
+  OtaEncoding received = download.getEncoding();
+  uint32_t imageSize = download.getImageSize();
+  uint32_t bodySize = download.getSourceSize();
+  bool verified = download.finish();
+  download.end();
   
-  // FIXED: Use newer certificate verification method for ESP32 Core 3.x
-  if (serverCertFingerprint.length() > 0) {
-    // Note: setFingerprint is deprecated, use setCACert or setInsecure
-    logUpdateEvent("WARNING: Certificate fingerprint validation deprecated in ESP32 Core 3.x");
-    client.setInsecure(); // Skip certificate validation for now
-  } else {
-    client.setInsecure(); // Skip certificate validation
-    logUpdateEvent("WARNING: Skipping certificate validation");
+  if (!verified) {
+    logError("Verification failed: " + download.getLastError());
+    if (comm) {
+      comm->println("Verification failed: " + download.getLastError());
+      comm->println("The running firmware is unchanged");
+    }
+    return UPDATE_VERIFICATION_FAILED;
   }
   
-  // Configure HTTP update settings
-  httpUpdate.rebootOnUpdate(false);
-  
+  String body = received == OTA_ENCODING_PATCH ? "patch" : received == OTA_ENCODING_COMPRESSED ? "compressed" : "download";
+  logUpdateEvent("Installed " + String(imageSize) + " byte image from " + String(bodySize) + " byte " + body +
+                 " in " + String(millis() - downloadStart) + " ms");
   if (comm) {
-    comm->println("Downloading firmware (HTTPS)...");
-    comm->println("URL: https://" + server + ":" + String(port) + path);
+    if (received != OTA_ENCODING_IMAGE) {
+      comm->println(String(received == OTA_ENCODING_PATCH ? "Patch: " : "Compressed: ") + String(bodySize / 1024) +
+                    " KB for a " + String(imageSize / 1024) + " KB image");
+    }
+    comm->println("New firmware installed; it starts on the next restart or wake");
+  }
+  return UPDATE_SUCCESS;
+}
+
+String OTAManager::getPatchPath() {
+  uint8_t hash[OTA_SHA256_SIZE];
+  if (!download.getRunningHash(hash)) {
+    return "";
+  }
+  return String(OTA_PATCH_PATH) + "?from=" + OtaDownload::toHex(hash, OTA_SHA256_SIZE) + "&version=" +
+         getCurrentFirmwareVersion();
+}
+
+OtaManifestResult OTAManager::fetchManifest(const String& server, int port) {
+  uint8_t runningHash[OTA_SHA256_SIZE];
+  if (!download.getRunningHash(runningHash)) {
+    memset(runningHash, 0, sizeof(runningHash));
   }
   
-  // Perform update
-  t_httpUpdate_return result = httpUpdate.update(client, server, port, path);
+  OtaManifestResult result;
+  if (useHTTPS) {
+    WiFiClientSecure client;
+    result = configureSecureClient(client) ? manifestCheck.fetch(client, server, port, OTA_MANIFEST_PATH, runningHash)
+                                           : OTA_MANIFEST_ERROR;
+  } else {
+    WiFiClient client;
+    result = manifestCheck.fetch(client, server, port, OTA_MANIFEST_PATH, runningHash);
+  }
   
-  // Convert result
-  switch (result) {
-    case HTTP_UPDATE_FAILED:
-      return UPDATE_FAILED;
-    case HTTP_UPDATE_NO_UPDATES:
-      return UPDATE_NO_UPDATES;
-    case HTTP_UPDATE_OK:
-      return UPDATE_SUCCESS;
-    default:
-      return UPDATE_FAILED;
+  hasManifest = result == OTA_MANIFEST_NEW || result == OTA_MANIFEST_UNCHANGED;
+  if (hasManifest) {
+    logUpdateEvent(String(result == OTA_MANIFEST_NEW ? "Manifest fetched: " : "Manifest unchanged (304): ") +
+                   manifestCheck.getReport());
+  } else if (result == OTA_MANIFEST_MISSING) {
+    logUpdateEvent("No manifest on the server");
   }
+  return result;
 }
 
-void OTAManager::handleUpdateResult(t_httpUpdate_return result) {
-  switch (result) {
-    case HTTP_UPDATE_FAILED:
-      logError("Update failed: " + String(httpUpdate.getLastError()) + " - " + httpUpdate.getLastErrorString());
-      if (comm) {
-        comm->println("UPDATE FAILED!");
-        comm->println("Error " + String(httpUpdate.getLastError()) + ": " + httpUpdate.getLastErrorString());
-        comm->println("Please check server and network connection");
-      }
-      break;
-      
-    case HTTP_UPDATE_NO_UPDATES:
-      logUpdateEvent("No updates available on server");
-      if (comm) {
-        comm->println("No firmware updates available");
-        comm->println("Current version is up to date");
-      }
-      break;
-      
-    case HTTP_UPDATE_OK:
-      logUpdateEvent("Update successful - preparing to reboot");
-      if (comm) {
-        comm->println("FIRMWARE UPDATE SUCCESSFUL!");
-        comm->println("New firmware installed successfully");
-        comm->println("Rebooting in 5 seconds...");
-        
-        // Countdown for user awareness
-        for (int i = 5; i > 0; i--) {
-          comm->println("Reboot in " + String(i) + "...");
-          delay(1000);
-        }
-        
-        comm->println("Rebooting now!");
-        comm->flush(); // Ensure message is sent
-      }
-      
-      delay(500);
-      ESP.restart();
-      break;
-      
-    default:
-      logError("Unknown update result: " + String(result));
-      if (comm) {
-        comm->println("Unknown update result: " + String(result));
-      }
-      break;
+OtaFetchResult OTAManager::fetchOnce() {
+  if (useHTTPS) {
+    WiFiClientSecure client;
+    if (!configureSecureClient(client)) {
+      return OTA_FETCH_FAILED;
+    }
+    return download.fetch(client, onUpdateProgress);
+  }
+  
+  WiFiClient client;
+  return download.fetch(client, onUpdateProgress);
+}
+
+bool OTAManager::configureSecureClient(WiFiClientSecure& client) {
+  // FIXED: Use newer certificate verification method for ESP32 Core 3.x
+  static const char caCert[] = OTA_SERVER_CA_CERT;
+  if (sizeof(caCert) <= 1) {
+    // Note: setFingerprint is deprecated and setInsecure would accept any server
+    logError("No OTA_SERVER_CA_CERT; refusing an unchecked HTTPS connection");
+    return false;
   }
+  
+  client.setCACert(caCert);
+  return true;
 }
 
 // FIXED: Progress and error callbacks - fixed for static member access
-void OTAManager::onUpdateProgress(int current, int total) {
+void OTAManager::onUpdateProgress(int current, int total, int received, int receivedTotal) {
   static unsigned long lastProgressTime = 0;
   static int lastPercent = -1;
   
@@ -414,17 +506,22 @@ void OTAManager::onUpdateProgress(int current, int total) {
   // Update static progress information (FIXED)
   staticProgress.currentBytes = current;
   staticProgress.totalBytes = total;
+  staticProgress.receivedBytes = received;
+  staticProgress.receivedTotal = receivedTotal;
   staticProgress.percentComplete = (total > 0) ? (current * 100) / total : 0;
   staticProgress.elapsedTime = now - staticProgress.startTime;
   
-  // Calculate download speed
+  // Calculate download speed (of the bytes on the wire)
   if (staticProgress.elapsedTime > 0) {
-    staticProgress.downloadSpeedKBps = (current / 1024.0) / (staticProgress.elapsedTime / 1000.0);
+    staticProgress.downloadSpeedKBps = (received / 1024.0) / (staticProgress.elapsedTime / 1000.0);
   }
   
   // Copy to instance progress if available
   if (staticInstance) {
     staticInstance->progress = staticProgress;
+    if (staticInstance->statusLed) {
+      staticInstance->statusLed->setProgress(staticProgress.percentComplete);
+    }
   }
   
   // Limit progress updates to avoid flooding (every 2 seconds or 5% change)
@@ -434,7 +531,11 @@ void OTAManager::onUpdateProgress(int current, int total) {
   
   if (staticProgress.percentComplete != lastPercent) {
     String progressMsg = "Download: " + String(staticProgress.percentComplete) + "% (" + 
-                        String(current / 1024) + "/" + String(total / 1024) + " KB)";
+                        String(current / 1024) + "/" + String(total / 1024) + " KB";
+    if (receivedTotal != total) {
+      progressMsg += " written, " + String(received / 1024) + "/" + String(receivedTotal / 1024) + " KB received";
+    }
+    progressMsg += ")";
     
     if (staticProgress.downloadSpeedKBps > 0) {
       progressMsg += " @ " + String(staticProgress.downloadSpeedKBps, 1) + " KB/s";
@@ -451,20 +552,6 @@ void OTAManager::onUpdateProgress(int current, int total) {
   }
 }
 
-void OTAManager::onUpdateError(int error) {
-  String errorMsg = "Update Error " + String(error);
-  
-  Serial.println(errorMsg);
-  
-  if (staticInstance) {
-    staticInstance->logError(errorMsg);
-    
-    if (staticInstance->comm) {
-      staticInstance->comm->println(errorMsg);
-    }
-  }
-}
-
 void OTAManager::onUpdateStart() {
   Serial.println("Update started");
   
@@ -502,10 +589,71 @@ bool OTAManager::validateUpdateURL(const String& server, int port, const String&
   return true;
 }
 
-bool OTAManager::validateFirmwareVersion() {
-  // Could implement version checking logic here
-  // For now, always allow updates
-  return true;
+UpdateResult OTAManager::validateFirmwareVersion(const OtaManifest& manifest) {
+  // UPDATE_SUCCESS means: download and install what the manifest names
+  uint8_t runningHash[OTA_SHA256_SIZE];
+  bool hashKnown = download.getRunningHash(runningHash);
+  
+  // The app hash tells builds apart even when the version string was not bumped
+  bool current = manifest.hasAppHash && hashKnown ? memcmp(manifest.appHash, runningHash, OTA_SHA256_SIZE) == 0
+                                                  : strcmp(manifest.version, FIRMWARE_VERSION) == 0;
+  if (current) {
+    logUpdateEvent("Running firmware is the current release (" + String(manifest.version) + ")");
+    if (comm) {
+      comm->println("Firmware is up to date: " + String(manifest.version));
+    }
+    return UPDATE_NO_UPDATES;
+  }
+  
+  // Installed by an earlier update but not started yet
+  const esp_partition_t* boot = esp_ota_get_boot_partition();
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  uint8_t bootHash[OTA_SHA256_SIZE];
+  if (manifest.hasAppHash && boot && boot != running && esp_partition_get_sha256(boot, bootHash) == ESP_OK &&
+      memcmp(bootHash, manifest.appHash, OTA_SHA256_SIZE) == 0) {
+    logUpdateEvent(String(manifest.version) + " is already installed in " + String(boot->label));
+    if (comm) {
+      comm->println(String(manifest.version) + " is already installed; it starts on the next restart or wake");
+    }
+    return UPDATE_NO_UPDATES;
+  }
+  
+  uint32_t bootloader = getBootloaderVersion();
+  if (manifest.minBootloader > bootloader) {
+    logError(String(manifest.version) + " needs bootloader " + String(manifest.minBootloader) + ", this one is " +
+             String(bootloader));
+    if (comm) {
+      comm->println(String(manifest.version) + " needs bootloader version " + String(manifest.minBootloader) +
+                    " (this device has " + String(bootloader) + "); update over USB");
+    }
+    return UPDATE_FAILED;
+  }
+  
+  const esp_partition_t* next = esp_ota_get_next_update_partition(nullptr);
+  if (next && manifest.imageSize > next->size) {
+    logError(String(manifest.version) + " (" + String(manifest.imageSize) + " bytes) does not fit the " +
+             String(next->size) + " byte slot");
+    if (comm) {
+      comm->println("New firmware does not fit the OTA slot");
+    }
+    return UPDATE_FAILED;
+  }
+  
+  logUpdateEvent("Update available: " + String(FIRMWARE_VERSION) + " -> " + String(manifest.version));
+  if (comm) {
+    comm->println("Update available: " + String(manifest.version) + " (" + String(manifest.imageSize / 1024) +
+                  " KB" + (manifest.patchAvailable ? ", patch available)" : ")"));
+  }
+  return UPDATE_SUCCESS;
+}
+
+uint32_t OTAManager::getBootloaderVersion() {
+  // CONFIG_BOOTLOADER_PROJECT_VER of the bootloader in flash
+  esp_bootloader_desc_t description;
+  if (esp_ota_get_bootloader_description(nullptr, &description) != ESP_OK) {
+    return 0;
+  }
+  return description.version;
 }
 
 // Configuration
@@ -569,10 +717,29 @@ String OTAManager::getCurrentFirmwareVersion() {
 }
 
 bool OTAManager::checkForUpdates(const ConfigManager& config) {
-  // Could implement update checking without downloading
-  // For now, return true to indicate updates might be available
+  // Manifest only; nothing is downloaded
   logUpdateEvent("Checking for updates on server");
-  return true;
+  if (updateInProgress || !connectToWiFi(config)) {
+    return false;
+  }
+  
+  OtaManifestResult result = fetchManifest(config.getIPAddress(), config.getPortInt());
+  disconnectWiFi();
+  
+  if (!hasManifest) {
+    String reason = result == OTA_MANIFEST_MISSING ? "the server has no manifest" : manifestCheck.getLastError();
+    logError("Update check failed: " + reason);
+    if (comm) {
+      comm->println("Update check failed: " + reason);
+    }
+    return false;
+  }
+  
+  if (comm) {
+    comm->println("Current Version: " + getCurrentFirmwareVersion());
+    comm->println(manifestCheck.getReport());
+  }
+  return validateFirmwareVersion(manifestCheck.getManifest()) == UPDATE_SUCCESS;
 }
 
 // Diagnostics
@@ -589,7 +756,11 @@ void OTAManager::printUpdateStatus() {
     }
     
     comm->println("HTTPS Enabled: " + String(useHTTPS ? "YES" : "NO"));
+    comm->println("Server Certificate Check: " + String(sizeof(OTA_SERVER_CA_CERT) > 1 ? "CA" : "NONE (HTTPS refused)"));
+    comm->println("Signing Key: " + String(OtaDownload::hasSigningKey() ? "SET" : "NONE (updates refused)"));
     comm->println("Timeout: " + String(updateTimeoutMs / 1000) + "s");
+    comm->println(download.getReport());
+    comm->println(manifestCheck.getReport());
     comm->println("========================");
   }
 }
@@ -0,0 +1,350 @@
+/*
+ * ota_manifest.h - Release manifest fetched before any firmware download
+ *
+ * This file contains the OtaManifestCheck class. It asks the update
+ * server for a small JSON manifest describing the current release:
+ *
+ *   {
+ *     "version": "V14.MODULAR",
+ *     "size": 1171456,
+ *     "sha256": "<SHA-256 of ota.bin>",
+ *     "app_hash": "<appended app hash, as esp_partition_get_sha256 reports it>",
+ *     "min_bootloader": 1,
+ *     "patch_from": ["<app hash>", ...],
+ *     "signature": "<DER ECDSA P-256 signature over ota.bin>"
+ *   }
+ *
+ * The parsed manifest is kept in NVS with the server's ETag. The next
+ * check sends it back as If-None-Match, so an unchanged release costs
+ * one request answered by "304 Not Modified" and no body. The cache also
+ * records which firmware it was made for, because "patch_from" is only
+ * meaningful against the image that was running then.
+ *
+ * The signature is not checked here: OtaDownload checks it against the
+ * hash of the bytes it actually wrote, with the key from config.h.
+ */
+
+#ifndef OTA_MANIFEST_H
+#define OTA_MANIFEST_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include "config.h"
+
+#define OTA_MANIFEST_MAGIC 0x4F544D32  // "OTM2"
+#define OTA_MANIFEST_HASH_SIZE 32
+#define OTA_MANIFEST_CACHE_ID_SIZE 8    // Leading app hash bytes that tie the cache to a firmware
+
+struct OtaManifest {
+  uint32_t magic;
+  char version[OTA_VERSION_MAX_LENGTH];
+  uint32_t imageSize;
+  uint32_t minBootloader;       // 0 = any
+  uint8_t hasSha256;
+  uint8_t sha256[OTA_MANIFEST_HASH_SIZE];
+  uint8_t hasAppHash;
+  uint8_t appHash[OTA_MANIFEST_HASH_SIZE];
+  uint8_t patchAvailable;       // "patch_from" lists the running firmware
+  uint8_t signatureLength;      // 0 = unsigned
+  uint8_t signature[OTA_SIGNATURE_MAX_SIZE];
+  uint8_t checkedBy[OTA_MANIFEST_CACHE_ID_SIZE];
+  char etag[OTA_ETAG_MAX_LENGTH];
+};
+
+enum OtaManifestResult {
+  OTA_MANIFEST_NEW,             // Fetched and parsed
+  OTA_MANIFEST_UNCHANGED,       // 304; the cached copy is current
+  OTA_MANIFEST_MISSING,         // The server has no manifest
+  OTA_MANIFEST_ERROR            // Connection or parse failure
+};
+
+class OtaManifestCheck {
+private:
+  Preferences preferences;
+  OtaManifest manifest;
+  String lastError;
+
+  bool loadCache(const uint8_t runningHash[OTA_MANIFEST_HASH_SIZE]);
+  void saveCache();
+  bool readResponse(WiFiClient& client, int& status, uint32_t& contentLength, String& etag);
+  bool parse(const String& json, const uint8_t runningHash[OTA_MANIFEST_HASH_SIZE]);
+  static bool jsonValue(const String& json, const char* key, String& value);
+  static bool parseHash(const String& hex, uint8_t hash[OTA_MANIFEST_HASH_SIZE]);
+  static size_t parseHex(const String& hex, uint8_t* data, size_t maxLength);
+
+public:
+  OtaManifestCheck();
+
+  // One conditional GET; the running app hash decides "patchAvailable"
+  OtaManifestResult fetch(WiFiClient& client, const String& host, int port, const String& path,
+                          const uint8_t runningHash[OTA_MANIFEST_HASH_SIZE]);
+
+  const OtaManifest& getManifest() const { return manifest; }
+  String getLastError() const { return lastError; }
+  String getReport() const;
+};
+
+// Implementation
+OtaManifestCheck::OtaManifestCheck() {
+  memset(&manifest, 0, sizeof(manifest));
+}
+
+bool OtaManifestCheck::loadCache(const uint8_t runningHash[OTA_MANIFEST_HASH_SIZE]) {
+  OtaManifest cached;
+  preferences.begin("ota", true);
+  size_t length = preferences.getBytes("manifest", &cached, sizeof(cached));
+  preferences.end();
+
+  // Made for another firmware: its patch answer no longer applies
+  if (length != sizeof(cached) || cached.magic != OTA_MANIFEST_MAGIC || cached.etag[0] == '\0' ||
+      memcmp(cached.checkedBy, runningHash, OTA_MANIFEST_CACHE_ID_SIZE) != 0) {
+    return false;
+  }
+  manifest = cached;
+  return true;
+}
+
+void OtaManifestCheck::saveCache() {
+  preferences.begin("ota", false);
+  if (manifest.etag[0] != '\0') {
+    preferences.putBytes("manifest", &manifest, sizeof(manifest));
+  } else {
+    preferences.remove("manifest");
+  }
+  preferences.end();
+}
+
+OtaManifestResult OtaManifestCheck::fetch(WiFiClient& client, const String& host, int port, const String& path,
+                                          const uint8_t runningHash[OTA_MANIFEST_HASH_SIZE]) {
+  lastError = "";
+  bool cached = loadCache(runningHash);
+
+  client.setTimeout(OTA_READ_TIMEOUT_MS);
+  if (!client.connect(host.c_str(), port)) {
+    lastError = "Cannot connect to " + host + ":" + String(port);
+    return OTA_MANIFEST_ERROR;
+  }
+
+  String request = "GET " + path + " HTTP/1.1\r\n" +
+                   "Host: " + host + ":" + String(port) + "\r\n";
+  if (cached) {
+    request += "If-None-Match: " + String(manifest.etag) + "\r\n";
+  }
+  request += "Connection: close\r\n\r\n";
+  client.print(request);
+
+  int status = 0;
+  uint32_t contentLength = 0;
+  String etag;
+  if (!readResponse(client, status, contentLength, etag)) {
+    client.stop();
+    lastError = "No valid HTTP response";
+    return OTA_MANIFEST_ERROR;
+  }
+
+  if (status == 304 && cached) {
+    client.stop();
+    return OTA_MANIFEST_UNCHANGED;
+  }
+  if (status == 404) {
+    client.stop();
+    return OTA_MANIFEST_MISSING;
+  }
+  if (status != 200 || contentLength == 0 || contentLength > OTA_MANIFEST_MAX_LENGTH) {
+    client.stop();
+    lastError = status == 200 ? "Manifest of " + String(contentLength) + " bytes" : "HTTP " + String(status);
+    return OTA_MANIFEST_ERROR;
+  }
+
+  String json;
+  json.reserve(contentLength);
+  unsigned long lastData = millis();
+  while (json.length() < contentLength && millis() - lastData < OTA_READ_TIMEOUT_MS) {
+    int c = client.read();
+    if (c < 0) {
+      if (!client.connected() && !client.available()) break;
+      delay(1);
+      continue;
+    }
+    json += (char)c;
+    lastData = millis();
+  }
+  client.stop();
+  if (json.length() < contentLength) {
+    lastError = "Manifest cut short";
+    return OTA_MANIFEST_ERROR;
+  }
+
+  if (!parse(json, runningHash)) {
+    return OTA_MANIFEST_ERROR;
+  }
+  memset(manifest.etag, 0, sizeof(manifest.etag));
+  if (etag.length() < sizeof(manifest.etag)) {
+    strncpy(manifest.etag, etag.c_str(), sizeof(manifest.etag) - 1);
+  }
+  saveCache();
+  return OTA_MANIFEST_NEW;
+}
+
+bool OtaManifestCheck::readResponse(WiFiClient& client, int& status, uint32_t& contentLength, String& etag) {
+  String line = client.readStringUntil('\n');
+  int space = line.indexOf(' ');
+  if (!line.startsWith("HTTP/") || space == -1) {
+    return false;
+  }
+  status = line.substring(space + 1).toInt();
+
+  for (;;) {
+    line = client.readStringUntil('\n');
+    line.trim();
+    if (line.length() == 0) {
+      break;
+    }
+    int colon = line.indexOf(':');
+    if (colon == -1) {
+      continue;
+    }
+    String name = line.substring(0, colon);
+    name.toLowerCase();
+    String value = line.substring(colon + 1);
+    value.trim();
+
+    if (name == "content-length") {
+      contentLength = strtoul(value.c_str(), nullptr, 10);
+    } else if (name == "etag") {
+      etag = value;
+    }
+  }
+  return true;
+}
+
+bool OtaManifestCheck::parse(const String& json, const uint8_t runningHash[OTA_MANIFEST_HASH_SIZE]) {
+  OtaManifest parsed;
+  memset(&parsed, 0, sizeof(parsed));
+  parsed.magic = OTA_MANIFEST_MAGIC;
+  memcpy(parsed.checkedBy, runningHash, OTA_MANIFEST_CACHE_ID_SIZE);
+
+  String value;
+  if (!jsonValue(json, "version", value) || value.length() == 0 || value.length() >= sizeof(parsed.version)) {
+    lastError = "Manifest has no usable \"version\"";
+    return false;
+  }
+  strncpy(parsed.version, value.c_str(), sizeof(parsed.version) - 1);
+
+  if (!jsonValue(json, "size", value) || value.toInt() <= 0) {
+    lastError = "Manifest has no \"size\"";
+    return false;
+  }
+  parsed.imageSize = value.toInt();
+
+  if (jsonValue(json, "sha256", value)) {
+    parsed.hasSha256 = parseHash(value, parsed.sha256);
+  }
+  if (jsonValue(json, "app_hash", value)) {
+    parsed.hasAppHash = parseHash(value, parsed.appHash);
+  }
+  if (jsonValue(json, "min_bootloader", value)) {
+    parsed.minBootloader = value.toInt();
+  }
+  if (jsonValue(json, "signature", value)) {
+    parsed.signatureLength = parseHex(value, parsed.signature, sizeof(parsed.signature));
+    if (parsed.signatureLength == 0) {
+      lastError = "Manifest \"signature\" is not a hex signature";
+      return false;
+    }
+  }
+
+  // Any listed app hash will do; the running one is all that matters
+  if (jsonValue(json, "patch_from", value)) {
+    String running;
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < OTA_MANIFEST_HASH_SIZE; i++) {
+      running += digits[runningHash[i] >> 4];
+      running += digits[runningHash[i] & 0x0F];
+    }
+    value.toLowerCase();
+    parsed.patchAvailable = value.indexOf("\"" + running + "\"") != -1;
+  }
+
+  manifest = parsed;
+  return true;
+}
+
+// Flat objects only: a string, number or array value for a top-level key
+bool OtaManifestCheck::jsonValue(const String& json, const char* key, String& value) {
+  int keyPos = json.indexOf("\"" + String(key) + "\"");
+  if (keyPos == -1) {
+    return false;
+  }
+  int colon = json.indexOf(':', keyPos + strlen(key) + 2);
+  if (colon == -1) {
+    return false;
+  }
+  int start = colon + 1;
+  while (start < (int)json.length() && isspace(json[start])) {
+    start++;
+  }
+  if (start >= (int)json.length()) {
+    return false;
+  }
+
+  int end;
+  if (json[start] == '"') {
+    end = json.indexOf('"', start + 1);
+    start++;
+  } else if (json[start] == '[') {
+    end = json.indexOf(']', start);
+    if (end != -1) end++;
+  } else {
+    end = start;
+    while (end < (int)json.length() && json[end] != ',' && json[end] != '}' && !isspace(json[end])) {
+      end++;
+    }
+  }
+  if (end == -1) {
+    return false;
+  }
+  value = json.substring(start, end);
+  return true;
+}
+
+bool OtaManifestCheck::parseHash(const String& hex, uint8_t hash[OTA_MANIFEST_HASH_SIZE]) {
+  return hex.length() == OTA_MANIFEST_HASH_SIZE * 2 && parseHex(hex, hash, OTA_MANIFEST_HASH_SIZE) > 0;
+}
+
+// Returns the byte count, or 0 for an odd length, a bad digit or too many bytes
+size_t OtaManifestCheck::parseHex(const String& hex, uint8_t* data, size_t maxLength) {
+  size_t length = hex.length() / 2;
+  if (hex.length() % 2 != 0 || length > maxLength) {
+    return 0;
+  }
+  for (size_t i = 0; i < length; i++) {
+    char pair[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+    char* end = nullptr;
+    data[i] = (uint8_t)strtoul(pair, &end, 16);
+    if (end != pair + 2) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+String OtaManifestCheck::getReport() const {
+  if (manifest.magic != OTA_MANIFEST_MAGIC) {
+    return "Manifest: not checked";
+  }
+  String report = "Manifest: " + String(manifest.version) + ", " + String(manifest.imageSize) + " bytes";
+  report += manifest.hasAppHash ? ", app hash listed" : ", no app hash";
+  report += manifest.patchAvailable ? ", patch for this firmware" : ", no patch for this firmware";
+  report += manifest.signatureLength > 0 ? ", signed" : ", unsigned";
+  if (manifest.minBootloader > 0) {
+    report += ", bootloader >= " + String(manifest.minBootloader);
+  }
+  if (manifest.etag[0] != '\0') {
+    report += ", ETag " + String(manifest.etag);
+  }
+  return report;
+}
+
+#endif // OTA_MANIFEST_H
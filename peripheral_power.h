@@ -0,0 +1,226 @@
+/*
+ * peripheral_power.h - Reference-counted power gating of the meter front end
+ *
+ * This file contains the PeripheralPower class that switches the external
+ * power rail, the IRDA transceiver and the 38 kHz carrier on only while a
+ * meter session needs them. Sessions acquire a set of peripherals and wait
+ * for whatever warm-up time is still left; the last release keeps them on
+ * for PERIPH_LINGER_MS so back-to-back reads do not pay the warm-up again.
+ *
+ * powerUp() starts the warm-up early without holding a reference, so it can
+ * overlap with other work (e.g. parsing the command) and add less latency.
+ */
+
+#ifndef PERIPHERAL_POWER_H
+#define PERIPHERAL_POWER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "hardware_control.h"
+#include "sleep_gate.h"
+
+enum Peripheral {
+  PERIPH_EXT_POWER,
+  PERIPH_IRDA,
+  PERIPH_PWM,
+  PERIPH_COUNT
+};
+
+#define PERIPH_MASK(peripheral) (1u << (peripheral))
+#define PERIPH_FRONT_END (PERIPH_MASK(PERIPH_EXT_POWER) | PERIPH_MASK(PERIPH_IRDA) | PERIPH_MASK(PERIPH_PWM))
+
+struct PeripheralStats {
+  uint32_t powerUps;
+  uint32_t sessions;
+  uint32_t waits;           // Sessions that had to wait for warm-up
+  uint32_t waitedMs;
+  uint32_t onMs;            // Closed on intervals
+};
+
+class PeripheralPower {
+private:
+  HardwareControl* hardware;
+  uint8_t refCount[PERIPH_COUNT];
+  bool powered[PERIPH_COUNT];
+  unsigned long onSince[PERIPH_COUNT];
+  unsigned long offAt[PERIPH_COUNT];      // Linger deadline while unreferenced
+  PeripheralStats stats[PERIPH_COUNT];
+
+  void switchOn(Peripheral peripheral);
+  void switchOff(Peripheral peripheral);
+  static unsigned long warmupMs(Peripheral peripheral);
+  static const char* peripheralName(Peripheral peripheral);
+
+public:
+  PeripheralPower();
+
+  void setHardwareControl(HardwareControl* hwCtrl) { hardware = hwCtrl; }
+
+  // Sessions
+  void powerUp(uint32_t mask);
+  void acquire(uint32_t mask);
+  void release(uint32_t mask);
+
+  // Switches off peripherals whose linger time has run out (main loop)
+  void update();
+  void powerDownAll();
+
+  // Status
+  bool isPowered(Peripheral peripheral) const { return powered[peripheral]; }
+  String getReport();
+};
+
+// Holds a set of peripherals, warmed up, for the lifetime of the object;
+// a forced sleep waits for the session to end instead of cutting it off
+class PeripheralSession {
+private:
+  SleepGuard guard;
+  PeripheralPower& power;
+  uint32_t mask;
+
+public:
+  PeripheralSession(PeripheralPower& peripheralPower, uint32_t peripheralMask)
+    : power(peripheralPower), mask(peripheralMask) {
+    power.acquire(mask);
+  }
+  ~PeripheralSession() { power.release(mask); }
+};
+
+// Implementation
+PeripheralPower::PeripheralPower() : hardware(nullptr) {
+  memset(refCount, 0, sizeof(refCount));
+  memset(powered, 0, sizeof(powered));
+  memset(onSince, 0, sizeof(onSince));
+  memset(offAt, 0, sizeof(offAt));
+  memset(stats, 0, sizeof(stats));
+}
+
+void PeripheralPower::powerUp(uint32_t mask) {
+  for (int i = 0; i < PERIPH_COUNT; i++) {
+    if (!(mask & PERIPH_MASK(i))) continue;
+    if (!powered[i]) {
+      switchOn((Peripheral)i);
+    }
+    if (refCount[i] == 0) {
+      offAt[i] = millis() + PERIPH_LINGER_MS;
+    }
+  }
+}
+
+void PeripheralPower::acquire(uint32_t mask) {
+  powerUp(mask);
+
+  // Wait once for the slowest peripheral still warming up
+  unsigned long waitMs = 0;
+  unsigned long now = millis();
+  for (int i = 0; i < PERIPH_COUNT; i++) {
+    if (!(mask & PERIPH_MASK(i))) continue;
+    refCount[i]++;
+    stats[i].sessions++;
+    unsigned long elapsed = now - onSince[i];
+    unsigned long warmup = warmupMs((Peripheral)i);
+    if (elapsed < warmup) {
+      stats[i].waits++;
+      stats[i].waitedMs += warmup - elapsed;
+      if (warmup - elapsed > waitMs) {
+        waitMs = warmup - elapsed;
+      }
+    }
+  }
+
+  if (waitMs > 0) {
+    delay(waitMs);
+  }
+}
+
+void PeripheralPower::release(uint32_t mask) {
+  for (int i = 0; i < PERIPH_COUNT; i++) {
+    if (!(mask & PERIPH_MASK(i)) || refCount[i] == 0) continue;
+    if (--refCount[i] == 0) {
+      offAt[i] = millis() + PERIPH_LINGER_MS;
+    }
+  }
+}
+
+void PeripheralPower::update() {
+  unsigned long now = millis();
+  for (int i = 0; i < PERIPH_COUNT; i++) {
+    if (powered[i] && refCount[i] == 0 && (long)(now - offAt[i]) >= 0) {
+      switchOff((Peripheral)i);
+    }
+  }
+}
+
+void PeripheralPower::powerDownAll() {
+  for (int i = 0; i < PERIPH_COUNT; i++) {
+    if (powered[i]) {
+      switchOff((Peripheral)i);
+    }
+  }
+}
+
+void PeripheralPower::switchOn(Peripheral peripheral) {
+  if (!hardware) {
+    return;
+  }
+
+  switch (peripheral) {
+    case PERIPH_EXT_POWER: hardware->enableExternalPower(); break;
+    case PERIPH_IRDA: hardware->enableIRDA(); break;
+    case PERIPH_PWM: hardware->enablePWM(); break;
+    default: return;
+  }
+  powered[peripheral] = true;
+  onSince[peripheral] = millis();
+  stats[peripheral].powerUps++;
+}
+
+void PeripheralPower::switchOff(Peripheral peripheral) {
+  if (!hardware) {
+    return;
+  }
+
+  switch (peripheral) {
+    case PERIPH_EXT_POWER: hardware->disableExternalPower(); break;
+    case PERIPH_IRDA: hardware->disableIRDA(); break;
+    case PERIPH_PWM: hardware->disablePWM(); break;
+    default: return;
+  }
+  powered[peripheral] = false;
+  stats[peripheral].onMs += millis() - onSince[peripheral];
+}
+
+unsigned long PeripheralPower::warmupMs(Peripheral peripheral) {
+  switch (peripheral) {
+    case PERIPH_EXT_POWER: return PERIPH_EXT_POWER_WARMUP_MS;
+    case PERIPH_IRDA: return PERIPH_IRDA_WARMUP_MS;
+    case PERIPH_PWM: return PERIPH_PWM_WARMUP_MS;
+    default: return 0;
+  }
+}
+
+const char* PeripheralPower::peripheralName(Peripheral peripheral) {
+  switch (peripheral) {
+    case PERIPH_EXT_POWER: return "External power";
+    case PERIPH_IRDA: return "IRDA transceiver";
+    case PERIPH_PWM: return "38 kHz carrier";
+    default: return "?";
+  }
+}
+
+String PeripheralPower::getReport() {
+  unsigned long now = millis();
+  String report = "=== Peripheral Power ===";
+  for (int i = 0; i < PERIPH_COUNT; i++) {
+    Peripheral peripheral = (Peripheral)i;
+    uint32_t onMs = stats[i].onMs + (powered[i] ? now - onSince[i] : 0);
+    report += "\n" + String(peripheralName(peripheral)) + ": " + String(powered[i] ? "ON" : "OFF") +
+              " (" + String(refCount[i]) + " refs), on " + String(onMs / 1000) + " s (" +
+              String(now > 0 ? onMs * 100.0f / now : 0.0f, 1) + "%), " + String(stats[i].powerUps) +
+              " power-ups, " + String(stats[i].sessions) + " sessions, warm-up " + String(warmupMs(peripheral)) +
+              " ms, waited " + String(stats[i].waits) + "x / " + String(stats[i].waitedMs) + " ms";
+  }
+  return report;
+}
+
+#endif // PERIPHERAL_POWER_H
@@ -10,8 +10,20 @@
 
 #include <Arduino.h>
 #include <esp_sleep.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+#include <esp_rtc_time.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <hal/gpio_ll.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
 #include "config.h"
+#include "sleep_gate.h"
 #include "hardware_control.h"
+#include "status_led.h"
+#include "battery_model.h"
 
 // Power states
 enum PowerState {
@@ -28,47 +40,143 @@ enum WakeupReason {
   WAKEUP_UNKNOWN
 };
 
+// Why the CPU is being kept awake at full speed
+enum PowerLockReason {
+  POWER_LOCK_COMMAND,
+  POWER_LOCK_METER_READ,
+  POWER_LOCK_OTA,
+  POWER_LOCK_REASON_COUNT
+};
+
+// Workload phases with their own clock policy and energy accounting
+enum PowerPhase {
+  PHASE_METER_WAIT,     // Protocol exchange and turnaround delays (low clock)
+  PHASE_PARSE,          // Parsing and formatting replies (max clock)
+  PHASE_RADIO,          // Bluetooth bursts, exports and OTA (max clock)
+  PHASE_COUNT
+};
+
+struct PhaseStats {
+  uint32_t count;
+  uint64_t totalUs;
+  uint32_t lastUs;
+  float energyMj;       // Estimated from the clock used and the battery voltage
+};
+
+// Gaps between commands, for the learned sleep timeout
+#define SLEEP_GAP_BINS 15
+
+static const uint16_t SLEEP_GAP_BIN_LIMITS_S[SLEEP_GAP_BINS - 1] = {
+  5, 10, 20, 30, 45, 60, 90, 120, 180, 240, 300, 420, 600, 900
+};
+
+struct SleepGapModel {
+  uint32_t magic;
+  uint32_t samples;
+  float weights[SLEEP_GAP_BINS];    // Decayed counts; the last bin is open-ended
+  uint64_t pendingGapStartUs;       // RTC time of the last command before a timeout sleep, 0 if none
+};
+
+#define SLEEP_MODEL_MAGIC 0x534C4D31  // "SLM1"
+
+// Survives deep sleep; relearned after power loss
+RTC_DATA_ATTR static SleepGapModel rtcSleepModel;
+
+// Button presses, classified by the button task
+enum ButtonEvent {
+  BUTTON_SHORT_PRESS,
+  BUTTON_LONG_PRESS,
+  BUTTON_DOUBLE_PRESS,
+  BUTTON_EVENT_COUNT
+};
+
+// One raw edge from the button interrupt
+struct ButtonEdge {
+  int64_t timeUs;
+  bool pressed;
+};
+
 // Battery information
 struct BatteryInfo {
   int levelPercent;
   float voltageV;
-  int rawADC;
+  uint32_t pinMilliVolts;     // Filtered, calibrated ADC pin voltage, load compensated
+  float loadMilliAmps;        // Estimated draw at the last sample
   bool isCharging;
   bool isLow;
   unsigned long lastUpdateTime;
   
   // Constructor
-  BatteryInfo() : levelPercent(0), voltageV(0.0), rawADC(0), 
+  BatteryInfo() : levelPercent(0), voltageV(0.0), pinMilliVolts(0), loadMilliAmps(0), 
                   isCharging(false), isLow(false), lastUpdateTime(0) {}
 };
 
 class PowerManager {
 private:
   HardwareControl* hardware;
+  EnergyMonitor* energy;
+  StatusLed* statusLed;
+  BatteryModel* batteryModel;
   
   // Sleep management
   unsigned long sleepTimer;
   unsigned long lastActivityTime;
   unsigned long sleepTimeoutMs;
   PowerState currentState;
+  bool gapOpen;                           // A command has finished and the next gap is running
+  bool sleepFromTimeout;
   
-  // Button handling
-  unsigned long buttonPressStartTime;
-  bool buttonCurrentlyPressed;
+  // Button handling (edges from the interrupt, classified by the button task)
+  volatile bool buttonCurrentlyPressed;
   bool buttonLongPressDetected;
+  TaskHandle_t buttonTask;
+  portMUX_TYPE buttonLock;
+  uint32_t pendingButtonEvents;           // ButtonEvent bits not yet taken by the loop
+  int64_t longPressAtUs;
+  int64_t forcedSleepPressUs;             // Long press a forced sleep was already tried for
+  uint32_t buttonEventCounts[BUTTON_EVENT_COUNT];
+  uint32_t buttonEdges;
+  uint32_t buttonBounces;
+  void (*sleepCallback)();
   
-  // Battery monitoring
+  // Battery monitoring (sampled by a background task, published under batteryLock)
   BatteryInfo battery;
-  unsigned long batteryUpdateInterval;
-  static const int BATTERY_SAMPLES = 50;
+  unsigned long batteryUpdateInterval;    // How often level changes are checked and logged
+  unsigned long lastBatteryCheck;
+  TaskHandle_t batteryTask;
+  portMUX_TYPE batteryLock;
+  float filteredMilliVolts;               // Sampler task only
+  volatile uint32_t batterySamples;
+  volatile uint32_t failedBatterySamples;
   
   // Wake-up handling
   WakeupReason lastWakeupReason;
   
+  // Automatic light sleep between commands
+  esp_pm_lock_handle_t cpuLock;           // ESP_PM_CPU_FREQ_MAX
+  esp_pm_lock_handle_t sleepLock;         // ESP_PM_NO_LIGHT_SLEEP
+  bool lightSleepEnabled;
+  int maxCpuMhz;
+  int heldLocks;
+  uint32_t lockCounts[POWER_LOCK_REASON_COUNT];
+  volatile uint8_t activeLocks[POWER_LOCK_REASON_COUNT];  // Held now, also without light sleep
+  int64_t idleTimeUs;
+  uint32_t wakeCount;
+  uint32_t lastWakeLatencyUs;
+  uint32_t maxWakeLatencyUs;
+  uint64_t totalWakeLatencyUs;
+  PhaseStats phaseStats[PHASE_COUNT];
+  static TaskHandle_t loopTask;
+  static volatile int64_t wakeRequestUs;
+  static QueueHandle_t buttonQueue;
+  static void IRAM_ATTR onButtonInterrupt();
+  
   // Private methods
-  void updateBatteryLevel();
-  int calculateBatteryPercentage(int adcValue);
-  float calculateBatteryVoltage(int adcValue);
+  void sampleBattery();
+  void checkBatteryLevel();
+  static void batteryTaskEntry(void* param);
+  int calculateBatteryPercentage(float voltage);
+  float calculateBatteryVoltage(uint32_t pinMilliVolts);
   bool isBatteryChargingInternal(); // FIXED: Renamed to avoid duplicate declaration
   
   // Sleep detection
@@ -76,9 +184,22 @@ private:
   bool checkAutoSleepCondition();
   bool checkLowBatteryCondition();
   
+  // Learned sleep timeout
+  void initSleepModel();
+  void recordGap(unsigned long gapMs);
+  void updateLearnedTimeout();
+  float expectedGapCost(float timeoutS) const;
+  static float gapBinMidpointS(int bin);
+  
   // Button handling
+  void initButton();
+  static void buttonTaskEntry(void* param);
+  void runButtonTask();
+  void postButtonEvent(ButtonEvent event);
+  void forceSleep();
   void updateButtonState();
   bool isButtonPressed();
+  static const char* buttonEventName(ButtonEvent event);
   
   // Power state management
   void setState(PowerState newState);
@@ -93,7 +214,13 @@ public:
   
   // Initialization
   void init();
+  void seedBattery(uint32_t pinMilliVolts) { filteredMilliVolts = pinMilliVolts; }  // Warm boot: resume the filter
   void setHardwareControl(HardwareControl* hwCtrl) { hardware = hwCtrl; }
+  void setEnergyMonitor(EnergyMonitor* monitor) { energy = monitor; }
+  void setStatusLed(StatusLed* led) { statusLed = led; }
+  void setBatteryModel(BatteryModel* model) { batteryModel = model; }
+  void setSleepCallback(void (*callback)()) { sleepCallback = callback; }  // Full sleep path, used for forced sleep
+  bool initLightSleep();
   
   // Main update function
   void update();
@@ -101,9 +228,27 @@ public:
   // Sleep management
   bool shouldSleep();
   void enterDeepSleep();
+  void enterTimedSleep(uint64_t sleepUs);
+  void armTimerWakeup(uint64_t sleepUs);
   void prepareSleep();
   void resetSleepTimer();
   void extendSleepTimer(unsigned long additionalMs);
+  void recordCommandStart();
+  
+  // Light sleep and power locks
+  bool setLightSleep(bool enabled);
+  bool isLightSleepEnabled() const { return lightSleepEnabled; }
+  void acquireLock(PowerLockReason reason);
+  void releaseLock(PowerLockReason reason);
+  bool isLockHeld(PowerLockReason reason) const { return activeLocks[reason] > 0; }
+  void idleWait(unsigned long timeoutMs);
+  static void notifyActivity();
+  uint64_t getIdleTimeUs() const { return idleTimeUs; }
+  
+  // Workload phases
+  void beginPhase(PowerPhase phase);
+  void endPhase(PowerPhase phase, int64_t durationUs);
+  static bool phaseNeedsMaxClock(PowerPhase phase) { return phase != PHASE_METER_WAIT; }
   
   // Activity tracking
   void recordActivity();
@@ -132,17 +277,65 @@ public:
   void printPowerStatus();
   void printBatteryStatus();
   void printSleepDiagnostics();
+  String getLightSleepReport();
+  String getPhaseReport();
+  String getSleepModelReport();
+  void resetSleepModel();
+  String getButtonReport();
+};
+
+// Keeps light sleep off while in scope; the clock is left to the phases
+class ScopedPowerLock {
+private:
+  PowerManager& manager;
+  PowerLockReason reason;
+
+public:
+  ScopedPowerLock(PowerManager& powerManager, PowerLockReason lockReason)
+    : manager(powerManager), reason(lockReason) {
+    manager.acquireLock(reason);
+  }
+  ~ScopedPowerLock() { manager.releaseLock(reason); }
+};
+
+// Runs one workload phase at its clock and accounts its time and energy
+class ScopedPowerPhase {
+private:
+  PowerManager& manager;
+  PowerPhase phase;
+  int64_t startUs;
+
+public:
+  ScopedPowerPhase(PowerManager& powerManager, PowerPhase workPhase)
+    : manager(powerManager), phase(workPhase) {
+    manager.beginPhase(phase);
+    startUs = esp_timer_get_time();
+  }
+  ~ScopedPowerPhase() { manager.endPhase(phase, esp_timer_get_time() - startUs); }
 };
 
 // Implementation
 PowerManager::PowerManager() 
-  : hardware(nullptr), sleepTimer(0), lastActivityTime(0), 
-    sleepTimeoutMs(SLEEP_TIMEOUT_MS), currentState(POWER_ACTIVE),
-    buttonPressStartTime(0), buttonCurrentlyPressed(false), 
-    buttonLongPressDetected(false), batteryUpdateInterval(30000),
-    lastWakeupReason(WAKEUP_UNKNOWN) {
+  : hardware(nullptr), energy(nullptr), statusLed(nullptr), batteryModel(nullptr), sleepTimer(0), lastActivityTime(0), 
+    sleepTimeoutMs(SLEEP_TIMEOUT_MS), currentState(POWER_ACTIVE), gapOpen(false), sleepFromTimeout(false),
+    buttonCurrentlyPressed(false), buttonLongPressDetected(false), buttonTask(nullptr),
+    buttonLock(portMUX_INITIALIZER_UNLOCKED), pendingButtonEvents(0), longPressAtUs(0), forcedSleepPressUs(-1),
+    buttonEdges(0),
+    buttonBounces(0), sleepCallback(nullptr), batteryUpdateInterval(30000), lastBatteryCheck(0),
+    batteryTask(nullptr), batteryLock(portMUX_INITIALIZER_UNLOCKED), filteredMilliVolts(0),
+    batterySamples(0), failedBatterySamples(0), lastWakeupReason(WAKEUP_UNKNOWN),
+    cpuLock(nullptr), sleepLock(nullptr), lightSleepEnabled(false), maxCpuMhz(0), heldLocks(0),
+    idleTimeUs(0), wakeCount(0), lastWakeLatencyUs(0), maxWakeLatencyUs(0), totalWakeLatencyUs(0) {
+  memset(lockCounts, 0, sizeof(lockCounts));
+  memset((void*)activeLocks, 0, sizeof(activeLocks));
+  memset(phaseStats, 0, sizeof(phaseStats));
+  memset(buttonEventCounts, 0, sizeof(buttonEventCounts));
 }
 
+TaskHandle_t PowerManager::loopTask = nullptr;
+volatile int64_t PowerManager::wakeRequestUs = 0;
+QueueHandle_t PowerManager::buttonQueue = nullptr;
+
 void PowerManager::init() {
   Serial.println("Initializing power manager...");
   
@@ -157,22 +350,32 @@ void PowerManager::init() {
   lastWakeupReason = determineWakeupReason();
   logWakeupReason(lastWakeupReason);
   
-  // Initialize battery monitoring
-  battery.lastUpdateTime = 0;
-  updateBatteryLevel();
+  // Learned sleep timeout (a button wake closes the gap that ended in sleep)
+  initSleepModel();
+  
+  // Initialize battery monitoring: seed the filter here, then sample in the background
+  analogSetPinAttenuation(PIN_BATTERY, ADC_11db);
+  sampleBattery();
+  checkBatteryLevel();
+  if (xTaskCreate(batteryTaskEntry, "battery", BATTERY_TASK_STACK, this, BATTERY_TASK_PRIORITY, &batteryTask) != pdPASS) {
+    Serial.println("ERROR: Could not start battery sampling task");
+  }
+  
+  // Button presses are classified in the background, even while the loop is blocked
+  initButton();
   
   // Set initial state
   setState(POWER_ACTIVE);
   
   Serial.println("Power manager initialized successfully");
   Serial.println("Sleep timeout: " + String(sleepTimeoutMs / 1000) + " seconds");
-  Serial.println("Initial battery level: " + String(battery.levelPercent) + "%");
+  Serial.println("Initial battery level: " + String(getBatteryLevel()) + "%");
 }
 
 void PowerManager::update() {
-  // Update battery level periodically
-  if (millis() - battery.lastUpdateTime > batteryUpdateInterval) {
-    updateBatteryLevel();
+  // Check the sampled battery level periodically
+  if (millis() - lastBatteryCheck > batteryUpdateInterval) {
+    checkBatteryLevel();
   }
   
   // Update button state
@@ -185,10 +388,12 @@ void PowerManager::update() {
   PowerState oldState = currentState;
   
   if (checkManualSleepTrigger() || checkLowBatteryCondition()) {
+    sleepFromTimeout = false;
     setState(POWER_PREPARING_SLEEP);
   } else if (checkAutoSleepCondition()) {
     setState(POWER_IDLE);
     if (sleepTimer > sleepTimeoutMs) {
+      sleepFromTimeout = true;
       setState(POWER_PREPARING_SLEEP);
     }
   } else {
@@ -222,7 +427,8 @@ bool PowerManager::checkAutoSleepCondition() {
 }
 
 bool PowerManager::checkLowBatteryCondition() {
-  return battery.isLow && (battery.levelPercent < 10);
+  BatteryInfo info = getBatteryInfo();
+  return info.isLow && (info.levelPercent < 10) && batterySamples > 0;
 }
 
 void PowerManager::prepareSleep() {
@@ -233,11 +439,16 @@ void PowerManager::prepareSleep() {
   if (hardware) {
     // Visual and audio indication of sleep
     hardware->multiBeep(5);
-    hardware->ledBlink(3, 200);
+    if (statusLed) {
+      statusLed->pulse(LED_STATE_SLEEP);
+    }
     
     // Disable external power to save energy
     hardware->disableExternalPower();
     
+    // The beeps play in the background; deep sleep would cut them off
+    hardware->waitForBuzzer(BUZZER_SLEEP_WAIT_MS);
+    
     // Small delay to ensure power state is stable
     hardware->delayWithYield(100);
   }
@@ -246,10 +457,21 @@ void PowerManager::prepareSleep() {
 void PowerManager::enterDeepSleep() {
   prepareSleep();
   
+  // The gap stays open across sleep only when the timeout ended it; an
+  // operator who turned the device off did not come back
+  rtcSleepModel.pendingGapStartUs = sleepFromTimeout && gapOpen ?
+    esp_rtc_get_time_us() - (uint64_t)(millis() - lastActivityTime) * 1000 : 0;
+  
   Serial.println("Entering deep sleep mode...");
   Serial.println("Device will wake on button press");
   Serial.flush(); // Ensure message is sent before sleep
   
+  // Carry this cycle's energy totals over to the next boot
+  if (energy) {
+    energy->setCpuIdleTime(idleTimeUs);
+    energy->prepareSleep();
+  }
+  
   // Enter deep sleep
   esp_deep_sleep_start();
   
@@ -263,9 +485,39 @@ void PowerManager::enterDeepSleep() {
   }
 }
 
+// Scheduled cycles: straight back to sleep without the beeps and blinks
+void PowerManager::enterTimedSleep(uint64_t sleepUs) {
+  if (hardware) {
+    hardware->disableExternalPower();
+  }
+  
+  // The button still wakes the device into interactive mode
+  esp_sleep_enable_ext0_wakeup(GPIO_NUM_33, 0);
+  armTimerWakeup(sleepUs);
+  
+  Serial.println("Sleeping " + String((uint32_t)(sleepUs / 1000)) + " ms until the next scheduled reading");
+  Serial.flush();
+  
+  if (energy) {
+    energy->setCpuIdleTime(idleTimeUs);
+    energy->prepareSleep();
+  }
+  
+  esp_deep_sleep_start();
+}
+
+void PowerManager::armTimerWakeup(uint64_t sleepUs) {
+  if (sleepUs > 0) {
+    esp_sleep_enable_timer_wakeup(sleepUs);
+  } else {
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+  }
+}
+
 void PowerManager::resetSleepTimer() {
   lastActivityTime = millis();
   sleepTimer = 0;
+  gapOpen = true;
   
   if (currentState == POWER_IDLE || currentState == POWER_PREPARING_SLEEP) {
     setState(POWER_ACTIVE);
@@ -276,6 +528,131 @@ void PowerManager::extendSleepTimer(unsigned long additionalMs) {
   lastActivityTime += additionalMs;
 }
 
+// Called as a command arrives; the time since the previous one finished is a gap
+void PowerManager::recordCommandStart() {
+  if (gapOpen) {
+    recordGap(millis() - lastActivityTime);
+    gapOpen = false;
+  }
+}
+
+// ========================= LEARNED SLEEP TIMEOUT =========================
+
+void PowerManager::initSleepModel() {
+  if (rtcSleepModel.magic != SLEEP_MODEL_MAGIC) {
+    memset(&rtcSleepModel, 0, sizeof(rtcSleepModel));
+    rtcSleepModel.magic = SLEEP_MODEL_MAGIC;
+  }
+  
+  // Woken by the operator after a timeout sleep: that whole gap is now known
+  if (lastWakeupReason == WAKEUP_EXTERNAL_BUTTON && rtcSleepModel.pendingGapStartUs != 0) {
+    uint64_t now = esp_rtc_get_time_us();
+    if (now > rtcSleepModel.pendingGapStartUs) {
+      recordGap((unsigned long)((now - rtcSleepModel.pendingGapStartUs) / 1000));
+    }
+    rtcSleepModel.pendingGapStartUs = 0;
+  } else if (lastWakeupReason != WAKEUP_TIMER) {
+    // Scheduled wakes leave the operator's gap open
+    rtcSleepModel.pendingGapStartUs = 0;
+  }
+  
+  updateLearnedTimeout();
+}
+
+void PowerManager::recordGap(unsigned long gapMs) {
+  unsigned long gapS = gapMs / 1000;
+  int bin = 0;
+  while (bin < SLEEP_GAP_BINS - 1 && gapS >= SLEEP_GAP_BIN_LIMITS_S[bin]) {
+    bin++;
+  }
+  
+  // Exponential forgetting keeps the model on the operator's current routine
+  for (int i = 0; i < SLEEP_GAP_BINS; i++) {
+    rtcSleepModel.weights[i] *= SLEEP_MODEL_DECAY;
+  }
+  rtcSleepModel.weights[bin] += 1.0f;
+  rtcSleepModel.samples++;
+  
+  updateLearnedTimeout();
+}
+
+float PowerManager::gapBinMidpointS(int bin) {
+  if (bin >= SLEEP_GAP_BINS - 1) {
+    return SLEEP_MODEL_LONG_GAP_S;
+  }
+  float lower = bin == 0 ? 0 : SLEEP_GAP_BIN_LIMITS_S[bin - 1];
+  return (lower + SLEEP_GAP_BIN_LIMITS_S[bin]) / 2.0f;
+}
+
+// Expected charge (mA*s) spent over one gap if the device sleeps after timeoutS:
+// gaps shorter than the timeout are spent awake; longer ones are awake for the
+// timeout, asleep for the rest and end with a wake from deep sleep
+float PowerManager::expectedGapCost(float timeoutS) const {
+  float cost = 0;
+  float total = 0;
+  for (int i = 0; i < SLEEP_GAP_BINS; i++) {
+    float weight = rtcSleepModel.weights[i];
+    float gapS = gapBinMidpointS(i);
+    total += weight;
+    if (gapS <= timeoutS) {
+      cost += weight * SLEEP_MODEL_AWAKE_MA * gapS;
+    } else {
+      cost += weight * (SLEEP_MODEL_AWAKE_MA * timeoutS + ENERGY_MA_DEEP_SLEEP * (gapS - timeoutS) + SLEEP_MODEL_WAKE_MAS);
+    }
+  }
+  return total > 0 ? cost / total : 0;
+}
+
+void PowerManager::updateLearnedTimeout() {
+  if (rtcSleepModel.samples < SLEEP_MODEL_MIN_SAMPLES) {
+    sleepTimeoutMs = SLEEP_TIMEOUT_MS;
+    return;
+  }
+  
+  // Candidates are the bounds and every bin edge between them
+  float bestTimeoutS = SLEEP_TIMEOUT_MIN_MS / 1000.0f;
+  float bestCost = expectedGapCost(bestTimeoutS);
+  for (int i = 0; i <= SLEEP_GAP_BINS - 1; i++) {
+    float timeoutS = i < SLEEP_GAP_BINS - 1 ? SLEEP_GAP_BIN_LIMITS_S[i] : SLEEP_TIMEOUT_MAX_MS / 1000.0f;
+    if (timeoutS * 1000 <= SLEEP_TIMEOUT_MIN_MS || timeoutS * 1000 > SLEEP_TIMEOUT_MAX_MS) continue;
+    float cost = expectedGapCost(timeoutS);
+    if (cost < bestCost) {
+      bestCost = cost;
+      bestTimeoutS = timeoutS;
+    }
+  }
+  sleepTimeoutMs = (unsigned long)(bestTimeoutS * 1000);
+}
+
+void PowerManager::resetSleepModel() {
+  memset(&rtcSleepModel, 0, sizeof(rtcSleepModel));
+  rtcSleepModel.magic = SLEEP_MODEL_MAGIC;
+  updateLearnedTimeout();
+}
+
+String PowerManager::getSleepModelReport() {
+  String report = "=== Sleep Model ===\n";
+  bool learned = rtcSleepModel.samples >= SLEEP_MODEL_MIN_SAMPLES;
+  report += "Timeout: " + String(sleepTimeoutMs / 1000) + " s (" +
+            (learned ? String("learned") : "default until " + String(SLEEP_MODEL_MIN_SAMPLES) + " gaps") + ", " +
+            String(rtcSleepModel.samples) + " gaps seen, bounds " + String(SLEEP_TIMEOUT_MIN_MS / 1000) + "-" +
+            String(SLEEP_TIMEOUT_MAX_MS / 1000) + " s)\n";
+  
+  report += "Gap weights:";
+  for (int i = 0; i < SLEEP_GAP_BINS; i++) {
+    String label = i < SLEEP_GAP_BINS - 1 ? "<" + String(SLEEP_GAP_BIN_LIMITS_S[i]) + "s"
+                                          : ">=" + String(SLEEP_GAP_BIN_LIMITS_S[SLEEP_GAP_BINS - 2]) + "s";
+    report += " " + label + ":" + String(rtcSleepModel.weights[i], 1);
+  }
+  
+  if (rtcSleepModel.samples > 0) {
+    report += "\nExpected per gap: " + String(expectedGapCost(sleepTimeoutMs / 1000.0f), 0) + " mAs at " +
+              String(sleepTimeoutMs / 1000) + " s, " + String(expectedGapCost(SLEEP_TIMEOUT_MS / 1000.0f), 0) +
+              " mAs at the fixed " + String(SLEEP_TIMEOUT_MS / 1000) + " s";
+  }
+  return report;
+}
+
 void PowerManager::recordActivity() {
   resetSleepTimer();
 }
@@ -293,57 +670,77 @@ unsigned long PowerManager::getSleepTimeRemaining() {
 }
 
 // Battery management
-void PowerManager::updateBatteryLevel() {
-  int totalReading = 0;
-  
-  // Take multiple samples for accuracy
-  for (int i = 0; i < BATTERY_SAMPLES; i++) {
-    totalReading += analogRead(PIN_BATTERY);
-    delay(2); // Small delay between readings
+void PowerManager::batteryTaskEntry(void* param) {
+  PowerManager* mgr = static_cast<PowerManager*>(param);
+  TickType_t lastWake = xTaskGetTickCount();
+
+  for (;;) {
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(BATTERY_SAMPLE_INTERVAL_MS));
+    mgr->sampleBattery();
   }
+}
+
+void PowerManager::sampleBattery() {
+  // Single calibrated conversion (eFuse characterisation), tens of microseconds
+  uint32_t milliVolts = analogReadMilliVolts(PIN_BATTERY);
+  if (milliVolts == 0) {
+    // PIN_BATTERY is on ADC2, which is unavailable while WiFi is on
+    failedBatterySamples++;
+    return;
+  }
+
+  // Add back the drop across the cell resistance at the present load, so
+  // switching the radio or the IR link on does not move the estimate
+  float loadMilliAmps = energy ? energy->getLoadMilliAmps() : 0;
+  float openCircuitMilliVolts = milliVolts + loadMilliAmps * BATTERY_INTERNAL_MOHM / 1000.0f / BATTERY_DIVIDER_RATIO;
+
+  // Exponential moving average instead of a blocking burst of reads
+  if (filteredMilliVolts <= 0) {
+    filteredMilliVolts = openCircuitMilliVolts;
+  } else {
+    filteredMilliVolts += BATTERY_EMA_ALPHA * (openCircuitMilliVolts - filteredMilliVolts);
+  }
+
+  BatteryInfo info;
+  info.pinMilliVolts = (uint32_t)(filteredMilliVolts + 0.5f);
+  info.loadMilliAmps = loadMilliAmps;
+  info.voltageV = calculateBatteryVoltage(info.pinMilliVolts);
+  info.levelPercent = calculateBatteryPercentage(info.voltageV);
+  info.isCharging = isBatteryChargingInternal();
+  info.isLow = (info.levelPercent < 20);
+  info.lastUpdateTime = millis();
+
+  portENTER_CRITICAL(&batteryLock);
+  battery = info;
+  portEXIT_CRITICAL(&batteryLock);
+  batterySamples++;
+}
+
+void PowerManager::checkBatteryLevel() {
+  lastBatteryCheck = millis();
+  BatteryInfo info = getBatteryInfo();
   
-  int averageReading = totalReading / BATTERY_SAMPLES;
-  
-  // Update battery information
-  battery.rawADC = averageReading;
-  battery.levelPercent = calculateBatteryPercentage(averageReading);
-  battery.voltageV = calculateBatteryVoltage(averageReading);
-  battery.isCharging = isBatteryChargingInternal();
-  battery.isLow = (battery.levelPercent < 20);
-  battery.lastUpdateTime = millis();
-  
-  // Ensure battery level is within valid range
-  if (battery.levelPercent < 0) battery.levelPercent = 0;
-  if (battery.levelPercent > 100) battery.levelPercent = 100;
-  
+  // Coulomb count since the last check, corrected towards the OCV table
+  if (batteryModel && batterySamples > 0) {
+    batteryModel->update(BatteryModel::socFromOcv(info.voltageV));
+  }
+
   // Log battery status changes
   static int lastLoggedLevel = -1;
-  if (abs(battery.levelPercent - lastLoggedLevel) >= 5) {
-    Serial.println("Battery level: " + String(battery.levelPercent) + "% (" + String(battery.voltageV, 2) + "V)");
-    lastLoggedLevel = battery.levelPercent;
+  if (abs(info.levelPercent - lastLoggedLevel) >= 5) {
+    Serial.println("Battery level: " + String(info.levelPercent) + "% (" + String(info.voltageV, 2) + "V)");
+    lastLoggedLevel = info.levelPercent;
   }
 }
 
-int PowerManager::calculateBatteryPercentage(int adcValue) {
-  // Convert ADC reading to percentage
-  const int minADC = 2000;  // Corresponds to ~3.0V (empty)
-  const int maxADC = 3400;  // Corresponds to ~4.2V (full)
-  
-  if (adcValue <= minADC) return 0;
-  if (adcValue >= maxADC) return 100;
-  
-  // Linear mapping (could be improved with proper battery discharge curve)
-  return map(adcValue, minADC, maxADC, 0, 100);
+int PowerManager::calculateBatteryPercentage(float voltage) {
+  // Li-ion discharge curve; the voltage is already load compensated
+  return (int)(BatteryModel::socFromOcv(voltage) + 0.5f);
 }
 
-float PowerManager::calculateBatteryVoltage(int adcValue) {
-  // Convert ADC reading to voltage
-  float voltage = (adcValue * 3.3f) / 4095.0f;
-  
-  // If using voltage divider, multiply by the ratio
-  voltage *= 2.0f; // Adjust this multiplier based on your circuit
-  
-  return voltage;
+float PowerManager::calculateBatteryVoltage(uint32_t pinMilliVolts) {
+  // The pin reading is already calibrated; undo the voltage divider
+  return pinMilliVolts * BATTERY_DIVIDER_RATIO / 1000.0f;
 }
 
 bool PowerManager::isBatteryChargingInternal() {
@@ -352,59 +749,343 @@ bool PowerManager::isBatteryChargingInternal() {
   return false;
 }
 
+// Constant-time reads of the latest published sample
 int PowerManager::getBatteryLevel() {
-  return battery.levelPercent;
+  portENTER_CRITICAL(&batteryLock);
+  int level = battery.levelPercent;
+  portEXIT_CRITICAL(&batteryLock);
+  return level;
 }
 
 float PowerManager::getBatteryVoltage() {
-  return battery.voltageV;
+  portENTER_CRITICAL(&batteryLock);
+  float voltage = battery.voltageV;
+  portEXIT_CRITICAL(&batteryLock);
+  return voltage;
 }
 
 bool PowerManager::isBatteryLow() {
-  return battery.isLow;
+  portENTER_CRITICAL(&batteryLock);
+  bool low = battery.isLow;
+  portEXIT_CRITICAL(&batteryLock);
+  return low;
 }
 
 bool PowerManager::isBatteryCharging() {
-  return battery.isCharging;
+  portENTER_CRITICAL(&batteryLock);
+  bool charging = battery.isCharging;
+  portEXIT_CRITICAL(&batteryLock);
+  return charging;
 }
 
 BatteryInfo PowerManager::getBatteryInfo() {
-  return battery;
+  portENTER_CRITICAL(&batteryLock);
+  BatteryInfo info = battery;
+  portEXIT_CRITICAL(&batteryLock);
+  return info;
 }
 
 void PowerManager::forceBatteryUpdate() {
-  updateBatteryLevel();
+  // The filter needs no burst; just log the current estimate now
+  checkBatteryLevel();
+}
+
+// Light sleep and power locks
+bool PowerManager::initLightSleep() {
+  maxCpuMhz = getCpuFrequencyMhz();
+  
+  esp_err_t err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "active", &cpuLock);
+  if (err == ESP_OK) {
+    err = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "awake", &sleepLock);
+  }
+  if (err != ESP_OK) {
+    Serial.println("Power locks unavailable (" + String(esp_err_to_name(err)) + "), light sleep disabled");
+    return false;
+  }
+  
+  // Whatever wakes the chip also wakes the main loop
+  loopTask = xTaskGetCurrentTaskHandle();
+  // Arms the low level; if the button is already down the interrupt fires once and flips it
+  gpio_wakeup_enable((gpio_num_t)PIN_EXT_SW, GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+  uart_set_wakeup_threshold(UART_NUM_0, POWER_UART_WAKE_THRESHOLD);
+  esp_sleep_enable_uart_wakeup(UART_NUM_0);
+  
+  return setLightSleep(true);
+}
+
+bool PowerManager::setLightSleep(bool enabled) {
+  esp_pm_config_t pmConfig;
+  pmConfig.max_freq_mhz = maxCpuMhz;
+  pmConfig.min_freq_mhz = enabled ? POWER_IDLE_CPU_MHZ : maxCpuMhz;
+  pmConfig.light_sleep_enable = enabled;
+  
+  esp_err_t err = esp_pm_configure(&pmConfig);
+  if (err != ESP_OK) {
+    Serial.println("Light sleep configuration failed: " + String(esp_err_to_name(err)));
+    lightSleepEnabled = false;
+    return false;
+  }
+  
+  lightSleepEnabled = enabled;
+  Serial.println("Light sleep " + String(enabled ? "enabled" : "disabled"));
+  return true;
+}
+
+void PowerManager::acquireLock(PowerLockReason reason) {
+  activeLocks[reason]++;
+  if (!sleepLock) return;
+  esp_pm_lock_acquire(sleepLock);
+  heldLocks++;
+  lockCounts[reason]++;
+}
+
+void PowerManager::releaseLock(PowerLockReason reason) {
+  if (activeLocks[reason] > 0) activeLocks[reason]--;
+  if (!sleepLock || heldLocks == 0) return;
+  esp_pm_lock_release(sleepLock);
+  heldLocks--;
+}
+
+void PowerManager::beginPhase(PowerPhase phase) {
+  if (cpuLock && phaseNeedsMaxClock(phase)) {
+    esp_pm_lock_acquire(cpuLock);
+  }
+}
+
+void PowerManager::endPhase(PowerPhase phase, int64_t durationUs) {
+  bool maxClock = phaseNeedsMaxClock(phase) || !lightSleepEnabled;
+  if (cpuLock && phaseNeedsMaxClock(phase)) {
+    esp_pm_lock_release(cpuLock);
+  }
+  
+  float voltage = getBatteryVoltage();
+  if (voltage <= 0) voltage = POWER_NOMINAL_VOLTAGE;
+  float milliAmps = maxClock ? POWER_MAX_CLOCK_MA : POWER_LOW_CLOCK_MA;
+  
+  PhaseStats& stats = phaseStats[phase];
+  stats.count++;
+  stats.totalUs += durationUs;
+  stats.lastUs = (uint32_t)durationUs;
+  stats.energyMj += milliAmps * voltage * (durationUs / 1000000.0f);
+}
+
+// Blocks the loop until Bluetooth, UART or the button needs it, or the timeout
+void PowerManager::idleWait(unsigned long timeoutMs) {
+  if (!loopTask) {
+    delay(1);
+    return;
+  }
+  
+  int64_t start = esp_timer_get_time();
+  uint32_t events = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeoutMs));
+  int64_t now = esp_timer_get_time();
+  idleTimeUs += now - start;
+  
+  int64_t requested = wakeRequestUs;
+  wakeRequestUs = 0;
+  if (events > 0 && requested > 0 && now > requested) {
+    lastWakeLatencyUs = (uint32_t)(now - requested);
+    if (lastWakeLatencyUs > maxWakeLatencyUs) maxWakeLatencyUs = lastWakeLatencyUs;
+    totalWakeLatencyUs += lastWakeLatencyUs;
+    wakeCount++;
+  }
+}
+
+// Called from the Bluetooth stack task when data or a connection arrives
+void PowerManager::notifyActivity() {
+  if (!loopTask) return;
+  if (wakeRequestUs == 0) wakeRequestUs = esp_timer_get_time();
+  xTaskNotifyGive(loopTask);
+}
+
+void IRAM_ATTR PowerManager::onButtonInterrupt() {
+  // Level-triggered so it can wake light sleep; re-armed for the opposite level
+  bool pressed = gpio_ll_get_level(&GPIO, PIN_EXT_SW) == 0;
+  gpio_ll_set_intr_type(&GPIO, PIN_EXT_SW, pressed ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+  if (!buttonQueue) return;
+  ButtonEdge edge = { esp_timer_get_time(), pressed };
+  BaseType_t woken = pdFALSE;
+  xQueueSendFromISR(buttonQueue, &edge, &woken);
+  portYIELD_FROM_ISR(woken);
 }
 
 // Button handling
+void PowerManager::initButton() {
+  buttonQueue = xQueueCreate(BUTTON_QUEUE_DEPTH, sizeof(ButtonEdge));
+  if (!buttonQueue) {
+    Serial.println("ERROR: Could not create button queue");
+    return;
+  }
+  if (xTaskCreate(buttonTaskEntry, "button", BUTTON_TASK_STACK, this, BUTTON_TASK_PRIORITY, &buttonTask) != pdPASS) {
+    Serial.println("ERROR: Could not start button task");
+    return;
+  }
+  attachInterrupt(PIN_EXT_SW, onButtonInterrupt, ONLOW);
+}
+
+void PowerManager::buttonTaskEntry(void* param) {
+  static_cast<PowerManager*>(param)->runButtonTask();
+}
+
+void PowerManager::runButtonTask() {
+  // A press still held from the wake belongs to the wake, not to a gesture
+  bool pressed = digitalRead(PIN_EXT_SW) == LOW;
+  bool longFired = pressed;
+  bool shortPending = false;
+  int64_t pressUs = esp_timer_get_time();
+  int64_t releaseUs = 0;
+  buttonCurrentlyPressed = pressed;
+  
+  for (;;) {
+    // Wait for the next edge or the next classification deadline
+    int64_t now = esp_timer_get_time();
+    int64_t deadlineUs = INT64_MAX;
+    if (pressed && !longFired) {
+      deadlineUs = pressUs + BUTTON_LONG_PRESS_MS * 1000LL;
+    } else if (!pressed && shortPending) {
+      deadlineUs = releaseUs + BUTTON_DOUBLE_PRESS_MS * 1000LL;
+    }
+    portENTER_CRITICAL(&buttonLock);
+    bool longPending = (pendingButtonEvents & (1u << BUTTON_LONG_PRESS)) && longPressAtUs != forcedSleepPressUs;
+    int64_t forcedSleepUs = longPressAtUs + BUTTON_FORCED_SLEEP_MS * 1000LL;
+    portEXIT_CRITICAL(&buttonLock);
+    if (longPending && forcedSleepUs < deadlineUs) {
+      deadlineUs = forcedSleepUs;
+    }
+    TickType_t wait = portMAX_DELAY;
+    if (deadlineUs != INT64_MAX) {
+      wait = deadlineUs > now ? pdMS_TO_TICKS((deadlineUs - now) / 1000) + 1 : 0;
+    }
+    
+    ButtonEdge edge;
+    if (xQueueReceive(buttonQueue, &edge, wait) == pdTRUE) {
+      // Let the contacts settle, drop the bounces and read the level once
+      vTaskDelay(pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS));
+      uint32_t bounces = uxQueueMessagesWaiting(buttonQueue);
+      xQueueReset(buttonQueue);
+      bool level = digitalRead(PIN_EXT_SW) == LOW;
+      buttonEdges += 1 + bounces;
+      buttonBounces += bounces + (level == pressed ? 1 : 0);
+      
+      if (level && !pressed) {
+        pressUs = edge.timeUs;
+        longFired = false;
+      } else if (!level && pressed && !longFired) {
+        if (shortPending) {
+          shortPending = false;
+          postButtonEvent(BUTTON_DOUBLE_PRESS);
+        } else {
+          shortPending = true;
+          releaseUs = edge.timeUs;
+        }
+      }
+      pressed = level;
+      buttonCurrentlyPressed = pressed;
+    }
+    
+    now = esp_timer_get_time();
+    if (pressed && !longFired && now - pressUs >= BUTTON_LONG_PRESS_MS * 1000LL) {
+      longFired = true;
+      if (shortPending) {
+        shortPending = false;
+        postButtonEvent(BUTTON_SHORT_PRESS);
+      }
+      postButtonEvent(BUTTON_LONG_PRESS);
+    }
+    if (!pressed && shortPending && now - releaseUs >= BUTTON_DOUBLE_PRESS_MS * 1000LL) {
+      shortPending = false;
+      postButtonEvent(BUTTON_SHORT_PRESS);
+    }
+    
+    // The loop is stuck in a blocking operation; sleep from here instead (once per press)
+    portENTER_CRITICAL(&buttonLock);
+    bool stuck = (pendingButtonEvents & (1u << BUTTON_LONG_PRESS)) && longPressAtUs != forcedSleepPressUs &&
+                 now - longPressAtUs >= BUTTON_FORCED_SLEEP_MS * 1000LL;
+    if (stuck) {
+      forcedSleepPressUs = longPressAtUs;
+    }
+    portEXIT_CRITICAL(&buttonLock);
+    if (stuck) {
+      forceSleep();
+    }
+  }
+}
+
+// Runs on the button task; the sleep path closes the sleep gate, so it only
+// goes ahead between flash writes and meter sessions of the blocked loop
+void PowerManager::forceSleep() {
+  // An OTA download leaves the slot half written; the loop takes the press once it is done
+  if (isLockHeld(POWER_LOCK_OTA)) {
+    Serial.println("Main loop busy with an OTA update, long press left for later");
+    return;
+  }
+  
+  Serial.println("Main loop busy, forcing sleep after long button press");
+  sleepFromTimeout = false;
+  if (sleepCallback) {
+    sleepCallback();  // Returns only when the sleep was postponed
+  } else if (SleepGate::close(SLEEP_GATE_WAIT_MS)) {
+    enterDeepSleep();
+  } else {
+    Serial.println("Sleep postponed: the loop did not finish its current step");
+  }
+}
+
+void PowerManager::postButtonEvent(ButtonEvent event) {
+  portENTER_CRITICAL(&buttonLock);
+  pendingButtonEvents |= 1u << event;
+  buttonEventCounts[event]++;
+  if (event == BUTTON_LONG_PRESS) {
+    longPressAtUs = esp_timer_get_time();
+  }
+  portEXIT_CRITICAL(&buttonLock);
+  notifyActivity();
+}
+
 void PowerManager::updateButtonState() {
-  if (!hardware) return;
-  
-  bool currentlyPressed = hardware->isExternalSwitchPressed();
-  
-  if (currentlyPressed && !buttonCurrentlyPressed) {
-    // Button just pressed
-    buttonCurrentlyPressed = true;
-    buttonPressStartTime = millis();
-    buttonLongPressDetected = false;
-  } else if (!currentlyPressed && buttonCurrentlyPressed) {
-    // Button released
-    buttonCurrentlyPressed = false;
-    buttonLongPressDetected = false;
-  } else if (currentlyPressed && buttonCurrentlyPressed) {
-    // Button held down - check for long press
-    unsigned long pressDuration = millis() - buttonPressStartTime;
-    if (pressDuration > BUTTON_DEBOUNCE_MS && !buttonLongPressDetected) {
-      buttonLongPressDetected = true;
-      Serial.println("Long button press detected (" + String(pressDuration) + "ms)");
+  portENTER_CRITICAL(&buttonLock);
+  uint32_t events = pendingButtonEvents;
+  pendingButtonEvents = 0;
+  portEXIT_CRITICAL(&buttonLock);
+  
+  for (int i = 0; i < BUTTON_EVENT_COUNT; i++) {
+    if (events & (1u << i)) {
+      Serial.println("Button: " + String(buttonEventName((ButtonEvent)i)));
     }
   }
+  
+  // Latched until the device sleeps
+  if (events & (1u << BUTTON_LONG_PRESS)) {
+    buttonLongPressDetected = true;
+  }
 }
 
 bool PowerManager::isButtonPressed() {
   return buttonCurrentlyPressed;
 }
 
+const char* PowerManager::buttonEventName(ButtonEvent event) {
+  switch (event) {
+    case BUTTON_SHORT_PRESS: return "short press";
+    case BUTTON_LONG_PRESS: return "long press";
+    case BUTTON_DOUBLE_PRESS: return "double press";
+    default: return "?";
+  }
+}
+
+String PowerManager::getButtonReport() {
+  String report = "=== Button ===\n";
+  report += "State: " + String(buttonCurrentlyPressed ? "pressed" : "released") + ", task " +
+            String(buttonTask ? "running" : "not running") + "\n";
+  report += "Edges: " + String(buttonEdges) + " (" + String(buttonBounces) + " bounces dropped)\n";
+  report += "Presses: " + String(buttonEventCounts[BUTTON_SHORT_PRESS]) + " short, " +
+            String(buttonEventCounts[BUTTON_DOUBLE_PRESS]) + " double, " +
+            String(buttonEventCounts[BUTTON_LONG_PRESS]) + " long (debounce " + String(BUTTON_DEBOUNCE_MS) +
+            " ms, long " + String(BUTTON_LONG_PRESS_MS) + " ms, double within " + String(BUTTON_DOUBLE_PRESS_MS) + " ms)";
+  return report;
+}
+
 // Power state management
 void PowerManager::setState(PowerState newState) {
   if (currentState != newState) {
@@ -486,21 +1167,70 @@ void PowerManager::printPowerStatus() {
   Serial.println("Time since activity: " + String(getTimeSinceLastActivity() / 1000) + "s");
   Serial.println("Sleep time remaining: " + String(getSleepTimeRemaining() / 1000) + "s");
   Serial.println("Button pressed: " + String(buttonCurrentlyPressed ? "YES" : "NO"));
+  if (statusLed) {
+    Serial.println("LED pattern: " + String(statusLed->getCurrentPatternName()));
+  }
   Serial.println("Free heap: " + String(ESP.getFreeHeap()) + " bytes");
   Serial.println("===================");
 }
 
 void PowerManager::printBatteryStatus() {
+  BatteryInfo info = getBatteryInfo();
   Serial.println("=== Battery Status ===");
-  Serial.println("Level: " + String(battery.levelPercent) + "%");
-  Serial.println("Voltage: " + String(battery.voltageV, 2) + "V");
-  Serial.println("Raw ADC: " + String(battery.rawADC));
-  Serial.println("Is Low: " + String(battery.isLow ? "YES" : "NO"));
-  Serial.println("Is Charging: " + String(battery.isCharging ? "YES" : "NO"));
-  Serial.println("Last Update: " + String((millis() - battery.lastUpdateTime) / 1000) + "s ago");
+  Serial.println("Level: " + String(info.levelPercent) + "%");
+  Serial.println("Voltage: " + String(info.voltageV, 2) + "V");
+  Serial.println("Pin voltage: " + String(info.pinMilliVolts) + " mV (filtered)");
+  Serial.println("Samples: " + String(batterySamples) + ", unavailable: " + String(failedBatterySamples));
+  Serial.println("Is Low: " + String(info.isLow ? "YES" : "NO"));
+  Serial.println("Is Charging: " + String(info.isCharging ? "YES" : "NO"));
+  Serial.println("Last Update: " + String((millis() - info.lastUpdateTime) / 1000) + "s ago");
   Serial.println("=====================");
 }
 
+String PowerManager::getLightSleepReport() {
+  String report = "=== Light Sleep ===\n";
+  if (!cpuLock) {
+    return report + "Not available (power management disabled in this build)";
+  }
+  
+  report += "Light sleep: " + String(lightSleepEnabled ? "ON" : "OFF") + " (CPU " +
+            String(lightSleepEnabled ? POWER_IDLE_CPU_MHZ : maxCpuMhz) + "-" + String(maxCpuMhz) + " MHz)\n";
+  report += "Locks held: " + String(heldLocks) + "\n";
+  report += "Lock uses: command " + String(lockCounts[POWER_LOCK_COMMAND]) + ", meter read " +
+            String(lockCounts[POWER_LOCK_METER_READ]) + ", OTA " + String(lockCounts[POWER_LOCK_OTA]) + "\n";
+  
+  int64_t uptimeUs = esp_timer_get_time();
+  report += "Loop idle: " + String(uptimeUs > 0 ? idleTimeUs * 100.0 / uptimeUs : 0.0, 1) + "% of " +
+            String((uint32_t)(uptimeUs / 1000000)) + " s\n";
+  if (wakeCount > 0) {
+    report += "Wake latency: last " + String(lastWakeLatencyUs) + " us, avg " +
+              String((uint32_t)(totalWakeLatencyUs / wakeCount)) + " us, max " + String(maxWakeLatencyUs) +
+              " us (" + String(wakeCount) + " wakes)";
+  } else {
+    report += "Wake latency: no wakes yet";
+  }
+  return report;
+}
+
+String PowerManager::getPhaseReport() {
+  static const char* const phaseNames[PHASE_COUNT] = {"Meter wait", "Parse/format", "Radio"};
+  
+  String report = "=== Workload Phases ===\n";
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    const PhaseStats& stats = phaseStats[i];
+    report += String(phaseNames[i]) + " (" + (phaseNeedsMaxClock((PowerPhase)i) ? "max" : "low") + " clock): ";
+    if (stats.count == 0) {
+      report += "not run yet\n";
+      continue;
+    }
+    report += String(stats.count) + "x, avg " + String((uint32_t)(stats.totalUs / stats.count / 1000)) +
+              " ms, last " + String(stats.lastUs / 1000) + " ms, ~" + String(stats.energyMj, 1) + " mJ\n";
+  }
+  report += "Estimates: " + String(POWER_LOW_CLOCK_MA) + " mA at " + String(POWER_IDLE_CPU_MHZ) + " MHz, " +
+            String(POWER_MAX_CLOCK_MA) + " mA at " + String(maxCpuMhz) + " MHz";
+  return report;
+}
+
 void PowerManager::printSleepDiagnostics() {
   Serial.println("=== Sleep Diagnostics ===");
   Serial.println("Sleep timeout: " + String(sleepTimeoutMs / 1000) + "s");
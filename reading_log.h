@@ -0,0 +1,995 @@
+/*
+ * reading_log.h - On-device reading log
+ *
+ * This file contains the ReadingLog class that keeps every meter
+ * reading in an append-only ring of fixed-size records inside the
+ * "readlog" flash partition (see partitions.csv).
+ *
+ * Layout: the partition is a ring of 4 KB sectors. Each sector holds
+ * variable-length entries packed front to back (see log_format.h) and
+ * a 64-byte index slot at the end. The first reading of a meter in a
+ * sector is a full keyframe; the following ones are stored as deltas
+ * of the changed fields against it, usually 15-25 bytes instead of 61.
+ * Every entry carries its own CRC, so a reset in the middle of a write
+ * costs at most that one entry. The sector after the head is always
+ * kept erased; when the head moves into it, the oldest sector is
+ * erased to make room.
+ *
+ * Index: the last slot of each sector holds a Bloom filter of the
+ * meter IDs stored in that sector. It starts erased (all ones) and
+ * each append only clears bits, so it is updated in place without an
+ * erase. Together with the first sequence and timestamp of every
+ * sector (kept in RAM) it lets queries skip straight to the sectors
+ * that can match.
+ *
+ * Appending only copies the record into a queue. Flash programming
+ * and erasing happen in a low-priority writer task.
+ */
+
+#ifndef READING_LOG_H
+#define READING_LOG_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <time.h>
+#include "config.h"
+#include "data_parser.h"
+#include "log_format.h"
+#include "sleep_gate.h"
+
+
+// RAM copy of what the queries need to know about a sector
+struct LogSectorSummary {
+  uint32_t firstSequence;     // 0 when the sector holds no records
+  uint32_t firstTimestamp;
+  bool clockSet;              // firstTimestamp is epoch time, not uptime
+  bool indexWritten;
+  uint8_t bloom[LOG_BLOOM_BYTES];
+};
+
+// Keyframe in the head sector that new deltas can refer to
+struct LogKeyframeRef {
+  char meterId[12];
+  uint16_t offset;            // Within the sector
+  uint8_t deltas;             // Deltas written against it since mount
+  bool intact;
+};
+
+// Query callback; return false to stop early
+typedef bool (*LogRecordVisitor)(const LogRecord& record, void* context);
+
+// Snapshot of the sectors a bulk export walks through
+struct LogExportPlan {
+  uint32_t fromSequence;
+  uint32_t toSequence;
+  uint32_t tailSector;
+  uint32_t startIndex;        // Ring position of the first sector to send
+  uint32_t chunkCount;        // One chunk per sector
+  uint32_t headSector;
+  uint32_t headOffset;
+};
+
+struct LogQueryResult {
+  uint32_t matches;
+  uint32_t sectorsRead;
+  bool stopped;               // Visitor ended the query early
+};
+
+class ReadingLog {
+private:
+  struct SinceSearch {
+    const ReadingLog* log;
+    uint32_t tail;
+  };
+
+  const esp_partition_t* partition;
+  const uint8_t* flashBase;               // Memory-mapped view used for all reads
+  esp_partition_mmap_handle_t mapHandle;
+  QueueHandle_t queue;
+  TaskHandle_t writerTask;
+  portMUX_TYPE positionLock;
+  uint32_t sectorCount;
+  LogSectorSummary* summaries;
+  bool mounted;
+  unsigned long mountTimeUs;
+
+  // Ring position, written by the writer task only
+  uint32_t headSector;
+  uint32_t headOffset;                    // Next free byte in the head sector
+  uint32_t tailSector;
+  uint32_t nextSequence;
+  uint32_t oldestSequence;
+
+  // Keyframes of the head sector, written by the writer task only
+  LogKeyframeRef keyframes[LOG_MAX_SECTOR_KEYFRAMES];
+  int keyframeCount;
+
+  // Statistics
+  volatile bool writing;                  // Writer holds a dequeued record
+  uint32_t recordsWritten;
+  uint32_t keyframesWritten;
+  uint32_t bytesWritten;
+  uint32_t droppedRecords;
+  uint32_t writeErrors;
+  uint32_t sectorsErased;
+
+  // Layout helpers
+  size_t sectorOffset(uint32_t sector) const { return sector * LOG_SECTOR_SIZE; }
+  size_t indexOffset(uint32_t sector) const { return sector * LOG_SECTOR_SIZE + LOG_DATA_SIZE; }
+  const uint8_t* sectorData(uint32_t sector) const { return flashBase + sectorOffset(sector); }
+  bool isSectorErased(uint32_t sector) const;
+  bool isForeignSector(uint32_t sector) const;
+  size_t usedLength(uint32_t sector) const;
+  uint32_t ringSectorAt(uint32_t tail, uint32_t index) const { return (tail + index) % sectorCount; }
+  bool endsBefore(uint32_t tail, uint32_t used, uint32_t index, uint32_t sequence) const;
+
+  // Index
+  void loadSummary(uint32_t sector);
+  void resetSummary(uint32_t sector);
+  bool updateIndex(const LogRecord& record);
+  static void bloomPositions(const char* meterId, uint16_t* positions);
+  static bool bloomContains(const uint8_t* bloom, const uint16_t* positions);
+  static void meterKey(const String& meterId, char* key);
+  static bool sectorClock(uint32_t index, uint32_t& firstTimestamp, void* context);
+
+  // Mount and write path
+  bool scan();
+  bool format();
+  bool eraseSector(uint32_t sector);
+  void prepareNextSector();
+  void findTail(uint32_t fromSector);
+  void loadHeadState();
+  size_t encodeEntry(const LogRecord& record, uint8_t* entry, int& keyIndex);
+  void writeRecord(LogRecord& record);
+  static void writerTaskEntry(void* param);
+
+  // Record construction
+  void fillReading(LogRecord& record, const ParsedMeterData& parsed);
+  static uint32_t scaled(float value, float factor, uint32_t limit);
+  static String meterIdString(const LogRecord& record);
+  void snapshotRing(uint32_t& tail, uint32_t& used);
+
+  void logStorageEvent(const String& event);
+
+public:
+  ReadingLog();
+
+  // Initialization (mounts the partition and starts the writer task)
+  bool init();
+
+  // Logging
+  bool append(const MeterData& data, const ParsedMeterData& parsed);
+  bool flush(unsigned long timeoutMs = 1000);
+
+  // Reading back
+  bool readLatest(LogRecord& record);
+  bool readRecord(uint32_t sequence, LogRecord& record);
+  String formatRecord(const LogRecord& record) const;
+  String formatRecordSummary(const LogRecord& record) const;
+
+  // Indexed queries (oldest first), starting at fromSequence to resume a cut-off query
+  LogQueryResult findByMeter(const String& meterId, LogRecordVisitor visitor, void* context,
+                             uint32_t fromSequence = 0);
+  LogQueryResult findSince(uint32_t timestamp, LogRecordVisitor visitor, void* context, uint32_t fromSequence = 0);
+
+  // Bulk export straight from the mapped partition
+  bool planExport(uint32_t fromSequence, LogExportPlan& plan);
+  bool getExportChunk(const LogExportPlan& plan, uint32_t index, const uint8_t*& data, size_t& length) const;
+
+  // Status
+  bool isMounted() const { return mounted; }
+  uint32_t getRecordCount();
+  uint32_t getUsedBytes();
+  uint32_t getCapacity();                 // Estimated from the average entry size
+  String getStatusReport();
+};
+
+// Implementation
+ReadingLog::ReadingLog()
+  : partition(nullptr), flashBase(nullptr), mapHandle(0), queue(nullptr), writerTask(nullptr),
+    positionLock(portMUX_INITIALIZER_UNLOCKED), sectorCount(0), summaries(nullptr), mounted(false), mountTimeUs(0),
+    headSector(0), headOffset(0), tailSector(0), nextSequence(1), oldestSequence(1), keyframeCount(0),
+    writing(false), recordsWritten(0), keyframesWritten(0), bytesWritten(0), droppedRecords(0), writeErrors(0), sectorsErased(0) {
+}
+
+bool ReadingLog::init() {
+  unsigned long start = micros();
+
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)READING_LOG_PARTITION_SUBTYPE,
+                                       READING_LOG_PARTITION);
+  if (!partition) {
+    logStorageEvent("No '" READING_LOG_PARTITION "' partition, reading log disabled");
+    return false;
+  }
+
+  sectorCount = partition->size / LOG_SECTOR_SIZE;
+  if (sectorCount < 2) {
+    logStorageEvent("Partition too small, reading log disabled");
+    return false;
+  }
+
+  const void* mapped = nullptr;
+  esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &mapped, &mapHandle);
+  if (err != ESP_OK) {
+    logStorageEvent("Partition map failed: " + String(esp_err_to_name(err)));
+    return false;
+  }
+  flashBase = static_cast<const uint8_t*>(mapped);
+
+  summaries = (LogSectorSummary*)calloc(sectorCount, sizeof(LogSectorSummary));
+  if (!summaries) {
+    logStorageEvent("Out of memory for the sector index");
+    return false;
+  }
+
+  if (!scan()) {
+    logStorageEvent("Unknown log format, formatting partition");
+    if (!format()) {
+      return false;
+    }
+  }
+
+  queue = xQueueCreate(READING_LOG_QUEUE_DEPTH, sizeof(LogRecord));
+  if (!queue ||
+      xTaskCreate(writerTaskEntry, "readlog", READING_LOG_TASK_STACK, this, READING_LOG_TASK_PRIORITY, &writerTask) != pdPASS) {
+    logStorageEvent("Could not start writer task");
+    return false;
+  }
+
+  mounted = true;
+  mountTimeUs = micros() - start;
+  logStorageEvent("Mounted " + String(getRecordCount()) + " records in " + String(mountTimeUs) + " us");
+  return true;
+}
+
+// ========================= MOUNT =========================
+
+bool ReadingLog::scan() {
+  int32_t newestSector = -1;
+  int32_t oldestSector = -1;
+  uint32_t newestFirst = 0;
+  uint32_t oldestFirst = 0;
+
+  // The first valid entry of each sector gives the sector's sequence
+  for (uint32_t sector = 0; sector < sectorCount; sector++) {
+    resetSummary(sector);
+    if (isForeignSector(sector)) {
+      return false;
+    }
+    if (sectorData(sector)[0] == LOG_ENTRY_ERASED) {
+      continue;
+    }
+
+    loadSummary(sector);
+    if (summaries[sector].firstSequence == 0) {
+      continue;  // Torn write into a fresh sector; erased again before reuse
+    }
+    uint32_t sequence = summaries[sector].firstSequence;
+    if (newestSector < 0 || sequence > newestFirst) {
+      newestSector = sector;
+      newestFirst = sequence;
+    }
+    if (oldestSector < 0 || sequence < oldestFirst) {
+      oldestSector = sector;
+      oldestFirst = sequence;
+    }
+  }
+
+  if (newestSector < 0) {
+    // Empty log (sector 0 may still hold a torn first write)
+    if (!isSectorErased(0) && !eraseSector(0)) {
+      return false;
+    }
+    headSector = 0;
+    headOffset = 0;
+    keyframeCount = 0;
+    tailSector = 0;
+    nextSequence = 1;
+    oldestSequence = 1;
+    return true;
+  }
+
+  headSector = newestSector;
+  nextSequence = newestFirst;
+  loadHeadState();
+
+  tailSector = oldestSector;
+  oldestSequence = oldestFirst;
+  return true;
+}
+
+bool ReadingLog::format() {
+  esp_err_t err = esp_partition_erase_range(partition, 0, sectorCount * LOG_SECTOR_SIZE);
+  if (err != ESP_OK) {
+    logStorageEvent("Format failed: " + String(esp_err_to_name(err)));
+    return false;
+  }
+
+  sectorsErased += sectorCount;
+  for (uint32_t sector = 0; sector < sectorCount; sector++) {
+    resetSummary(sector);
+  }
+  headSector = 0;
+  headOffset = 0;
+  keyframeCount = 0;
+  tailSector = 0;
+  nextSequence = 1;
+  oldestSequence = 1;
+  return true;
+}
+
+// Rebuilds the append position and the keyframe table of the head sector
+void ReadingLog::loadHeadState() {
+  const uint8_t* data = sectorData(headSector);
+  LogSectorReader reader(data);
+  LogRecord record;
+  while (reader.next(record)) {
+    if (record.sequence >= nextSequence) {
+      nextSequence = record.sequence + 1;
+    }
+  }
+
+  // A torn entry header ends the sector; nothing is appended after it
+  headOffset = reader.endedClean() ? reader.endOffset() : LOG_DATA_SIZE;
+
+  keyframeCount = reader.getKeyframeCount();
+  for (int i = 0; i < keyframeCount; i++) {
+    LogKeyframeRef& ref = keyframes[i];
+    const uint8_t* entry = data + reader.keyframeOffset(i);
+    ref.offset = reader.keyframeOffset(i);
+    ref.deltas = 0;  // Not stored; a restart allows at most one longer run
+    ref.intact = LogSectorReader::isEntryValid(entry);
+    if (ref.intact) {
+      logDecodeKeyframe(entry, record);
+      memcpy(ref.meterId, record.meterId, sizeof(ref.meterId));
+    } else {
+      memset(ref.meterId, 0, sizeof(ref.meterId));
+    }
+  }
+}
+
+// ========================= LAYOUT HELPERS =========================
+
+bool ReadingLog::isSectorErased(uint32_t sector) const {
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(sectorData(sector));
+  for (int i = 0; i < LOG_SECTOR_SIZE / 4; i++) {
+    if (words[i] != 0xFFFFFFFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Written by an older firmware with a different layout
+bool ReadingLog::isForeignSector(uint32_t sector) const {
+  uint8_t marker = sectorData(sector)[0];
+  if (marker != LOG_ENTRY_ERASED && marker != LOG_ENTRY_KEYFRAME && marker != LOG_ENTRY_DELTA) {
+    return true;
+  }
+  const LogSectorIndex* index = reinterpret_cast<const LogSectorIndex*>(flashBase + indexOffset(sector));
+  return index->magic == LOG_INDEX_MAGIC && index->version != LOG_FORMAT_VERSION;
+}
+
+// Bytes up to the first erased or torn entry
+size_t ReadingLog::usedLength(uint32_t sector) const {
+  LogSectorReader reader(sectorData(sector));
+  LogRecord record;
+  while (reader.next(record)) {
+  }
+  return reader.endOffset();
+}
+
+// ========================= INDEX =========================
+
+void ReadingLog::loadSummary(uint32_t sector) {
+  LogSectorSummary& summary = summaries[sector];
+  LogSectorReader reader(sectorData(sector));
+  LogRecord first;
+  bool found = reader.next(first);
+  summary.firstSequence = found ? first.sequence : 0;
+  summary.firstTimestamp = found ? first.timestamp : 0;
+  summary.clockSet = found && (first.flags & LOG_FLAG_CLOCK_SET);
+
+  const LogSectorIndex* index = reinterpret_cast<const LogSectorIndex*>(flashBase + indexOffset(sector));
+  summary.indexWritten = index->magic == LOG_INDEX_MAGIC;
+  if (summary.indexWritten) {
+    memcpy(summary.bloom, index->bloom, LOG_BLOOM_BYTES);
+  } else {
+    // No usable index: let every meter query look at this sector
+    memset(summary.bloom, 0x00, LOG_BLOOM_BYTES);
+  }
+}
+
+void ReadingLog::resetSummary(uint32_t sector) {
+  LogSectorSummary& summary = summaries[sector];
+  summary.firstSequence = 0;
+  summary.firstTimestamp = 0;
+  summary.clockSet = false;
+  summary.indexWritten = false;
+  memset(summary.bloom, 0xFF, LOG_BLOOM_BYTES);
+}
+
+// Written before the entry, so a reset in between can only add a false match
+bool ReadingLog::updateIndex(const LogRecord& record) {
+  LogSectorSummary& summary = summaries[headSector];
+  uint16_t positions[LOG_BLOOM_HASHES];
+  bloomPositions(record.meterId, positions);
+
+  if (summary.indexWritten && bloomContains(summary.bloom, positions)) {
+    return true;  // Meter already indexed in this sector
+  }
+
+  for (int i = 0; i < LOG_BLOOM_HASHES; i++) {
+    summary.bloom[positions[i] / 8] &= ~(1 << (positions[i] % 8));
+  }
+
+  LogSectorIndex index;
+  index.magic = LOG_INDEX_MAGIC;
+  index.version = LOG_FORMAT_VERSION;
+  index.reserved = 0xFF;
+  memcpy(index.bloom, summary.bloom, LOG_BLOOM_BYTES);
+
+  // Bits only go from 1 to 0, so the slot is rewritten in place
+  esp_err_t err = esp_partition_write(partition, indexOffset(headSector), &index, sizeof(index));
+  if (err != ESP_OK) {
+    writeErrors++;
+    logStorageEvent("Index write failed: " + String(esp_err_to_name(err)));
+    return false;
+  }
+  summary.indexWritten = true;
+  return true;
+}
+
+void ReadingLog::bloomPositions(const char* meterId, uint16_t* positions) {
+  // Double hashing from one CRC over the fixed-size ID field
+  uint32_t hash = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(meterId), sizeof(LogRecord::meterId));
+  uint32_t h1 = hash & 0xFFFF;
+  uint32_t h2 = (hash >> 16) | 1;
+  for (int i = 0; i < LOG_BLOOM_HASHES; i++) {
+    positions[i] = (h1 + i * h2) % LOG_BLOOM_BITS;
+  }
+}
+
+bool ReadingLog::bloomContains(const uint8_t* bloom, const uint16_t* positions) {
+  for (int i = 0; i < LOG_BLOOM_HASHES; i++) {
+    if (bloom[positions[i] / 8] & (1 << (positions[i] % 8))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ReadingLog::meterKey(const String& meterId, char* key) {
+  // Same padding as the record field
+  memset(key, 0, sizeof(LogRecord::meterId));
+  strncpy(key, meterId.c_str(), sizeof(LogRecord::meterId));
+}
+
+// ========================= WRITE PATH =========================
+
+bool ReadingLog::append(const MeterData& data, const ParsedMeterData& parsed) {
+  if (!mounted) {
+    return false;
+  }
+
+  LogRecord record;
+  memset(&record, 0, sizeof(record));
+  record.meterType = (uint8_t)data.type;
+
+  time_t now = time(nullptr);
+  if (now >= (time_t)LOG_CLOCK_VALID_AFTER) {
+    record.timestamp = (uint32_t)now;
+    record.flags |= LOG_FLAG_CLOCK_SET;
+  } else {
+    record.timestamp = millis() / 1000;
+  }
+
+  if (data.binaryData && data.dataLength > 0) {
+    record.frameHash = esp_rom_crc32_le(0, data.binaryData + RAW_FRAME_HEADER_SIZE, data.dataLength);
+  }
+
+  const String& id = parsed.info.serialNumber.length() > 0 ? parsed.info.serialNumber : parsed.info.manufacturerId;
+  strncpy(record.meterId, id.c_str(), sizeof(record.meterId));
+
+  if (parsed.isValid) {
+    fillReading(record, parsed);
+  }
+
+  // The sequence is assigned by the writer so sequences follow flash order
+  if (xQueueSend(queue, &record, 0) != pdTRUE) {
+    droppedRecords++;
+    return false;
+  }
+  return true;
+}
+
+void ReadingLog::fillReading(LogRecord& record, const ParsedMeterData& parsed) {
+  record.kwh = scaled(parsed.energy.kwh, 100, UINT32_MAX);
+  record.kvah = scaled(parsed.energy.kvah, 100, UINT32_MAX);
+  record.kvarhLag = scaled(parsed.energy.kvarhLag, 100, UINT32_MAX);
+  record.kvarhLead = scaled(parsed.energy.kvarhLead, 100, UINT32_MAX);
+  record.maxDemand = scaled(parsed.energy.maxDemand, 100, UINT16_MAX);
+  record.voltage[0] = scaled(parsed.electrical.voltageR, 10, UINT16_MAX);
+  record.voltage[1] = scaled(parsed.electrical.voltageY, 10, UINT16_MAX);
+  record.voltage[2] = scaled(parsed.electrical.voltageB, 10, UINT16_MAX);
+  record.current[0] = scaled(parsed.electrical.currentR, 100, UINT16_MAX);
+  record.current[1] = scaled(parsed.electrical.currentY, 100, UINT16_MAX);
+  record.current[2] = scaled(parsed.electrical.currentB, 100, UINT16_MAX);
+  record.powerFactor = scaled(parsed.energy.powerFactor, 100, UINT8_MAX);
+  record.flags |= LOG_FLAG_PARSED;
+}
+
+uint32_t ReadingLog::scaled(float value, float factor, uint32_t limit) {
+  if (value <= 0) {
+    return 0;
+  }
+  double result = (double)value * factor + 0.5;
+  return result >= (double)limit ? limit : (uint32_t)result;
+}
+
+bool ReadingLog::flush(unsigned long timeoutMs) {
+  unsigned long start = millis();
+  while (uxQueueMessagesWaiting(queue) > 0 || writing) {
+    if (millis() - start >= timeoutMs) {
+      return false;
+    }
+    delay(1);
+  }
+  return true;
+}
+
+void ReadingLog::writerTaskEntry(void* param) {
+  ReadingLog* log = static_cast<ReadingLog*>(param);
+
+  // Restore the erased-sector invariant left open by a reset
+  {
+    SleepGuard guard;
+    log->prepareNextSector();
+  }
+
+  LogRecord record;
+  for (;;) {
+    if (xQueueReceive(log->queue, &record, portMAX_DELAY) == pdTRUE) {
+      // Deep sleep waits until the entry (and any sector erase) is complete
+      SleepGuard guard;
+      log->writing = true;
+      log->writeRecord(record);
+      log->writing = false;
+    }
+  }
+}
+
+void ReadingLog::writeRecord(LogRecord& record) {
+  record.sequence = nextSequence;
+
+  uint8_t entry[LOG_ENTRY_MAX_SIZE];
+  int keyIndex;
+  size_t length = encodeEntry(record, entry, keyIndex);
+  if (headOffset + length > LOG_DATA_SIZE) {
+    // Move into the pre-erased sector, then free the one after it
+    portENTER_CRITICAL(&positionLock);
+    headSector = (headSector + 1) % sectorCount;
+    headOffset = 0;
+    portEXIT_CRITICAL(&positionLock);
+    keyframeCount = 0;
+    prepareNextSector();
+    length = encodeEntry(record, entry, keyIndex);  // Deltas never refer across sectors
+  }
+
+  updateIndex(record);
+  esp_err_t err = esp_partition_write(partition, sectorOffset(headSector) + headOffset, entry, length);
+
+  portENTER_CRITICAL(&positionLock);
+  if (err == ESP_OK) {
+    headOffset += length;
+    if (summaries[headSector].firstSequence == 0) {
+      summaries[headSector].firstSequence = record.sequence;
+      summaries[headSector].firstTimestamp = record.timestamp;
+      summaries[headSector].clockSet = record.flags & LOG_FLAG_CLOCK_SET;
+    }
+    nextSequence++;
+    recordsWritten++;
+    bytesWritten += length;
+  } else {
+    headOffset = LOG_DATA_SIZE;  // The failed range may hold a torn entry; close the sector
+  }
+  portEXIT_CRITICAL(&positionLock);
+
+  if (err != ESP_OK) {
+    writeErrors++;
+    logStorageEvent("Write failed: " + String(esp_err_to_name(err)));
+    return;
+  }
+
+  if (keyIndex >= 0) {
+    keyframes[keyIndex].deltas++;
+    return;
+  }
+
+  keyframesWritten++;
+  if (keyframeCount < LOG_MAX_SECTOR_KEYFRAMES) {
+    LogKeyframeRef& ref = keyframes[keyframeCount++];
+    memcpy(ref.meterId, record.meterId, sizeof(ref.meterId));
+    ref.offset = headOffset - length;
+    ref.deltas = 0;
+    ref.intact = true;
+  }
+}
+
+// Delta against the meter's latest keyframe in the head sector, or a new keyframe
+size_t ReadingLog::encodeEntry(const LogRecord& record, uint8_t* entry, int& keyIndex) {
+  keyIndex = -1;
+  for (int i = keyframeCount - 1; i >= 0; i--) {
+    if (memcmp(keyframes[i].meterId, record.meterId, sizeof(record.meterId)) == 0) {
+      keyIndex = i;
+      break;
+    }
+  }
+
+  if (keyIndex >= 0 && keyframes[keyIndex].intact && keyframes[keyIndex].deltas + 1 < LOG_KEYFRAME_INTERVAL) {
+    LogRecord key;
+    logDecodeKeyframe(sectorData(headSector) + keyframes[keyIndex].offset, key);
+    size_t length = logEncodeDelta(record, key, keyIndex, entry);
+    if (length < LOG_KEYFRAME_SIZE) {
+      return length;
+    }
+  }
+
+  keyIndex = -1;
+  return logEncodeKeyframe(record, entry);
+}
+
+void ReadingLog::prepareNextSector() {
+  uint32_t next = (headSector + 1) % sectorCount;
+  if (isSectorErased(next)) {
+    return;
+  }
+
+  if (!eraseSector(next)) {
+    return;
+  }
+
+  // The oldest data was in that sector; the tail moves past it
+  if (next == tailSector) {
+    findTail((next + 1) % sectorCount);
+  }
+}
+
+void ReadingLog::findTail(uint32_t fromSector) {
+  for (uint32_t i = 0; i < sectorCount; i++) {
+    uint32_t sector = (fromSector + i) % sectorCount;
+    if (summaries[sector].firstSequence != 0) {
+      portENTER_CRITICAL(&positionLock);
+      tailSector = sector;
+      oldestSequence = summaries[sector].firstSequence;
+      portEXIT_CRITICAL(&positionLock);
+      return;
+    }
+  }
+
+  portENTER_CRITICAL(&positionLock);
+  tailSector = headSector;
+  oldestSequence = nextSequence;
+  portEXIT_CRITICAL(&positionLock);
+}
+
+bool ReadingLog::eraseSector(uint32_t sector) {
+  esp_err_t err = esp_partition_erase_range(partition, sector * LOG_SECTOR_SIZE, LOG_SECTOR_SIZE);
+  if (err != ESP_OK) {
+    writeErrors++;
+    logStorageEvent("Erase failed: " + String(esp_err_to_name(err)));
+    return false;
+  }
+  portENTER_CRITICAL(&positionLock);
+  resetSummary(sector);
+  portEXIT_CRITICAL(&positionLock);
+  sectorsErased++;
+  return true;
+}
+
+// ========================= READING BACK =========================
+
+bool ReadingLog::readLatest(LogRecord& record) {
+  if (!mounted) {
+    return false;
+  }
+
+  portENTER_CRITICAL(&positionLock);
+  uint32_t sequence = nextSequence - 1;
+  portEXIT_CRITICAL(&positionLock);
+
+  return sequence >= oldestSequence && readRecord(sequence, record);
+}
+
+bool ReadingLog::readRecord(uint32_t sequence, LogRecord& record) {
+  if (!mounted) {
+    return false;
+  }
+
+  portENTER_CRITICAL(&positionLock);
+  uint32_t sector = headSector;
+  uint32_t tail = tailSector;
+  portEXIT_CRITICAL(&positionLock);
+
+  // Walk back from the head to the sector that starts at or before the sequence
+  for (uint32_t i = 0; i < sectorCount; i++) {
+    uint32_t first = summaries[sector].firstSequence;
+    if (first != 0 && first <= sequence) {
+      LogSectorReader reader(sectorData(sector));
+      while (reader.next(record)) {
+        if (record.sequence == sequence) {
+          return true;
+        }
+      }
+      return false;
+    }
+    if (sector == tail) {
+      break;
+    }
+    sector = (sector + sectorCount - 1) % sectorCount;
+  }
+  return false;
+}
+
+void ReadingLog::snapshotRing(uint32_t& tail, uint32_t& used) {
+  portENTER_CRITICAL(&positionLock);
+  tail = tailSector;
+  used = (headSector + sectorCount - tailSector) % sectorCount + 1;
+  portEXIT_CRITICAL(&positionLock);
+}
+
+// Every record of the sector is older than sequence: the next sector starts at or before it
+bool ReadingLog::endsBefore(uint32_t tail, uint32_t used, uint32_t index, uint32_t sequence) const {
+  if (index + 1 >= used) {
+    return false;
+  }
+  uint32_t nextFirst = summaries[ringSectorAt(tail, index + 1)].firstSequence;
+  return nextFirst != 0 && nextFirst <= sequence;
+}
+
+LogQueryResult ReadingLog::findByMeter(const String& meterId, LogRecordVisitor visitor, void* context,
+                                       uint32_t fromSequence) {
+  LogQueryResult result = {0, 0, false};
+  if (!mounted || getRecordCount() == 0) {
+    return result;
+  }
+
+  char key[sizeof(LogRecord::meterId)];
+  meterKey(meterId, key);
+  uint16_t positions[LOG_BLOOM_HASHES];
+  bloomPositions(key, positions);
+
+  uint32_t tail, used;
+  snapshotRing(tail, used);
+
+  for (uint32_t i = 0; i < used && !result.stopped; i++) {
+    uint32_t sector = ringSectorAt(tail, i);
+    if (summaries[sector].firstSequence == 0 || !bloomContains(summaries[sector].bloom, positions) ||
+        endsBefore(tail, used, i, fromSequence)) {
+      continue;
+    }
+
+    result.sectorsRead++;
+    LogSectorReader reader(sectorData(sector));
+    LogRecord record;
+    while (reader.next(record)) {
+      if (record.sequence >= fromSequence && memcmp(record.meterId, key, sizeof(key)) == 0) {
+        result.matches++;
+        if (!visitor(record, context)) {
+          result.stopped = true;
+          break;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+bool ReadingLog::sectorClock(uint32_t index, uint32_t& firstTimestamp, void* context) {
+  const SinceSearch* search = static_cast<const SinceSearch*>(context);
+  const LogSectorSummary& summary = search->log->summaries[search->log->ringSectorAt(search->tail, index)];
+  firstTimestamp = summary.firstTimestamp;
+  return summary.firstSequence != 0 && summary.clockSet;
+}
+
+LogQueryResult ReadingLog::findSince(uint32_t timestamp, LogRecordVisitor visitor, void* context,
+                                     uint32_t fromSequence) {
+  LogQueryResult result = {0, 0, false};
+  if (!mounted || getRecordCount() == 0) {
+    return result;
+  }
+
+  uint32_t tail, used;
+  snapshotRing(tail, used);
+
+  // Earlier sectors only hold records stamped before the timestamp
+  SinceSearch search = { this, tail };
+  uint32_t start = logFindSinceStart(used, timestamp, sectorClock, &search);
+
+  for (uint32_t i = start; i < used && !result.stopped; i++) {
+    uint32_t sector = ringSectorAt(tail, i);
+    if (summaries[sector].firstSequence == 0 || endsBefore(tail, used, i, fromSequence)) {
+      continue;
+    }
+
+    result.sectorsRead++;
+    LogSectorReader reader(sectorData(sector));
+    LogRecord record;
+    while (reader.next(record)) {
+      if (record.sequence >= fromSequence && (record.flags & LOG_FLAG_CLOCK_SET) && record.timestamp >= timestamp) {
+        result.matches++;
+        if (!visitor(record, context)) {
+          result.stopped = true;
+          break;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+bool ReadingLog::planExport(uint32_t fromSequence, LogExportPlan& plan) {
+  if (!mounted || getRecordCount() == 0) {
+    return false;
+  }
+
+  // Everything queued so far belongs in the export
+  flush();
+
+  uint32_t tail, used;
+  snapshotRing(tail, used);
+  portENTER_CRITICAL(&positionLock);
+  plan.headSector = headSector;
+  plan.headOffset = headOffset;
+  plan.toSequence = nextSequence - 1;
+  plan.fromSequence = fromSequence < oldestSequence ? oldestSequence : fromSequence;
+  portEXIT_CRITICAL(&positionLock);
+
+  if (plan.fromSequence > plan.toSequence) {
+    return false;
+  }
+
+  // Last sector that starts at or before the requested sequence
+  uint32_t start = 0;
+  for (uint32_t i = 0; i < used; i++) {
+    uint32_t first = summaries[ringSectorAt(tail, i)].firstSequence;
+    if (first != 0 && first <= plan.fromSequence) {
+      start = i;
+    }
+  }
+
+  plan.tailSector = tail;
+  plan.startIndex = start;
+  plan.chunkCount = used - start;
+  return true;
+}
+
+bool ReadingLog::getExportChunk(const LogExportPlan& plan, uint32_t index, const uint8_t*& data, size_t& length) const {
+  if (index >= plan.chunkCount) {
+    return false;
+  }
+
+  // Whole sectors go out as stored, since deltas need their keyframe;
+  // the receiver drops records before the requested sequence
+  uint32_t sector = ringSectorAt(plan.tailSector, plan.startIndex + index);
+  data = sectorData(sector);
+  length = sector == plan.headSector ? plan.headOffset : usedLength(sector);
+  return true;
+}
+
+String ReadingLog::meterIdString(const LogRecord& record) {
+  char id[sizeof(record.meterId) + 1];
+  memcpy(id, record.meterId, sizeof(record.meterId));
+  id[sizeof(record.meterId)] = '\0';
+  return String(id);
+}
+
+String ReadingLog::formatRecord(const LogRecord& record) const {
+  String text = "=== Log Record #" + String(record.sequence) + " ===\n";
+  text += "Meter ID: " + meterIdString(record) + "\n";
+  text += "Meter Type: " + String(record.meterType) + "\n";
+  if (record.flags & LOG_FLAG_CLOCK_SET) {
+    text += "Time: " + String(record.timestamp) + " (epoch)\n";
+  } else {
+    text += "Time: " + String(record.timestamp) + " s after boot (clock not set)\n";
+  }
+
+  if (record.flags & LOG_FLAG_PARSED) {
+    text += "KWh: " + String(record.kwh / 100.0, 2) + "\n";
+    text += "KVAh: " + String(record.kvah / 100.0, 2) + "\n";
+    if (record.kvarhLag > 0 || record.kvarhLead > 0) {
+      text += "KVArh Lag: " + String(record.kvarhLag / 100.0, 2) + "\n";
+      text += "KVArh Lead: " + String(record.kvarhLead / 100.0, 2) + "\n";
+    }
+    if (record.maxDemand > 0) {
+      text += "Max Demand: " + String(record.maxDemand / 100.0, 2) + "\n";
+    }
+    if (record.voltage[0] > 0) {
+      text += "Voltage R/Y/B: " + String(record.voltage[0] / 10.0, 1) + " / " + String(record.voltage[1] / 10.0, 1) +
+              " / " + String(record.voltage[2] / 10.0, 1) + " V\n";
+    }
+    if (record.current[0] > 0) {
+      text += "Current R/Y/B: " + String(record.current[0] / 100.0, 2) + " / " + String(record.current[1] / 100.0, 2) +
+              " / " + String(record.current[2] / 100.0, 2) + " A\n";
+    }
+    if (record.powerFactor > 0) {
+      text += "Power Factor: " + String(record.powerFactor / 100.0, 2) + "\n";
+    }
+  } else {
+    text += "Reading: not parsed\n";
+  }
+
+  text += "Frame CRC: 0x" + String(record.frameHash, HEX);
+  return text;
+}
+
+String ReadingLog::formatRecordSummary(const LogRecord& record) const {
+  String line = "#" + String(record.sequence) + " " + String(record.timestamp) +
+                ((record.flags & LOG_FLAG_CLOCK_SET) ? "" : "u") + " " + meterIdString(record) +
+                " T" + String(record.meterType);
+  if (record.flags & LOG_FLAG_PARSED) {
+    line += " KWh=" + String(record.kwh / 100.0, 2) + " KVAh=" + String(record.kvah / 100.0, 2);
+  }
+  return line;
+}
+
+// ========================= STATUS =========================
+
+uint32_t ReadingLog::getRecordCount() {
+  portENTER_CRITICAL(&positionLock);
+  uint32_t count = nextSequence - oldestSequence;
+  portEXIT_CRITICAL(&positionLock);
+  return count;
+}
+
+uint32_t ReadingLog::getUsedBytes() {
+  uint32_t tail, used;
+  snapshotRing(tail, used);
+  portENTER_CRITICAL(&positionLock);
+  uint32_t offset = headOffset;
+  portEXIT_CRITICAL(&positionLock);
+  return (used - 1) * LOG_DATA_SIZE + offset;
+}
+
+uint32_t ReadingLog::getCapacity() {
+  if (sectorCount < 2) {
+    return 0;
+  }
+  uint32_t records = getRecordCount();
+  uint32_t bytes = getUsedBytes();
+  uint32_t entrySize = records > 0 && bytes >= records ? bytes / records : LOG_KEYFRAME_SIZE;
+  return (sectorCount - 1) * (LOG_DATA_SIZE / entrySize);
+}
+
+String ReadingLog::getStatusReport() {
+  if (!mounted) {
+    return "=== Reading Log ===\nNot available (missing 'readlog' partition)";
+  }
+
+  String report = "=== Reading Log ===\n";
+  uint32_t records = getRecordCount();
+  uint32_t usedBytes = getUsedBytes();
+  report += "Records: " + String(records) + " / ~" + String(getCapacity()) + "\n";
+  if (records > 0) {
+    report += "Sequence: " + String(oldestSequence) + " - " + String(nextSequence - 1) + "\n";
+    report += "Stored: " + String(usedBytes) + " bytes, " + String((float)usedBytes / records, 1) + " per record\n";
+  }
+  report += "Sectors: " + String(sectorCount) + " x " + String(LOG_SECTOR_SIZE) + " bytes (format v" +
+            String(LOG_FORMAT_VERSION) + ")\n";
+  report += "Written this boot: " + String(recordsWritten) + " (" + String(keyframesWritten) + " keyframes, " +
+            String(bytesWritten) + " bytes)\n";
+  report += "Dropped: " + String(droppedRecords) + ", write errors: " + String(writeErrors) + "\n";
+  report += "Sector erases: " + String(sectorsErased) + "\n";
+  report += "Mount time: " + String(mountTimeUs) + " us";
+  return report;
+}
+
+void ReadingLog::logStorageEvent(const String& event) {
+  Serial.println("[Log] " + event);
+}
+
+#endif // READING_LOG_H
@@ -0,0 +1,170 @@
+/*
+ * reading_scheduler.h - Timer-wake scheduled reading mode
+ *
+ * This file contains the ReadingScheduler class for reader units fixed
+ * to a meter. With a schedule configured (#SCHED=...*), every deep
+ * sleep also arms a timer wake. A timer wake runs one short cycle from
+ * setup(): read the configured meter type, append the reading to the
+ * log and go straight back to deep sleep. Bluetooth stays off and WiFi
+ * is only started when an upload is due. The button still wakes the
+ * device into normal interactive mode.
+ *
+ * Cycle counters live in RTC memory, which only a power loss clears. The
+ * last uploaded sequence is also kept in NVS so a power loss does not
+ * resend the whole log.
+ */
+
+#ifndef READING_SCHEDULER_H
+#define READING_SCHEDULER_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include "config.h"
+
+struct ScheduleState {
+  uint32_t magic;
+  uint32_t cycles;
+  uint32_t failedReads;
+  uint32_t uploads;
+  uint32_t failedUploads;
+  uint32_t cyclesSinceUpload;
+  uint32_t uploadedThrough;     // Newest sequence the server has, 0 = none
+  uint32_t lastAwakeMs;         // Wake to sleep, last scheduled cycle
+  uint32_t maxAwakeMs;
+  uint64_t totalAwakeMs;
+};
+
+#define SCHEDULE_STATE_MAGIC 0x53434831  // "SCH1"
+
+// Survives deep sleep and software resets (watchdog, panic, OTA restart);
+// losing power clears it, and init() then reloads the upload position from NVS
+RTC_DATA_ATTR static ScheduleState rtcSchedule;
+
+class ReadingScheduler {
+private:
+  Preferences preferences;
+  ConfigManager* config;
+
+public:
+  ReadingScheduler();
+
+  void setConfigManager(ConfigManager* configMgr) { config = configMgr; }
+
+  // Initialization (after the configuration is loaded)
+  void init();
+
+  // Cycle control
+  bool isScheduledWake() const;
+  bool isUploadDue() const;
+  void recordRead(bool success);
+  void recordUpload(bool success, uint32_t uploadedThrough);
+  uint32_t getUploadFrom() const { return rtcSchedule.uploadedThrough + 1; }
+
+  // Deep-sleep time that keeps wakes on the configured period; 0 = no schedule.
+  // Called once right before sleeping (records a scheduled cycle's awake time)
+  uint64_t getSleepUs();
+
+  // Status
+  String getReport() const;
+};
+
+// Implementation
+ReadingScheduler::ReadingScheduler() : config(nullptr) {
+}
+
+void ReadingScheduler::init() {
+  if (rtcSchedule.magic == SCHEDULE_STATE_MAGIC) {
+    return;
+  }
+
+  // Power loss: counters start over, the upload position comes from NVS
+  memset(&rtcSchedule, 0, sizeof(rtcSchedule));
+  rtcSchedule.magic = SCHEDULE_STATE_MAGIC;
+  preferences.begin("schedule", true);
+  rtcSchedule.uploadedThrough = preferences.getUInt("uploaded", 0);
+  preferences.end();
+}
+
+bool ReadingScheduler::isScheduledWake() const {
+  return config && config->isScheduleEnabled() && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER;
+}
+
+bool ReadingScheduler::isUploadDue() const {
+  uint16_t every = config ? config->getUploadEveryCycles() : 0;
+  return every > 0 && rtcSchedule.cyclesSinceUpload >= every;
+}
+
+void ReadingScheduler::recordRead(bool success) {
+  rtcSchedule.cycles++;
+  rtcSchedule.cyclesSinceUpload++;
+  if (!success) {
+    rtcSchedule.failedReads++;
+  }
+}
+
+void ReadingScheduler::recordUpload(bool success, uint32_t uploadedThrough) {
+  if (!success) {
+    // Retried on the next cycle
+    rtcSchedule.failedUploads++;
+    return;
+  }
+
+  rtcSchedule.uploads++;
+  rtcSchedule.cyclesSinceUpload = 0;
+  if (uploadedThrough != rtcSchedule.uploadedThrough) {
+    rtcSchedule.uploadedThrough = uploadedThrough;
+    preferences.begin("schedule", false);
+    preferences.putUInt("uploaded", uploadedThrough);
+    preferences.end();
+  }
+}
+
+uint64_t ReadingScheduler::getSleepUs() {
+  if (!config || !config->isScheduleEnabled()) {
+    return 0;
+  }
+
+  uint64_t intervalMs = (uint64_t)config->getScheduleIntervalS() * 1000;
+  uint32_t awakeMs = (uint32_t)(esp_timer_get_time() / 1000);
+
+  // Only scheduled cycles count towards the awake statistics
+  if (isScheduledWake()) {
+    rtcSchedule.lastAwakeMs = awakeMs;
+    if (awakeMs > rtcSchedule.maxAwakeMs) {
+      rtcSchedule.maxAwakeMs = awakeMs;
+    }
+    rtcSchedule.totalAwakeMs += awakeMs;
+  } else {
+    // Interactive session: the next cycle is a full interval after it ends
+    awakeMs = 0;
+  }
+
+  uint64_t sleepMs = intervalMs > awakeMs + SCHEDULE_MIN_SLEEP_MS ? intervalMs - awakeMs : SCHEDULE_MIN_SLEEP_MS;
+  return sleepMs * 1000;
+}
+
+String ReadingScheduler::getReport() const {
+  String report = "=== Schedule ===\n";
+  if (!config || !config->isScheduleEnabled()) {
+    report += "Off";
+  } else {
+    report += "Every " + String(config->getScheduleIntervalS()) + " s, meter type " +
+              String((int)config->getScheduleMeterType()) + ", upload " +
+              (config->getUploadEveryCycles() > 0 ? "every " + String(config->getUploadEveryCycles()) + " cycles"
+                                                   : String("off"));
+  }
+  report += "\nCycles: " + String(rtcSchedule.cycles) + " (" + String(rtcSchedule.failedReads) + " failed reads)\n";
+  if (rtcSchedule.cycles > 0) {
+    report += "Awake per cycle: last " + String(rtcSchedule.lastAwakeMs) + " ms, avg " +
+              String((uint32_t)(rtcSchedule.totalAwakeMs / rtcSchedule.cycles)) + " ms, max " +
+              String(rtcSchedule.maxAwakeMs) + " ms\n";
+  }
+  report += "Uploads: " + String(rtcSchedule.uploads) + " (" + String(rtcSchedule.failedUploads) +
+            " failed), through #" + String(rtcSchedule.uploadedThrough) + ", " +
+            String(rtcSchedule.cyclesSinceUpload) + " cycles since";
+  return report;
+}
+
+#endif // READING_SCHEDULER_H
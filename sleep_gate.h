@@ -0,0 +1,81 @@
+/*
+ * sleep_gate.h - Keeps deep sleep out of half-finished work
+ *
+ * A long button press can put the device to sleep from the button task
+ * while the main loop is still busy. Work that must not be cut off holds
+ * the gate for its duration: a reading log entry or sector erase, an OTA
+ * sector commit, a powered meter session. Any number of them may hold it
+ * at once. The sleep path closes the gate before it powers anything down:
+ * it waits for the current holders to finish, and whoever comes next
+ * blocks until the device is asleep.
+ */
+
+#ifndef SLEEP_GATE_H
+#define SLEEP_GATE_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+class SleepGate {
+private:
+  static portMUX_TYPE lock;
+  static volatile int holders;
+  static volatile bool closed;
+
+public:
+  // Blocks while the gate is closed
+  static void enter() {
+    for (;;) {
+      portENTER_CRITICAL(&lock);
+      if (!closed) {
+        holders++;
+        portEXIT_CRITICAL(&lock);
+        return;
+      }
+      portEXIT_CRITICAL(&lock);
+      vTaskDelay(pdMS_TO_TICKS(10));
+    }
+  }
+
+  static void exit() {
+    portENTER_CRITICAL(&lock);
+    if (holders > 0) holders--;
+    portEXIT_CRITICAL(&lock);
+  }
+
+  // Stays closed on success; reopens if the holders do not finish in time.
+  // The caller must not hold the gate itself.
+  static bool close(unsigned long timeoutMs) {
+    portENTER_CRITICAL(&lock);
+    closed = true;
+    portEXIT_CRITICAL(&lock);
+
+    unsigned long start = millis();
+    while (holders > 0) {
+      if (millis() - start >= timeoutMs) {
+        portENTER_CRITICAL(&lock);
+        closed = false;
+        portEXIT_CRITICAL(&lock);
+        return false;
+      }
+      vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return true;
+  }
+
+  static int getHolders() { return holders; }
+};
+
+portMUX_TYPE SleepGate::lock = portMUX_INITIALIZER_UNLOCKED;
+volatile int SleepGate::holders = 0;
+volatile bool SleepGate::closed = false;
+
+// Holds the gate for the lifetime of the object
+class SleepGuard {
+public:
+  SleepGuard() { SleepGate::enter(); }
+  ~SleepGuard() { SleepGate::exit(); }
+};
+
+#endif // SLEEP_GATE_H
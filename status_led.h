@@ -0,0 +1,250 @@
+/*
+ * status_led.h - Timer-driven status LED patterns
+ *
+ * This file contains the StatusLed class that shows the device state on
+ * PIN_LED without blocking anyone. Modules switch states on and off; the
+ * highest-priority active state owns the LED, and when it ends the next
+ * one shows through. Transient states (error, sleep) play a fixed number
+ * of blinks and then clear themselves.
+ *
+ * The level is computed from the time since the current pattern started,
+ * and a one-shot esp_timer is armed for the next edge only. Steady
+ * patterns arm no timer at all, so the LED adds no wakes while idle.
+ */
+
+#ifndef STATUS_LED_H
+#define STATUS_LED_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "config.h"
+#include "hardware_control.h"
+
+// Lowest priority first
+enum LedState {
+  LED_STATE_IDLE,
+  LED_STATE_BT_CONNECTED,
+  LED_STATE_LOW_BATTERY,
+  LED_STATE_COMMAND,
+  LED_STATE_READING,
+  LED_STATE_OTA,
+  LED_STATE_NOTICE,       // Transient: start-up
+  LED_STATE_ERROR,        // Transient: failed read or update
+  LED_STATE_SLEEP,        // Transient: going to deep sleep
+  LED_STATE_COUNT
+};
+
+struct LedPattern {
+  const char* name;
+  uint16_t onMs;          // 0 = steady off
+  uint16_t offMs;         // 0 = steady on
+  uint8_t cycles;         // Transient length in on/off cycles, 0 = until cleared
+};
+
+static const LedPattern LED_PATTERNS[LED_STATE_COUNT] = {
+  { "idle",           0,    0,    0 },
+  { "bluetooth",      50,   2950, 0 },    // Short flash every 3 s while connected
+  { "low battery",    100,  900,  0 },
+  { "command",        1,    0,    0 },    // Steady on
+  { "reading",        100,  100,  0 },
+  { "ota",            0,    0,    0 },    // On-time follows the download progress
+  { "notice",         100,  100,  2 },
+  { "error",          300,  200,  3 },
+  { "sleep",          200,  200,  3 }
+};
+
+class StatusLed {
+private:
+  HardwareControl* hardware;
+  esp_timer_handle_t timer;
+  portMUX_TYPE lock;
+  uint32_t activeStates;                  // LedState bits
+  LedState currentState;
+  int64_t patternStartUs;
+  uint8_t otaPercent;
+  uint32_t patternChanges;
+
+  static void onTimer(void* arg);
+  LedState highestActive() const;
+  void patternTimes(LedState state, uint32_t& onMs, uint32_t& offMs) const;
+  void refresh();
+
+public:
+  StatusLed();
+
+  void setHardwareControl(HardwareControl* hwCtrl) { hardware = hwCtrl; }
+
+  // Initialization (after the hardware)
+  bool init();
+
+  // State stack
+  void set(LedState state, bool active);
+  void pulse(LedState state) { set(state, true); }    // Transient states clear themselves
+  void setProgress(uint8_t percent);      // Shown while LED_STATE_OTA is on top
+
+  // Status
+  LedState getCurrentState() const { return currentState; }
+  const char* getCurrentPatternName() const { return LED_PATTERNS[currentState].name; }
+  String getReport();
+};
+
+// Keeps a state active for the lifetime of the object
+class ScopedLedState {
+private:
+  StatusLed& led;
+  LedState state;
+
+public:
+  ScopedLedState(StatusLed& statusLed, LedState ledState) : led(statusLed), state(ledState) {
+    led.set(state, true);
+  }
+  ~ScopedLedState() { led.set(state, false); }
+};
+
+// Implementation
+StatusLed::StatusLed()
+  : hardware(nullptr), timer(nullptr), lock(portMUX_INITIALIZER_UNLOCKED), activeStates(0),
+    currentState(LED_STATE_IDLE), patternStartUs(0), otaPercent(0), patternChanges(0) {
+}
+
+bool StatusLed::init() {
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = onTimer;
+  timerArgs.arg = this;
+  timerArgs.dispatch_method = ESP_TIMER_TASK;
+  timerArgs.name = "status_led";
+  if (esp_timer_create(&timerArgs, &timer) != ESP_OK) {
+    Serial.println("ERROR: Could not create status LED timer");
+    timer = nullptr;
+    return false;
+  }
+  refresh();
+  return true;
+}
+
+void StatusLed::set(LedState state, bool active) {
+  // Pulsing a transient again restarts it
+  bool restart = active && LED_PATTERNS[state].cycles > 0;
+
+  portENTER_CRITICAL(&lock);
+  uint32_t before = activeStates;
+  if (active) {
+    activeStates |= 1u << state;
+  } else {
+    activeStates &= ~(1u << state);
+  }
+  if (restart && state == currentState) {
+    patternStartUs = esp_timer_get_time();
+  }
+  bool changed = activeStates != before;
+  portEXIT_CRITICAL(&lock);
+
+  if (changed || restart) {
+    refresh();
+  }
+}
+
+void StatusLed::setProgress(uint8_t percent) {
+  otaPercent = percent > 100 ? 100 : percent;
+}
+
+void StatusLed::onTimer(void* arg) {
+  static_cast<StatusLed*>(arg)->refresh();
+}
+
+LedState StatusLed::highestActive() const {
+  for (int i = LED_STATE_COUNT - 1; i > LED_STATE_IDLE; i--) {
+    if (activeStates & (1u << i)) {
+      return (LedState)i;
+    }
+  }
+  return LED_STATE_IDLE;
+}
+
+void StatusLed::patternTimes(LedState state, uint32_t& onMs, uint32_t& offMs) const {
+  if (state == LED_STATE_OTA) {
+    // Fixed period, the on-time grows with the download
+    onMs = LED_OTA_MIN_MS + (LED_OTA_PERIOD_MS - 2 * LED_OTA_MIN_MS) * otaPercent / 100;
+    offMs = LED_OTA_PERIOD_MS - onMs;
+    return;
+  }
+  onMs = LED_PATTERNS[state].onMs;
+  offMs = LED_PATTERNS[state].offMs;
+}
+
+// Sets the level for now and arms the timer for the next edge (any context)
+void StatusLed::refresh() {
+  if (!hardware) {
+    return;
+  }
+
+  int64_t now = esp_timer_get_time();
+  bool level = false;
+  uint64_t nextEdgeUs = 0;
+
+  portENTER_CRITICAL(&lock);
+  for (;;) {
+    LedState state = highestActive();
+    if (state != currentState) {
+      currentState = state;
+      patternStartUs = now;
+      patternChanges++;
+    }
+
+    uint32_t onMs, offMs;
+    patternTimes(state, onMs, offMs);
+    if (onMs == 0 || offMs == 0) {
+      level = onMs > 0;
+      break;
+    }
+
+    uint64_t periodUs = (uint64_t)(onMs + offMs) * 1000;
+    uint64_t elapsedUs = now - patternStartUs;
+    uint8_t cycles = LED_PATTERNS[state].cycles;
+    if (cycles > 0 && elapsedUs >= periodUs * cycles) {
+      // Transient done; fall back to whatever is underneath
+      activeStates &= ~(1u << state);
+      continue;
+    }
+
+    uint64_t positionUs = elapsedUs % periodUs;
+    level = positionUs < (uint64_t)onMs * 1000;
+    nextEdgeUs = level ? (uint64_t)onMs * 1000 - positionUs : periodUs - positionUs;
+    break;
+  }
+  portEXIT_CRITICAL(&lock);
+
+  if (level) {
+    hardware->ledOn();
+  } else {
+    hardware->ledOff();
+  }
+
+  if (timer) {
+    esp_timer_stop(timer);
+    if (nextEdgeUs > 0) {
+      esp_timer_start_once(timer, nextEdgeUs);
+    }
+  }
+}
+
+String StatusLed::getReport() {
+  String report = "=== Status LED ===\n";
+  report += "Pattern: " + String(getCurrentPatternName()) + " (" + String(hardware && hardware->isLedOn() ? "on" : "off") + ")";
+  if (currentState == LED_STATE_OTA) {
+    report += ", " + String(otaPercent) + "%";
+  }
+  report += "\nActive:";
+  for (int i = LED_STATE_COUNT - 1; i > LED_STATE_IDLE; i--) {
+    if (activeStates & (1u << i)) {
+      report += " " + String(LED_PATTERNS[i].name);
+    }
+  }
+  if (activeStates == 0) {
+    report += " none";
+  }
+  report += "\nPattern changes: " + String(patternChanges);
+  return report;
+}
+
+#endif // STATUS_LED_H
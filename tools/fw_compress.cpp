@@ -0,0 +1,359 @@
+/*
+ * fw_compress.cpp - Host-side companion for fw_compress.h
+ *
+ * Compresses firmware images for the device to decompress while it
+ * downloads, checks them with the firmware's own decoder, and benchmarks
+ * the size and time saved. The test server (ota_server --compressed)
+ * and production servers hand the .fwz file to devices that send
+ * "Accept-Encoding: fwz"; everyone else gets ota.bin.
+ *
+ * Build: g++ -O2 -o fw_compress tools/fw_compress.cpp
+ * Usage: fw_compress compress <image.bin> <out.fwz>
+ *        fw_compress decompress <in.fwz> <out.bin>
+ *        fw_compress bench <image.bin> [download KB/s]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "host_sha256.h"
+#include "../fw_compress.h"
+
+#define HASH_BITS 12
+#define MAX_CHAIN 256              // Candidates tried per position
+#define DEFAULT_DOWNLOAD_KBPS 50
+
+static bool readFile(const char* path, std::vector<uint8_t>& data) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    data.insert(data.end(), chunk, chunk + n);
+  }
+  fclose(f);
+  return true;
+}
+
+static bool writeFile(const char* path, const std::vector<uint8_t>& data) {
+  FILE* f = fopen(path, "wb");
+  if (!f) return false;
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  fclose(f);
+  return ok;
+}
+
+// ========================= ENCODER =========================
+
+struct CompressStats {
+  uint32_t blocks;
+  uint32_t storedBlocks;
+  uint32_t matches;
+  uint32_t literals;
+};
+
+struct Match {
+  uint32_t length;
+  uint32_t distance;
+};
+
+static uint32_t hash3(const uint8_t* p) {
+  return ((p[0] << 8 | p[1]) * 0x9E37 ^ p[2] * 0x3B) & ((1 << HASH_BITS) - 1);
+}
+
+// Token groups for one block; matches stay inside it
+class BlockEncoder {
+private:
+  const uint8_t* data;
+  uint32_t size;
+  int32_t head[1 << HASH_BITS];
+  int32_t prev[FW_COMPRESS_BLOCK_SIZE];
+  uint32_t inserted;
+
+  std::vector<uint8_t>& out;
+  size_t flagsAt;
+  uint8_t tokens;
+
+  void insertUpTo(uint32_t pos) {
+    for (; inserted < pos && inserted + FW_COMPRESS_MIN_MATCH <= size; inserted++) {
+      uint32_t h = hash3(data + inserted);
+      prev[inserted] = head[h];
+      head[h] = inserted;
+    }
+  }
+
+  Match longestMatch(uint32_t pos) {
+    Match best = { 0, 0 };
+    if (pos + FW_COMPRESS_MIN_MATCH > size) return best;
+    insertUpTo(pos);
+    uint32_t limit = size - pos < FW_COMPRESS_MAX_MATCH ? size - pos : FW_COMPRESS_MAX_MATCH;
+    int32_t candidate = head[hash3(data + pos)];
+    for (int chain = 0; candidate >= 0 && chain < MAX_CHAIN; chain++) {
+      uint32_t length = 0;
+      while (length < limit && data[candidate + length] == data[pos + length]) length++;
+      if (length > best.length) {
+        best.length = length;
+        best.distance = pos - candidate;
+        if (length == limit) break;
+      }
+      candidate = prev[candidate];
+    }
+    if (best.length < FW_COMPRESS_MIN_MATCH) best.length = 0;
+    return best;
+  }
+
+  void startToken(bool match) {
+    if (tokens % 8 == 0) {
+      flagsAt = out.size();
+      out.push_back(0);
+    }
+    if (match) out[flagsAt] |= 1 << (tokens % 8);
+    tokens++;
+  }
+
+  void emitLiteral(uint8_t value) {
+    startToken(false);
+    out.push_back(value);
+  }
+
+  void emitMatch(const Match& match) {
+    startToken(true);
+    uint32_t code = match.length - FW_COMPRESS_MIN_MATCH;
+    if (code >= FW_COMPRESS_LENGTH_EXTENDED) code = FW_COMPRESS_LENGTH_EXTENDED;
+    uint16_t token = (uint16_t)((match.distance - 1) << 4 | code);
+    out.push_back(token >> 8);
+    out.push_back(token & 0xFF);
+    if (code == FW_COMPRESS_LENGTH_EXTENDED) {
+      out.push_back(match.length - FW_COMPRESS_MIN_MATCH - FW_COMPRESS_LENGTH_EXTENDED);
+    }
+  }
+
+public:
+  BlockEncoder(const uint8_t* blockData, uint32_t blockSize, std::vector<uint8_t>& payload)
+    : data(blockData), size(blockSize), inserted(0), out(payload), flagsAt(0), tokens(0) {
+    for (int32_t& h : head) h = -1;
+  }
+
+  // Greedy with one step of lazy matching
+  void encode(CompressStats& stats) {
+    uint32_t pos = 0;
+    Match match = longestMatch(0);
+    while (pos < size) {
+      if (match.length == 0) {
+        emitLiteral(data[pos]);
+        stats.literals++;
+        pos++;
+        match = longestMatch(pos);
+        continue;
+      }
+      Match next = longestMatch(pos + 1);
+      if (next.length > match.length + 1) {
+        emitLiteral(data[pos]);
+        stats.literals++;
+        pos++;
+        match = next;
+        continue;
+      }
+      emitMatch(match);
+      stats.matches++;
+      pos += match.length;
+      match = longestMatch(pos);
+    }
+  }
+};
+
+static std::vector<uint8_t> compressImage(const std::vector<uint8_t>& image, CompressStats& stats) {
+  memset(&stats, 0, sizeof(stats));
+
+  FwCompressHeader header;
+  header.imageSize = image.size();
+  sha256Digest(image.data(), image.size(), header.imageHash);
+  std::vector<uint8_t> out(FW_COMPRESS_HEADER_SIZE);
+  fwCompressEncodeHeader(header, out.data());
+
+  std::vector<uint8_t> payload;
+  for (size_t offset = 0; offset < image.size(); offset += FW_COMPRESS_BLOCK_SIZE) {
+    uint32_t size = image.size() - offset < FW_COMPRESS_BLOCK_SIZE ? image.size() - offset : FW_COMPRESS_BLOCK_SIZE;
+    payload.clear();
+    CompressStats blockStats = {};
+    BlockEncoder(&image[offset], size, payload).encode(blockStats);
+
+    // Incompressible blocks (tables, encrypted data) go out raw
+    bool stored = payload.size() >= size;
+    uint16_t length = stored ? (size | FW_COMPRESS_STORED) : payload.size();
+    out.push_back(length & 0xFF);
+    out.push_back(length >> 8);
+    if (stored) {
+      out.insert(out.end(), &image[offset], &image[offset] + size);
+      stats.storedBlocks++;
+    } else {
+      out.insert(out.end(), payload.begin(), payload.end());
+      stats.matches += blockStats.matches;
+      stats.literals += blockStats.literals;
+    }
+    stats.blocks++;
+  }
+  return out;
+}
+
+// ========================= DECODER HARNESS =========================
+
+struct DecodeContext {
+  std::vector<uint8_t> output;
+  std::vector<uint32_t> blockConsumed;   // Input offset at each block boundary, as the device saves it
+  FwCompressDecoder* decoder;
+};
+
+static bool writeBlock(const uint8_t* data, size_t length, void* context) {
+  DecodeContext* ctx = static_cast<DecodeContext*>(context);
+  ctx->output.insert(ctx->output.end(), data, data + length);
+  ctx->blockConsumed.push_back(ctx->decoder->getConsumed());
+  return true;
+}
+
+// Feeds the input in uneven pieces, like TCP reads; from offset when resuming
+static bool runDecoder(FwCompressDecoder& decoder, const std::vector<uint8_t>& input, size_t offset) {
+  size_t pos = offset;
+  size_t piece = 1;
+  while (pos < input.size()) {
+    size_t n = input.size() - pos < piece ? input.size() - pos : piece;
+    if (!decoder.write(&input[pos], n)) {
+      fprintf(stderr, "Decode error at byte %zu: %s\n", pos, decoder.getError());
+      return false;
+    }
+    pos += n;
+    piece = piece * 7 % 1461 + 1;
+  }
+  return decoder.isDone();
+}
+
+static bool decompressImage(const std::vector<uint8_t>& input, DecodeContext& ctx) {
+  static FwCompressDecoder decoder;
+  ctx.output.clear();
+  ctx.blockConsumed.clear();
+  ctx.decoder = &decoder;
+
+  FwCompressCallbacks callbacks = { nullptr, writeBlock, &ctx };
+  decoder.begin(callbacks);
+  if (!runDecoder(decoder, input, 0)) {
+    return false;
+  }
+
+  uint8_t hash[FW_COMPRESS_HASH_SIZE];
+  sha256Digest(ctx.output.data(), ctx.output.size(), hash);
+  if (memcmp(hash, decoder.getHeader().imageHash, FW_COMPRESS_HASH_SIZE) != 0) {
+    fprintf(stderr, "Output SHA-256 does not match the header\n");
+    return false;
+  }
+  return true;
+}
+
+// Restarts the decoder at a block boundary the way a resumed download does
+static bool checkResume(const std::vector<uint8_t>& input, const DecodeContext& full, size_t block) {
+  static FwCompressDecoder decoder;
+  DecodeContext ctx;
+  ctx.output.assign(full.output.begin(), full.output.begin() + (block + 1) * FW_COMPRESS_BLOCK_SIZE);
+  ctx.decoder = &decoder;
+
+  FwCompressCallbacks callbacks = { nullptr, writeBlock, &ctx };
+  decoder.resume(callbacks, full.decoder->getHeader(), ctx.output.size());
+  return runDecoder(decoder, input, full.blockConsumed[block]) && ctx.output == full.output;
+}
+
+// ========================= COMMANDS =========================
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int cmdCompress(const char* inPath, const char* outPath) {
+  std::vector<uint8_t> image;
+  if (!readFile(inPath, image) || image.empty()) {
+    fprintf(stderr, "Cannot read %s\n", inPath);
+    return 1;
+  }
+
+  CompressStats stats;
+  std::vector<uint8_t> out = compressImage(image, stats);
+  if (!writeFile(outPath, out)) {
+    fprintf(stderr, "Cannot write %s\n", outPath);
+    return 1;
+  }
+  printf("%zu -> %zu bytes (%.1f%%), %u blocks, %u stored\n", image.size(), out.size(),
+         out.size() * 100.0 / image.size(), stats.blocks, stats.storedBlocks);
+  return 0;
+}
+
+static int cmdDecompress(const char* inPath, const char* outPath) {
+  std::vector<uint8_t> input;
+  if (!readFile(inPath, input)) {
+    fprintf(stderr, "Cannot read %s\n", inPath);
+    return 1;
+  }
+
+  DecodeContext ctx;
+  if (!decompressImage(input, ctx)) return 1;
+  if (!writeFile(outPath, ctx.output)) {
+    fprintf(stderr, "Cannot write %s\n", outPath);
+    return 1;
+  }
+  printf("Wrote %zu bytes, SHA-256 verified\n", ctx.output.size());
+  return 0;
+}
+
+static int cmdBench(const char* inPath, double kbps) {
+  std::vector<uint8_t> image;
+  if (!readFile(inPath, image) || image.empty()) {
+    fprintf(stderr, "Cannot read %s\n", inPath);
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  CompressStats stats;
+  std::vector<uint8_t> out = compressImage(image, stats);
+  double compressMs = elapsedMs(start);
+
+  start = std::chrono::steady_clock::now();
+  DecodeContext ctx;
+  bool decoded = decompressImage(out, ctx) && ctx.output == image;
+  double decodeMs = elapsedMs(start);
+
+  size_t resumeChecks = 0, resumeFailures = 0;
+  for (size_t block = 0; decoded && block + 1 < ctx.blockConsumed.size(); block += 7) {
+    resumeChecks++;
+    if (!checkResume(out, ctx, block)) resumeFailures++;
+  }
+
+  double fullS = image.size() / 1024.0 / kbps;
+  double compressedS = out.size() / 1024.0 / kbps;
+  printf("Image:       %zu bytes\n", image.size());
+  printf("Compressed:  %zu bytes (%.1f%% of the image)\n", out.size(), out.size() * 100.0 / image.size());
+  printf("Blocks:      %u, %u stored; %u matches, %u literals\n", stats.blocks, stats.storedBlocks,
+         stats.matches, stats.literals);
+  printf("Compress:    %.1f ms\n", compressMs);
+  printf("Decompress:  %.1f ms on this host, %s\n", decodeMs, decoded ? "output matches" : "OUTPUT MISMATCH");
+  printf("Resume:      %zu/%zu block restarts match\n", resumeChecks - resumeFailures, resumeChecks);
+  printf("Download at %.0f KB/s: image %.1f s, compressed %.1f s (%.1fx less)\n", kbps, fullS, compressedS,
+         compressedS > 0 ? fullS / compressedS : 0);
+  return decoded && resumeFailures == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 4 && strcmp(argv[1], "compress") == 0) {
+    return cmdCompress(argv[2], argv[3]);
+  }
+  if (argc >= 4 && strcmp(argv[1], "decompress") == 0) {
+    return cmdDecompress(argv[2], argv[3]);
+  }
+  if (argc >= 3 && strcmp(argv[1], "bench") == 0) {
+    return cmdBench(argv[2], argc >= 4 ? atof(argv[3]) : DEFAULT_DOWNLOAD_KBPS);
+  }
+
+  fprintf(stderr, "Usage: %s compress <image.bin> <out.fwz>\n"
+                  "       %s decompress <in.fwz> <out.bin>\n"
+                  "       %s bench <image.bin> [download KB/s]\n", argv[0], argv[0], argv[0]);
+  return 1;
+}
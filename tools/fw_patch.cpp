@@ -0,0 +1,440 @@
+/*
+ * fw_patch.cpp - Host-side companion for fw_patch.h
+ *
+ * Builds delta patches between two firmware images, applies them with
+ * the firmware's own decoder, and benchmarks patch size and apply time
+ * against downloading the full image. Images are the ota.bin files the
+ * build produces; the old one must carry its appended SHA-256, which is
+ * how the device identifies the firmware it is running.
+ *
+ * It also writes the release manifest the device checks before any
+ * download (ota_manifest.h), listing the firmware the patches apply to.
+ * A signature made with openssl is carried along for OtaDownload to check:
+ *   openssl dgst -sha256 -sign key.pem -out ota.sig ota.bin
+ *
+ * Build: g++ -O2 -o fw_patch tools/fw_patch.cpp
+ * Usage: fw_patch diff <old.bin> <new.bin> <out.patch>
+ *        fw_patch apply <old.bin> <patch> <out.bin>
+ *        fw_patch bench <old.bin> <new.bin> [download KB/s]
+ *        fw_patch manifest <new.bin> <version> <out.json> [--min-bootloader <n>] [--signature <ota.sig>]
+ *                 [patch ...]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "host_sha256.h"
+#include "../fw_patch.h"
+
+#define HASH_BITS 20
+#define MAX_SIGNATURE_SIZE 72      // OTA_SIGNATURE_MAX_SIZE in config.h
+#define MIN_COPY 8                 // Shorter matches cost more as a copy than as literals
+#define MAX_CHAIN 64               // Candidates tried per position
+#define DEFAULT_DOWNLOAD_KBPS 50
+
+static bool readFile(const char* path, std::vector<uint8_t>& data) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    data.insert(data.end(), chunk, chunk + n);
+  }
+  fclose(f);
+  return true;
+}
+
+static bool writeFile(const char* path, const std::vector<uint8_t>& data) {
+  FILE* f = fopen(path, "wb");
+  if (!f) return false;
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  fclose(f);
+  return ok;
+}
+
+// The appended digest covers everything before it, as esp_image_verify checks
+static bool appHash(const std::vector<uint8_t>& image, uint8_t hash[FW_PATCH_HASH_SIZE]) {
+  if (image.size() <= FW_PATCH_HASH_SIZE) return false;
+  size_t body = image.size() - FW_PATCH_HASH_SIZE;
+  sha256Digest(image.data(), body, hash);
+  return memcmp(hash, image.data() + body, FW_PATCH_HASH_SIZE) == 0;
+}
+
+// ========================= ENCODER =========================
+
+struct PatchStats {
+  uint32_t copies;
+  uint32_t inserts;
+  uint32_t copiedBytes;
+  uint32_t insertedBytes;
+};
+
+static uint32_t hash8(const uint8_t* p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return (uint32_t)((value * 0x9E3779B97F4A7C15ULL) >> (64 - HASH_BITS));
+}
+
+static void emitInsert(std::vector<uint8_t>& patch, const uint8_t* data, uint32_t length, PatchStats& stats) {
+  uint8_t varint[5];
+  size_t n = fwPatchPutVarint(varint, (length << 1) | FW_PATCH_OP_INSERT);
+  patch.insert(patch.end(), varint, varint + n);
+  patch.insert(patch.end(), data, data + length);
+  stats.inserts++;
+  stats.insertedBytes += length;
+}
+
+static void emitCopy(std::vector<uint8_t>& patch, uint32_t newOffset, uint32_t oldOffset, uint32_t length,
+                     PatchStats& stats) {
+  uint8_t varint[5];
+  size_t n = fwPatchPutVarint(varint, (length << 1) | FW_PATCH_OP_COPY);
+  patch.insert(patch.end(), varint, varint + n);
+  n = fwPatchPutVarint(varint, fwPatchZigzag((int32_t)(oldOffset - newOffset)));
+  patch.insert(patch.end(), varint, varint + n);
+  stats.copies++;
+  stats.copiedBytes += length;
+}
+
+static std::vector<uint8_t> makePatch(const std::vector<uint8_t>& oldImage, const std::vector<uint8_t>& newImage,
+                                      const uint8_t oldHash[FW_PATCH_HASH_SIZE], PatchStats& stats) {
+  memset(&stats, 0, sizeof(stats));
+
+  FwPatchHeader header;
+  header.oldSize = oldImage.size();
+  header.newSize = newImage.size();
+  memcpy(header.oldHash, oldHash, FW_PATCH_HASH_SIZE);
+  sha256Digest(newImage.data(), newImage.size(), header.newHash);
+
+  std::vector<uint8_t> patch(FW_PATCH_HEADER_SIZE);
+  fwPatchEncodeHeader(header, patch.data());
+
+  // Hash chains over every 8-byte window of the old image, newest first
+  std::vector<int32_t> head(1 << HASH_BITS, -1);
+  std::vector<int32_t> next(oldImage.size(), -1);
+  for (size_t i = 0; i + 8 <= oldImage.size(); i++) {
+    uint32_t h = hash8(&oldImage[i]);
+    next[i] = head[h];
+    head[h] = i;
+  }
+
+  const uint32_t newSize = newImage.size();
+  const uint32_t oldSize = oldImage.size();
+  int64_t lastShift = 0;           // Old minus new offset of the previous copy
+  uint32_t pos = 0;
+  uint32_t literalStart = 0;
+
+  while (pos < newSize) {
+    uint32_t blockEnd = (pos / FW_PATCH_BLOCK_SIZE + 1) * FW_PATCH_BLOCK_SIZE;
+    if (blockEnd > newSize) blockEnd = newSize;
+    uint32_t limit = blockEnd - pos;
+
+    auto matchLength = [&](int64_t oldPos) -> uint32_t {
+      if (oldPos < 0 || oldPos >= oldSize) return 0;
+      uint32_t n = 0;
+      uint32_t max = oldSize - oldPos < limit ? oldSize - oldPos : limit;
+      while (n < max && oldImage[oldPos + n] == newImage[pos + n]) n++;
+      return n;
+    };
+
+    // The previous shift first: code that moved keeps matching there after a changed word
+    uint32_t bestLength = matchLength(pos + lastShift);
+    int64_t bestOld = pos + lastShift;
+    if (pos + 8 <= newSize) {
+      int32_t candidate = head[hash8(&newImage[pos])];
+      for (int chain = 0; candidate >= 0 && chain < MAX_CHAIN && bestLength < limit; chain++) {
+        uint32_t length = matchLength(candidate);
+        if (length > bestLength) {
+          bestLength = length;
+          bestOld = candidate;
+        }
+        candidate = next[candidate];
+      }
+    }
+
+    if (bestLength >= MIN_COPY || (bestLength == limit && bestLength > 0 && literalStart == pos)) {
+      if (literalStart < pos) {
+        emitInsert(patch, &newImage[literalStart], pos - literalStart, stats);
+      }
+      emitCopy(patch, pos, bestOld, bestLength, stats);
+      lastShift = bestOld - pos;
+      pos += bestLength;
+      literalStart = pos;
+    } else {
+      pos++;
+    }
+
+    // Nothing crosses a block boundary
+    if (pos == blockEnd && literalStart < pos) {
+      emitInsert(patch, &newImage[literalStart], pos - literalStart, stats);
+      literalStart = pos;
+    }
+  }
+  return patch;
+}
+
+// ========================= DECODER HARNESS =========================
+
+struct ApplyContext {
+  const std::vector<uint8_t>* oldImage;
+  std::vector<uint8_t> output;
+  std::vector<uint32_t> blockConsumed;   // Patch offset at each block boundary, as the device saves it
+  FwPatchDecoder* decoder;
+};
+
+static bool readOld(uint32_t offset, uint8_t* data, size_t length, void* context) {
+  ApplyContext* ctx = static_cast<ApplyContext*>(context);
+  memcpy(data, ctx->oldImage->data() + offset, length);
+  return true;
+}
+
+static bool writeNew(const uint8_t* data, size_t length, void* context) {
+  ApplyContext* ctx = static_cast<ApplyContext*>(context);
+  ctx->output.insert(ctx->output.end(), data, data + length);
+  if (ctx->output.size() % FW_PATCH_BLOCK_SIZE == 0) {
+    ctx->blockConsumed.push_back(ctx->decoder->getConsumed());
+  }
+  return true;
+}
+
+// Feeds the patch in uneven pieces, like TCP reads; from patchOffset when resuming
+static bool runDecoder(FwPatchDecoder& decoder, const std::vector<uint8_t>& patch, size_t patchOffset) {
+  size_t pos = patchOffset;
+  size_t piece = 1;
+  while (pos < patch.size()) {
+    size_t n = patch.size() - pos < piece ? patch.size() - pos : piece;
+    if (!decoder.write(&patch[pos], n)) {
+      fprintf(stderr, "Decode error at patch byte %zu: %s\n", pos, decoder.getError());
+      return false;
+    }
+    pos += n;
+    piece = piece * 7 % 1461 + 1;
+  }
+  return decoder.isDone();
+}
+
+static bool applyPatch(const std::vector<uint8_t>& oldImage, const std::vector<uint8_t>& patch,
+                       ApplyContext& ctx) {
+  static FwPatchDecoder decoder;
+  ctx.oldImage = &oldImage;
+  ctx.output.clear();
+  ctx.blockConsumed.clear();
+  ctx.decoder = &decoder;
+
+  FwPatchCallbacks callbacks = { nullptr, readOld, writeNew, &ctx };
+  decoder.begin(callbacks);
+  if (!runDecoder(decoder, patch, 0)) {
+    return false;
+  }
+
+  uint8_t hash[FW_PATCH_HASH_SIZE];
+  sha256Digest(ctx.output.data(), ctx.output.size(), hash);
+  if (memcmp(hash, decoder.getHeader().newHash, FW_PATCH_HASH_SIZE) != 0) {
+    fprintf(stderr, "Output SHA-256 does not match the patch header\n");
+    return false;
+  }
+  return true;
+}
+
+// Restarts the decoder at a block boundary the way a resumed download does
+static bool checkResume(const std::vector<uint8_t>& oldImage, const std::vector<uint8_t>& patch,
+                        const ApplyContext& full, size_t block) {
+  FwPatchDecoder decoder;
+  ApplyContext ctx;
+  ctx.oldImage = &oldImage;
+  ctx.output.assign(full.output.begin(), full.output.begin() + (block + 1) * FW_PATCH_BLOCK_SIZE);
+  ctx.decoder = &decoder;
+
+  FwPatchCallbacks callbacks = { nullptr, readOld, writeNew, &ctx };
+  decoder.resume(callbacks, full.decoder->getHeader(), ctx.output.size());
+  return runDecoder(decoder, patch, full.blockConsumed[block]) && ctx.output == full.output;
+}
+
+// ========================= COMMANDS =========================
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool loadPair(const char* oldPath, const char* newPath, std::vector<uint8_t>& oldImage,
+                     std::vector<uint8_t>& newImage, uint8_t oldHash[FW_PATCH_HASH_SIZE]) {
+  if (!readFile(oldPath, oldImage) || !readFile(newPath, newImage)) {
+    fprintf(stderr, "Cannot read input images\n");
+    return false;
+  }
+  if (!appHash(oldImage, oldHash)) {
+    fprintf(stderr, "%s has no appended SHA-256 (build with the default esptool settings)\n", oldPath);
+    return false;
+  }
+  return true;
+}
+
+static int cmdDiff(const char* oldPath, const char* newPath, const char* outPath) {
+  std::vector<uint8_t> oldImage, newImage;
+  uint8_t oldHash[FW_PATCH_HASH_SIZE];
+  if (!loadPair(oldPath, newPath, oldImage, newImage, oldHash)) return 1;
+
+  PatchStats stats;
+  std::vector<uint8_t> patch = makePatch(oldImage, newImage, oldHash, stats);
+  if (!writeFile(outPath, patch)) {
+    fprintf(stderr, "Cannot write %s\n", outPath);
+    return 1;
+  }
+  printf("%zu -> %zu bytes patch (%.1f%% of the image), %u copies, %u inserts (%u bytes)\n", newImage.size(),
+         patch.size(), patch.size() * 100.0 / newImage.size(), stats.copies, stats.inserts, stats.insertedBytes);
+  printf("Applies to app hash %s\n", hexString(oldHash, FW_PATCH_HASH_SIZE).c_str());
+  return 0;
+}
+
+static int cmdApply(const char* oldPath, const char* patchPath, const char* outPath) {
+  std::vector<uint8_t> oldImage, patch;
+  if (!readFile(oldPath, oldImage) || !readFile(patchPath, patch)) {
+    fprintf(stderr, "Cannot read inputs\n");
+    return 1;
+  }
+
+  ApplyContext ctx;
+  if (!applyPatch(oldImage, patch, ctx)) return 1;
+  if (!writeFile(outPath, ctx.output)) {
+    fprintf(stderr, "Cannot write %s\n", outPath);
+    return 1;
+  }
+  printf("Wrote %zu bytes, SHA-256 verified\n", ctx.output.size());
+  return 0;
+}
+
+static int cmdBench(const char* oldPath, const char* newPath, double kbps) {
+  std::vector<uint8_t> oldImage, newImage;
+  uint8_t oldHash[FW_PATCH_HASH_SIZE];
+  if (!loadPair(oldPath, newPath, oldImage, newImage, oldHash)) return 1;
+
+  auto start = std::chrono::steady_clock::now();
+  PatchStats stats;
+  std::vector<uint8_t> patch = makePatch(oldImage, newImage, oldHash, stats);
+  double diffMs = elapsedMs(start);
+
+  start = std::chrono::steady_clock::now();
+  ApplyContext ctx;
+  bool applied = applyPatch(oldImage, patch, ctx) && ctx.output == newImage;
+  double applyMs = elapsedMs(start);
+
+  size_t resumeChecks = 0, resumeFailures = 0;
+  for (size_t block = 0; applied && block < ctx.blockConsumed.size(); block += 7) {
+    resumeChecks++;
+    if (!checkResume(oldImage, patch, ctx, block)) resumeFailures++;
+  }
+
+  double fullS = newImage.size() / 1024.0 / kbps;
+  double patchS = patch.size() / 1024.0 / kbps;
+  printf("Old image:   %zu bytes\n", oldImage.size());
+  printf("New image:   %zu bytes\n", newImage.size());
+  printf("Patch:       %zu bytes (%.1f%% of the image)\n", patch.size(), patch.size() * 100.0 / newImage.size());
+  printf("Operations:  %u copies (%u bytes), %u inserts (%u bytes)\n", stats.copies, stats.copiedBytes,
+         stats.inserts, stats.insertedBytes);
+  printf("Diff:        %.1f ms\n", diffMs);
+  printf("Apply:       %.1f ms on this host, %s\n", applyMs, applied ? "output matches" : "OUTPUT MISMATCH");
+  printf("Resume:      %zu/%zu block restarts match\n", resumeChecks - resumeFailures, resumeChecks);
+  printf("Download at %.0f KB/s: full image %.1f s, patch %.1f s (%.1fx less)\n", kbps, fullS, patchS,
+         patchS > 0 ? fullS / patchS : 0);
+  printf("Flash writes are the same for both; the patch adds one old-image read per copied byte\n");
+  return applied && resumeFailures == 0 ? 0 : 1;
+}
+
+static int cmdManifest(const char* imagePath, const char* version, const char* outPath, int argc, char** argv) {
+  std::vector<uint8_t> image;
+  if (!readFile(imagePath, image) || image.empty()) {
+    fprintf(stderr, "Cannot read %s\n", imagePath);
+    return 1;
+  }
+
+  uint8_t appDigest[FW_PATCH_HASH_SIZE];
+  bool hasAppHash = appHash(image, appDigest);
+  if (!hasAppHash) {
+    fprintf(stderr, "Warning: %s has no appended SHA-256; devices will compare versions only\n", imagePath);
+  }
+  uint8_t imageHash[FW_PATCH_HASH_SIZE];
+  sha256Digest(image.data(), image.size(), imageHash);
+
+  // Patches must build this image; their old hashes are the firmware they serve
+  int minBootloader = 0;
+  std::vector<uint8_t> signature;
+  std::vector<std::string> patchFrom;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "--min-bootloader") == 0 && i + 1 < argc) {
+      minBootloader = atoi(argv[++i]);
+      continue;
+    }
+    if (strcmp(argv[i], "--signature") == 0 && i + 1 < argc) {
+      // DER ECDSA, as openssl dgst -sign writes it; P-256 signatures are 70 to 72 bytes
+      if (!readFile(argv[++i], signature) || signature.empty() || signature.size() > MAX_SIGNATURE_SIZE ||
+          signature[0] != 0x30) {
+        fprintf(stderr, "%s is not a DER ECDSA signature\n", argv[i]);
+        return 1;
+      }
+      continue;
+    }
+    std::vector<uint8_t> patch;
+    FwPatchHeader header;
+    if (!readFile(argv[i], patch) || patch.size() < FW_PATCH_HEADER_SIZE ||
+        !fwPatchDecodeHeader(patch.data(), header)) {
+      fprintf(stderr, "%s is not a firmware patch\n", argv[i]);
+      return 1;
+    }
+    if (memcmp(header.newHash, imageHash, FW_PATCH_HASH_SIZE) != 0) {
+      fprintf(stderr, "%s builds another image than %s\n", argv[i], imagePath);
+      return 1;
+    }
+    patchFrom.push_back(hexString(header.oldHash, FW_PATCH_HASH_SIZE));
+  }
+
+  std::string json = "{\n";
+  json += "  \"version\": \"" + std::string(version) + "\",\n";
+  json += "  \"size\": " + std::to_string(image.size()) + ",\n";
+  json += "  \"sha256\": \"" + hexString(imageHash, FW_PATCH_HASH_SIZE) + "\",\n";
+  if (hasAppHash) {
+    json += "  \"app_hash\": \"" + hexString(appDigest, FW_PATCH_HASH_SIZE) + "\",\n";
+  }
+  json += "  \"min_bootloader\": " + std::to_string(minBootloader) + ",\n";
+  json += "  \"patch_from\": [";
+  for (size_t i = 0; i < patchFrom.size(); i++) {
+    json += (i > 0 ? ", \"" : "\"") + patchFrom[i] + "\"";
+  }
+  json += "]";
+  if (!signature.empty()) {
+    json += ",\n  \"signature\": \"" + hexString(signature.data(), signature.size()) + "\"";
+  }
+  json += "\n}\n";
+
+  if (!writeFile(outPath, std::vector<uint8_t>(json.begin(), json.end()))) {
+    fprintf(stderr, "Cannot write %s\n", outPath);
+    return 1;
+  }
+  printf("%s: %s, %zu bytes, %zu patch%s, %s\n", outPath, version, image.size(), patchFrom.size(),
+         patchFrom.size() == 1 ? "" : "es", signature.empty() ? "unsigned" : "signed");
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 5 && strcmp(argv[1], "diff") == 0) {
+    return cmdDiff(argv[2], argv[3], argv[4]);
+  }
+  if (argc >= 5 && strcmp(argv[1], "apply") == 0) {
+    return cmdApply(argv[2], argv[3], argv[4]);
+  }
+  if (argc >= 4 && strcmp(argv[1], "bench") == 0) {
+    return cmdBench(argv[2], argv[3], argc >= 5 ? atof(argv[4]) : DEFAULT_DOWNLOAD_KBPS);
+  }
+  if (argc >= 5 && strcmp(argv[1], "manifest") == 0) {
+    return cmdManifest(argv[2], argv[3], argv[4], argc - 5, argv + 5);
+  }
+
+  fprintf(stderr, "Usage: %s diff <old.bin> <new.bin> <out.patch>\n"
+                  "       %s apply <old.bin> <patch> <out.bin>\n"
+                  "       %s bench <old.bin> <new.bin> [download KB/s]\n"
+                  "       %s manifest <new.bin> <version> <out.json> [--min-bootloader <n>] [--signature <ota.sig>]\n"
+                  "                [patch ...]\n",
+          argv[0], argv[0], argv[0], argv[0]);
+  return 1;
+}
@@ -0,0 +1,124 @@
+/*
+ * host_sha256.h - SHA-256 for the host tools
+ *
+ * A small portable SHA-256 so the tools build with a plain g++ and no
+ * crypto library. The firmware uses mbedtls (hardware accelerated).
+ */
+
+#ifndef HOST_SHA256_H
+#define HOST_SHA256_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct Sha256 {
+  uint32_t h[8];
+  uint8_t block[64];
+  size_t blockFill;
+  uint64_t length;
+};
+
+static const uint32_t SHA256_K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t rotr(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+static void sha256Block(Sha256& ctx, const uint8_t* p) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = ((uint32_t)p[4 * i] << 24) | (p[4 * i + 1] << 16) | (p[4 * i + 2] << 8) | p[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t a = ctx.h[0], b = ctx.h[1], c = ctx.h[2], d = ctx.h[3];
+  uint32_t e = ctx.h[4], f = ctx.h[5], g = ctx.h[6], h = ctx.h[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+    uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  ctx.h[0] += a; ctx.h[1] += b; ctx.h[2] += c; ctx.h[3] += d;
+  ctx.h[4] += e; ctx.h[5] += f; ctx.h[6] += g; ctx.h[7] += h;
+}
+
+static void sha256Init(Sha256& ctx) {
+  static const uint32_t init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(ctx.h, init, sizeof(init));
+  ctx.blockFill = 0;
+  ctx.length = 0;
+}
+
+static void sha256Update(Sha256& ctx, const uint8_t* data, size_t length) {
+  ctx.length += length;
+  while (length > 0) {
+    size_t n = 64 - ctx.blockFill < length ? 64 - ctx.blockFill : length;
+    memcpy(ctx.block + ctx.blockFill, data, n);
+    ctx.blockFill += n;
+    data += n;
+    length -= n;
+    if (ctx.blockFill == 64) {
+      sha256Block(ctx, ctx.block);
+      ctx.blockFill = 0;
+    }
+  }
+}
+
+static void sha256Digest(const uint8_t* data, size_t length, uint8_t digest[32]) {
+  Sha256 ctx;
+  sha256Init(ctx);
+  sha256Update(ctx, data, length);
+
+  uint64_t bits = ctx.length * 8;
+  uint8_t pad = 0x80;
+  sha256Update(ctx, &pad, 1);
+  pad = 0;
+  while (ctx.blockFill != 56) {
+    sha256Update(ctx, &pad, 1);
+  }
+  uint8_t lengthBytes[8];
+  for (int i = 0; i < 8; i++) {
+    lengthBytes[i] = (uint8_t)(bits >> (56 - 8 * i));
+  }
+  sha256Update(ctx, lengthBytes, 8);
+
+  for (int i = 0; i < 32; i++) {
+    digest[i] = (uint8_t)(ctx.h[i / 4] >> (24 - 8 * (i % 4)));
+  }
+}
+
+static inline std::string hexString(const uint8_t* data, size_t length) {
+  std::string hex;
+  char pair[3];
+  for (size_t i = 0; i < length; i++) {
+    snprintf(pair, sizeof(pair), "%02x", data[i]);
+    hex += pair;
+  }
+  return hex;
+}
+
+static inline std::string sha256Hex(const std::vector<uint8_t>& data) {
+  uint8_t digest[32];
+  sha256Digest(data.data(), data.size(), digest);
+  return hexString(digest, sizeof(digest));
+}
+
+#endif // HOST_SHA256_H
@@ -0,0 +1,474 @@
+/*
+ * log_receiver.cpp - Host-side receiver for #LOGEXPORT
+ *
+ * Talks to the device over a Bluetooth serial port (e.g. /dev/rfcomm0),
+ * requests a bulk export, acknowledges chunks as they arrive and checks
+ * every frame CRC, every entry CRC and the sequence numbers. Each chunk
+ * is one sector of keyframe and delta entries, decoded here with the
+ * firmware's own reader. With --lz the export is requested as
+ * "Z#LOGEXPORT" and LZ-compressed chunks are inflated with lz_codec.h.
+ * Records are written as CSV. A captured stream can also be verified
+ * offline, and --selftest checks the time search that #LOG? "since"
+ * queries use on the device and the compressed chunk round trip.
+ *
+ * Build: g++ -O2 -o log_receiver tools/log_receiver.cpp
+ * Usage: log_receiver [--lz] <port> [from sequence] [window] [output.csv]
+ *        log_receiver --verify <capture.bin> [output.csv]
+ *        log_receiver --selftest
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+#include "../log_format.h"
+#include "../lz_codec.h"
+
+#define FRAME_MAGIC_0 0xA5
+#define FRAME_MAGIC_1 0x5A
+#define FRAME_HEADER_SIZE 5
+#define FRAME_CRC_SIZE 4
+#define IDLE_TIMEOUT_MS 10000
+
+static uint32_t readLE32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// ========================= EXPORT STATE =========================
+
+struct ExportSession {
+  int port = -1;                 // -1 when verifying a capture
+  FILE* csv = nullptr;
+  bool started = false;
+  bool finished = false;
+  LogExportStart start = {};
+  LogExportEnd end = {};
+  uint32_t nextChunk = 0;
+  uint32_t lastSequence = 0;
+  uint32_t records = 0;
+  uint32_t badRecords = 0;
+  uint32_t gaps = 0;
+  uint32_t badFrames = 0;
+  uint32_t duplicateChunks = 0;
+  uint32_t compressedChunks = 0;
+  uint64_t bytesReceived = 0;
+};
+
+static void sendAck(ExportSession& session) {
+  if (session.port < 0) return;
+  char ack[32];
+  int n = snprintf(ack, sizeof(ack), "#ACK=%u*", session.nextChunk);
+  if (write(session.port, ack, n) != n) {
+    fprintf(stderr, "warning: ACK write failed\n");
+  }
+}
+
+static void writeRecord(ExportSession& session, const LogRecord& r) {
+  if (!session.csv) return;
+  char id[sizeof(r.meterId) + 1];
+  memcpy(id, r.meterId, sizeof(r.meterId));
+  id[sizeof(r.meterId)] = '\0';
+  fprintf(session.csv, "%u,%u,%d,%s,%u,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f,%.1f,%.1f,%.2f,%.2f,%.2f,%.2f,%08x\n",
+          r.sequence, r.timestamp, (r.flags & LOG_FLAG_CLOCK_SET) ? 1 : 0, id, r.meterType,
+          r.kwh / 100.0, r.kvah / 100.0, r.kvarhLag / 100.0, r.kvarhLead / 100.0, r.maxDemand / 100.0,
+          r.voltage[0] / 10.0, r.voltage[1] / 10.0, r.voltage[2] / 10.0,
+          r.current[0] / 100.0, r.current[1] / 100.0, r.current[2] / 100.0,
+          r.powerFactor / 100.0, r.frameHash);
+}
+
+static void appendBytes(const uint8_t* data, size_t length, void* context) {
+  std::vector<uint8_t>& out = *static_cast<std::vector<uint8_t>*>(context);
+  out.insert(out.end(), data, data + length);
+}
+
+static void handleChunk(ExportSession& session, const uint8_t* payload, size_t length, bool compressed) {
+  if (length < 4) {
+    session.badFrames++;
+    return;
+  }
+
+  uint32_t index = readLE32(payload);
+  if (index != session.nextChunk) {
+    // Retransmission or a chunk after a lost one: re-acknowledge what we have
+    session.duplicateChunks++;
+    sendAck(session);
+    return;
+  }
+
+  const uint8_t* entries = payload + 4;
+  size_t entriesLength = length - 4;
+  std::vector<uint8_t> inflated;
+  if (compressed) {
+    // Each chunk is a complete stream; a bad one is left unacknowledged and resent
+    LZDecompressor decompressor;
+    decompressor.begin(appendBytes, &inflated);
+    if (!decompressor.write(entries, entriesLength) || !decompressor.isFinished() ||
+        inflated.size() > LOG_DATA_SIZE) {
+      session.badFrames++;
+      return;
+    }
+    entries = inflated.data();
+    entriesLength = inflated.size();
+    session.compressedChunks++;
+  }
+
+  // Chunks are whole sectors; the first one may start before the requested record
+  LogSectorReader reader(entries, entriesLength);
+  LogRecord record;
+  while (reader.next(record)) {
+    if (record.sequence < session.start.fromSequence) {
+      continue;
+    }
+    if (session.lastSequence != 0 && record.sequence != session.lastSequence + 1) {
+      if (record.sequence <= session.lastSequence) {
+        session.badRecords++;
+        continue;
+      }
+      session.gaps++;
+    }
+    session.lastSequence = record.sequence;
+    session.records++;
+    writeRecord(session, record);
+  }
+  session.badRecords += reader.invalidEntries;  // Torn writes on the device, skipped
+
+  session.nextChunk++;
+  sendAck(session);
+}
+
+static void handleFrame(ExportSession& session, uint8_t type, const uint8_t* payload, size_t length) {
+  switch (type) {
+    case LOG_FRAME_EXPORT_START:
+      if (length >= sizeof(LogExportStart)) {
+        memcpy(&session.start, payload, sizeof(LogExportStart));
+        if (session.start.formatVersion != LOG_FORMAT_VERSION) {
+          fprintf(stderr, "unsupported log format %u (expected %u)\n", session.start.formatVersion, LOG_FORMAT_VERSION);
+          session.finished = true;
+          break;
+        }
+        session.started = true;
+        printf("Export #%u - #%u in %u chunks, window %u\n", session.start.fromSequence, session.start.toSequence,
+               session.start.chunkCount, session.start.window);
+      }
+      break;
+    case LOG_FRAME_EXPORT_CHUNK:
+    case LOG_FRAME_EXPORT_CHUNK_LZ:
+      handleChunk(session, payload, length, type == LOG_FRAME_EXPORT_CHUNK_LZ);
+      break;
+    case LOG_FRAME_EXPORT_END:
+      if (length >= sizeof(LogExportEnd)) {
+        memcpy(&session.end, payload, sizeof(LogExportEnd));
+      }
+      session.finished = true;
+      break;
+    default:
+      break;  // Not part of an export
+  }
+}
+
+// Consumes complete frames from the buffer; text and noise between frames are skipped
+static void parseFrames(ExportSession& session, std::vector<uint8_t>& buffer) {
+  size_t pos = 0;
+  while (!session.finished) {
+    while (pos + 1 < buffer.size() && !(buffer[pos] == FRAME_MAGIC_0 && buffer[pos + 1] == FRAME_MAGIC_1)) {
+      pos++;
+    }
+    if (pos + FRAME_HEADER_SIZE > buffer.size()) break;
+
+    uint8_t type = buffer[pos + 2];
+    size_t length = buffer[pos + 3] | (buffer[pos + 4] << 8);
+    size_t total = FRAME_HEADER_SIZE + length + FRAME_CRC_SIZE;
+    if (pos + total > buffer.size()) break;
+
+    const uint8_t* frame = buffer.data() + pos;
+    uint32_t crc = logCrc32(0, frame + 2, FRAME_HEADER_SIZE - 2 + length);
+    if (crc != readLE32(frame + FRAME_HEADER_SIZE + length)) {
+      session.badFrames++;
+      pos++;  // Resynchronise on the next magic
+      continue;
+    }
+
+    handleFrame(session, type, frame + FRAME_HEADER_SIZE, length);
+    pos += total;
+  }
+  buffer.erase(buffer.begin(), buffer.begin() + pos);
+}
+
+// ========================= TRANSPORTS =========================
+
+static int openPort(const char* path) {
+  int fd = open(path, O_RDWR | O_NOCTTY);
+  if (fd < 0) return -1;
+
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, B115200);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  tcflush(fd, TCIOFLUSH);
+  return fd;
+}
+
+static bool runLive(ExportSession& session, const char* path, uint32_t fromSequence, unsigned window, bool lz) {
+  session.port = openPort(path);
+  if (session.port < 0) {
+    perror(path);
+    return false;
+  }
+
+  char command[48];
+  int n = snprintf(command, sizeof(command), "%s#LOGEXPORT=%u,%u*", lz ? "Z" : "", fromSequence, window);
+  if (write(session.port, command, n) != n) {
+    perror("write");
+    return false;
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  auto lastData = begin;
+  std::vector<uint8_t> buffer;
+  uint8_t chunk[4096];
+
+  while (!session.finished) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(session.port, &fds);
+    struct timeval tv = {0, 100000};
+    if (select(session.port + 1, &fds, nullptr, nullptr, &tv) > 0) {
+      ssize_t got = read(session.port, chunk, sizeof(chunk));
+      if (got <= 0) break;
+      session.bytesReceived += got;
+      buffer.insert(buffer.end(), chunk, chunk + got);
+      parseFrames(session, buffer);
+      lastData = std::chrono::steady_clock::now();
+    } else if (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - lastData).count() >
+               IDLE_TIMEOUT_MS) {
+      fprintf(stderr, "timeout: no data for %d ms\n", IDLE_TIMEOUT_MS);
+      break;
+    }
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  if (seconds > 0) {
+    printf("Host: %llu bytes in %.2f s (%.1f KB/s)\n", (unsigned long long)session.bytesReceived, seconds,
+           session.bytesReceived / seconds / 1024.0);
+  }
+  close(session.port);
+  return true;
+}
+
+static bool runVerify(ExportSession& session, const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  std::vector<uint8_t> buffer;
+  uint8_t chunk[4096];
+  size_t got;
+  while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    session.bytesReceived += got;
+    buffer.insert(buffer.end(), chunk, chunk + got);
+    parseFrames(session, buffer);
+  }
+  fclose(f);
+  return true;
+}
+
+// ========================= SELF TEST =========================
+
+// One sector of a simulated ring: the clock flag and timestamp of each record
+struct TestSector {
+  std::vector<std::pair<bool, uint32_t>> records;
+};
+
+static bool testSectorClock(uint32_t index, uint32_t& firstTimestamp, void* context) {
+  const std::vector<TestSector>& ring = *static_cast<const std::vector<TestSector>*>(context);
+  if (ring[index].records.empty()) return false;
+  firstTimestamp = ring[index].records[0].second;
+  return ring[index].records[0].first;
+}
+
+// Every clock-stamped record at or after the timestamp must lie at or after the start
+static bool checkSince(const char* name, const std::vector<TestSector>& ring, uint32_t timestamp) {
+  uint32_t start = logFindSinceStart(ring.size(), timestamp, testSectorClock, (void*)&ring);
+  unsigned missed = 0;
+  unsigned found = 0;
+  for (size_t i = 0; i < ring.size(); i++) {
+    for (const auto& record : ring[i].records) {
+      if (record.first && record.second >= timestamp) {
+        (i < start ? missed : found)++;
+      }
+    }
+  }
+  printf("%-34s since %-5u start %u, %u found, %u missed\n", name, timestamp, start, found, missed);
+  return missed == 0;
+}
+
+static void appendFrame(std::vector<uint8_t>& stream, uint8_t type, const std::vector<uint8_t>& payload) {
+  size_t start = stream.size();
+  stream.push_back(FRAME_MAGIC_0);
+  stream.push_back(FRAME_MAGIC_1);
+  stream.push_back(type);
+  stream.push_back(payload.size() & 0xFF);
+  stream.push_back(payload.size() >> 8);
+  stream.insert(stream.end(), payload.begin(), payload.end());
+  uint32_t crc = logCrc32(0, stream.data() + start + 2, FRAME_HEADER_SIZE - 2 + payload.size());
+  for (int i = 0; i < 4; i++) stream.push_back((crc >> (8 * i)) & 0xFF);
+}
+
+// A full sector of one meter's readings, sent as an LZ chunk and resent once
+static bool checkCompressedChunk() {
+  std::vector<uint8_t> entries(LOG_DATA_SIZE);
+  size_t used = 0;
+  uint32_t count = 0;
+  LogRecord key = {};
+  uint8_t keyIndex = 0;
+  for (uint32_t i = 0; used + LOG_ENTRY_MAX_SIZE <= entries.size(); i++) {
+    LogRecord r = {};
+    r.sequence = i + 1;
+    r.timestamp = 1700000000 + 900 * i;
+    r.frameHash = 0x9E3779B9u * (i + 1);
+    memcpy(r.meterId, "X1234567", 8);
+    r.meterType = 3;
+    r.flags = LOG_FLAG_PARSED | LOG_FLAG_CLOCK_SET;
+    r.kwh = 1250000 + 37 * i;
+    r.kvah = 1300000 + 39 * i;
+    r.maxDemand = 420;
+    for (int p = 0; p < 3; p++) {
+      r.voltage[p] = 2300 + (i * 7 + p) % 40;
+      r.current[p] = 500 + (i * 13 + p) % 90;
+    }
+    r.powerFactor = 97;
+    if (i % (LOG_KEYFRAME_INTERVAL + 1) == 0) {
+      keyIndex = (uint8_t)(i / (LOG_KEYFRAME_INTERVAL + 1));
+      key = r;
+      used += logEncodeKeyframe(r, entries.data() + used);
+    } else {
+      used += logEncodeDelta(r, key, keyIndex, entries.data() + used);
+    }
+    count++;
+  }
+
+  std::vector<uint8_t> chunk = {0, 0, 0, 0};
+  LZCompressor compressor;
+  compressor.begin(appendBytes, &chunk, LZ_DICTIONARY_NONE);
+  compressor.write(entries.data(), used);
+  compressor.finish();
+
+  LogExportStart start = {1, count, 1, 1, LOG_FORMAT_VERSION};
+  LogExportEnd end = {2, 0, 1, 1, {0, 0, 0}};
+
+  std::vector<uint8_t> stream;
+  appendFrame(stream, LOG_FRAME_EXPORT_START, std::vector<uint8_t>((uint8_t*)&start, (uint8_t*)(&start + 1)));
+  appendFrame(stream, LOG_FRAME_EXPORT_CHUNK_LZ, chunk);
+  appendFrame(stream, LOG_FRAME_EXPORT_CHUNK_LZ, chunk);
+  appendFrame(stream, LOG_FRAME_EXPORT_END, std::vector<uint8_t>((uint8_t*)&end, (uint8_t*)(&end + 1)));
+
+  ExportSession session;
+  parseFrames(session, stream);
+  bool ok = session.finished && session.nextChunk == 1 && session.compressedChunks == 1 &&
+            session.duplicateChunks == 1 && session.records == count && session.lastSequence == count &&
+            session.gaps == 0 && session.badRecords == 0;
+  printf("%-34s %u records, %zu -> %zu bytes, %s\n", "compressed chunk round trip", session.records, used,
+         chunk.size() - 4, ok ? "ok" : "MISMATCH");
+  return ok;
+}
+
+static int runSelfTest() {
+  // Clock sectors with uptime sectors (reboots before #TIME) between them
+  std::vector<TestSector> mixed = {
+    {{{true, 1000}, {true, 1200}}},
+    {{{false, 5}, {false, 9}, {true, 1250}}},
+    {{{true, 1300}, {true, 1400}}},
+    {{{false, 3}}},
+    {{{false, 7}, {true, 1500}}},
+    {{{true, 1600}}},
+  };
+  std::vector<TestSector> uptimeOnly = {{{{false, 4}}}, {{{false, 8}}}, {{{false, 2}, {true, 900}}}};
+  std::vector<TestSector> clockOnly;
+  for (uint32_t i = 0; i < 64; i++) {
+    clockOnly.push_back({{{true, 100 * i}, {true, 100 * i + 50}}});
+  }
+
+  bool ok = true;
+  for (uint32_t since : {0u, 999u, 1150u, 1200u, 1260u, 1450u, 1550u, 1601u}) {
+    ok &= checkSince("clock and uptime sectors", mixed, since);
+  }
+  ok &= checkSince("uptime sectors only", uptimeOnly, 500);
+  for (uint32_t since : {0u, 50u, 3149u, 3150u, 6351u}) {
+    ok &= checkSince("clock sectors only", clockOnly, since);
+  }
+  ok &= logFindSinceStart(clockOnly.size(), 3150, testSectorClock, &clockOnly) == 31;
+  ok &= checkCompressedChunk();
+  printf("%s\n", ok ? "SELFTEST PASSED" : "SELFTEST FAILED");
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  bool lz = argc > 1 && strcmp(argv[1], "--lz") == 0;
+  if (lz) {
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s [--lz] <port> [from sequence] [window] [output.csv]\n", argv[0]);
+    fprintf(stderr, "       %s --verify <capture.bin> [output.csv]\n", argv[0]);
+    fprintf(stderr, "       %s --selftest\n", argv[0]);
+    return 2;
+  }
+  if (strcmp(argv[1], "--selftest") == 0) {
+    return runSelfTest();
+  }
+
+  ExportSession session;
+  bool verify = strcmp(argv[1], "--verify") == 0;
+  const char* csvPath = verify ? (argc > 3 ? argv[3] : nullptr) : (argc > 4 ? argv[4] : nullptr);
+  if (csvPath) {
+    session.csv = fopen(csvPath, "w");
+    if (!session.csv) {
+      perror(csvPath);
+      return 1;
+    }
+    fprintf(session.csv, "sequence,timestamp,clock_set,meter_id,meter_type,kwh,kvah,kvarh_lag,kvarh_lead,"
+                         "max_demand,voltage_r,voltage_y,voltage_b,current_r,current_y,current_b,power_factor,frame_crc\n");
+  }
+
+  bool ok;
+  if (verify) {
+    if (argc < 3) {
+      fprintf(stderr, "--verify needs a capture file\n");
+      return 2;
+    }
+    ok = runVerify(session, argv[2]);
+  } else {
+    uint32_t fromSequence = argc > 2 ? strtoul(argv[2], nullptr, 10) : 0;
+    unsigned window = argc > 3 ? strtoul(argv[3], nullptr, 10) : 4;
+    ok = runLive(session, argv[1], fromSequence, window, lz);
+  }
+  if (session.csv) fclose(session.csv);
+  if (!ok) return 1;
+
+  printf("Records: %u (last #%u), torn/invalid: %u, sequence gaps: %u\n", session.records, session.lastSequence,
+         session.badRecords, session.gaps);
+  printf("Chunks: %u of %u (%u compressed), repeated: %u, bad frames: %u\n", session.nextChunk,
+         session.start.chunkCount, session.compressedChunks, session.duplicateChunks, session.badFrames);
+  if (session.finished && session.end.elapsedMs > 0) {
+    printf("Device: %u bytes in %u ms (%.1f KB/s), %s\n", session.end.bytesSent, session.end.elapsedMs,
+           session.end.bytesSent / (session.end.elapsedMs / 1000.0) / 1024.0,
+           session.end.complete ? "complete" : "INCOMPLETE");
+  }
+
+  bool verified = session.started && session.finished && session.end.complete &&
+                  session.nextChunk == session.start.chunkCount && session.gaps == 0 &&
+                  (session.records == 0 || session.lastSequence == session.start.toSequence);
+  printf("%s\n", verified ? "VERIFIED" : "NOT VERIFIED");
+  return verified ? 0 : 1;
+}
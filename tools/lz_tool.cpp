@@ -0,0 +1,201 @@
+/*
+ * lz_tool.cpp - Host-side companion for lz_codec.h
+ *
+ * Decompresses streams produced by the device, compresses files for
+ * testing, and benchmarks ratio and speed on synthetic reading batches.
+ *
+ * Build: g++ -O2 -o lz_tool tools/lz_tool.cpp
+ * Usage: lz_tool c <input> <output>
+ *        lz_tool d <input> <output>
+ *        lz_tool bench [record count]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "../lz_codec.h"
+
+static void appendToVector(const uint8_t* data, size_t length, void* context) {
+  std::vector<uint8_t>* out = static_cast<std::vector<uint8_t>*>(context);
+  out->insert(out->end(), data, data + length);
+}
+
+static bool readFile(const char* path, std::vector<uint8_t>& data) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    data.insert(data.end(), chunk, chunk + n);
+  }
+  fclose(f);
+  return true;
+}
+
+static bool writeFile(const char* path, const std::vector<uint8_t>& data) {
+  FILE* f = fopen(path, "wb");
+  if (!f) return false;
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  fclose(f);
+  return ok;
+}
+
+static std::vector<uint8_t> compress(const std::vector<uint8_t>& input, uint8_t dictionaryId) {
+  std::vector<uint8_t> out;
+  LZCompressor* compressor = new LZCompressor();
+  compressor->begin(appendToVector, &out, dictionaryId);
+  // Feed in small pieces, as the device does from println()
+  for (size_t i = 0; i < input.size(); i += 37) {
+    size_t n = input.size() - i < 37 ? input.size() - i : 37;
+    compressor->write(input.data() + i, n);
+  }
+  compressor->finish();
+  delete compressor;
+  return out;
+}
+
+static bool decompress(const std::vector<uint8_t>& input, std::vector<uint8_t>& out) {
+  LZDecompressor* decompressor = new LZDecompressor();
+  decompressor->begin(appendToVector, &out);
+  bool ok = decompressor->write(input.data(), input.size()) && decompressor->isFinished();
+  delete decompressor;
+  return ok;
+}
+
+// One parsed 3-phase reading as printed over Bluetooth
+static std::string syntheticReading(int index) {
+  char text[1024];
+  snprintf(text, sizeof(text),
+    "=== PARSING DATA ===\r\n"
+    "=== METER INFORMATION ===\r\n"
+    "Manufacturer ID: %d\r\n"
+    "Time: %02d:%02d:%02d\r\n"
+    "Date: 15:11:24\r\n"
+    "Make: XYZ\r\n"
+    "Phase: 3\r\n"
+    "Multiplication Factor: 1.00\r\n"
+    "=== ENERGY DATA ===\r\n"
+    "KWh: %.2f\r\n"
+    "KVAh: %.2f\r\n"
+    "Max Demand: %.2f\r\n"
+    "=== ELECTRICAL DATA ===\r\n"
+    "Voltage R: %.1fV\r\n"
+    "Voltage Y: %.1fV\r\n"
+    "Voltage B: %.1fV\r\n"
+    "Current R: %.2fA\r\n"
+    "Current Y: %.2fA\r\n"
+    "Current B: %.2fA\r\n"
+    "=== DATA STATISTICS ===\r\n"
+    "Parsing Status: SUCCESS\r\n"
+    "Total Power: %.2f units\r\n"
+    "System Type: 3-Phase\r\n"
+    "BATTERY CHARGE: %d %%\r\n"
+    "VERSION: V13.MODULAR\r\n"
+    "DATA RECEIVED: IRDA-3Ph-PARSED.\r\n",
+    12345 + (index % 4), 9 + index / 60 % 10, index % 60, (index * 7) % 60,
+    1234.56 + index * 0.37, 1456.78 + index * 0.41, 45.67 + (index % 5) * 0.1,
+    230.5 + (index % 3) * 0.2, 231.2 - (index % 2) * 0.3, 229.8 + (index % 4) * 0.1,
+    12.34 + (index % 7) * 0.01, 11.98, 12.67 - (index % 3) * 0.02,
+    2691.34 + index * 0.78, 85 - index / 50);
+  return text;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int runBenchmark(int recordCount) {
+  std::vector<uint8_t> batch;
+  for (int i = 0; i < recordCount; i++) {
+    std::string reading = syntheticReading(i);
+    batch.insert(batch.end(), reading.begin(), reading.end());
+  }
+
+  printf("Dictionary: %zu bytes, window %d bytes\n", sizeof(LZ_READINGS_DICTIONARY) - 1, LZ_WINDOW_SIZE);
+  printf("Input: %d records, %zu bytes\n\n", recordCount, batch.size());
+  printf("%-12s %10s %8s %12s %12s\n", "mode", "bytes", "ratio", "comp MB/s", "decomp MB/s");
+
+  const uint8_t dictionaries[2] = { LZ_DICTIONARY_NONE, LZ_DICTIONARY_READINGS };
+  for (int d = 0; d < 2; d++) {
+    // Per-record streams show the dictionary benefit on short batches
+    for (int perRecord = 0; perRecord < 2; perRecord++) {
+      std::vector<std::vector<uint8_t>> inputs;
+      if (perRecord) {
+        for (int i = 0; i < recordCount; i++) {
+          std::string reading = syntheticReading(i);
+          inputs.push_back(std::vector<uint8_t>(reading.begin(), reading.end()));
+        }
+      } else {
+        inputs.push_back(batch);
+      }
+
+      const int rounds = 20;
+      size_t compressedSize = 0;
+      std::vector<std::vector<uint8_t>> compressed;
+      auto start = std::chrono::steady_clock::now();
+      for (int r = 0; r < rounds; r++) {
+        compressed.clear();
+        compressedSize = 0;
+        for (size_t i = 0; i < inputs.size(); i++) {
+          compressed.push_back(compress(inputs[i], dictionaries[d]));
+          compressedSize += compressed.back().size();
+        }
+      }
+      double compressSeconds = secondsSince(start);
+
+      start = std::chrono::steady_clock::now();
+      for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < compressed.size(); i++) {
+          std::vector<uint8_t> restored;
+          if (!decompress(compressed[i], restored) || restored != inputs[i]) {
+            fprintf(stderr, "Round trip mismatch (dictionary %d, record %zu)\n", dictionaries[d], i);
+            return 1;
+          }
+        }
+      }
+      double decompressSeconds = secondsSince(start);
+
+      double megabytes = (double)batch.size() * rounds / (1024.0 * 1024.0);
+      std::string mode = std::string(dictionaries[d] ? "dict" : "plain") + (perRecord ? "/record" : "/batch");
+      printf("%-12s %10zu %7.2fx %12.1f %12.1f\n", mode.c_str(), compressedSize,
+             (double)batch.size() / compressedSize, megabytes / compressSeconds, megabytes / decompressSeconds);
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    return runBenchmark(argc >= 3 ? atoi(argv[2]) : 200);
+  }
+
+  if (argc != 4 || (std::string(argv[1]) != "c" && std::string(argv[1]) != "d")) {
+    fprintf(stderr, "Usage: %s c|d <input> <output>\n       %s bench [records]\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  std::vector<uint8_t> input;
+  if (!readFile(argv[2], input)) {
+    fprintf(stderr, "Cannot read %s\n", argv[2]);
+    return 1;
+  }
+
+  std::vector<uint8_t> output;
+  if (argv[1][0] == 'c') {
+    output = compress(input, LZ_DICTIONARY_READINGS);
+  } else if (!decompress(input, output)) {
+    fprintf(stderr, "Malformed or truncated stream\n");
+    return 1;
+  }
+
+  if (!writeFile(argv[3], output)) {
+    fprintf(stderr, "Cannot write %s\n", argv[3]);
+    return 1;
+  }
+
+  printf("%zu -> %zu bytes\n", input.size(), output.size());
+  return 0;
+}
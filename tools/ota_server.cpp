@@ -0,0 +1,390 @@
+/*
+ * ota_server.cpp - Local firmware server for testing resumable OTA
+ *
+ * Serves one image the way the device expects: Content-Length, an ETag,
+ * X-Image-SHA256 and "Range: bytes=<n>-" requests (206 answers, with
+ * If-Range honoured). To exercise the resume path it can drop the
+ * connection on purpose after a number of body bytes, for the first few
+ * responses, and replace the image with another file midway to check
+ * the restart on a changed image.
+ *
+ * With --patch it also serves a fw_patch delta at /firmware/ota.patch,
+ * but only to devices whose ?from= app hash matches the patch; others
+ * get a 404 and fall back to the full image.
+ *
+ * With --compressed it answers requests that send "Accept-Encoding: fwz"
+ * with the fw_compress image instead (Content-Encoding: fwz, its own
+ * ETag); other requests still get the plain image.
+ *
+ * With --manifest it serves that file at /firmware/manifest.json and
+ * answers a matching If-None-Match with 304, as the device's update
+ * check expects (make the file with "fw_patch manifest").
+ *
+ * Build: g++ -O2 -o ota_server tools/ota_server.cpp
+ * Usage: ota_server <image.bin> [port] [--drop-after <bytes>] [--drops <count>]
+ *                   [--stall] [--swap <other.bin> <after requests>] [--patch <file.patch>]
+ *                   [--compressed <image.fwz>] [--manifest <manifest.json>]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "host_sha256.h"
+#include "../fw_patch.h"
+#include "../fw_compress.h"
+
+#define FIRMWARE_PATH "/firmware/ota.bin"
+#define PATCH_PATH "/firmware/ota.patch"
+#define MANIFEST_PATH "/firmware/manifest.json"
+#define COMPRESSED_ENCODING "fwz"
+#define SEND_CHUNK 1460
+
+// ========================= IMAGE =========================
+
+struct Image {
+  std::vector<uint8_t> data;
+  std::string sha256;             // X-Image-SHA256: of the decoded image for a compressed one
+  std::string etag;               // Always of the bytes sent
+  std::string encoding;           // Content-Encoding, empty for none
+};
+
+static bool loadImage(const char* path, Image& image) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  image.data.clear();
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    image.data.insert(image.data.end(), chunk, chunk + n);
+  }
+  fclose(f);
+  image.sha256 = sha256Hex(image.data);
+  image.etag = "\"" + image.sha256.substr(0, 16) + "\"";
+  return true;
+}
+
+// ========================= HTTP =========================
+
+struct Request {
+  std::string method;
+  std::string path;
+  std::string query;
+  bool hasRange;
+  size_t rangeStart;
+  std::string ifRange;
+  std::string acceptEncoding;
+  std::string ifNoneMatch;
+};
+
+static bool readRequest(int fd, Request& request) {
+  std::string head;
+  char c;
+  while (head.size() < 8192 && head.find("\r\n\r\n") == std::string::npos) {
+    if (recv(fd, &c, 1, 0) != 1) return false;
+    head += c;
+  }
+
+  size_t lineEnd = head.find("\r\n");
+  std::string line = head.substr(0, lineEnd);
+  size_t space1 = line.find(' ');
+  size_t space2 = line.find(' ', space1 + 1);
+  if (space1 == std::string::npos || space2 == std::string::npos) return false;
+  request.method = line.substr(0, space1);
+  request.path = line.substr(space1 + 1, space2 - space1 - 1);
+  size_t question = request.path.find('?');
+  request.query = question == std::string::npos ? "" : request.path.substr(question + 1);
+  request.path = request.path.substr(0, question);
+  request.hasRange = false;
+  request.rangeStart = 0;
+  request.ifRange.clear();
+  request.acceptEncoding.clear();
+  request.ifNoneMatch.clear();
+
+  size_t pos = lineEnd + 2;
+  while (pos < head.size()) {
+    size_t end = head.find("\r\n", pos);
+    if (end == std::string::npos || end == pos) break;
+    std::string header = head.substr(pos, end - pos);
+    pos = end + 2;
+    size_t colon = header.find(':');
+    if (colon == std::string::npos) continue;
+    std::string name = header.substr(0, colon);
+    for (char& ch : name) ch = tolower(ch);
+    std::string value = header.substr(colon + 1);
+    value.erase(0, value.find_first_not_of(' '));
+
+    if (name == "range" && value.compare(0, 6, "bytes=") == 0) {
+      request.hasRange = true;
+      request.rangeStart = strtoul(value.c_str() + 6, nullptr, 10);
+    } else if (name == "if-range") {
+      request.ifRange = value;
+    } else if (name == "accept-encoding") {
+      request.acceptEncoding = value;
+    } else if (name == "if-none-match") {
+      request.ifNoneMatch = value;
+    }
+  }
+  return true;
+}
+
+static bool sendAll(int fd, const void* data, size_t length) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  while (length > 0) {
+    ssize_t n = send(fd, p, length, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    length -= n;
+  }
+  return true;
+}
+
+static void sendStatus(int fd, int status, const char* reason) {
+  char head[256];
+  int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                   status, reason);
+  sendAll(fd, head, n);
+}
+
+// ========================= SERVER =========================
+
+struct Options {
+  int port = 8080;
+  size_t dropAfter = 0;         // Body bytes per response before a deliberate drop, 0 = never
+  int drops = 3;                // Responses that get dropped
+  bool stall = false;           // Stop sending instead of closing (tests the read timeout)
+  const char* swapPath = nullptr;
+  int swapAfter = 0;            // Requests served before the image is replaced
+};
+
+static std::string queryValue(const std::string& query, const std::string& name) {
+  size_t pos = ("&" + query).find("&" + name + "=");
+  if (pos == std::string::npos) return "";
+  size_t start = pos + name.size() + 1;
+  return query.substr(start, query.find('&', start) - start);
+}
+
+static bool acceptsEncoding(const std::string& accept, const std::string& encoding) {
+  size_t pos = accept.find(encoding);
+  return pos != std::string::npos && (pos == 0 || accept[pos - 1] == ' ' || accept[pos - 1] == ',');
+}
+
+static void serveManifest(int fd, const Request& request, const Image& manifest, int requestNumber) {
+  // The device's whole update check when nothing changed
+  if (request.ifNoneMatch == manifest.etag) {
+    std::string head = "HTTP/1.1 304 Not Modified\r\nETag: " + manifest.etag + "\r\nConnection: close\r\n\r\n";
+    sendAll(fd, head.data(), head.size());
+    printf("#%d: %s 304\n", requestNumber, request.path.c_str());
+    return;
+  }
+  std::string head = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n";
+  head += "Content-Length: " + std::to_string(manifest.data.size()) + "\r\n";
+  head += "ETag: " + manifest.etag + "\r\nConnection: close\r\n\r\n";
+  if (sendAll(fd, head.data(), head.size())) {
+    sendAll(fd, manifest.data.data(), manifest.data.size());
+  }
+  printf("#%d: %s 200, %zu bytes\n", requestNumber, request.path.c_str(), manifest.data.size());
+}
+
+static void serve(int fd, Image& firmware, Image* patch, Image* compressed, Image* manifest, const Options& options,
+                  int requestNumber, int& dropsLeft) {
+  Request request;
+  if (!readRequest(fd, request)) {
+    printf("#%d: bad request\n", requestNumber);
+    return;
+  }
+  if (manifest && request.method == "GET" && request.path == MANIFEST_PATH) {
+    serveManifest(fd, request, *manifest, requestNumber);
+    return;
+  }
+
+  // A patch only for the firmware it was made from
+  Image* resource = nullptr;
+  if (request.method == "GET" && request.path == FIRMWARE_PATH) {
+    resource = compressed && acceptsEncoding(request.acceptEncoding, COMPRESSED_ENCODING) ? compressed : &firmware;
+  } else if (request.method == "GET" && request.path == PATCH_PATH && patch &&
+             queryValue(request.query, "from") == hexString(patch->data.data() + 12, FW_PATCH_HASH_SIZE)) {
+    resource = patch;
+  }
+  if (!resource) {
+    sendStatus(fd, 404, "Not Found");
+    printf("#%d: %s %s -> 404\n", requestNumber, request.method.c_str(), request.path.c_str());
+    return;
+  }
+  Image& image = *resource;
+
+  // If-Range with another ETag means the client has a different image: send all of this one
+  size_t total = image.data.size();
+  bool partial = request.hasRange && (request.ifRange.empty() || request.ifRange == image.etag);
+  if (partial && request.rangeStart >= total) {
+    sendStatus(fd, 416, "Range Not Satisfiable");
+    printf("#%d: range %zu- -> 416\n", requestNumber, request.rangeStart);
+    return;
+  }
+  size_t start = partial ? request.rangeStart : 0;
+
+  std::string head = partial ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+  head += "Content-Type: application/octet-stream\r\n";
+  if (!image.encoding.empty()) {
+    head += "Content-Encoding: " + image.encoding + "\r\n";
+  }
+  if (compressed && request.path == FIRMWARE_PATH) {
+    head += "Vary: Accept-Encoding\r\n";
+  }
+  head += "Content-Length: " + std::to_string(total - start) + "\r\n";
+  if (partial) {
+    head += "Content-Range: bytes " + std::to_string(start) + "-" + std::to_string(total - 1) + "/" +
+            std::to_string(total) + "\r\n";
+  }
+  head += "Accept-Ranges: bytes\r\n";
+  head += "ETag: " + image.etag + "\r\n";
+  head += "X-Image-SHA256: " + image.sha256 + "\r\n";
+  head += "Connection: close\r\n\r\n";
+  if (!sendAll(fd, head.data(), head.size())) return;
+
+  size_t limit = total - start;
+  bool drop = options.dropAfter > 0 && dropsLeft > 0 && options.dropAfter < limit;
+  if (drop) {
+    limit = options.dropAfter;
+    dropsLeft--;
+  }
+
+  size_t sent = 0;
+  while (sent < limit) {
+    size_t n = limit - sent < SEND_CHUNK ? limit - sent : SEND_CHUNK;
+    if (!sendAll(fd, image.data.data() + start + sent, n)) break;
+    sent += n;
+  }
+
+  printf("#%d: %s%s %s %zu-%zu/%zu, sent %zu%s\n", requestNumber, request.path.c_str(),
+         image.encoding.empty() ? "" : (" (" + image.encoding + ")").c_str(), partial ? "206" : "200", start,
+         total - 1, total, sent,
+         drop ? (options.stall ? ", stalled on purpose" : ", dropped on purpose") : "");
+  if (drop && options.stall) {
+    // Hold the connection open without data until the client gives up
+    char c;
+    while (recv(fd, &c, 1, 0) > 0) {
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <image.bin> [port] [--drop-after <bytes>] [--drops <count>]\n"
+                    "          [--stall] [--swap <other.bin> <after requests>] [--patch <file.patch>]\n"
+                    "          [--compressed <image.fwz>] [--manifest <manifest.json>]\n", argv[0]);
+    return 1;
+  }
+
+  Options options;
+  const char* patchPath = nullptr;
+  const char* compressedPath = nullptr;
+  const char* manifestPath = nullptr;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--drop-after") == 0 && i + 1 < argc) {
+      options.dropAfter = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--drops") == 0 && i + 1 < argc) {
+      options.drops = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--stall") == 0) {
+      options.stall = true;
+    } else if (strcmp(argv[i], "--patch") == 0 && i + 1 < argc) {
+      patchPath = argv[++i];
+    } else if (strcmp(argv[i], "--compressed") == 0 && i + 1 < argc) {
+      compressedPath = argv[++i];
+    } else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+      manifestPath = argv[++i];
+    } else if (strcmp(argv[i], "--swap") == 0 && i + 2 < argc) {
+      options.swapPath = argv[++i];
+      options.swapAfter = atoi(argv[++i]);
+    } else {
+      options.port = atoi(argv[i]);
+    }
+  }
+
+  Image image;
+  if (!loadImage(argv[1], image)) {
+    fprintf(stderr, "Cannot read %s\n", argv[1]);
+    return 1;
+  }
+
+  Image patch;
+  if (patchPath && (!loadImage(patchPath, patch) || patch.data.size() < FW_PATCH_HEADER_SIZE ||
+                    patch.data[0] != 'F' || patch.data[1] != 'P')) {
+    fprintf(stderr, "%s is not a firmware patch\n", patchPath);
+    return 1;
+  }
+
+  Image compressed;
+  if (compressedPath) {
+    if (!loadImage(compressedPath, compressed) || compressed.data.size() < FW_COMPRESS_HEADER_SIZE ||
+        compressed.data[0] != 'F' || compressed.data[1] != 'Z') {
+      fprintf(stderr, "%s is not a compressed image\n", compressedPath);
+      return 1;
+    }
+    compressed.sha256 = hexString(compressed.data.data() + 8, FW_COMPRESS_HASH_SIZE);
+    compressed.encoding = COMPRESSED_ENCODING;
+    if (compressed.sha256 != image.sha256) {
+      fprintf(stderr, "Warning: %s decompresses to another image than %s\n", compressedPath, argv[1]);
+    }
+  }
+
+  Image manifest;
+  if (manifestPath && !loadImage(manifestPath, manifest)) {
+    fprintf(stderr, "Cannot read %s\n", manifestPath);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int yes = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(options.port);
+  if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 4) != 0) {
+    perror("bind");
+    return 1;
+  }
+
+  printf("Serving %s (%zu bytes, SHA-256 %s) at :%d%s\n", argv[1], image.data.size(), image.sha256.c_str(),
+         options.port, FIRMWARE_PATH);
+  if (patchPath) {
+    printf("Patch %s (%zu bytes) for app hash %s\n", patchPath, patch.data.size(),
+           hexString(patch.data.data() + 12, FW_PATCH_HASH_SIZE).c_str());
+  }
+  if (compressedPath) {
+    printf("Compressed %s (%zu bytes, ETag %s) for Accept-Encoding: %s\n", compressedPath, compressed.data.size(),
+           compressed.etag.c_str(), COMPRESSED_ENCODING);
+  }
+  if (manifestPath) {
+    printf("Manifest %s at %s (ETag %s)\n", manifestPath, MANIFEST_PATH, manifest.etag.c_str());
+  }
+  if (options.dropAfter > 0) {
+    printf("Dropping the first %d responses after %zu bytes\n", options.drops, options.dropAfter);
+  }
+  fflush(stdout);
+
+  int dropsLeft = options.drops;
+  for (int requestNumber = 1;; requestNumber++) {
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) continue;
+    serve(fd, image, patchPath ? &patch : nullptr, compressedPath ? &compressed : nullptr,
+          manifestPath ? &manifest : nullptr, options, requestNumber, dropsLeft);
+    close(fd);
+
+    if (options.swapPath && requestNumber == options.swapAfter) {
+      if (loadImage(options.swapPath, image)) {
+        printf("Image replaced by %s (%zu bytes, ETag %s)\n", options.swapPath, image.data.size(),
+               image.etag.c_str());
+      }
+    }
+    fflush(stdout);
+  }
+}
@@ -0,0 +1,170 @@
+/*
+ * warm_boot.h - Fast wake path from deep sleep
+ *
+ * This file contains the WarmBoot class that keeps a snapshot of the
+ * running state (configuration, IRDA port baud rate, battery filter and
+ * boot counters) in RTC memory across deep sleep. When the button wakes
+ * the device, setup() restores from the snapshot instead of reading NVS,
+ * skips the startup beeps and the IRDA baud-rate sequence, and reports
+ * how long it took to become ready.
+ *
+ * Any other reset (power-on, brown-out, OTA restart, timer wake) takes
+ * the normal cold path. A scheduled timer cycle changes nothing in the
+ * snapshot, so it leaves it for the next button wake; any reset that is
+ * not a deep-sleep wake drops it.
+ */
+
+#ifndef WARM_BOOT_H
+#define WARM_BOOT_H
+
+#include <Arduino.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <esp_rom_crc.h>
+#include "config.h"
+
+// State carried from one wake cycle to the next
+struct WarmBootState {
+  uint32_t magic;
+  SystemConfig settings;
+  uint32_t irdaBaudRate;        // Baud rate the IRDA UART was left at
+  uint32_t batteryMilliVolts;   // Filtered battery pin voltage (seeds the EMA)
+  uint32_t crc;
+};
+
+// Boot counters and timings since the last reset; kept apart from the
+// snapshot so timer wakes and invalid snapshots do not clear them
+struct WarmBootCounters {
+  uint32_t magic;
+  uint32_t coldBoots;
+  uint32_t warmBoots;
+  uint32_t lastReadyUs;
+  uint32_t minWarmReadyUs;
+  uint32_t maxWarmReadyUs;
+  uint64_t totalWarmReadyUs;
+  uint32_t lastColdReadyUs;
+};
+
+#define WARM_BOOT_MAGIC 0x57524D31      // "WRM1"
+#define WARM_COUNTERS_MAGIC 0x57524331  // "WRC1"
+
+// RTC memory survives deep sleep and software resets; only power-on clears it.
+// begin() drops the snapshot after other resets, the counters run until power-on
+RTC_DATA_ATTR static WarmBootState rtcWarmBoot;
+RTC_DATA_ATTR static WarmBootCounters rtcBootCounters;
+
+class WarmBoot {
+private:
+  bool warm;
+  bool ready;
+
+  bool isSnapshotValid() const;
+
+public:
+  WarmBoot();
+
+  // Decides between the warm and the cold path (call first in setup())
+  bool begin();
+  bool isWarm() const { return warm; }
+
+  // Restored state (valid only when isWarm())
+  const SystemConfig& getSettings() const { return rtcWarmBoot.settings; }
+  int getIRDABaudRate() const { return rtcWarmBoot.irdaBaudRate; }
+  uint32_t getBatteryMilliVolts() const { return rtcWarmBoot.batteryMilliVolts; }
+
+  // End of setup(); records the wake-to-ready time
+  uint32_t markReady();
+
+  // Called right before esp_deep_sleep_start()
+  void save(const SystemConfig& settings, int irdaBaudRate, uint32_t batteryMilliVolts);
+
+  // Status
+  String getReport() const;
+};
+
+// Implementation
+WarmBoot::WarmBoot() : warm(false), ready(false) {
+}
+
+bool WarmBoot::begin() {
+  if (rtcBootCounters.magic != WARM_COUNTERS_MAGIC) {
+    memset(&rtcBootCounters, 0, sizeof(rtcBootCounters));
+    rtcBootCounters.magic = WARM_COUNTERS_MAGIC;
+  }
+
+  // Only a button wake resumes; the snapshot is used once. A timer wake
+  // keeps it, since the scheduled cycle sleeps again without saving, and
+  // after any other reset it may come from different firmware
+  esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+  warm = cause == ESP_SLEEP_WAKEUP_EXT0 && isSnapshotValid();
+  if (cause != ESP_SLEEP_WAKEUP_TIMER) {
+    rtcWarmBoot.magic = 0;
+  }
+
+  if (warm) {
+    rtcBootCounters.warmBoots++;
+  } else {
+    rtcBootCounters.coldBoots++;
+  }
+  return warm;
+}
+
+bool WarmBoot::isSnapshotValid() const {
+  if (rtcWarmBoot.magic != WARM_BOOT_MAGIC) {
+    return false;
+  }
+  uint32_t crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&rtcWarmBoot), offsetof(WarmBootState, crc));
+  return crc == rtcWarmBoot.crc;
+}
+
+uint32_t WarmBoot::markReady() {
+  // esp_timer starts with the application; ROM and bootloader time is not included
+  uint32_t readyUs = (uint32_t)esp_timer_get_time();
+  if (ready) {
+    return readyUs;
+  }
+  ready = true;
+
+  rtcBootCounters.lastReadyUs = readyUs;
+  if (warm) {
+    if (rtcBootCounters.minWarmReadyUs == 0 || readyUs < rtcBootCounters.minWarmReadyUs) {
+      rtcBootCounters.minWarmReadyUs = readyUs;
+    }
+    if (readyUs > rtcBootCounters.maxWarmReadyUs) {
+      rtcBootCounters.maxWarmReadyUs = readyUs;
+    }
+    rtcBootCounters.totalWarmReadyUs += readyUs;
+  } else {
+    rtcBootCounters.lastColdReadyUs = readyUs;
+  }
+
+  Serial.println(String(warm ? "Warm" : "Cold") + " boot, ready in " + String(readyUs / 1000) + " ms");
+  return readyUs;
+}
+
+void WarmBoot::save(const SystemConfig& settings, int irdaBaudRate, uint32_t batteryMilliVolts) {
+  memset(&rtcWarmBoot, 0, sizeof(rtcWarmBoot));
+  rtcWarmBoot.settings = settings;
+  rtcWarmBoot.irdaBaudRate = irdaBaudRate;
+  rtcWarmBoot.batteryMilliVolts = batteryMilliVolts;
+  rtcWarmBoot.magic = WARM_BOOT_MAGIC;
+  rtcWarmBoot.crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&rtcWarmBoot), offsetof(WarmBootState, crc));
+}
+
+String WarmBoot::getReport() const {
+  String report = "=== Boot ===\n";
+  report += "This boot: " + String(warm ? "warm (button wake)" : "cold") + ", ready in " +
+            String(rtcBootCounters.lastReadyUs / 1000.0f, 1) + " ms\n";
+  report += "Cold boots: " + String(rtcBootCounters.coldBoots) + ", last ready in " +
+            String(rtcBootCounters.lastColdReadyUs / 1000.0f, 1) + " ms\n";
+  report += "Warm boots: " + String(rtcBootCounters.warmBoots);
+  if (rtcBootCounters.warmBoots > 0) {
+    report += ", ready in avg " + String(rtcBootCounters.totalWarmReadyUs / 1000.0f / rtcBootCounters.warmBoots, 1) +
+              " / min " + String(rtcBootCounters.minWarmReadyUs / 1000.0f, 1) +
+              " / max " + String(rtcBootCounters.maxWarmReadyUs / 1000.0f, 1) + " ms";
+  }
+  report += "\n(Measured from application start; ROM and bootloader time is not included)";
+  return report;
+}
+
+#endif // WARM_BOOT_H